@@ -49,6 +49,8 @@ void block_acct_cleanup(BlockAcctStats *stats)
     QSLIST_FOREACH_SAFE(s, &stats->intervals, entries, next) {
         g_free(s);
     }
+
+    block_latency_histograms_clear(stats);
 }
 
 void block_acct_add_interval(BlockAcctStats *stats, unsigned interval_length)
@@ -86,6 +88,31 @@ void block_acct_start(BlockAcctStats *stats, BlockAcctCookie *cookie,
     cookie->type = type;
 }
 
+static void block_latency_histogram_account(BlockLatencyHistogram *hist,
+                                            int64_t latency_ns)
+{
+    unsigned lo = 0, hi;
+
+    if (!hist->bins) {
+        return;
+    }
+
+    /* Find the first boundary above the latency, which is also the index
+     * of the bin, with a binary search */
+    hi = hist->nbins - 1;
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+
+        if (latency_ns < 0 || (uint64_t) latency_ns < hist->boundaries[mid]) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    hist->bins[lo]++;
+}
+
 void block_acct_done(BlockAcctStats *stats, BlockAcctCookie *cookie)
 {
     BlockAcctTimedStats *s;
@@ -106,6 +133,9 @@ void block_acct_done(BlockAcctStats *stats, BlockAcctCookie *cookie)
     QSLIST_FOREACH(s, &stats->intervals, entries) {
         timed_average_account(&s->latency[cookie->type], latency_ns);
     }
+
+    block_latency_histogram_account(&stats->latency_histogram[cookie->type],
+                                    latency_ns);
 }
 
 void block_acct_failed(BlockAcctStats *stats, BlockAcctCookie *cookie)
@@ -129,6 +159,9 @@ void block_acct_failed(BlockAcctStats *stats, BlockAcctCookie *cookie)
         QSLIST_FOREACH(s, &stats->intervals, entries) {
             timed_average_account(&s->latency[cookie->type], latency_ns);
         }
+
+        block_latency_histogram_account(
+            &stats->latency_histogram[cookie->type], latency_ns);
     }
 }
 
@@ -171,3 +204,56 @@ double block_acct_queue_depth(BlockAcctTimedStats *stats,
 
     return (double) sum / elapsed;
 }
+
+/* Check that histogram boundaries are in strictly ascending order */
+bool block_latency_histogram_is_valid(const uint64_t *boundaries,
+                                      unsigned nb_boundaries)
+{
+    unsigned i;
+
+    for (i = 1; i < nb_boundaries; i++) {
+        if (boundaries[i] <= boundaries[i - 1]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Start a new, empty latency histogram for requests of @type, replacing
+ * the previous one.  The @nb_boundaries values in @boundaries are
+ * copied; they must be valid according to
+ * block_latency_histogram_is_valid().
+ */
+void block_latency_histogram_set(BlockAcctStats *stats,
+                                 enum BlockAcctType type,
+                                 const uint64_t *boundaries,
+                                 unsigned nb_boundaries)
+{
+    BlockLatencyHistogram *hist;
+
+    assert(type < BLOCK_MAX_IOTYPE);
+    assert(block_latency_histogram_is_valid(boundaries, nb_boundaries));
+
+    hist = &stats->latency_histogram[type];
+    g_free(hist->boundaries);
+    g_free(hist->bins);
+
+    hist->nbins = nb_boundaries + 1;
+    hist->boundaries = g_memdup(boundaries,
+                                nb_boundaries * sizeof(*boundaries));
+    hist->bins = g_new0(uint64_t, hist->nbins);
+}
+
+/* Remove all latency histograms */
+void block_latency_histograms_clear(BlockAcctStats *stats)
+{
+    unsigned i;
+
+    for (i = 0; i < BLOCK_MAX_IOTYPE; i++) {
+        BlockLatencyHistogram *hist = &stats->latency_histogram[i];
+
+        g_free(hist->boundaries);
+        g_free(hist->bins);
+        memset(hist, 0, sizeof(*hist));
+    }
+}
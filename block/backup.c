@@ -25,6 +25,10 @@
 #include "qemu/bitmap.h"
 
 #define BACKUP_CLUSTER_SIZE_DEFAULT (1 << 16)
+#define BACKUP_MAX_WORKERS_DEFAULT 8
+#define BACKUP_MAX_WORKERS 64
+#define BACKUP_MAX_CHUNK_DEFAULT (1 << 20)
+#define BACKUP_MAX_CHUNK (64 << 20)
 #define SLICE_TIME 100000000ULL /* ns */
 
 typedef struct CowRequest {
@@ -47,9 +51,28 @@ typedef struct BackupBlockJob {
     uint64_t sectors_read;
     unsigned long *done_bitmap;
     int64_t cluster_size;
+    /* Largest number of bytes copied with a single request */
+    int64_t max_chunk;
+    /* Cleared once the storage turns out not to support copy offloading */
+    bool use_copy_range;
     QLIST_HEAD(, CowRequest) inflight_reqs;
+
+    /* Coroutines copying clusters on behalf of backup_run */
+    int max_workers;
+    int nb_workers;
+    bool waiting_for_worker;
+    /* First error hit by a worker, and where to resume after it */
+    int worker_ret;
+    bool worker_error_is_read;
+    int64_t worker_failed_cluster;
 } BackupBlockJob;
 
+typedef struct BackupWorker {
+    BackupBlockJob *job;
+    int64_t cluster;
+    int64_t nb_clusters;
+} BackupWorker;
+
 /* Size of a cluster in sectors, instead of bytes. */
 static inline int64_t cluster_size_sectors(BackupBlockJob *job)
 {
@@ -105,7 +128,8 @@ static int coroutine_fn backup_do_cow(BlockDriverState *bs,
     void *bounce_buffer = NULL;
     int ret = 0;
     int64_t sectors_per_cluster = cluster_size_sectors(job);
-    int64_t start, end;
+    int64_t max_clusters = job->max_chunk / job->cluster_size;
+    int64_t start, end, run;
     int n;
 
     qemu_co_rwlock_rdlock(&job->flush_rwlock);
@@ -118,20 +142,71 @@ static int coroutine_fn backup_do_cow(BlockDriverState *bs,
     wait_for_overlapping_requests(job, start, end);
     cow_request_begin(&cow_request, job, start, end);
 
-    for (; start < end; start++) {
+    while (start < end) {
         if (test_bit(start, job->done_bitmap)) {
             trace_backup_do_cow_skip(job, start);
+            start++;
             continue; /* already copied */
         }
 
         trace_backup_do_cow_process(job, start);
 
-        n = MIN(sectors_per_cluster,
+        /* Copy consecutive clusters that are not done yet in one go */
+        for (run = 1; run < max_clusters && start + run < end; run++) {
+            if (test_bit(start + run, job->done_bitmap)) {
+                break;
+            }
+        }
+
+        n = MIN(run * sectors_per_cluster,
                 job->common.len / BDRV_SECTOR_SIZE -
                 start * sectors_per_cluster);
 
+        if (job->use_copy_range) {
+            BlockDriverState *file;
+            int64_t status;
+            int pnum;
+
+            /* Offloading copies holes as data, so look for ranges that
+             * read as zeroes and keep them sparse in the target. */
+            status = bdrv_get_block_status_above(bs, NULL,
+                                                 start * sectors_per_cluster,
+                                                 n, &pnum, &file);
+            if (status >= 0 && pnum < n && pnum >= sectors_per_cluster) {
+                run = pnum / sectors_per_cluster;
+                n = run * sectors_per_cluster;
+            }
+            if (status >= 0 && (status & BDRV_BLOCK_ZERO) && pnum >= n) {
+                ret = bdrv_co_write_zeroes(job->target,
+                                           start * sectors_per_cluster,
+                                           n, BDRV_REQ_MAY_UNMAP);
+                if (ret < 0) {
+                    trace_backup_do_cow_write_fail(job, start, ret);
+                    if (error_is_read) {
+                        *error_is_read = false;
+                    }
+                    goto out;
+                }
+                goto copied;
+            }
+
+            ret = bdrv_co_copy_range(bs, start * sectors_per_cluster,
+                                     job->target, start * sectors_per_cluster,
+                                     n, BDRV_REQ_NO_FALLBACK |
+                                     (is_write_notifier ?
+                                      BDRV_REQ_NO_SERIALISING : 0));
+            if (ret >= 0) {
+                goto copied;
+            }
+            /* Use the bounce buffer from now on.  This also tells whether
+             * a failure came from the source or from the target. */
+            trace_backup_do_cow_copy_range_fail(job, start, ret);
+            job->use_copy_range = false;
+        }
+
         if (!bounce_buffer) {
-            bounce_buffer = qemu_blockalign(bs, job->cluster_size);
+            bounce_buffer = qemu_blockalign(bs, MIN(end - start, max_clusters) *
+                                                job->cluster_size);
         }
         iov.iov_base = bounce_buffer;
         iov.iov_len = n * BDRV_SECTOR_SIZE;
@@ -170,13 +245,15 @@ static int coroutine_fn backup_do_cow(BlockDriverState *bs,
             goto out;
         }
 
-        set_bit(start, job->done_bitmap);
+copied:
+        bitmap_set(job->done_bitmap, start, run);
 
         /* Publish progress, guest I/O counts as progress too.  Note that the
          * offset field is an opaque progress value, it is not a disk offset.
          */
         job->sectors_read += n;
         job->common.offset += n * BDRV_SECTOR_SIZE;
+        start += run;
     }
 
 out:
@@ -320,6 +397,104 @@ static bool coroutine_fn yield_and_check(BackupBlockJob *job)
     return false;
 }
 
+static void coroutine_fn backup_worker_entry(void *opaque)
+{
+    BackupWorker *w = opaque;
+    BackupBlockJob *job = w->job;
+    int64_t sectors_per_cluster = cluster_size_sectors(job);
+    bool error_is_read;
+    int ret;
+
+    ret = backup_do_cow(job->common.bs, w->cluster * sectors_per_cluster,
+                        w->nb_clusters * sectors_per_cluster,
+                        &error_is_read, false);
+    if (ret < 0 && (job->worker_ret == 0 ||
+                    w->cluster < job->worker_failed_cluster)) {
+        job->worker_ret = ret;
+        job->worker_error_is_read = error_is_read;
+        job->worker_failed_cluster = w->cluster;
+    }
+    g_free(w);
+
+    job->nb_workers--;
+    if (job->waiting_for_worker) {
+        qemu_coroutine_enter(job->common.co, NULL);
+    }
+}
+
+static void coroutine_fn backup_wait_for_workers(BackupBlockJob *job,
+                                                 int max_workers)
+{
+    while (job->nb_workers > max_workers) {
+        job->waiting_for_worker = true;
+        qemu_coroutine_yield();
+        job->waiting_for_worker = false;
+    }
+}
+
+/* Copy @nb_clusters clusters starting at @cluster in a new worker, after
+ * waiting for a free slot.  Errors are collected in job->worker_ret.
+ */
+static void coroutine_fn backup_start_worker(BackupBlockJob *job,
+                                             int64_t cluster,
+                                             int64_t nb_clusters)
+{
+    BackupWorker *w;
+    Coroutine *co;
+
+    backup_wait_for_workers(job, job->max_workers - 1);
+
+    w = g_new(BackupWorker, 1);
+    w->job = job;
+    w->cluster = cluster;
+    w->nb_clusters = nb_clusters;
+
+    job->nb_workers++;
+    co = qemu_coroutine_create(backup_worker_entry);
+    qemu_coroutine_enter(co, w);
+}
+
+/* For sync=top, check whether the cluster has data in the topmost image */
+static bool coroutine_fn backup_cluster_is_allocated(BackupBlockJob *job,
+                                                     int64_t cluster)
+{
+    BlockDriverState *bs = job->common.bs;
+    int64_t sectors_per_cluster = cluster_size_sectors(job);
+    int i, n;
+    int alloced = 0;
+
+    for (i = 0; i < sectors_per_cluster;) {
+        /* bdrv_is_allocated() only returns true/false based
+         * on the first set of sectors it comes across that
+         * are are all in the same state.
+         * For that reason we must verify each sector in the
+         * backup cluster length.  We end up copying more than
+         * needed but at some point that is always the case. */
+        alloced =
+            bdrv_is_allocated(bs,
+                    cluster * sectors_per_cluster + i,
+                    sectors_per_cluster - i, &n);
+        i += n;
+
+        if (alloced == 1 || n == 0) {
+            break;
+        }
+    }
+
+    /* Errors are treated as allocated, the copy will report them */
+    return alloced != 0;
+}
+
+static bool coroutine_fn backup_cluster_needed(BackupBlockJob *job,
+                                               int64_t cluster)
+{
+    if (test_bit(cluster, job->done_bitmap)) {
+        return false;
+    }
+    return job->sync_mode != MIRROR_SYNC_MODE_TOP ||
+           backup_cluster_is_allocated(job, cluster);
+}
+
 static int coroutine_fn backup_run_incremental(BackupBlockJob *job)
 {
     bool error_is_read;
@@ -393,7 +568,6 @@ static void coroutine_fn backup_run(void *opaque)
         .notify = backup_before_write_notify,
     };
     int64_t start, end;
-    int64_t sectors_per_cluster = cluster_size_sectors(job);
     int ret = 0;
 
     QLIST_INIT(&job->inflight_reqs);
@@ -422,59 +596,56 @@ static void coroutine_fn backup_run(void *opaque)
     } else if (job->sync_mode == MIRROR_SYNC_MODE_INCREMENTAL) {
         ret = backup_run_incremental(job);
     } else {
-        /* Both FULL and TOP SYNC_MODE's require copying.. */
-        for (; start < end; start++) {
-            bool error_is_read;
+        /* Both FULL and TOP SYNC_MODE's require copying.  Up to
+         * max_workers chunks are copied in parallel; chunks start at one
+         * cluster and grow up to max_chunk as long as copies succeed.
+         */
+        int64_t max_clusters = job->max_chunk / job->cluster_size;
+        int64_t chunk = 1;
+        int64_t n;
+
+        while (true) {
+            if (job->worker_ret < 0 || start >= end) {
+                backup_wait_for_workers(job, 0);
+                if (job->worker_ret == 0) {
+                    break;
+                }
+
+                /* Depending on error action, fail now or retry from the
+                 * first cluster that failed */
+                ret = job->worker_ret;
+                job->worker_ret = 0;
+                if (backup_error_action(job, job->worker_error_is_read, -ret) ==
+                    BLOCK_ERROR_ACTION_REPORT) {
+                    break;
+                }
+                ret = 0;
+                start = job->worker_failed_cluster;
+                chunk = 1;
+                continue;
+            }
+
             if (yield_and_check(job)) {
                 break;
             }
 
-            if (job->sync_mode == MIRROR_SYNC_MODE_TOP) {
-                int i, n;
-                int alloced = 0;
-
-                /* Check to see if these blocks are already in the
-                 * backing file. */
-
-                for (i = 0; i < sectors_per_cluster;) {
-                    /* bdrv_is_allocated() only returns true/false based
-                     * on the first set of sectors it comes across that
-                     * are are all in the same state.
-                     * For that reason we must verify each sector in the
-                     * backup cluster length.  We end up copying more than
-                     * needed but at some point that is always the case. */
-                    alloced =
-                        bdrv_is_allocated(bs,
-                                start * sectors_per_cluster + i,
-                                sectors_per_cluster - i, &n);
-                    i += n;
-
-                    if (alloced == 1 || n == 0) {
-                        break;
-                    }
-                }
-
-                /* If the above loop never found any sectors that are in
-                 * the topmost image, skip this backup. */
-                if (alloced == 0) {
-                    continue;
-                }
+            /* Skip clusters that are already in the backing file or have
+             * been copied by a guest write. */
+            if (!backup_cluster_needed(job, start)) {
+                start++;
+                continue;
             }
-            /* FULL sync mode we copy the whole drive. */
-            ret = backup_do_cow(bs, start * sectors_per_cluster,
-                                sectors_per_cluster, &error_is_read, false);
-            if (ret < 0) {
-                /* Depending on error action, fail now or retry cluster */
-                BlockErrorAction action =
-                    backup_error_action(job, error_is_read, -ret);
-                if (action == BLOCK_ERROR_ACTION_REPORT) {
+
+            for (n = 1; n < chunk && start + n < end; n++) {
+                if (!backup_cluster_needed(job, start + n)) {
                     break;
-                } else {
-                    start--;
-                    continue;
                 }
             }
+            backup_start_worker(job, start, n);
+            start += n;
+            chunk = MIN(chunk * 2, max_clusters);
         }
+        backup_wait_for_workers(job, 0);
     }
 
     notifier_with_return_remove(&before_write);
@@ -499,6 +670,7 @@ void backup_start(BlockDriverState *bs, BlockDriverState *target,
                   BdrvDirtyBitmap *sync_bitmap,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
+                  int64_t max_workers, int64_t max_chunk,
                   BlockCompletionFunc *cb, void *opaque,
                   BlockJobTxn *txn, Error **errp)
 {
@@ -523,6 +695,18 @@ void backup_start(BlockDriverState *bs, BlockDriverState *target,
         return;
     }
 
+    if (max_workers < 0 || max_workers > BACKUP_MAX_WORKERS) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "max-workers",
+                   "a value in range [1, 64]");
+        return;
+    }
+
+    if (max_chunk < 0 || max_chunk > BACKUP_MAX_CHUNK) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "max-chunk",
+                   "a value in range [0, 64MB]");
+        return;
+    }
+
     if (!bdrv_is_inserted(bs)) {
         error_setg(errp, "Device is not inserted: %s",
                    bdrv_get_device_name(bs));
@@ -599,6 +783,11 @@ void backup_start(BlockDriverState *bs, BlockDriverState *target,
         job->cluster_size = MAX(BACKUP_CLUSTER_SIZE_DEFAULT, bdi.cluster_size);
     }
 
+    job->use_copy_range = true;
+    job->max_workers = max_workers ?: BACKUP_MAX_WORKERS_DEFAULT;
+    job->max_chunk = ROUND_UP(max_chunk ?: BACKUP_MAX_CHUNK_DEFAULT,
+                              job->cluster_size);
+
     bdrv_op_block_all(target, job->common.blocker);
     job->common.len = len;
     job->common.co = qemu_coroutine_create(backup_run);
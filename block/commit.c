@@ -42,15 +42,30 @@ typedef struct CommitBlockJob {
     int base_flags;
     int orig_overlay_flags;
     char *backing_file_str;
+    /* Cleared once the storage turns out not to support copy offloading */
+    bool use_copy_range;
 } CommitBlockJob;
 
-static int coroutine_fn commit_populate(BlockDriverState *bs,
+static int coroutine_fn commit_populate(CommitBlockJob *s,
+                                        BlockDriverState *bs,
                                         BlockDriverState *base,
                                         int64_t sector_num, int nb_sectors,
                                         void *buf)
 {
     int ret = 0;
 
+    if (s->use_copy_range) {
+        ret = bdrv_co_copy_range(bs, sector_num, base, sector_num,
+                                 nb_sectors, BDRV_REQ_NO_FALLBACK);
+        if (ret >= 0) {
+            return ret;
+        }
+        /* Use the buffer from now on, as backup does.  This also retries
+         * the failed range with exact read/write error reporting. */
+        trace_commit_populate_copy_range_fail(s, sector_num, ret);
+        s->use_copy_range = false;
+    }
+
     ret = bdrv_read(bs, sector_num, buf, nb_sectors);
     if (ret) {
         return ret;
@@ -158,7 +173,7 @@ wait:
                     goto wait;
                 }
             }
-            ret = commit_populate(top, base, sector_num, n, buf);
+            ret = commit_populate(s, top, base, sector_num, n, buf);
             bytes_written += n * BDRV_SECTOR_SIZE;
         }
         if (ret < 0) {
@@ -270,6 +285,7 @@ void commit_start(BlockDriverState *bs, BlockDriverState *base,
     s->backing_file_str = g_strdup(backing_file_str);
 
     s->on_error = on_error;
+    s->use_copy_range = true;
     s->common.co = qemu_coroutine_create(commit_run);
 
     trace_commit_start(bs, base, top, s, s->common.co, opaque);
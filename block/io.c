@@ -980,6 +980,7 @@ int coroutine_fn bdrv_co_do_preadv(BlockDriverState *bs,
     uint8_t *tail_buf = NULL;
     QEMUIOVector local_qiov;
     bool use_local_qiov = false;
+    int64_t throttle_start_ns = -1;
     int ret;
 
     if (!drv) {
@@ -998,7 +999,8 @@ int coroutine_fn bdrv_co_do_preadv(BlockDriverState *bs,
 
     /* throttling disk I/O */
     if (bs->io_limits_enabled) {
-        throttle_group_co_io_limits_intercept(bs, bytes, false);
+        throttle_start_ns = throttle_group_co_io_limits_intercept(bs, bytes,
+                                                                  false);
     }
 
     /* Align read if necessary by padding qiov */
@@ -1038,6 +1040,9 @@ int coroutine_fn bdrv_co_do_preadv(BlockDriverState *bs,
         qemu_vfree(tail_buf);
     }
 
+    if (throttle_start_ns >= 0) {
+        throttle_group_co_io_done(bs, throttle_start_ns);
+    }
     return ret;
 }
 
@@ -1123,7 +1128,7 @@ static int coroutine_fn bdrv_co_do_write_zeroes(BlockDriverState *bs,
             ret = drv->bdrv_co_write_zeroes(bs, sector_num, num, flags);
         }
 
-        if (ret == -ENOTSUP) {
+        if (ret == -ENOTSUP && !(flags & BDRV_REQ_NO_FALLBACK)) {
             /* Fall back to bounce buffer if write zeroes is unsupported */
             int max_xfer_len = MIN_NON_ZERO(bs->bl.max_transfer_length,
                                             MAX_WRITE_ZEROES_BOUNCE_BUFFER);
@@ -1167,6 +1172,7 @@ static int coroutine_fn bdrv_aligned_pwritev(BlockDriverState *bs,
     QEMUIOVector *qiov, int flags)
 {
     BlockDriver *drv = bs->drv;
+    BdrvCompletedWrite write_done;
     bool waited;
     int ret;
 
@@ -1218,6 +1224,15 @@ static int coroutine_fn bdrv_aligned_pwritev(BlockDriverState *bs,
 
     bdrv_set_dirty(bs, sector_num, nb_sectors);
 
+    write_done = (BdrvCompletedWrite) {
+        .req    = req,
+        .offset = offset,
+        .bytes  = bytes,
+        .qiov   = flags & BDRV_REQ_ZERO_WRITE ? NULL : qiov,
+        .ret    = ret,
+    };
+    notifier_list_notify(&bs->after_write_notifiers, &write_done);
+
     if (bs->wr_highest_offset < offset + bytes) {
         bs->wr_highest_offset = offset + bytes;
     }
@@ -1331,6 +1346,7 @@ int coroutine_fn bdrv_co_do_pwritev(BlockDriverState *bs,
     uint8_t *tail_buf = NULL;
     QEMUIOVector local_qiov;
     bool use_local_qiov = false;
+    int64_t throttle_start_ns = -1;
     int ret;
 
     if (!bs->drv) {
@@ -1348,7 +1364,8 @@ int coroutine_fn bdrv_co_do_pwritev(BlockDriverState *bs,
 
     /* throttling disk I/O */
     if (bs->io_limits_enabled) {
-        throttle_group_co_io_limits_intercept(bs, bytes, true);
+        throttle_start_ns = throttle_group_co_io_limits_intercept(bs, bytes,
+                                                                  true);
     }
 
     /*
@@ -1444,6 +1461,9 @@ fail:
     qemu_vfree(tail_buf);
 out:
     tracked_request_end(&req);
+    if (throttle_start_ns >= 0) {
+        throttle_group_co_io_done(bs, throttle_start_ns);
+    }
     return ret;
 }
 
@@ -1481,6 +1501,192 @@ int coroutine_fn bdrv_co_write_zeroes(BlockDriverState *bs,
                              BDRV_REQ_ZERO_WRITE | flags);
 }
 
+/* Largest request used when a copy falls back to a bounce buffer */
+#define COPY_RANGE_BOUNCE_SECTORS ((1 * 1024 * 1024) >> BDRV_SECTOR_BITS)
+
+static bool bdrv_copy_range_aligned(BlockDriverState *bs, int64_t sector_num,
+                                    int nb_sectors)
+{
+    uint64_t align = bs->request_alignment;
+
+    return !(((sector_num << BDRV_SECTOR_BITS) & (align - 1)) ||
+             (((int64_t)nb_sectors << BDRV_SECTOR_BITS) & (align - 1)));
+}
+
+static int coroutine_fn bdrv_co_copy_range_internal(BlockDriverState *src,
+    int64_t src_sector, BlockDriverState *dst, int64_t dst_sector,
+    int nb_sectors, BdrvRequestFlags flags, bool recurse_src)
+{
+    BdrvTrackedRequest req;
+    int64_t offset;
+    unsigned int bytes = nb_sectors << BDRV_SECTOR_BITS;
+    int64_t throttle_start_ns = -1;
+    int ret;
+
+    if (!src->drv || !dst->drv) {
+        return -ENOMEDIUM;
+    }
+    ret = bdrv_check_request(src, src_sector, nb_sectors);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = bdrv_check_request(dst, dst_sector, nb_sectors);
+    if (ret < 0) {
+        return ret;
+    } else if (dst->read_only) {
+        return -EPERM;
+    }
+    assert(!(dst->open_flags & BDRV_O_INACTIVE));
+
+    if (!bdrv_copy_range_aligned(src, src_sector, nb_sectors) ||
+        !bdrv_copy_range_aligned(dst, dst_sector, nb_sectors)) {
+        return -ENOTSUP;
+    }
+
+    if (recurse_src) {
+        if (!src->drv->bdrv_co_copy_range_from) {
+            return -ENOTSUP;
+        }
+
+        /* Throttled like the read that it replaces */
+        if (src->io_limits_enabled) {
+            throttle_start_ns = throttle_group_co_io_limits_intercept(src,
+                                                                      bytes,
+                                                                      false);
+        }
+
+        offset = src_sector << BDRV_SECTOR_BITS;
+        tracked_request_begin(&req, src, offset, bytes, BDRV_TRACKED_READ);
+        if (!(flags & BDRV_REQ_NO_SERIALISING)) {
+            wait_serialising_requests(&req);
+        }
+        ret = src->drv->bdrv_co_copy_range_from(src, src_sector, dst,
+                                                dst_sector, nb_sectors, flags);
+        tracked_request_end(&req);
+        if (throttle_start_ns >= 0) {
+            throttle_group_co_io_done(src, throttle_start_ns);
+        }
+        return ret;
+    }
+
+    /* After-write notifiers expect the data that was written */
+    if (!dst->drv->bdrv_co_copy_range_to ||
+        !QLIST_EMPTY(&dst->after_write_notifiers.notifiers)) {
+        return -ENOTSUP;
+    }
+
+    /* Throttled like the write that it replaces */
+    if (dst->io_limits_enabled) {
+        throttle_start_ns = throttle_group_co_io_limits_intercept(dst, bytes,
+                                                                  true);
+    }
+
+    offset = dst_sector << BDRV_SECTOR_BITS;
+    tracked_request_begin(&req, dst, offset, bytes, BDRV_TRACKED_WRITE);
+    wait_serialising_requests(&req);
+
+    ret = notifier_with_return_list_notify(&dst->before_write_notifiers, &req);
+    if (!ret) {
+        ret = dst->drv->bdrv_co_copy_range_to(dst, src, src_sector,
+                                              dst_sector, nb_sectors, flags);
+    }
+
+    bdrv_set_dirty(dst, dst_sector, nb_sectors);
+    if (dst->wr_highest_offset < offset + bytes) {
+        dst->wr_highest_offset = offset + bytes;
+    }
+    if (ret >= 0) {
+        dst->total_sectors = MAX(dst->total_sectors, dst_sector + nb_sectors);
+    }
+
+    tracked_request_end(&req);
+    if (throttle_start_ns >= 0) {
+        throttle_group_co_io_done(dst, throttle_start_ns);
+    }
+    return ret;
+}
+
+int coroutine_fn bdrv_co_copy_range_from(BlockDriverState *src,
+    int64_t src_sector, BlockDriverState *dst, int64_t dst_sector,
+    int nb_sectors, BdrvRequestFlags flags)
+{
+    return bdrv_co_copy_range_internal(src, src_sector, dst, dst_sector,
+                                       nb_sectors, flags, true);
+}
+
+int coroutine_fn bdrv_co_copy_range_to(BlockDriverState *dst,
+    BlockDriverState *src, int64_t src_sector, int64_t dst_sector,
+    int nb_sectors, BdrvRequestFlags flags)
+{
+    return bdrv_co_copy_range_internal(src, src_sector, dst, dst_sector,
+                                       nb_sectors, flags, false);
+}
+
+static int coroutine_fn bdrv_co_copy_range_bounce(BlockDriverState *src,
+    int64_t src_sector, BlockDriverState *dst, int64_t dst_sector,
+    int nb_sectors, BdrvRequestFlags flags)
+{
+    QEMUIOVector qiov;
+    struct iovec iov;
+    void *buf;
+    int ret = 0;
+
+    buf = qemu_try_memalign(MAX(bdrv_opt_mem_align(src),
+                                bdrv_opt_mem_align(dst)),
+                            MIN(nb_sectors, COPY_RANGE_BOUNCE_SECTORS) *
+                            BDRV_SECTOR_SIZE);
+    if (buf == NULL) {
+        return -ENOMEM;
+    }
+
+    while (nb_sectors > 0) {
+        int num = MIN(nb_sectors, COPY_RANGE_BOUNCE_SECTORS);
+
+        iov = (struct iovec) {
+            .iov_base = buf,
+            .iov_len  = num * BDRV_SECTOR_SIZE,
+        };
+        qemu_iovec_init_external(&qiov, &iov, 1);
+
+        ret = bdrv_co_do_preadv(src, src_sector << BDRV_SECTOR_BITS,
+                                iov.iov_len, &qiov,
+                                flags & BDRV_REQ_NO_SERIALISING);
+        if (ret < 0) {
+            break;
+        }
+        ret = bdrv_co_do_pwritev(dst, dst_sector << BDRV_SECTOR_BITS,
+                                 iov.iov_len, &qiov, 0);
+        if (ret < 0) {
+            break;
+        }
+
+        src_sector += num;
+        dst_sector += num;
+        nb_sectors -= num;
+    }
+
+    qemu_vfree(buf);
+    return ret;
+}
+
+int coroutine_fn bdrv_co_copy_range(BlockDriverState *src, int64_t src_sector,
+                                    BlockDriverState *dst, int64_t dst_sector,
+                                    int nb_sectors, BdrvRequestFlags flags)
+{
+    int ret;
+
+    trace_bdrv_co_copy_range(src, src_sector, dst, dst_sector, nb_sectors,
+                             flags);
+
+    ret = bdrv_co_copy_range_from(src, src_sector, dst, dst_sector,
+                                  nb_sectors, flags);
+    if (ret == -ENOTSUP && !(flags & BDRV_REQ_NO_FALLBACK)) {
+        ret = bdrv_co_copy_range_bounce(src, src_sector, dst, dst_sector,
+                                        nb_sectors, flags);
+    }
+    return ret;
+}
+
 typedef struct BdrvCoGetBlockStatusData {
     BlockDriverState *bs;
     BlockDriverState *base;
@@ -2491,6 +2697,9 @@ int coroutine_fn bdrv_co_discard(BlockDriverState *bs, int64_t sector_num,
                                  int nb_sectors)
 {
     BdrvTrackedRequest req;
+    BdrvCompletedWrite discard_done;
+    int64_t start_sector = sector_num;
+    int discard_sectors = nb_sectors;
     int max_discard, ret;
 
     if (!bs->drv) {
@@ -2565,6 +2774,15 @@ int coroutine_fn bdrv_co_discard(BlockDriverState *bs, int64_t sector_num,
     }
     ret = 0;
 out:
+    discard_done = (BdrvCompletedWrite) {
+        .req     = &req,
+        .offset  = start_sector << BDRV_SECTOR_BITS,
+        .bytes   = (unsigned int) discard_sectors << BDRV_SECTOR_BITS,
+        .discard = true,
+        .ret     = ret,
+    };
+    notifier_list_notify(&bs->after_write_notifiers, &discard_done);
+
     tracked_request_end(&req);
     return ret;
 }
@@ -2745,6 +2963,12 @@ void bdrv_add_before_write_notifier(BlockDriverState *bs,
     notifier_with_return_list_add(&bs->before_write_notifiers, notifier);
 }
 
+void bdrv_add_after_write_notifier(BlockDriverState *bs,
+                                   Notifier *notifier)
+{
+    notifier_list_add(&bs->after_write_notifiers, notifier);
+}
+
 void bdrv_io_plug(BlockDriverState *bs)
 {
     BlockDriver *drv = bs->drv;
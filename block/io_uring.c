@@ -0,0 +1,441 @@
+/*
+ * Linux io_uring support.
+ *
+ * Requests are placed on a submission ring shared with the kernel and
+ * their results are read back from a completion ring, so that a batch of
+ * requests costs at most one system call and completions none at all.
+ * Unlike Linux native AIO this also works asynchronously on files that
+ * are not opened with O_DIRECT.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "block/aio.h"
+#include "qemu/queue.h"
+#include "block/raw-aio.h"
+#include "qemu/event_notifier.h"
+#include "qemu/timer.h"
+#include "trace.h"
+
+#include <liburing.h>
+#include <linux/falloc.h>
+
+/* Submission ring entries.  The completion ring is twice as large, and
+ * no more than this many requests are ever in flight, so it cannot
+ * overflow.
+ */
+#define MAX_ENTRIES 128
+
+/* How long to wait before handing the ring to the kernel again when it
+ * refused it and no completion is going to trigger a retry.
+ */
+#define SUBMIT_RETRY_NS (1 * SCALE_MS)
+
+struct qemu_luringcb {
+    BlockAIOCB common;
+    struct qemu_luring_state *ctx;
+    int fd;
+    int type;
+    off_t offset;
+    ssize_t ret;
+    size_t nbytes;
+    QEMUIOVector *qiov;
+
+    /* What is left of a short read, resubmitted from where it stopped */
+    QEMUIOVector resubmit_qiov;
+    size_t total_read;
+    QSIMPLEQ_ENTRY(qemu_luringcb) next;
+};
+
+typedef struct {
+    int plugged;
+    unsigned int in_queue;
+    unsigned int in_flight;
+    bool blocked;
+    QSIMPLEQ_HEAD(, qemu_luringcb) pending;
+} LuringQueue;
+
+struct qemu_luring_state {
+    struct io_uring ring;
+    EventNotifier e;
+
+    /* io queue for submit at batch */
+    LuringQueue io_q;
+
+    /* I/O completion processing */
+    QEMUBH *completion_bh;
+
+    /* Retries a refused submission when nothing is in flight */
+    QEMUTimer *retry_timer;
+};
+
+static void luring_ioq_submit(struct qemu_luring_state *s);
+
+static void luring_prep_sqe(struct io_uring_sqe *sqe,
+                            struct qemu_luringcb *luringcb)
+{
+    QEMUIOVector *qiov = luringcb->qiov;
+    off_t offset = luringcb->offset;
+
+    if (luringcb->total_read) {
+        qiov = &luringcb->resubmit_qiov;
+        offset += luringcb->total_read;
+    }
+
+    switch (luringcb->type) {
+    case QEMU_AIO_WRITE:
+        io_uring_prep_writev(sqe, luringcb->fd, qiov->iov, qiov->niov,
+                             offset);
+        break;
+    case QEMU_AIO_READ:
+        io_uring_prep_readv(sqe, luringcb->fd, qiov->iov, qiov->niov,
+                            offset);
+        break;
+    case QEMU_AIO_FLUSH:
+        io_uring_prep_fsync(sqe, luringcb->fd, IORING_FSYNC_DATASYNC);
+        break;
+    case QEMU_AIO_DISCARD:
+        io_uring_prep_fallocate(sqe, luringcb->fd,
+                                FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                                offset, luringcb->nbytes);
+        break;
+    default:
+        abort();
+    }
+    io_uring_sqe_set_data(sqe, luringcb);
+}
+
+/* Queue the rest of a read that came back short, ahead of everything
+ * that was not submitted yet.
+ */
+static void luring_resubmit_short_read(struct qemu_luring_state *s,
+                                       struct qemu_luringcb *luringcb,
+                                       ssize_t nread)
+{
+    if (!luringcb->total_read) {
+        qemu_iovec_init(&luringcb->resubmit_qiov, luringcb->qiov->niov);
+    }
+    luringcb->total_read += nread;
+    qemu_iovec_reset(&luringcb->resubmit_qiov);
+    qemu_iovec_concat(&luringcb->resubmit_qiov, luringcb->qiov,
+                      luringcb->total_read,
+                      luringcb->nbytes - luringcb->total_read);
+
+    QSIMPLEQ_INSERT_HEAD(&s->io_q.pending, luringcb, next);
+    s->io_q.in_queue++;
+}
+
+/*
+ * Completes an io_uring request (calls the callback and frees the ACB).
+ */
+static void luring_process_completion(struct qemu_luring_state *s,
+                                      struct qemu_luringcb *luringcb)
+{
+    ssize_t ret = luringcb->ret;
+
+    switch (luringcb->type) {
+    case QEMU_AIO_READ:
+        if (ret < 0) {
+            break;
+        }
+        ret += luringcb->total_read;
+        if (ret < luringcb->nbytes) {
+            /* Short reads mean EOF, pad with zeros. */
+            qemu_iovec_memset(luringcb->qiov, ret, 0,
+                              luringcb->qiov->size - ret);
+        }
+        ret = 0;
+        break;
+    case QEMU_AIO_WRITE:
+        if (ret == luringcb->nbytes) {
+            ret = 0;
+        } else if (ret >= 0) {
+            ret = -EINVAL;
+        }
+        break;
+    case QEMU_AIO_DISCARD:
+        /* As in raw-posix.c, anything that says that the file system does
+         * not punch holes means discard is not supported
+         */
+        if (ret == -ENODEV || ret == -EINVAL || ret == -EOPNOTSUPP) {
+            ret = -ENOTSUP;
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (luringcb->total_read) {
+        qemu_iovec_destroy(&luringcb->resubmit_qiov);
+    }
+    trace_luring_process_completion(s, luringcb, ret);
+    luringcb->common.cb(luringcb->common.opaque, ret);
+
+    qemu_aio_unref(luringcb);
+}
+
+/* The completion BH reaps completed requests from the completion ring and
+ * invokes their callbacks.
+ *
+ * As with Linux native AIO, a callback may run a nested event loop.  The
+ * completion ring itself keeps the events that were not processed yet, so
+ * the BH only needs to reschedule itself before calling out; it stops when
+ * the ring is empty.
+ */
+static void luring_completion_bh(void *opaque)
+{
+    struct qemu_luring_state *s = opaque;
+    struct io_uring_cqe *cqe;
+
+    while (io_uring_peek_cqe(&s->ring, &cqe) == 0 && cqe) {
+        struct qemu_luringcb *luringcb = io_uring_cqe_get_data(cqe);
+        ssize_t ret = cqe->res;
+
+        io_uring_cqe_seen(&s->ring, cqe);
+        s->io_q.in_flight--;
+
+        /* Reschedule so nested event loops see pending completions */
+        qemu_bh_schedule(s->completion_bh);
+
+        if (ret == -EINTR || ret == -EAGAIN) {
+            /* Retry from the start, nothing was transferred */
+            QSIMPLEQ_INSERT_HEAD(&s->io_q.pending, luringcb, next);
+            s->io_q.in_queue++;
+            continue;
+        }
+        if (luringcb->type == QEMU_AIO_READ && ret > 0 &&
+            ret + luringcb->total_read < luringcb->nbytes) {
+            /* Buffered reads may stop early without being at EOF */
+            luring_resubmit_short_read(s, luringcb, ret);
+            continue;
+        }
+
+        luringcb->ret = ret;
+        luring_process_completion(s, luringcb);
+    }
+
+    if (!s->io_q.plugged &&
+        (!QSIMPLEQ_EMPTY(&s->io_q.pending) || io_uring_sq_ready(&s->ring))) {
+        luring_ioq_submit(s);
+    }
+}
+
+static void luring_completion_cb(EventNotifier *e)
+{
+    struct qemu_luring_state *s = container_of(e, struct qemu_luring_state,
+                                               e);
+
+    if (event_notifier_test_and_clear(&s->e)) {
+        qemu_bh_schedule(s->completion_bh);
+    }
+}
+
+static const AIOCBInfo luring_aiocb_info = {
+    .aiocb_size         = sizeof(struct qemu_luringcb),
+};
+
+static void luring_ioq_init(LuringQueue *io_q)
+{
+    QSIMPLEQ_INIT(&io_q->pending);
+    io_q->plugged = 0;
+    io_q->in_queue = 0;
+    io_q->in_flight = 0;
+    io_q->blocked = false;
+}
+
+/* Move pending requests to the submission ring and hand the ring to the
+ * kernel, with a single io_uring_enter() for the whole batch.
+ *
+ * If the kernel is short of resources (-EAGAIN or -EBUSY), the entries
+ * stay in the submission ring and are handed over again by the next call.
+ */
+static void luring_ioq_submit(struct qemu_luring_state *s)
+{
+    struct qemu_luringcb *luringcb;
+    struct io_uring_sqe *sqe;
+    int ret;
+
+    while (!QSIMPLEQ_EMPTY(&s->io_q.pending) &&
+           s->io_q.in_flight < MAX_ENTRIES) {
+        sqe = io_uring_get_sqe(&s->ring);
+        if (!sqe) {
+            break;
+        }
+        luringcb = QSIMPLEQ_FIRST(&s->io_q.pending);
+        QSIMPLEQ_REMOVE_HEAD(&s->io_q.pending, next);
+        luring_prep_sqe(sqe, luringcb);
+        s->io_q.in_queue--;
+        s->io_q.in_flight++;
+    }
+
+    do {
+        ret = io_uring_submit(&s->ring);
+    } while (ret == -EINTR);
+    if (ret < 0 && ret != -EAGAIN && ret != -EBUSY) {
+        abort();
+    }
+    trace_luring_ioq_submit(s, s->io_q.in_queue, s->io_q.in_flight, ret);
+
+    /* Whatever is still pending goes in once completions make room */
+    s->io_q.blocked = (s->io_q.in_queue > 0 || io_uring_sq_ready(&s->ring));
+
+    /* Requests that completed while being submitted need no wakeup.  If
+     * the kernel has nothing in flight, no completion will come to retry
+     * the submission either.  Retrying right away would only spin while
+     * the kernel is short of resources, so wait a little.
+     */
+    if (io_uring_cq_ready(&s->ring)) {
+        qemu_bh_schedule(s->completion_bh);
+    } else if (io_uring_sq_ready(&s->ring) &&
+               io_uring_sq_ready(&s->ring) == s->io_q.in_flight &&
+               !timer_pending(s->retry_timer)) {
+        timer_mod(s->retry_timer,
+                  qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + SUBMIT_RETRY_NS);
+    }
+}
+
+static void luring_retry_cb(void *opaque)
+{
+    struct qemu_luring_state *s = opaque;
+
+    if (io_uring_sq_ready(&s->ring)) {
+        luring_ioq_submit(s);
+    }
+}
+
+void luring_io_plug(BlockDriverState *bs, void *aio_ctx)
+{
+    struct qemu_luring_state *s = aio_ctx;
+
+    s->io_q.plugged++;
+}
+
+void luring_io_unplug(BlockDriverState *bs, void *aio_ctx, bool unplug)
+{
+    struct qemu_luring_state *s = aio_ctx;
+
+    assert(s->io_q.plugged > 0 || !unplug);
+
+    if (unplug && --s->io_q.plugged > 0) {
+        return;
+    }
+
+    if (io_uring_sq_ready(&s->ring) ||
+        (!s->io_q.blocked && !QSIMPLEQ_EMPTY(&s->io_q.pending))) {
+        luring_ioq_submit(s);
+    }
+}
+
+/* TYPE is QEMU_AIO_READ, QEMU_AIO_WRITE, QEMU_AIO_FLUSH, or
+ * QEMU_AIO_DISCARD on a regular file that supports punching holes.
+ */
+BlockAIOCB *luring_submit(BlockDriverState *bs, void *aio_ctx, int fd,
+        int64_t sector_num, QEMUIOVector *qiov, int nb_sectors,
+        BlockCompletionFunc *cb, void *opaque, int type)
+{
+    struct qemu_luring_state *s = aio_ctx;
+    struct qemu_luringcb *luringcb;
+
+    switch (type) {
+    case QEMU_AIO_READ:
+    case QEMU_AIO_WRITE:
+    case QEMU_AIO_FLUSH:
+    case QEMU_AIO_DISCARD:
+        break;
+    default:
+        fprintf(stderr, "%s: invalid AIO request type 0x%x.\n",
+                        __func__, type);
+        return NULL;
+    }
+
+    luringcb = qemu_aio_get(&luring_aiocb_info, bs, cb, opaque);
+    luringcb->ctx = s;
+    luringcb->fd = fd;
+    luringcb->type = type;
+    luringcb->offset = sector_num * BDRV_SECTOR_SIZE;
+    luringcb->nbytes = nb_sectors * BDRV_SECTOR_SIZE;
+    luringcb->ret = -EINPROGRESS;
+    luringcb->qiov = qiov;
+    luringcb->total_read = 0;
+    trace_luring_submit(s, luringcb, type, sector_num, nb_sectors);
+
+    QSIMPLEQ_INSERT_TAIL(&s->io_q.pending, luringcb, next);
+    s->io_q.in_queue++;
+    if (!s->io_q.blocked &&
+        (!s->io_q.plugged || s->io_q.in_queue >= MAX_ENTRIES)) {
+        luring_ioq_submit(s);
+    }
+    return &luringcb->common;
+}
+
+void luring_detach_aio_context(void *s_, AioContext *old_context)
+{
+    struct qemu_luring_state *s = s_;
+
+    aio_set_event_notifier(old_context, &s->e, false, NULL);
+    qemu_bh_delete(s->completion_bh);
+    timer_del(s->retry_timer);
+    timer_free(s->retry_timer);
+}
+
+void luring_attach_aio_context(void *s_, AioContext *new_context)
+{
+    struct qemu_luring_state *s = s_;
+
+    s->completion_bh = aio_bh_new(new_context, luring_completion_bh, s);
+    s->retry_timer = aio_timer_new(new_context, QEMU_CLOCK_REALTIME,
+                                   SCALE_NS, luring_retry_cb, s);
+    if (io_uring_sq_ready(&s->ring)) {
+        /* A retry was cancelled by the detach */
+        timer_mod(s->retry_timer, qemu_clock_get_ns(QEMU_CLOCK_REALTIME));
+    }
+    aio_set_event_notifier(new_context, &s->e, false,
+                           luring_completion_cb);
+}
+
+/* Returns NULL if the kernel has no io_uring, so that the caller can fall
+ * back to the thread pool.
+ */
+void *luring_init(void)
+{
+    struct qemu_luring_state *s;
+
+    s = g_malloc0(sizeof(*s));
+    if (event_notifier_init(&s->e, false) < 0) {
+        goto out_free_state;
+    }
+
+    if (io_uring_queue_init(MAX_ENTRIES, &s->ring, 0) < 0) {
+        goto out_close_efd;
+    }
+
+    /* Completions are signalled through the event notifier */
+    if (io_uring_register_eventfd(&s->ring,
+                                  event_notifier_get_fd(&s->e)) < 0) {
+        goto out_queue_exit;
+    }
+
+    luring_ioq_init(&s->io_q);
+
+    return s;
+
+out_queue_exit:
+    io_uring_queue_exit(&s->ring);
+out_close_efd:
+    event_notifier_cleanup(&s->e);
+out_free_state:
+    g_free(s);
+    return NULL;
+}
+
+void luring_cleanup(void *s_)
+{
+    struct qemu_luring_state *s = s_;
+
+    io_uring_unregister_eventfd(&s->ring);
+    io_uring_queue_exit(&s->ring);
+    event_notifier_cleanup(&s->e);
+    g_free(s);
+}
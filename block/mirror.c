@@ -66,6 +66,15 @@ typedef struct MirrorBlockJob {
     bool waiting_for_io;
     int target_cluster_sectors;
     int max_iov;
+
+    MirrorCopyMode copy_mode;
+    /* True once guest writes are being mirrored synchronously */
+    bool write_blocking;
+    Notifier after_write;
+    /* Guest writes waiting for background copies of the same chunks */
+    CoQueue active_write_queue;
+    int active_write_waiters;
+    int active_writes;
 } MirrorBlockJob;
 
 typedef struct MirrorOp {
@@ -88,6 +97,18 @@ static BlockErrorAction mirror_error_action(MirrorBlockJob *s, bool read,
     }
 }
 
+static void mirror_wake_active_writers(MirrorBlockJob *s)
+{
+    int waiters = s->active_write_waiters;
+
+    /* Woken writers may queue themselves again, so only wake those that
+     * were waiting when we started.
+     */
+    while (waiters-- > 0 && qemu_co_enter_next(&s->active_write_queue)) {
+        /* do nothing */
+    }
+}
+
 static void mirror_iteration_done(MirrorOp *op, int ret)
 {
     MirrorBlockJob *s = op->s;
@@ -120,6 +141,7 @@ static void mirror_iteration_done(MirrorOp *op, int ret)
     qemu_iovec_destroy(&op->qiov);
     g_free(op);
 
+    mirror_wake_active_writers(s);
     if (s->waiting_for_io) {
         qemu_coroutine_enter(s->common.co, NULL);
     }
@@ -416,6 +438,157 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
     return delay_ns;
 }
 
+/* Write-blocking mode: called in the coroutine of a guest write to the
+ * source once it has completed.  The same data is written to the target
+ * before the guest request completes, so that the chunks it fully covers
+ * need not be copied again by the background loop.
+ *
+ * The dirty bitmap is disabled in this mode, so only what could not be
+ * mirrored here is marked dirty.
+ */
+static void coroutine_fn mirror_after_write(Notifier *notifier, void *opaque)
+{
+    MirrorBlockJob *s = container_of(notifier, MirrorBlockJob, after_write);
+    BdrvCompletedWrite *write = opaque;
+    int sectors_per_chunk = s->granularity >> BDRV_SECTOR_BITS;
+    int64_t end = s->bdev_length / BDRV_SECTOR_SIZE;
+    int64_t sector_num, first_chunk, last_chunk;
+    int nb_sectors;
+    int ret;
+
+    assert((write->offset & ~BDRV_SECTOR_MASK) == 0);
+    assert((write->bytes & ~BDRV_SECTOR_MASK) == 0);
+    sector_num = write->offset >> BDRV_SECTOR_BITS;
+    nb_sectors = write->bytes >> BDRV_SECTOR_BITS;
+    if (sector_num >= end) {
+        return;
+    }
+    mirror_clip_sectors(s, sector_num, &nb_sectors);
+
+    /* Leave discards and failed writes to the background loop */
+    if (write->discard || write->ret < 0 || s->ret < 0) {
+        bdrv_set_dirty_bitmap(s->dirty_bitmap, sector_num, nb_sectors);
+        return;
+    }
+
+    /* Without COW on the target, a partial cluster can only be written if
+     * the background loop has already copied it.
+     */
+    if (s->cow_bitmap &&
+        (sector_num % s->target_cluster_sectors ||
+         (nb_sectors % s->target_cluster_sectors &&
+          sector_num + nb_sectors < end))) {
+        int64_t chunk = sector_num / sectors_per_chunk;
+        int64_t last = (sector_num + nb_sectors - 1) / sectors_per_chunk;
+
+        for (; chunk <= last; chunk++) {
+            if (!test_bit(chunk, s->cow_bitmap)) {
+                bdrv_set_dirty_bitmap(s->dirty_bitmap, sector_num,
+                                      nb_sectors);
+                return;
+            }
+        }
+    }
+
+    /* Serialise against background copies and other guest writes to the
+     * same chunks, so that the target sees the writes in source order.
+     */
+    first_chunk = sector_num / sectors_per_chunk;
+    last_chunk = DIV_ROUND_UP(sector_num + nb_sectors, sectors_per_chunk);
+    while (find_next_bit(s->in_flight_bitmap, last_chunk, first_chunk) <
+           last_chunk) {
+        s->active_write_waiters++;
+        qemu_co_queue_wait(&s->active_write_queue);
+        s->active_write_waiters--;
+
+        /* The job is going away, leave the target alone */
+        if (!s->write_blocking) {
+            bdrv_set_dirty_bitmap(s->dirty_bitmap, sector_num, nb_sectors);
+            if (s->waiting_for_io) {
+                qemu_coroutine_enter(s->common.co, NULL);
+            }
+            return;
+        }
+    }
+    bitmap_set(s->in_flight_bitmap, first_chunk, last_chunk - first_chunk);
+    s->active_writes++;
+
+    if (write->qiov) {
+        QEMUIOVector qiov;
+
+        qemu_iovec_init(&qiov, write->qiov->niov);
+        qemu_iovec_concat(&qiov, write->qiov, 0, nb_sectors * BDRV_SECTOR_SIZE);
+        ret = bdrv_co_writev(s->target, sector_num, nb_sectors, &qiov);
+        qemu_iovec_destroy(&qiov);
+    } else {
+        ret = bdrv_co_write_zeroes(s->target, sector_num, nb_sectors,
+                                   s->unmap ? BDRV_REQ_MAY_UNMAP : 0);
+    }
+
+    if (ret < 0) {
+        BlockErrorAction action;
+
+        bdrv_set_dirty_bitmap(s->dirty_bitmap, sector_num, nb_sectors);
+        action = mirror_error_action(s, false, -ret);
+        if (action == BLOCK_ERROR_ACTION_REPORT && s->ret >= 0) {
+            s->ret = ret;
+        }
+    } else {
+        /* Only whole chunks are clean now; a partial chunk at the end of
+         * the device counts as whole.
+         */
+        int64_t clean_first = DIV_ROUND_UP(sector_num, sectors_per_chunk);
+        int64_t clean_last = (sector_num + nb_sectors) / sectors_per_chunk;
+
+        if (sector_num + nb_sectors == end) {
+            clean_last = last_chunk;
+        }
+        if (clean_first < clean_last) {
+            bdrv_reset_dirty_bitmap(s->dirty_bitmap,
+                                    clean_first * sectors_per_chunk,
+                                    (clean_last - clean_first) *
+                                    sectors_per_chunk);
+            if (s->cow_bitmap) {
+                bitmap_set(s->cow_bitmap, clean_first,
+                           clean_last - clean_first);
+            }
+        }
+    }
+
+    bitmap_clear(s->in_flight_bitmap, first_chunk, last_chunk - first_chunk);
+    s->active_writes--;
+
+    mirror_wake_active_writers(s);
+    if (s->waiting_for_io) {
+        qemu_coroutine_enter(s->common.co, NULL);
+    }
+}
+
+static void mirror_enable_write_blocking(MirrorBlockJob *s)
+{
+    trace_mirror_enable_write_blocking(s);
+    s->after_write.notify = mirror_after_write;
+    bdrv_add_after_write_notifier(s->common.bs, &s->after_write);
+    bdrv_disable_dirty_bitmap(s->dirty_bitmap);
+    s->write_blocking = true;
+}
+
+/* Stop mirroring guest writes and wait for those already in progress,
+ * including the ones still waiting for a background copy.
+ */
+static void mirror_disable_write_blocking(MirrorBlockJob *s)
+{
+    if (!s->write_blocking) {
+        return;
+    }
+    notifier_remove(&s->after_write);
+    bdrv_enable_dirty_bitmap(s->dirty_bitmap);
+    s->write_blocking = false;
+    while (s->active_writes > 0 || s->active_write_waiters > 0) {
+        mirror_wait_for_io(s);
+    }
+}
+
 static void mirror_free_init(MirrorBlockJob *s)
 {
     int granularity = s->granularity;
@@ -609,6 +782,11 @@ static void coroutine_fn mirror_run(void *opaque)
             goto immediate_exit;
         }
 
+        if (s->copy_mode == MIRROR_COPY_MODE_WRITE_BLOCKING &&
+            !s->write_blocking) {
+            mirror_enable_write_blocking(s);
+        }
+
         cnt = bdrv_get_dirty_count(s->dirty_bitmap);
         /* s->common.offset contains the number of bytes already processed so
          * far, cnt is the number of dirty sectors remaining and
@@ -696,6 +874,7 @@ static void coroutine_fn mirror_run(void *opaque)
     }
 
 immediate_exit:
+    mirror_disable_write_blocking(s);
     if (s->in_flight > 0) {
         /* We get here only if something went wrong.  Either the job failed,
          * or it was cancelled prematurely so that we do not guarantee that
@@ -812,7 +991,7 @@ static void mirror_start_job(BlockDriverState *bs, BlockDriverState *target,
                              int64_t buf_size,
                              BlockdevOnError on_source_error,
                              BlockdevOnError on_target_error,
-                             bool unmap,
+                             bool unmap, MirrorCopyMode copy_mode,
                              BlockCompletionFunc *cb,
                              void *opaque, Error **errp,
                              const BlockJobDriver *driver,
@@ -872,6 +1051,8 @@ static void mirror_start_job(BlockDriverState *bs, BlockDriverState *target,
     s->granularity = granularity;
     s->buf_size = ROUND_UP(buf_size, granularity);
     s->unmap = unmap;
+    s->copy_mode = copy_mode;
+    qemu_co_queue_init(&s->active_write_queue);
 
     s->dirty_bitmap = bdrv_create_dirty_bitmap(bs, granularity, NULL, errp);
     if (!s->dirty_bitmap) {
@@ -891,12 +1072,33 @@ static void mirror_start_job(BlockDriverState *bs, BlockDriverState *target,
     qemu_coroutine_enter(s->common.co, s);
 }
 
+void mirror_set_copy_mode(BlockJob *job, MirrorCopyMode copy_mode,
+                          Error **errp)
+{
+    MirrorBlockJob *s = container_of(job, MirrorBlockJob, common);
+
+    assert(job->driver == &mirror_job_driver);
+    if (copy_mode == s->copy_mode) {
+        return;
+    }
+    if (copy_mode != MIRROR_COPY_MODE_WRITE_BLOCKING) {
+        error_setg(errp, "Cannot switch a mirror job from '%s' to '%s' mode",
+                   MirrorCopyMode_lookup[s->copy_mode],
+                   MirrorCopyMode_lookup[copy_mode]);
+        return;
+    }
+
+    /* The job enables write-blocking mode on its next iteration */
+    s->copy_mode = copy_mode;
+    block_job_enter(job);
+}
+
 void mirror_start(BlockDriverState *bs, BlockDriverState *target,
                   const char *replaces,
                   int64_t speed, uint32_t granularity, int64_t buf_size,
                   MirrorSyncMode mode, BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
-                  bool unmap,
+                  bool unmap, MirrorCopyMode copy_mode,
                   BlockCompletionFunc *cb,
                   void *opaque, Error **errp)
 {
@@ -911,8 +1113,8 @@ void mirror_start(BlockDriverState *bs, BlockDriverState *target,
     base = mode == MIRROR_SYNC_MODE_TOP ? backing_bs(bs) : NULL;
     mirror_start_job(bs, target, replaces,
                      speed, granularity, buf_size,
-                     on_source_error, on_target_error, unmap, cb, opaque, errp,
-                     &mirror_job_driver, is_none_mode, base);
+                     on_source_error, on_target_error, unmap, copy_mode,
+                     cb, opaque, errp, &mirror_job_driver, is_none_mode, base);
 }
 
 void commit_active_start(BlockDriverState *bs, BlockDriverState *base,
@@ -959,7 +1161,8 @@ void commit_active_start(BlockDriverState *bs, BlockDriverState *base,
 
     bdrv_ref(base);
     mirror_start_job(bs, base, NULL, speed, 0, 0,
-                     on_error, on_error, false, cb, opaque, &local_err,
+                     on_error, on_error, false, MIRROR_COPY_MODE_BACKGROUND,
+                     cb, opaque, &local_err,
                      &commit_active_job_driver, false, base);
     if (local_err) {
         error_propagate(errp, local_err);
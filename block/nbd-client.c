@@ -27,12 +27,27 @@
  */
 
 #include "qemu/osdep.h"
+#include "qapi/error.h"
 #include "nbd-client.h"
 
-#define HANDLE_TO_INDEX(bs, handle) ((handle) ^ ((uint64_t)(intptr_t)bs))
-#define INDEX_TO_HANDLE(bs, index)  ((index)  ^ ((uint64_t)(intptr_t)bs))
+#define HANDLE_TO_INDEX(s, handle) ((handle) ^ ((uint64_t)(intptr_t)s))
+#define INDEX_TO_HANDLE(s, index)  ((index)  ^ ((uint64_t)(intptr_t)s))
 
-static void nbd_recv_coroutines_enter_all(NbdClientSession *s)
+/* Block status requests are not limited by the buffer size, only by the
+ * 32-bit length field.
+ */
+#define NBD_MAX_STATUS_SECTORS (UINT32_MAX / 512)
+
+/* Reads and writes at least this large are split across all connections */
+#define NBD_STRIPE_MIN_SECTORS ((1 * 1024 * 1024) / 512)
+
+/* Part of a read request covered by an OFFSET_DATA or OFFSET_HOLE chunk */
+typedef struct NbdReadRange {
+    uint64_t from;
+    uint32_t len;
+} NbdReadRange;
+
+static void nbd_recv_coroutines_enter_all(NbdConnection *s)
 {
     int i;
 
@@ -43,31 +58,34 @@ static void nbd_recv_coroutines_enter_all(NbdClientSession *s)
     }
 }
 
-static void nbd_teardown_connection(BlockDriverState *bs)
+static void nbd_connection_detach_aio_context(NbdConnection *s)
 {
-    NbdClientSession *client = nbd_get_client_session(bs);
+    aio_set_fd_handler(bdrv_get_aio_context(s->bs), s->sioc->fd,
+                       false, NULL, NULL, NULL);
+}
 
-    if (!client->ioc) { /* Already closed */
+static void nbd_teardown_connection(NbdConnection *s)
+{
+    if (!s->ioc) { /* Already closed */
         return;
     }
 
     /* finish any pending coroutines */
-    qio_channel_shutdown(client->ioc,
+    qio_channel_shutdown(s->ioc,
                          QIO_CHANNEL_SHUTDOWN_BOTH,
                          NULL);
-    nbd_recv_coroutines_enter_all(client);
+    nbd_recv_coroutines_enter_all(s);
 
-    nbd_client_detach_aio_context(bs);
-    object_unref(OBJECT(client->sioc));
-    client->sioc = NULL;
-    object_unref(OBJECT(client->ioc));
-    client->ioc = NULL;
+    nbd_connection_detach_aio_context(s);
+    object_unref(OBJECT(s->sioc));
+    s->sioc = NULL;
+    object_unref(OBJECT(s->ioc));
+    s->ioc = NULL;
 }
 
 static void nbd_reply_ready(void *opaque)
 {
-    BlockDriverState *bs = opaque;
-    NbdClientSession *s = nbd_get_client_session(bs);
+    NbdConnection *s = opaque;
     uint64_t i;
     int ret;
 
@@ -104,21 +122,20 @@ static void nbd_reply_ready(void *opaque)
     }
 
 fail:
-    nbd_teardown_connection(bs);
+    nbd_teardown_connection(s);
 }
 
 static void nbd_restart_write(void *opaque)
 {
-    BlockDriverState *bs = opaque;
+    NbdConnection *s = opaque;
 
-    qemu_coroutine_enter(nbd_get_client_session(bs)->send_coroutine, NULL);
+    qemu_coroutine_enter(s->send_coroutine, NULL);
 }
 
-static int nbd_co_send_request(BlockDriverState *bs,
+static int nbd_co_send_request(NbdConnection *s,
                                struct nbd_request *request,
                                QEMUIOVector *qiov, int offset)
 {
-    NbdClientSession *s = nbd_get_client_session(bs);
     AioContext *aio_context;
     int rc, ret, i;
 
@@ -141,10 +158,10 @@ static int nbd_co_send_request(BlockDriverState *bs,
     }
 
     s->send_coroutine = qemu_coroutine_self();
-    aio_context = bdrv_get_aio_context(bs);
+    aio_context = bdrv_get_aio_context(s->bs);
 
     aio_set_fd_handler(aio_context, s->sioc->fd, false,
-                       nbd_reply_ready, nbd_restart_write, bs);
+                       nbd_reply_ready, nbd_restart_write, s);
     if (qiov) {
         qio_channel_set_cork(s->ioc, true);
         rc = nbd_send_request(s->ioc, request);
@@ -160,40 +177,247 @@ static int nbd_co_send_request(BlockDriverState *bs,
         rc = nbd_send_request(s->ioc, request);
     }
     aio_set_fd_handler(aio_context, s->sioc->fd, false,
-                       nbd_reply_ready, NULL, bs);
+                       nbd_reply_ready, NULL, s);
     s->send_coroutine = NULL;
     qemu_co_mutex_unlock(&s->send_mutex);
     return rc;
 }
 
-static void nbd_co_receive_reply(NbdClientSession *s,
-    struct nbd_request *request, struct nbd_reply *reply,
-    QEMUIOVector *qiov, int offset)
+static int nbd_co_read_buf(NbdConnection *s, void *buf, size_t len)
 {
-    int ret;
+    struct iovec iov = { .iov_base = buf, .iov_len = len };
 
-    /* Wait until we're woken up by the read handler.  TODO: perhaps
-     * peek at the next reply and avoid yielding if it's ours?  */
-    qemu_coroutine_yield();
-    *reply = s->reply;
-    if (reply->handle != request->handle ||
-        !s->ioc) {
-        reply->error = EIO;
-    } else {
-        if (qiov && reply->error == 0) {
-            ret = nbd_wr_syncv(s->ioc, qiov->iov, qiov->niov,
-                               offset, request->len, 1);
-            if (ret != request->len) {
-                reply->error = EIO;
+    return nbd_wr_syncv(s->ioc, &iov, 1, 0, len, true) == len ? 0 : -EIO;
+}
+
+/* Add the range covered by a read chunk to RANGES, which is sorted by
+ * offset.  Returns false if the chunk overlaps one received before.
+ */
+static bool nbd_read_range_add(GArray *ranges, uint64_t from, uint32_t len)
+{
+    NbdReadRange range = { .from = from, .len = len };
+    guint i;
+
+    for (i = 0; i < ranges->len; i++) {
+        if (g_array_index(ranges, NbdReadRange, i).from >= from) {
+            break;
+        }
+    }
+    if (i > 0) {
+        NbdReadRange *prev = &g_array_index(ranges, NbdReadRange, i - 1);
+
+        if (prev->from + prev->len > from) {
+            return false;
+        }
+    }
+    if (i < ranges->len &&
+        from + len > g_array_index(ranges, NbdReadRange, i).from) {
+        return false;
+    }
+    g_array_insert_val(ranges, i, range);
+    return true;
+}
+
+static uint64_t nbd_read_ranges_bytes(GArray *ranges)
+{
+    uint64_t bytes = 0;
+    guint i;
+
+    for (i = 0; i < ranges->len; i++) {
+        bytes += g_array_index(ranges, NbdReadRange, i).len;
+    }
+    return bytes;
+}
+
+static int nbd_co_drop(NbdConnection *s, size_t len)
+{
+    uint8_t buf[512];
+
+    while (len > 0) {
+        size_t chunk = MIN(len, sizeof(buf));
+
+        if (nbd_co_read_buf(s, buf, chunk) < 0) {
+            return -EIO;
+        }
+        len -= chunk;
+    }
+    return 0;
+}
+
+/* Read the payload of the structured reply chunk in REPLY.  Errors that
+ * the server reports for the request are stored in *request_ret; the
+ * return value is negative only if the stream can no longer be trusted.
+ * The parts of a read that data and hole chunks covered are added to
+ * READ_RANGES.
+ */
+static int nbd_co_receive_chunk(NbdConnection *s,
+                                struct nbd_request *request,
+                                struct nbd_reply *reply,
+                                QEMUIOVector *qiov, int offset,
+                                GArray *read_ranges,
+                                NBDExtent *extent, int *request_ret)
+{
+    uint32_t command = request->type & NBD_CMD_MASK_COMMAND;
+    uint8_t buf[4 + 8];
+    uint64_t from;
+    uint32_t len;
+
+    switch (reply->type) {
+    case NBD_REPLY_TYPE_NONE:
+        if (reply->length != 0 || !(reply->flags & NBD_REPLY_FLAG_DONE)) {
+            return -EIO;
+        }
+        return 0;
+
+    case NBD_REPLY_TYPE_OFFSET_DATA:
+    case NBD_REPLY_TYPE_OFFSET_HOLE:
+        /* Offset, then either the data or the length of the hole */
+        if (command != NBD_CMD_READ || !read_ranges || reply->length <= 8) {
+            return -EIO;
+        }
+        if (reply->type == NBD_REPLY_TYPE_OFFSET_HOLE) {
+            if (reply->length != 8 + 4 ||
+                nbd_co_read_buf(s, buf, 8 + 4) < 0) {
+                return -EIO;
+            }
+            len = ldl_be_p(buf + 8);
+        } else {
+            if (nbd_co_read_buf(s, buf, 8) < 0) {
+                return -EIO;
+            }
+            len = reply->length - 8;
+        }
+        from = ldq_be_p(buf);
+        if (len == 0 || from < request->from || len > request->len ||
+            from - request->from > request->len - len ||
+            !nbd_read_range_add(read_ranges, from - request->from, len)) {
+            return -EIO;
+        }
+
+        offset += from - request->from;
+        if (reply->type == NBD_REPLY_TYPE_OFFSET_HOLE) {
+            qemu_iovec_memset(qiov, offset, 0, len);
+        } else if (nbd_wr_syncv(s->ioc, qiov->iov, qiov->niov, offset,
+                                len, true) != len) {
+            return -EIO;
+        }
+        return 0;
+
+    case NBD_REPLY_TYPE_BLOCK_STATUS:
+        /* Context id and one descriptor, then maybe more descriptors */
+        if (command != NBD_CMD_BLOCK_STATUS || !extent ||
+            reply->length < 4 + 8 || (reply->length - 4) % 8 ||
+            nbd_co_read_buf(s, buf, 4 + 8) < 0) {
+            return -EIO;
+        }
+        if (ldl_be_p(buf) != s->info.meta_base_allocation_id) {
+            return -EIO;
+        }
+        extent->length = ldl_be_p(buf + 4);
+        extent->flags = ldl_be_p(buf + 8);
+        if (extent->length == 0) {
+            return -EIO;
+        }
+        return nbd_co_drop(s, reply->length - (4 + 8));
+
+    default:
+        if (!NBD_REPLY_TYPE_IS_ERR(reply->type)) {
+            /* An unknown chunk type may carry data we need */
+            return -EIO;
+        }
+
+        /* Error, message length, message, and for NBD_REPLY_TYPE_ERROR_OFFSET
+         * the offset of the error; unknown error types look the same.
+         */
+        if (reply->length < 4 + 2 || nbd_co_read_buf(s, buf, 4 + 2) < 0) {
+            return -EIO;
+        }
+        *request_ret = -nbd_errno_to_system_errno(ldl_be_p(buf));
+        if (*request_ret == 0) {
+            *request_ret = -EINVAL;
+        }
+        if (lduw_be_p(buf + 4) > reply->length - (4 + 2)) {
+            return -EIO;
+        }
+        return nbd_co_drop(s, reply->length - (4 + 2));
+    }
+}
+
+/* Collect the reply to REQUEST, which is either a simple reply or a
+ * series of structured reply chunks.  READ data is stored in QIOV at
+ * OFFSET, and the first BLOCK_STATUS descriptor in *EXTENT.  Structured
+ * chunks must cover the whole read exactly once.
+ */
+static int nbd_co_receive_reply(NbdConnection *s,
+                                struct nbd_request *request,
+                                QEMUIOVector *qiov, int offset,
+                                NBDExtent *extent)
+{
+    struct nbd_reply reply;
+    GArray *read_ranges = NULL;
+    bool got_extent = false;
+    bool structured = false;
+    int ret = 0;
+
+    if (qiov) {
+        read_ranges = g_array_new(false, false, sizeof(NbdReadRange));
+    }
+
+    do {
+        /* Wait until we're woken up by the read handler.  TODO: perhaps
+         * peek at the next reply and avoid yielding if it's ours?  */
+        qemu_coroutine_yield();
+        reply = s->reply;
+        if (reply.handle != request->handle || !s->ioc) {
+            ret = -EIO;
+            goto out;
+        }
+
+        if (!nbd_reply_is_structured(&reply)) {
+            if (reply.error) {
+                ret = ret ? ret : -reply.error;
+            } else if (qiov) {
+                if (nbd_wr_syncv(s->ioc, qiov->iov, qiov->niov,
+                                 offset, request->len, 1) != request->len) {
+                    ret = -EIO;
+                }
+            }
+            reply.flags = NBD_REPLY_FLAG_DONE;
+        } else if (nbd_co_receive_chunk(s, request, &reply, qiov, offset,
+                                        read_ranges, extent, &ret) < 0) {
+            /* Leave s->reply alone, so that the read handler finds no
+             * owner for it and tears down the connection.
+             */
+            qio_channel_shutdown(s->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
+            ret = -EIO;
+            goto out;
+        } else {
+            structured = true;
+            if (reply.type == NBD_REPLY_TYPE_BLOCK_STATUS) {
+                got_extent = true;
             }
         }
 
         /* Tell the read handler to read another header.  */
         s->reply.handle = 0;
+    } while (!(reply.flags & NBD_REPLY_FLAG_DONE));
+
+    if (ret == 0 && extent && !got_extent) {
+        ret = -EIO;
+    }
+    if (ret == 0 && structured && read_ranges &&
+        nbd_read_ranges_bytes(read_ranges) != request->len) {
+        ret = -EIO;
+    }
+
+out:
+    if (read_ranges) {
+        g_array_free(read_ranges, true);
     }
+    return ret;
 }
 
-static void nbd_coroutine_start(NbdClientSession *s,
+static void nbd_coroutine_start(NbdConnection *s,
    struct nbd_request *request)
 {
     /* Poor man semaphore.  The free_sema is locked when no other request
@@ -207,7 +431,7 @@ static void nbd_coroutine_start(NbdClientSession *s,
     /* s->recv_coroutine[i] is set as soon as we get the send_lock.  */
 }
 
-static void nbd_coroutine_end(NbdClientSession *s,
+static void nbd_coroutine_end(NbdConnection *s,
     struct nbd_request *request)
 {
     int i = HANDLE_TO_INDEX(s, request->handle);
@@ -217,65 +441,102 @@ static void nbd_coroutine_end(NbdClientSession *s,
     }
 }
 
-static int nbd_co_readv_1(BlockDriverState *bs, int64_t sector_num,
+/* Send a request without payload on S and wait for its reply */
+static int nbd_co_request(NbdConnection *s, struct nbd_request *request,
+                          NBDExtent *extent)
+{
+    int ret;
+
+    nbd_coroutine_start(s, request);
+    ret = nbd_co_send_request(s, request, NULL, 0);
+    if (ret >= 0) {
+        ret = nbd_co_receive_reply(s, request, NULL, 0, extent);
+    }
+    nbd_coroutine_end(s, request);
+    return ret;
+}
+
+/* Pick the live connection with the fewest requests in flight.  The search
+ * starts after the last connection picked, so that ties go round-robin.
+ */
+static NbdConnection *nbd_pick_connection(NbdClientSession *client)
+{
+    NbdConnection *best = NULL;
+    int i;
+
+    for (i = 0; i < client->num_conns; i++) {
+        NbdConnection *s;
+
+        s = &client->conns[(client->next_conn + i) % client->num_conns];
+        if (s->ioc && (!best || s->in_flight < best->in_flight)) {
+            best = s;
+        }
+    }
+
+    if (!best) {
+        /* Everything is closed, the request will fail with -EPIPE */
+        return &client->conns[0];
+    }
+    client->next_conn = (best - client->conns + 1) % client->num_conns;
+    return best;
+}
+
+static int nbd_co_readv_1(NbdConnection *s, int64_t sector_num,
                           int nb_sectors, QEMUIOVector *qiov,
                           int offset)
 {
-    NbdClientSession *client = nbd_get_client_session(bs);
     struct nbd_request request = { .type = NBD_CMD_READ };
-    struct nbd_reply reply;
     ssize_t ret;
 
     request.from = sector_num * 512;
     request.len = nb_sectors * 512;
 
-    nbd_coroutine_start(client, &request);
-    ret = nbd_co_send_request(bs, &request, NULL, 0);
-    if (ret < 0) {
-        reply.error = -ret;
-    } else {
-        nbd_co_receive_reply(client, &request, &reply, qiov, offset);
+    nbd_coroutine_start(s, &request);
+    ret = nbd_co_send_request(s, &request, NULL, 0);
+    if (ret >= 0) {
+        ret = nbd_co_receive_reply(s, &request, qiov, offset, NULL);
     }
-    nbd_coroutine_end(client, &request);
-    return -reply.error;
+    nbd_coroutine_end(s, &request);
+    return ret;
 
 }
 
-static int nbd_co_writev_1(BlockDriverState *bs, int64_t sector_num,
+static int nbd_co_writev_1(NbdConnection *s, int64_t sector_num,
                            int nb_sectors, QEMUIOVector *qiov,
-                           int offset, int *flags)
+                           int offset, uint32_t cmd_flags)
 {
-    NbdClientSession *client = nbd_get_client_session(bs);
-    struct nbd_request request = { .type = NBD_CMD_WRITE };
-    struct nbd_reply reply;
+    struct nbd_request request = { .type = NBD_CMD_WRITE | cmd_flags };
     ssize_t ret;
 
-    if ((*flags & BDRV_REQ_FUA) && (client->nbdflags & NBD_FLAG_SEND_FUA)) {
-        *flags &= ~BDRV_REQ_FUA;
-        request.type |= NBD_CMD_FLAG_FUA;
-    }
-
     request.from = sector_num * 512;
     request.len = nb_sectors * 512;
 
-    nbd_coroutine_start(client, &request);
-    ret = nbd_co_send_request(bs, &request, qiov, offset);
-    if (ret < 0) {
-        reply.error = -ret;
-    } else {
-        nbd_co_receive_reply(client, &request, &reply, NULL, 0);
+    nbd_coroutine_start(s, &request);
+    ret = nbd_co_send_request(s, &request, qiov, offset);
+    if (ret >= 0) {
+        ret = nbd_co_receive_reply(s, &request, NULL, 0, NULL);
     }
-    nbd_coroutine_end(client, &request);
-    return -reply.error;
+    nbd_coroutine_end(s, &request);
+    return ret;
 }
 
-int nbd_client_co_readv(BlockDriverState *bs, int64_t sector_num,
-                        int nb_sectors, QEMUIOVector *qiov)
+/* Read or write NB_SECTORS starting at SECTOR_NUM on S, using the part of
+ * QIOV that starts at OFFSET.
+ */
+static int nbd_co_rw(NbdConnection *s, int64_t sector_num, int nb_sectors,
+                     QEMUIOVector *qiov, int offset, bool is_write,
+                     uint32_t cmd_flags)
 {
-    int offset = 0;
     int ret;
+
     while (nb_sectors > NBD_MAX_SECTORS) {
-        ret = nbd_co_readv_1(bs, sector_num, NBD_MAX_SECTORS, qiov, offset);
+        if (is_write) {
+            ret = nbd_co_writev_1(s, sector_num, NBD_MAX_SECTORS, qiov,
+                                  offset, cmd_flags);
+        } else {
+            ret = nbd_co_readv_1(s, sector_num, NBD_MAX_SECTORS, qiov,
+                                 offset);
+        }
         if (ret < 0) {
             return ret;
         }
@@ -283,50 +544,174 @@ int nbd_client_co_readv(BlockDriverState *bs, int64_t sector_num,
         sector_num += NBD_MAX_SECTORS;
         nb_sectors -= NBD_MAX_SECTORS;
     }
-    return nbd_co_readv_1(bs, sector_num, nb_sectors, qiov, offset);
+
+    if (is_write) {
+        return nbd_co_writev_1(s, sector_num, nb_sectors, qiov, offset,
+                               cmd_flags);
+    } else {
+        return nbd_co_readv_1(s, sector_num, nb_sectors, qiov, offset);
+    }
+}
+
+typedef struct NbdStripe {
+    Coroutine *co;
+    int pending;
+    int ret;
+} NbdStripe;
+
+typedef struct NbdStripePart {
+    NbdStripe *stripe;
+    NbdConnection *conn;
+    int64_t sector_num;
+    int nb_sectors;
+    QEMUIOVector *qiov;
+    int offset;
+    bool is_write;
+    uint32_t cmd_flags;
+} NbdStripePart;
+
+static void coroutine_fn nbd_co_stripe_entry(void *opaque)
+{
+    NbdStripePart *part = opaque;
+    NbdStripe *stripe = part->stripe;
+    int ret;
+
+    ret = nbd_co_rw(part->conn, part->sector_num, part->nb_sectors,
+                    part->qiov, part->offset, part->is_write,
+                    part->cmd_flags);
+    if (ret < 0 && stripe->ret == 0) {
+        stripe->ret = ret;
+    }
+
+    if (--stripe->pending == 0) {
+        qemu_coroutine_enter(stripe->co, NULL);
+    }
+}
+
+/* Split a large request into one contiguous part per connection and wait
+ * for all of them.  Each part is issued from its own coroutine, so the
+ * connections send and receive in parallel.
+ */
+static int nbd_co_rw_striped(NbdClientSession *client, int64_t sector_num,
+                             int nb_sectors, QEMUIOVector *qiov,
+                             bool is_write, uint32_t cmd_flags)
+{
+    NbdStripe stripe = {
+        .co = qemu_coroutine_self(),
+        .pending = 1,
+    };
+    NbdStripePart parts[MAX_NBD_CONNECTIONS];
+    int part_sectors = DIV_ROUND_UP(nb_sectors, client->num_conns);
+    int offset = 0;
+    int i;
+
+    for (i = 0; i < client->num_conns && nb_sectors > 0; i++) {
+        Coroutine *co;
+
+        parts[i] = (NbdStripePart) {
+            .stripe     = &stripe,
+            .conn       = nbd_pick_connection(client),
+            .sector_num = sector_num,
+            .nb_sectors = MIN(nb_sectors, part_sectors),
+            .qiov       = qiov,
+            .offset     = offset,
+            .is_write   = is_write,
+            .cmd_flags  = cmd_flags,
+        };
+        sector_num += parts[i].nb_sectors;
+        nb_sectors -= parts[i].nb_sectors;
+        offset += parts[i].nb_sectors * 512;
+
+        stripe.pending++;
+        co = qemu_coroutine_create(nbd_co_stripe_entry);
+        qemu_coroutine_enter(co, &parts[i]);
+    }
+
+    /* Drop our own reference; the last part to finish wakes us up */
+    if (--stripe.pending > 0) {
+        qemu_coroutine_yield();
+    }
+    return stripe.ret;
+}
+
+static int nbd_client_co_rw(BlockDriverState *bs, int64_t sector_num,
+                            int nb_sectors, QEMUIOVector *qiov,
+                            bool is_write, uint32_t cmd_flags)
+{
+    NbdClientSession *client = nbd_get_client_session(bs);
+
+    if (client->num_conns > 1 && nb_sectors >= NBD_STRIPE_MIN_SECTORS) {
+        return nbd_co_rw_striped(client, sector_num, nb_sectors, qiov,
+                                 is_write, cmd_flags);
+    }
+    return nbd_co_rw(nbd_pick_connection(client), sector_num, nb_sectors,
+                     qiov, 0, is_write, cmd_flags);
+}
+
+int nbd_client_co_readv(BlockDriverState *bs, int64_t sector_num,
+                        int nb_sectors, QEMUIOVector *qiov)
+{
+    return nbd_client_co_rw(bs, sector_num, nb_sectors, qiov, false, 0);
 }
 
 int nbd_client_co_writev(BlockDriverState *bs, int64_t sector_num,
                          int nb_sectors, QEMUIOVector *qiov, int *flags)
 {
-    int offset = 0;
-    int ret;
-    while (nb_sectors > NBD_MAX_SECTORS) {
-        ret = nbd_co_writev_1(bs, sector_num, NBD_MAX_SECTORS, qiov, offset,
-                              flags);
-        if (ret < 0) {
-            return ret;
-        }
-        offset += NBD_MAX_SECTORS * 512;
-        sector_num += NBD_MAX_SECTORS;
-        nb_sectors -= NBD_MAX_SECTORS;
+    NbdClientSession *client = nbd_get_client_session(bs);
+    uint32_t cmd_flags = 0;
+
+    if ((*flags & BDRV_REQ_FUA) && (client->info.flags & NBD_FLAG_SEND_FUA)) {
+        *flags &= ~BDRV_REQ_FUA;
+        cmd_flags |= NBD_CMD_FLAG_FUA;
     }
-    return nbd_co_writev_1(bs, sector_num, nb_sectors, qiov, offset, flags);
+
+    return nbd_client_co_rw(bs, sector_num, nb_sectors, qiov, true,
+                            cmd_flags);
 }
 
 int nbd_client_co_flush(BlockDriverState *bs)
 {
     NbdClientSession *client = nbd_get_client_session(bs);
     struct nbd_request request = { .type = NBD_CMD_FLUSH };
-    struct nbd_reply reply;
-    ssize_t ret;
 
-    if (!(client->nbdflags & NBD_FLAG_SEND_FLUSH)) {
+    if (!(client->info.flags & NBD_FLAG_SEND_FLUSH)) {
         return 0;
     }
 
     request.from = 0;
     request.len = 0;
 
-    nbd_coroutine_start(client, &request);
-    ret = nbd_co_send_request(bs, &request, NULL, 0);
-    if (ret < 0) {
-        reply.error = -ret;
-    } else {
-        nbd_co_receive_reply(client, &request, &reply, NULL, 0);
+    /* The block layer only flushes after the writes it wants to persist
+     * have completed.  With several connections the server promised
+     * (NBD_FLAG_CAN_MULTI_CONN) that a flush on one of them covers writes
+     * completed on any of them, so one flush is enough.
+     */
+    return nbd_co_request(nbd_pick_connection(client), &request, NULL);
+}
+
+int nbd_client_co_write_zeroes(BlockDriverState *bs, int64_t sector_num,
+                               int nb_sectors, BdrvRequestFlags flags)
+{
+    NbdClientSession *client = nbd_get_client_session(bs);
+    struct nbd_request request = { .type = NBD_CMD_WRITE_ZEROES };
+
+    if (!(client->info.flags & NBD_FLAG_SEND_WRITE_ZEROES)) {
+        return -ENOTSUP;
     }
-    nbd_coroutine_end(client, &request);
-    return -reply.error;
+    if (flags & BDRV_REQ_NO_FALLBACK) {
+        if (!(client->info.flags & NBD_FLAG_SEND_FAST_ZERO)) {
+            return -ENOTSUP;
+        }
+        request.type |= NBD_CMD_FLAG_FAST_ZERO;
+    }
+    if (!(flags & BDRV_REQ_MAY_UNMAP)) {
+        request.type |= NBD_CMD_FLAG_NO_HOLE;
+    }
+
+    request.from = sector_num * BDRV_SECTOR_SIZE;
+    request.len = nb_sectors * BDRV_SECTOR_SIZE;
+
+    return nbd_co_request(nbd_pick_connection(client), &request, NULL);
 }
 
 int nbd_client_co_discard(BlockDriverState *bs, int64_t sector_num,
@@ -334,99 +719,213 @@ int nbd_client_co_discard(BlockDriverState *bs, int64_t sector_num,
 {
     NbdClientSession *client = nbd_get_client_session(bs);
     struct nbd_request request = { .type = NBD_CMD_TRIM };
-    struct nbd_reply reply;
-    ssize_t ret;
 
-    if (!(client->nbdflags & NBD_FLAG_SEND_TRIM)) {
+    if (!(client->info.flags & NBD_FLAG_SEND_TRIM)) {
         return 0;
     }
     request.from = sector_num * 512;
     request.len = nb_sectors * 512;
 
-    nbd_coroutine_start(client, &request);
-    ret = nbd_co_send_request(bs, &request, NULL, 0);
+    return nbd_co_request(nbd_pick_connection(client), &request, NULL);
+}
+
+int64_t nbd_client_co_get_block_status(BlockDriverState *bs,
+                                       int64_t sector_num,
+                                       int nb_sectors, int *pnum,
+                                       BlockDriverState **file)
+{
+    NbdClientSession *client = nbd_get_client_session(bs);
+    struct nbd_request request = {
+        .type = NBD_CMD_BLOCK_STATUS | NBD_CMD_FLAG_REQ_ONE,
+    };
+    NBDExtent extent;
+    int64_t ret;
+
+    if (!client->info.base_allocation) {
+        *pnum = nb_sectors;
+        return BDRV_BLOCK_DATA;
+    }
+
+    request.from = sector_num * 512;
+    request.len = MIN(nb_sectors, NBD_MAX_STATUS_SECTORS) * 512;
+
+    ret = nbd_co_request(nbd_pick_connection(client), &request, &extent);
     if (ret < 0) {
-        reply.error = -ret;
-    } else {
-        nbd_co_receive_reply(client, &request, &reply, NULL, 0);
+        return ret;
     }
-    nbd_coroutine_end(client, &request);
-    return -reply.error;
 
+    /* The rest of a partial sector may differ, so call it data */
+    *pnum = MIN(extent.length, request.len) / 512;
+    if (*pnum == 0) {
+        *pnum = 1;
+        return BDRV_BLOCK_DATA;
+    }
+    return (extent.flags & NBD_STATE_HOLE ? 0 : BDRV_BLOCK_DATA) |
+           (extent.flags & NBD_STATE_ZERO ? BDRV_BLOCK_ZERO : 0);
 }
 
 void nbd_client_detach_aio_context(BlockDriverState *bs)
 {
-    aio_set_fd_handler(bdrv_get_aio_context(bs),
-                       nbd_get_client_session(bs)->sioc->fd,
-                       false, NULL, NULL, NULL);
+    NbdClientSession *client = nbd_get_client_session(bs);
+    int i;
+
+    for (i = 0; i < client->num_conns; i++) {
+        if (client->conns[i].ioc) {
+            nbd_connection_detach_aio_context(&client->conns[i]);
+        }
+    }
 }
 
 void nbd_client_attach_aio_context(BlockDriverState *bs,
                                    AioContext *new_context)
 {
-    aio_set_fd_handler(new_context, nbd_get_client_session(bs)->sioc->fd,
-                       false, nbd_reply_ready, NULL, bs);
+    NbdClientSession *client = nbd_get_client_session(bs);
+    int i;
+
+    for (i = 0; i < client->num_conns; i++) {
+        NbdConnection *s = &client->conns[i];
+
+        if (s->ioc) {
+            aio_set_fd_handler(new_context, s->sioc->fd,
+                               false, nbd_reply_ready, NULL, s);
+        }
+    }
 }
 
-void nbd_client_close(BlockDriverState *bs)
+static void nbd_connection_close(NbdConnection *s)
 {
-    NbdClientSession *client = nbd_get_client_session(bs);
     struct nbd_request request = {
         .type = NBD_CMD_DISC,
         .from = 0,
         .len = 0
     };
 
-    if (client->ioc == NULL) {
+    if (s->ioc == NULL) {
         return;
     }
 
-    nbd_send_request(client->ioc, &request);
+    nbd_send_request(s->ioc, &request);
 
-    nbd_teardown_connection(bs);
+    nbd_teardown_connection(s);
 }
 
-int nbd_client_init(BlockDriverState *bs,
-                    QIOChannelSocket *sioc,
-                    const char *export,
-                    QCryptoTLSCreds *tlscreds,
-                    const char *hostname,
-                    Error **errp)
+void nbd_client_close(BlockDriverState *bs)
 {
     NbdClientSession *client = nbd_get_client_session(bs);
+    int i;
+
+    for (i = 0; i < client->num_conns; i++) {
+        nbd_connection_close(&client->conns[i]);
+    }
+}
+
+static int nbd_connection_init(NbdConnection *s,
+                               BlockDriverState *bs,
+                               QIOChannelSocket *sioc,
+                               const char *export,
+                               QCryptoTLSCreds *tlscreds,
+                               const char *hostname,
+                               Error **errp)
+{
     int ret;
 
     /* NBD handshake */
     logout("session init %s\n", export);
     qio_channel_set_blocking(QIO_CHANNEL(sioc), true, NULL);
 
+    s->info.request_structured = true;
     ret = nbd_receive_negotiate(QIO_CHANNEL(sioc), export,
-                                &client->nbdflags,
                                 tlscreds, hostname,
-                                &client->ioc,
-                                &client->size, errp);
+                                &s->ioc,
+                                &s->info, errp);
     if (ret < 0) {
         logout("Failed to negotiate with the NBD server\n");
         return ret;
     }
 
-    qemu_co_mutex_init(&client->send_mutex);
-    qemu_co_mutex_init(&client->free_sema);
-    client->sioc = sioc;
-    object_ref(OBJECT(client->sioc));
+    qemu_co_mutex_init(&s->send_mutex);
+    qemu_co_mutex_init(&s->free_sema);
+    s->bs = bs;
+    s->sioc = sioc;
+    object_ref(OBJECT(s->sioc));
 
-    if (!client->ioc) {
-        client->ioc = QIO_CHANNEL(sioc);
-        object_ref(OBJECT(client->ioc));
+    if (!s->ioc) {
+        s->ioc = QIO_CHANNEL(sioc);
+        object_ref(OBJECT(s->ioc));
     }
 
     /* Now that we're connected, set the socket to be non-blocking and
      * kick the reply mechanism.  */
     qio_channel_set_blocking(QIO_CHANNEL(sioc), false, NULL);
 
-    nbd_client_attach_aio_context(bs, bdrv_get_aio_context(bs));
+    aio_set_fd_handler(bdrv_get_aio_context(bs), sioc->fd,
+                       false, nbd_reply_ready, NULL, s);
 
     logout("Established connection with NBD server\n");
     return 0;
 }
+
+int nbd_client_init(BlockDriverState *bs,
+                    QIOChannelSocket *sioc,
+                    const char *export,
+                    QCryptoTLSCreds *tlscreds,
+                    const char *hostname,
+                    Error **errp)
+{
+    NbdClientSession *client = nbd_get_client_session(bs);
+    int ret;
+
+    ret = nbd_connection_init(&client->conns[0], bs, sioc, export,
+                              tlscreds, hostname, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    client->num_conns = 1;
+    client->next_conn = 0;
+    client->info = client->conns[0].info;
+    return 0;
+}
+
+/* Open another connection to the export that nbd_client_init() connected
+ * to.  The server must have advertised NBD_FLAG_CAN_MULTI_CONN.
+ */
+int nbd_client_add_connection(BlockDriverState *bs,
+                              QIOChannelSocket *sioc,
+                              const char *export,
+                              QCryptoTLSCreds *tlscreds,
+                              const char *hostname,
+                              Error **errp)
+{
+    NbdClientSession *client = nbd_get_client_session(bs);
+    NbdConnection *s;
+    int ret;
+
+    if (!(client->info.flags & NBD_FLAG_CAN_MULTI_CONN)) {
+        error_setg(errp, "Server does not support multiple connections");
+        return -EINVAL;
+    }
+    if (client->num_conns == MAX_NBD_CONNECTIONS) {
+        error_setg(errp, "Too many connections (max %d)",
+                   MAX_NBD_CONNECTIONS);
+        return -EINVAL;
+    }
+
+    s = &client->conns[client->num_conns];
+    ret = nbd_connection_init(s, bs, sioc, export, tlscreds, hostname, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (s->info.size != client->info.size ||
+        s->info.flags != client->info.flags ||
+        s->info.structured_reply != client->info.structured_reply ||
+        s->info.base_allocation != client->info.base_allocation) {
+        error_setg(errp, "Export changed between connections");
+        nbd_connection_close(s);
+        return -EINVAL;
+    }
+
+    client->num_conns++;
+    return 0;
+}
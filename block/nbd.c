@@ -234,6 +234,20 @@ static SocketAddress *nbd_config(BDRVNBDState *s, QDict *options, char **export,
     return saddr;
 }
 
+static QemuOptsList runtime_opts = {
+    .name = "nbd",
+    .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
+    .desc = {
+        {
+            .name = "connections",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of connections to open if the server allows "
+                    "more than one (default: 1)",
+        },
+        { /* end of list */ }
+    },
+};
+
 NbdClientSession *nbd_get_client_session(BlockDriverState *bs)
 {
     BDRVNBDState *s = bs->opaque;
@@ -302,8 +316,26 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
     const char *tlscredsid;
     QCryptoTLSCreds *tlscreds = NULL;
     const char *hostname = NULL;
+    QemuOpts *opts;
+    Error *local_err = NULL;
+    uint64_t connections;
     int ret = -EINVAL;
 
+    opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+    qemu_opts_absorb_qdict(opts, options, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+    connections = qemu_opt_get_number(opts, "connections", 1);
+    qemu_opts_del(opts);
+    if (connections < 1 || connections > MAX_NBD_CONNECTIONS) {
+        error_setg(errp, "connections must be between 1 and %d",
+                   MAX_NBD_CONNECTIONS);
+        return -EINVAL;
+    }
+
     /* Pop the config into our state object. Exit if invalid. */
     saddr = nbd_config(s, options, &export, errp);
     if (!saddr) {
@@ -337,6 +369,32 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
     /* NBD handshake */
     ret = nbd_client_init(bs, sioc, export,
                           tlscreds, hostname, errp);
+    if (ret < 0) {
+        goto error;
+    }
+
+    /* Only open more connections if the server says that they see each
+     * other's writes and flushes; otherwise quietly stay with one.
+     */
+    if (!(s->client.info.flags & NBD_FLAG_CAN_MULTI_CONN)) {
+        connections = 1;
+    }
+    while (s->client.num_conns < connections) {
+        object_unref(OBJECT(sioc));
+        sioc = nbd_establish_connection(saddr, errp);
+        if (!sioc) {
+            nbd_client_close(bs);
+            ret = -ECONNREFUSED;
+            goto error;
+        }
+        ret = nbd_client_add_connection(bs, sioc, export,
+                                        tlscreds, hostname, errp);
+        if (ret < 0) {
+            nbd_client_close(bs);
+            goto error;
+        }
+    }
+
  error:
     if (sioc) {
         object_unref(OBJECT(sioc));
@@ -385,9 +443,18 @@ static int nbd_co_flush(BlockDriverState *bs)
     return nbd_client_co_flush(bs);
 }
 
+static int coroutine_fn nbd_co_write_zeroes(BlockDriverState *bs,
+                                            int64_t sector_num,
+                                            int nb_sectors,
+                                            BdrvRequestFlags flags)
+{
+    return nbd_client_co_write_zeroes(bs, sector_num, nb_sectors, flags);
+}
+
 static void nbd_refresh_limits(BlockDriverState *bs, Error **errp)
 {
     bs->bl.max_discard = UINT32_MAX >> BDRV_SECTOR_BITS;
+    bs->bl.max_write_zeroes = UINT32_MAX >> BDRV_SECTOR_BITS;
     bs->bl.max_transfer_length = UINT32_MAX >> BDRV_SECTOR_BITS;
 }
 
@@ -397,6 +464,15 @@ static int nbd_co_discard(BlockDriverState *bs, int64_t sector_num,
     return nbd_client_co_discard(bs, sector_num, nb_sectors);
 }
 
+static int64_t coroutine_fn nbd_co_get_block_status(BlockDriverState *bs,
+                                                    int64_t sector_num,
+                                                    int nb_sectors, int *pnum,
+                                                    BlockDriverState **file)
+{
+    return nbd_client_co_get_block_status(bs, sector_num, nb_sectors, pnum,
+                                          file);
+}
+
 static void nbd_close(BlockDriverState *bs)
 {
     nbd_client_close(bs);
@@ -406,7 +482,7 @@ static int64_t nbd_getlength(BlockDriverState *bs)
 {
     BDRVNBDState *s = bs->opaque;
 
-    return s->client.size;
+    return s->client.info.size;
 }
 
 static void nbd_detach_aio_context(BlockDriverState *bs)
@@ -428,6 +504,7 @@ static void nbd_refresh_filename(BlockDriverState *bs, QDict *options)
     const char *port   = qdict_get_try_str(options, "port");
     const char *export = qdict_get_try_str(options, "export");
     const char *tlscreds = qdict_get_try_str(options, "tls-creds");
+    QObject *connections = qdict_get(options, "connections");
 
     qdict_put_obj(opts, "driver", QOBJECT(qstring_from_str("nbd")));
 
@@ -465,6 +542,10 @@ static void nbd_refresh_filename(BlockDriverState *bs, QDict *options)
     if (tlscreds) {
         qdict_put_obj(opts, "tls-creds", QOBJECT(qstring_from_str(tlscreds)));
     }
+    if (connections) {
+        qobject_incref(connections);
+        qdict_put_obj(opts, "connections", connections);
+    }
 
     bs->full_open_options = opts;
 }
@@ -481,7 +562,9 @@ static BlockDriver bdrv_nbd = {
     .supported_write_flags      = BDRV_REQ_FUA,
     .bdrv_close                 = nbd_close,
     .bdrv_co_flush_to_os        = nbd_co_flush,
+    .bdrv_co_write_zeroes       = nbd_co_write_zeroes,
     .bdrv_co_discard            = nbd_co_discard,
+    .bdrv_co_get_block_status   = nbd_co_get_block_status,
     .bdrv_refresh_limits        = nbd_refresh_limits,
     .bdrv_getlength             = nbd_getlength,
     .bdrv_detach_aio_context    = nbd_detach_aio_context,
@@ -501,7 +584,9 @@ static BlockDriver bdrv_nbd_tcp = {
     .supported_write_flags      = BDRV_REQ_FUA,
     .bdrv_close                 = nbd_close,
     .bdrv_co_flush_to_os        = nbd_co_flush,
+    .bdrv_co_write_zeroes       = nbd_co_write_zeroes,
     .bdrv_co_discard            = nbd_co_discard,
+    .bdrv_co_get_block_status   = nbd_co_get_block_status,
     .bdrv_refresh_limits        = nbd_refresh_limits,
     .bdrv_getlength             = nbd_getlength,
     .bdrv_detach_aio_context    = nbd_detach_aio_context,
@@ -521,7 +606,9 @@ static BlockDriver bdrv_nbd_unix = {
     .supported_write_flags      = BDRV_REQ_FUA,
     .bdrv_close                 = nbd_close,
     .bdrv_co_flush_to_os        = nbd_co_flush,
+    .bdrv_co_write_zeroes       = nbd_co_write_zeroes,
     .bdrv_co_discard            = nbd_co_discard,
+    .bdrv_co_get_block_status   = nbd_co_get_block_status,
     .bdrv_refresh_limits        = nbd_refresh_limits,
     .bdrv_getlength             = nbd_getlength,
     .bdrv_detach_aio_context    = nbd_detach_aio_context,
@@ -119,6 +119,9 @@ BlockDeviceInfo *bdrv_block_device_info(BlockBackend *blk,
 
         info->has_group = true;
         info->group = g_strdup(throttle_group_get_name(bs));
+
+        info->has_latency_target = cfg.latency_target;
+        info->latency_target = cfg.latency_target;
     }
 
     info->write_threshold = bdrv_write_threshold_get(bs);
@@ -361,6 +364,36 @@ static BlockStats *bdrv_query_stats(BlockBackend *blk,
                                     const BlockDriverState *bs,
                                     bool query_backing);
 
+static BlockLatencyHistogramInfo *
+bdrv_latency_histogram_stats(BlockLatencyHistogram *hist)
+{
+    BlockLatencyHistogramInfo *info;
+    uint64List **p;
+    unsigned i;
+
+    if (!hist->bins) {
+        return NULL;
+    }
+
+    info = g_new0(BlockLatencyHistogramInfo, 1);
+
+    p = &info->boundaries;
+    for (i = 0; i < hist->nbins - 1; i++) {
+        *p = g_new0(uint64List, 1);
+        (*p)->value = hist->boundaries[i];
+        p = &(*p)->next;
+    }
+
+    p = &info->bins;
+    for (i = 0; i < hist->nbins; i++) {
+        *p = g_new0(uint64List, 1);
+        (*p)->value = hist->bins[i];
+        p = &(*p)->next;
+    }
+
+    return info;
+}
+
 static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
 {
     BlockAcctStats *stats = blk_get_stats(blk);
@@ -426,6 +459,16 @@ static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
         dev_stats->avg_wr_queue_depth =
             block_acct_queue_depth(ts, BLOCK_ACCT_WRITE);
     }
+
+    ds->rd_latency_histogram = bdrv_latency_histogram_stats(
+        &stats->latency_histogram[BLOCK_ACCT_READ]);
+    ds->has_rd_latency_histogram = ds->rd_latency_histogram != NULL;
+    ds->wr_latency_histogram = bdrv_latency_histogram_stats(
+        &stats->latency_histogram[BLOCK_ACCT_WRITE]);
+    ds->has_wr_latency_histogram = ds->wr_latency_histogram != NULL;
+    ds->flush_latency_histogram = bdrv_latency_histogram_stats(
+        &stats->latency_histogram[BLOCK_ACCT_FLUSH]);
+    ds->has_flush_latency_histogram = ds->flush_latency_histogram != NULL;
 }
 
 static void bdrv_query_bds_stats(BlockStats *s, const BlockDriverState *bs,
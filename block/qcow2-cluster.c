@@ -844,6 +844,21 @@ err:
     return ret;
  }
 
+/*
+ * Frees the clusters allocated for a request that failed before they could
+ * be linked into the L2 table.
+ */
+void qcow2_alloc_cluster_abort(BlockDriverState *bs, QCowL2Meta *m)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (m->nb_clusters != 0) {
+        qcow2_free_clusters(bs, m->alloc_offset,
+                            (int64_t)m->nb_clusters << s->cluster_bits,
+                            QCOW2_DISCARD_NEVER);
+    }
+}
+
 /*
  * Returns the number of contiguous clusters that can be used for an allocating
  * write, but require COW to be performed (this includes yet unallocated space,
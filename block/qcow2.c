@@ -1682,6 +1682,193 @@ fail:
     return ret;
 }
 
+static coroutine_fn int qcow2_co_copy_range_from(BlockDriverState *bs,
+    int64_t src_sector, BlockDriverState *dst, int64_t dst_sector,
+    int nb_sectors, BdrvRequestFlags flags)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int index_in_cluster;
+    int ret;
+    int cur_nr_sectors; /* number of sectors in current iteration */
+    uint64_t cluster_offset = 0;
+
+    if (bs->encrypted) {
+        return -ENOTSUP;
+    }
+
+    qemu_co_mutex_lock(&s->lock);
+
+    while (nb_sectors != 0) {
+        cur_nr_sectors = nb_sectors;
+        ret = qcow2_get_cluster_offset(bs, src_sector << 9,
+            &cur_nr_sectors, &cluster_offset);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        index_in_cluster = src_sector & (s->cluster_sectors - 1);
+
+        qemu_co_mutex_unlock(&s->lock);
+        switch (ret) {
+        case QCOW2_CLUSTER_UNALLOCATED:
+            if (bs->backing) {
+                /* Reads after the end of the backing file return zeroes,
+                 * leave that to the bounce buffer path */
+                if (src_sector + cur_nr_sectors >
+                    bs->backing->bs->total_sectors) {
+                    ret = -ENOTSUP;
+                    break;
+                }
+                ret = bdrv_co_copy_range_from(bs->backing->bs, src_sector,
+                                              dst, dst_sector, cur_nr_sectors,
+                                              flags);
+                break;
+            }
+            /* fall through */
+
+        case QCOW2_CLUSTER_ZERO:
+            ret = bdrv_co_write_zeroes(dst, dst_sector, cur_nr_sectors, 0);
+            break;
+
+        case QCOW2_CLUSTER_COMPRESSED:
+            ret = -ENOTSUP;
+            break;
+
+        case QCOW2_CLUSTER_NORMAL:
+            if ((cluster_offset & 511) != 0) {
+                ret = -EIO;
+                break;
+            }
+            ret = bdrv_co_copy_range_from(bs->file->bs,
+                                          (cluster_offset >> 9) +
+                                          index_in_cluster,
+                                          dst, dst_sector, cur_nr_sectors,
+                                          flags);
+            break;
+
+        default:
+            g_assert_not_reached();
+            ret = -EIO;
+            break;
+        }
+        qemu_co_mutex_lock(&s->lock);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        nb_sectors -= cur_nr_sectors;
+        src_sector += cur_nr_sectors;
+        dst_sector += cur_nr_sectors;
+    }
+    ret = 0;
+
+fail:
+    qemu_co_mutex_unlock(&s->lock);
+    return ret;
+}
+
+static coroutine_fn int qcow2_co_copy_range_to(BlockDriverState *bs,
+    BlockDriverState *src, int64_t src_sector, int64_t dst_sector,
+    int nb_sectors, BdrvRequestFlags flags)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int index_in_cluster;
+    int ret;
+    int cur_nr_sectors; /* number of sectors in current iteration */
+    uint64_t cluster_offset;
+    QCowL2Meta *l2meta = NULL;
+
+    /* Don't allocate clusters if the protocol layer cannot possibly do
+     * the copy. */
+    if (bs->encrypted || src->drv != bs->file->bs->drv ||
+        !bs->file->bs->drv->bdrv_co_copy_range_to) {
+        return -ENOTSUP;
+    }
+
+    s->cluster_cache_offset = -1; /* disable compressed cache */
+
+    qemu_co_mutex_lock(&s->lock);
+
+    while (nb_sectors != 0) {
+
+        l2meta = NULL;
+
+        index_in_cluster = dst_sector & (s->cluster_sectors - 1);
+        cur_nr_sectors = nb_sectors;
+
+        ret = qcow2_alloc_cluster_offset(bs, dst_sector << 9,
+            &cur_nr_sectors, &cluster_offset, &l2meta);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        assert((cluster_offset & 511) == 0);
+
+        ret = qcow2_pre_write_overlap_check(bs, 0,
+                cluster_offset + index_in_cluster * BDRV_SECTOR_SIZE,
+                cur_nr_sectors * BDRV_SECTOR_SIZE);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        qemu_co_mutex_unlock(&s->lock);
+        BLKDBG_EVENT(bs->file, BLKDBG_WRITE_AIO);
+        ret = bdrv_co_copy_range_to(bs->file->bs, src, src_sector,
+                                    (cluster_offset >> 9) + index_in_cluster,
+                                    cur_nr_sectors, flags);
+        qemu_co_mutex_lock(&s->lock);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        while (l2meta != NULL) {
+            QCowL2Meta *next;
+
+            ret = qcow2_alloc_cluster_link_l2(bs, l2meta);
+            if (ret < 0) {
+                goto fail;
+            }
+
+            /* Take the request off the list of running requests */
+            if (l2meta->nb_clusters != 0) {
+                QLIST_REMOVE(l2meta, next_in_flight);
+            }
+
+            qemu_co_queue_restart_all(&l2meta->dependent_requests);
+
+            next = l2meta->next;
+            g_free(l2meta);
+            l2meta = next;
+        }
+
+        nb_sectors -= cur_nr_sectors;
+        src_sector += cur_nr_sectors;
+        dst_sector += cur_nr_sectors;
+    }
+    ret = 0;
+
+fail:
+    /* Clusters that did not make it into the L2 table are unused, give
+     * them back instead of leaking them. */
+    while (l2meta != NULL) {
+        QCowL2Meta *next;
+
+        qcow2_alloc_cluster_abort(bs, l2meta);
+        if (l2meta->nb_clusters != 0) {
+            QLIST_REMOVE(l2meta, next_in_flight);
+        }
+        qemu_co_queue_restart_all(&l2meta->dependent_requests);
+
+        next = l2meta->next;
+        g_free(l2meta);
+        l2meta = next;
+    }
+
+    qemu_co_mutex_unlock(&s->lock);
+
+    return ret;
+}
+
 static int qcow2_inactivate(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -3335,6 +3522,8 @@ BlockDriver bdrv_qcow2 = {
 
     .bdrv_co_write_zeroes   = qcow2_co_write_zeroes,
     .bdrv_co_discard        = qcow2_co_discard,
+    .bdrv_co_copy_range_from = qcow2_co_copy_range_from,
+    .bdrv_co_copy_range_to  = qcow2_co_copy_range_to,
     .bdrv_truncate          = qcow2_truncate,
     .bdrv_write_compressed  = qcow2_write_compressed,
     .bdrv_make_empty        = qcow2_make_empty,
@@ -147,6 +147,22 @@ static int coroutine_fn raw_co_discard(BlockDriverState *bs,
     return bdrv_co_discard(bs->file->bs, sector_num, nb_sectors);
 }
 
+static int coroutine_fn raw_co_copy_range_from(BlockDriverState *bs,
+    int64_t src_sector, BlockDriverState *dst, int64_t dst_sector,
+    int nb_sectors, BdrvRequestFlags flags)
+{
+    return bdrv_co_copy_range_from(bs->file->bs, src_sector, dst, dst_sector,
+                                   nb_sectors, flags);
+}
+
+static int coroutine_fn raw_co_copy_range_to(BlockDriverState *bs,
+    BlockDriverState *src, int64_t src_sector, int64_t dst_sector,
+    int nb_sectors, BdrvRequestFlags flags)
+{
+    return bdrv_co_copy_range_to(bs->file->bs, src, src_sector, dst_sector,
+                                 nb_sectors, flags);
+}
+
 static int64_t raw_getlength(BlockDriverState *bs)
 {
     return bdrv_getlength(bs->file->bs);
@@ -261,6 +277,8 @@ BlockDriver bdrv_raw = {
     .supported_write_flags = BDRV_REQ_FUA,
     .bdrv_co_write_zeroes = &raw_co_write_zeroes,
     .bdrv_co_discard      = &raw_co_discard,
+    .bdrv_co_copy_range_from = &raw_co_copy_range_from,
+    .bdrv_co_copy_range_to = &raw_co_copy_range_to,
     .bdrv_co_get_block_status = &raw_co_get_block_status,
     .bdrv_truncate        = &raw_truncate,
     .bdrv_getlength       = &raw_getlength,
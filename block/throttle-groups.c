@@ -26,7 +26,15 @@
 #include "block/throttle-groups.h"
 #include "qemu/queue.h"
 #include "qemu/thread.h"
+#include "qemu/atomic.h"
 #include "sysemu/qtest.h"
+#include "trace.h"
+
+/* Part of the free bucket space that a member reserves for itself */
+#define THROTTLE_GROUP_CREDIT_FRACTION 0.125
+
+/* How often the rates are adjusted to meet the latency target */
+#define THROTTLE_GROUP_LATENCY_WINDOW_NS (100 * SCALE_MS)
 
 /* The ThrottleGroup structure (with its ThrottleState) is shared
  * among different BlockDriverState and it's independent from
@@ -51,16 +59,35 @@
  * bdrv_set_aio_context()). Therefore in this file a thread will
  * access some other BDS's timers only after verifying that that BDS
  * has throttled requests in the queue.
+ *
+ * As long as no member of the group is being throttled, the lock is
+ * mostly avoided: every time a BDS takes it, it also reserves part of
+ * the free bucket space for itself (a ThrottleCredit), and its next
+ * requests are accounted against that credit from its own AioContext.
+ * What is left of the credit is given back the next time the BDS takes
+ * the lock.  Reading 'any_timer_armed' without the lock can let one
+ * request per BDS through just after another member got throttled,
+ * which is not a problem since the space it uses was already reserved.
  */
 typedef struct ThrottleGroup {
     char *name; /* This is constant during the lifetime of the group */
 
-    QemuMutex lock; /* This lock protects the following four fields */
+    QemuMutex lock; /* This lock protects the following fields */
     ThrottleState ts;
     QLIST_HEAD(, BlockDriverState) head;
     BlockDriverState *tokens[2];
     bool any_timer_armed[2];
 
+    /* Completed requests since latency_window_start, for the latency
+     * target */
+    int64_t latency_window_start;
+    uint64_t latency_ops;
+    uint64_t latency_total_ns;
+
+    /* Credits reserved with a different generation are not valid anymore.
+     * This and any_timer_armed are also read without the lock. */
+    unsigned credit_generation;
+
     /* These two are protected by the global throttle_groups_lock */
     unsigned refcount;
     QTAILQ_ENTRY(ThrottleGroup) list;
@@ -273,6 +300,71 @@ static void schedule_next_request(BlockDriverState *bs, bool is_write)
     }
 }
 
+/* Give back what is left of the credit of a BlockDriverState.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @bs:        the current BlockDriverState
+ * @is_write:  the type of operation (read/write)
+ */
+static void throttle_group_release_credit(BlockDriverState *bs,
+                                          bool is_write)
+{
+    ThrottleGroup *tg = container_of(bs->throttle_state, ThrottleGroup, ts);
+    ThrottleCredit *credit = &bs->throttle_credit[is_write];
+
+    if (bs->throttle_credit_generation[is_write] == tg->credit_generation) {
+        throttle_release(&tg->ts, is_write, credit);
+    } else {
+        /* The buckets have been reset since the credit was reserved */
+        memset(credit, 0, sizeof(*credit));
+    }
+}
+
+/* Add the latency of the requests that a BlockDriverState completed to
+ * the group, and adjust the rates of the group to the latency target
+ * once per window.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @bs:  the current BlockDriverState
+ */
+static void throttle_group_update_latency(BlockDriverState *bs)
+{
+    ThrottleGroup *tg = container_of(bs->throttle_state, ThrottleGroup, ts);
+    ThrottleState *ts = &tg->ts;
+    uint64_t latency_ns;
+    int64_t now;
+
+    /* Drop the counts even without a target, so that the first window
+     * after setting one only covers recent requests */
+    if (ts->cfg.latency_target) {
+        tg->latency_ops += bs->throttle_latency_ops;
+        tg->latency_total_ns += bs->throttle_latency_ns;
+    }
+    bs->throttle_latency_ops = 0;
+    bs->throttle_latency_ns = 0;
+    if (!ts->cfg.latency_target) {
+        return;
+    }
+
+    now = qemu_clock_get_ns(bs->throttle_timers.clock_type);
+    if (now - tg->latency_window_start < THROTTLE_GROUP_LATENCY_WINDOW_NS) {
+        return;
+    }
+
+    if (tg->latency_ops) {
+        latency_ns = tg->latency_total_ns / tg->latency_ops;
+        throttle_update_scale(ts, latency_ns);
+        trace_throttle_group_update_latency(tg, latency_ns,
+                                            ts->scale * 100);
+    }
+
+    tg->latency_window_start = now;
+    tg->latency_ops = 0;
+    tg->latency_total_ns = 0;
+}
+
 /* Check if an I/O request needs to be throttled, wait and set a timer
  * if necessary, and schedule the next request using a round robin
  * algorithm.
@@ -280,17 +372,32 @@ static void schedule_next_request(BlockDriverState *bs, bool is_write)
  * @bs:        the current BlockDriverState
  * @bytes:     the number of bytes for this I/O
  * @is_write:  the type of operation (read/write)
+ * @ret:       the time at which the request was let through, to be
+ *             passed to throttle_group_co_io_done()
  */
-void coroutine_fn throttle_group_co_io_limits_intercept(BlockDriverState *bs,
-                                                        unsigned int bytes,
-                                                        bool is_write)
+int64_t coroutine_fn throttle_group_co_io_limits_intercept(
+    BlockDriverState *bs, unsigned int bytes, bool is_write)
 {
     bool must_wait;
     BlockDriverState *token;
 
     ThrottleGroup *tg = container_of(bs->throttle_state, ThrottleGroup, ts);
+
+    /* Nobody is throttled and the credit of bs covers this request */
+    if (!bs->pending_reqs[is_write] &&
+        !atomic_read(&tg->any_timer_armed[is_write]) &&
+        bs->throttle_credit_generation[is_write] ==
+        atomic_read(&tg->credit_generation) &&
+        throttle_credit_consume(&bs->throttle_credit[is_write], bytes)) {
+        return qemu_clock_get_ns(bs->throttle_timers.clock_type);
+    }
+
     qemu_mutex_lock(&tg->lock);
 
+    /* The buckets must be exact to decide whether to wait */
+    throttle_group_release_credit(bs, is_write);
+    throttle_group_update_latency(bs);
+
     /* First we check if this I/O has to be throttled. */
     token = next_throttle_token(bs, is_write);
     must_wait = throttle_group_schedule_timer(token, is_write);
@@ -310,7 +417,32 @@ void coroutine_fn throttle_group_co_io_limits_intercept(BlockDriverState *bs,
     /* Schedule the next request */
     schedule_next_request(bs, is_write);
 
+    /* Let the next requests of bs through without the lock, unless that
+     * would have to be fair to requests that are waiting */
+    if (!tg->any_timer_armed[is_write] && !bs->pending_reqs[is_write]) {
+        throttle_reserve(&tg->ts, is_write, THROTTLE_GROUP_CREDIT_FRACTION,
+                         &bs->throttle_credit[is_write]);
+        bs->throttle_credit_generation[is_write] = tg->credit_generation;
+    }
+
     qemu_mutex_unlock(&tg->lock);
+    return qemu_clock_get_ns(bs->throttle_timers.clock_type);
+}
+
+/* Record the completion of a request that was let through by
+ * throttle_group_co_io_limits_intercept().  The time spent waiting in
+ * the throttle queue is not part of the latency, otherwise the latency
+ * target would keep lowering the rates of a group that is limited by
+ * its own configuration.
+ *
+ * @bs:        the current BlockDriverState
+ * @start_ns:  the value returned by throttle_group_co_io_limits_intercept()
+ */
+void throttle_group_co_io_done(BlockDriverState *bs, int64_t start_ns)
+{
+    bs->throttle_latency_ops++;
+    bs->throttle_latency_ns +=
+        qemu_clock_get_ns(bs->throttle_timers.clock_type) - start_ns;
 }
 
 /* Update the throttle configuration for a particular group. Similar
@@ -334,6 +466,11 @@ void throttle_group_config(BlockDriverState *bs, ThrottleConfig *cfg)
         tg->any_timer_armed[1] = false;
     }
     throttle_config(ts, tt, cfg);
+    /* throttle_config() resets the buckets, drop all credits */
+    atomic_inc(&tg->credit_generation);
+    tg->latency_window_start = qemu_clock_get_ns(tt->clock_type);
+    tg->latency_ops = 0;
+    tg->latency_total_ns = 0;
     qemu_mutex_unlock(&tg->lock);
 }
 
@@ -456,6 +593,7 @@ void throttle_group_unregister_bs(BlockDriverState *bs)
 
     qemu_mutex_lock(&tg->lock);
     for (i = 0; i < 2; i++) {
+        throttle_group_release_credit(bs, i);
         if (tg->tokens[i] == bs) {
             BlockDriverState *token = throttle_group_next_bs(bs);
             /* Take care of the case where this is the last bs in the group */
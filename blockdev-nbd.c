@@ -176,8 +176,9 @@ void qmp_nbd_server_add(const char *device, bool has_writable, bool writable,
         writable = false;
     }
 
-    exp = nbd_export_new(blk, 0, -1, writable ? 0 : NBD_FLAG_READ_ONLY, NULL,
-                         errp);
+    /* The server accepts any number of clients */
+    exp = nbd_export_new(blk, 0, -1, NBD_FLAG_CAN_MULTI_CONN |
+                         (writable ? 0 : NBD_FLAG_READ_ONLY), NULL, errp);
     if (!exp) {
         return;
     }
@@ -375,6 +375,8 @@ static void extract_common_blockdev_options(QemuOpts *opts, int *bdrv_flags,
         if ((aio = qemu_opt_get(opts, "aio")) != NULL) {
             if (!strcmp(aio, "native")) {
                 *bdrv_flags |= BDRV_O_NATIVE_AIO;
+            } else if (!strcmp(aio, "io_uring")) {
+                *bdrv_flags |= BDRV_O_IO_URING;
             } else if (!strcmp(aio, "threads")) {
                 /* this is the default */
             } else {
@@ -432,6 +434,8 @@ static void extract_common_blockdev_options(QemuOpts *opts, int *bdrv_flags,
 
         throttle_cfg->op_size =
             qemu_opt_get_number(opts, "throttling.iops-size", 0);
+        throttle_cfg->latency_target =
+            qemu_opt_get_number(opts, "throttling.latency-target", 0);
 
         if (!throttle_is_valid(throttle_cfg, errp)) {
             return;
@@ -884,6 +888,7 @@ DriveInfo *drive_new(QemuOpts *all_opts, BlockInterfaceType block_default_type)
         { "iops_size",      "throttling.iops-size" },
 
         { "group",          "throttling.group" },
+        { "latency_target", "throttling.latency-target" },
 
         { "readonly",       "read-only" },
     };
@@ -1863,6 +1868,8 @@ static void do_drive_backup(const char *device, const char *target,
                             BlockdevOnError on_source_error,
                             bool has_on_target_error,
                             BlockdevOnError on_target_error,
+                            bool has_max_workers, int64_t max_workers,
+                            bool has_max_chunk, int64_t max_chunk,
                             BlockJobTxn *txn, Error **errp);
 
 static void drive_backup_prepare(BlkActionState *common, Error **errp)
@@ -1901,6 +1908,8 @@ static void drive_backup_prepare(BlkActionState *common, Error **errp)
                     backup->has_bitmap, backup->bitmap,
                     backup->has_on_source_error, backup->on_source_error,
                     backup->has_on_target_error, backup->on_target_error,
+                    backup->has_max_workers, backup->max_workers,
+                    backup->has_max_chunk, backup->max_chunk,
                     common->block_job_txn, &local_err);
     if (local_err) {
         error_propagate(errp, local_err);
@@ -1945,6 +1954,8 @@ static void do_blockdev_backup(const char *device, const char *target,
                                BlockdevOnError on_source_error,
                                bool has_on_target_error,
                                BlockdevOnError on_target_error,
+                               bool has_max_workers, int64_t max_workers,
+                               bool has_max_chunk, int64_t max_chunk,
                                BlockJobTxn *txn, Error **errp);
 
 static void blockdev_backup_prepare(BlkActionState *common, Error **errp)
@@ -1990,6 +2001,8 @@ static void blockdev_backup_prepare(BlkActionState *common, Error **errp)
                        backup->has_speed, backup->speed,
                        backup->has_on_source_error, backup->on_source_error,
                        backup->has_on_target_error, backup->on_target_error,
+                       backup->has_max_workers, backup->max_workers,
+                       backup->has_max_chunk, backup->max_chunk,
                        common->block_job_txn, &local_err);
     if (local_err) {
         error_propagate(errp, local_err);
@@ -2641,7 +2654,9 @@ void qmp_block_set_io_throttle(const char *device, int64_t bps, int64_t bps_rd,
                                bool has_iops_size,
                                int64_t iops_size,
                                bool has_group,
-                               const char *group, Error **errp)
+                               const char *group,
+                               bool has_latency_target,
+                               int64_t latency_target, Error **errp)
 {
     ThrottleConfig cfg;
     BlockDriverState *bs;
@@ -2722,6 +2737,10 @@ void qmp_block_set_io_throttle(const char *device, int64_t bps, int64_t bps_rd,
         cfg.op_size = iops_size;
     }
 
+    if (has_latency_target) {
+        cfg.latency_target = latency_target;
+    }
+
     if (!throttle_is_valid(&cfg, errp)) {
         goto out;
     }
@@ -2745,6 +2764,113 @@ out:
     aio_context_release(aio_context);
 }
 
+/* Copy latency histogram boundaries from a QMP list into an array */
+static bool latency_histogram_boundaries(uint64List *list, const char *name,
+                                         uint64_t **boundaries,
+                                         unsigned *nb_boundaries,
+                                         Error **errp)
+{
+    uint64List *entry;
+    unsigned n = 0;
+
+    for (entry = list; entry; entry = entry->next) {
+        n++;
+    }
+
+    *boundaries = g_new(uint64_t, n);
+    *nb_boundaries = n;
+
+    n = 0;
+    for (entry = list; entry; entry = entry->next) {
+        (*boundaries)[n++] = entry->value;
+    }
+
+    if (!block_latency_histogram_is_valid(*boundaries, n)) {
+        error_setg(errp, "The values of '%s' must be in strictly ascending"
+                   " order", name);
+        return false;
+    }
+    return true;
+}
+
+void qmp_block_latency_histogram_set(const char *device,
+                                     bool has_boundaries,
+                                     uint64List *boundaries,
+                                     bool has_boundaries_read,
+                                     uint64List *boundaries_read,
+                                     bool has_boundaries_write,
+                                     uint64List *boundaries_write,
+                                     bool has_boundaries_flush,
+                                     uint64List *boundaries_flush,
+                                     Error **errp)
+{
+    const char *names[BLOCK_MAX_IOTYPE] = {
+        [BLOCK_ACCT_READ]  = "boundaries-read",
+        [BLOCK_ACCT_WRITE] = "boundaries-write",
+        [BLOCK_ACCT_FLUSH] = "boundaries-flush",
+    };
+    bool has_lists[BLOCK_MAX_IOTYPE] = {
+        [BLOCK_ACCT_READ]  = has_boundaries_read,
+        [BLOCK_ACCT_WRITE] = has_boundaries_write,
+        [BLOCK_ACCT_FLUSH] = has_boundaries_flush,
+    };
+    uint64List *lists[BLOCK_MAX_IOTYPE] = {
+        [BLOCK_ACCT_READ]  = boundaries_read,
+        [BLOCK_ACCT_WRITE] = boundaries_write,
+        [BLOCK_ACCT_FLUSH] = boundaries_flush,
+    };
+    uint64_t *values[BLOCK_MAX_IOTYPE] = { NULL };
+    unsigned nb_values[BLOCK_MAX_IOTYPE];
+    BlockBackend *blk;
+    AioContext *aio_context;
+    bool clear = true;
+    int i;
+
+    blk = blk_by_name(device);
+    if (!blk) {
+        error_set(errp, ERROR_CLASS_DEVICE_NOT_FOUND,
+                  "Device '%s' not found", device);
+        return;
+    }
+
+    /* Check everything before changing any histogram */
+    for (i = 0; i < BLOCK_MAX_IOTYPE; i++) {
+        if (!has_lists[i] && has_boundaries) {
+            has_lists[i] = true;
+            lists[i] = boundaries;
+            names[i] = "boundaries";
+        }
+        if (!has_lists[i]) {
+            continue;
+        }
+        clear = false;
+        if (!latency_histogram_boundaries(lists[i], names[i], &values[i],
+                                          &nb_values[i], errp)) {
+            goto out;
+        }
+    }
+
+    aio_context = blk_get_aio_context(blk);
+    aio_context_acquire(aio_context);
+
+    if (clear) {
+        block_latency_histograms_clear(blk_get_stats(blk));
+    }
+    for (i = 0; i < BLOCK_MAX_IOTYPE; i++) {
+        if (has_lists[i]) {
+            block_latency_histogram_set(blk_get_stats(blk), i, values[i],
+                                        nb_values[i]);
+        }
+    }
+
+    aio_context_release(aio_context);
+
+out:
+    for (i = 0; i < BLOCK_MAX_IOTYPE; i++) {
+        g_free(values[i]);
+    }
+}
+
 void qmp_block_dirty_bitmap_add(const char *node, const char *name,
                                 bool has_granularity, uint32_t granularity,
                                 Error **errp)
@@ -3177,6 +3303,8 @@ static void do_drive_backup(const char *device, const char *target,
                             BlockdevOnError on_source_error,
                             bool has_on_target_error,
                             BlockdevOnError on_target_error,
+                            bool has_max_workers, int64_t max_workers,
+                            bool has_max_chunk, int64_t max_chunk,
                             BlockJobTxn *txn, Error **errp)
 {
     BlockBackend *blk;
@@ -3203,6 +3331,17 @@ static void do_drive_backup(const char *device, const char *target,
     if (!has_mode) {
         mode = NEW_IMAGE_MODE_ABSOLUTE_PATHS;
     }
+    if (!has_max_workers) {
+        max_workers = 0;
+    } else if (max_workers == 0) {
+        /* backup_start() takes 0 as "use the default" */
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "max-workers",
+                   "a value in range [1, 64]");
+        return;
+    }
+    if (!has_max_chunk) {
+        max_chunk = 0;
+    }
 
     blk = blk_by_name(device);
     if (!blk) {
@@ -3292,7 +3431,7 @@ static void do_drive_backup(const char *device, const char *target,
     }
 
     backup_start(bs, target_bs, speed, sync, bmap,
-                 on_source_error, on_target_error,
+                 on_source_error, on_target_error, max_workers, max_chunk,
                  block_job_cb, bs, txn, &local_err);
     if (local_err != NULL) {
         bdrv_unref(target_bs);
@@ -3312,6 +3451,8 @@ void qmp_drive_backup(const char *device, const char *target,
                       bool has_bitmap, const char *bitmap,
                       bool has_on_source_error, BlockdevOnError on_source_error,
                       bool has_on_target_error, BlockdevOnError on_target_error,
+                      bool has_max_workers, int64_t max_workers,
+                      bool has_max_chunk, int64_t max_chunk,
                       Error **errp)
 {
     return do_drive_backup(device, target, has_format, format, sync,
@@ -3319,6 +3460,8 @@ void qmp_drive_backup(const char *device, const char *target,
                            has_bitmap, bitmap,
                            has_on_source_error, on_source_error,
                            has_on_target_error, on_target_error,
+                           has_max_workers, max_workers,
+                           has_max_chunk, max_chunk,
                            NULL, errp);
 }
 
@@ -3334,6 +3477,8 @@ void do_blockdev_backup(const char *device, const char *target,
                          BlockdevOnError on_source_error,
                          bool has_on_target_error,
                          BlockdevOnError on_target_error,
+                         bool has_max_workers, int64_t max_workers,
+                         bool has_max_chunk, int64_t max_chunk,
                          BlockJobTxn *txn, Error **errp)
 {
     BlockBackend *blk, *target_blk;
@@ -3351,6 +3496,17 @@ void do_blockdev_backup(const char *device, const char *target,
     if (!has_on_target_error) {
         on_target_error = BLOCKDEV_ON_ERROR_REPORT;
     }
+    if (!has_max_workers) {
+        max_workers = 0;
+    } else if (max_workers == 0) {
+        /* backup_start() takes 0 as "use the default" */
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "max-workers",
+                   "a value in range [1, 64]");
+        return;
+    }
+    if (!has_max_chunk) {
+        max_chunk = 0;
+    }
 
     blk = blk_by_name(device);
     if (!blk) {
@@ -3382,7 +3538,8 @@ void do_blockdev_backup(const char *device, const char *target,
     bdrv_ref(target_bs);
     bdrv_set_aio_context(target_bs, aio_context);
     backup_start(bs, target_bs, speed, sync, NULL, on_source_error,
-                 on_target_error, block_job_cb, bs, txn, &local_err);
+                 on_target_error, max_workers, max_chunk,
+                 block_job_cb, bs, txn, &local_err);
     if (local_err != NULL) {
         bdrv_unref(target_bs);
         error_propagate(errp, local_err);
@@ -3398,11 +3555,15 @@ void qmp_blockdev_backup(const char *device, const char *target,
                          BlockdevOnError on_source_error,
                          bool has_on_target_error,
                          BlockdevOnError on_target_error,
+                         bool has_max_workers, int64_t max_workers,
+                         bool has_max_chunk, int64_t max_chunk,
                          Error **errp)
 {
     do_blockdev_backup(device, target, sync, has_speed, speed,
                        has_on_source_error, on_source_error,
                        has_on_target_error, on_target_error,
+                       has_max_workers, max_workers,
+                       has_max_chunk, max_chunk,
                        NULL, errp);
 }
 
@@ -3421,6 +3582,8 @@ static void blockdev_mirror_common(BlockDriverState *bs,
                                    bool has_on_target_error,
                                    BlockdevOnError on_target_error,
                                    bool has_unmap, bool unmap,
+                                   bool has_copy_mode,
+                                   MirrorCopyMode copy_mode,
                                    Error **errp)
 {
 
@@ -3442,6 +3605,9 @@ static void blockdev_mirror_common(BlockDriverState *bs,
     if (!has_unmap) {
         unmap = true;
     }
+    if (!has_copy_mode) {
+        copy_mode = MIRROR_COPY_MODE_BACKGROUND;
+    }
 
     if (granularity != 0 && (granularity < 512 || granularity > 1048576 * 64)) {
         error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "granularity",
@@ -3475,7 +3641,7 @@ static void blockdev_mirror_common(BlockDriverState *bs,
     mirror_start(bs, target,
                  has_replaces ? replaces : NULL,
                  speed, granularity, buf_size, sync,
-                 on_source_error, on_target_error, unmap,
+                 on_source_error, on_target_error, unmap, copy_mode,
                  block_job_cb, bs, errp);
 }
 
@@ -3491,6 +3657,7 @@ void qmp_drive_mirror(const char *device, const char *target,
                       bool has_on_source_error, BlockdevOnError on_source_error,
                       bool has_on_target_error, BlockdevOnError on_target_error,
                       bool has_unmap, bool unmap,
+                      bool has_copy_mode, MirrorCopyMode copy_mode,
                       Error **errp)
 {
     BlockDriverState *bs;
@@ -3628,6 +3795,7 @@ void qmp_drive_mirror(const char *device, const char *target,
                            has_on_source_error, on_source_error,
                            has_on_target_error, on_target_error,
                            has_unmap, unmap,
+                           has_copy_mode, copy_mode,
                            &local_err);
     if (local_err) {
         error_propagate(errp, local_err);
@@ -3647,6 +3815,7 @@ void qmp_blockdev_mirror(const char *device, const char *target,
                          BlockdevOnError on_source_error,
                          bool has_on_target_error,
                          BlockdevOnError on_target_error,
+                         bool has_copy_mode, MirrorCopyMode copy_mode,
                          Error **errp)
 {
     BlockDriverState *bs;
@@ -3686,6 +3855,7 @@ void qmp_blockdev_mirror(const char *device, const char *target,
                            has_on_source_error, on_source_error,
                            has_on_target_error, on_target_error,
                            true, true,
+                           has_copy_mode, copy_mode,
                            &local_err);
     if (local_err) {
         error_propagate(errp, local_err);
@@ -3746,6 +3916,24 @@ void qmp_block_job_set_speed(const char *device, int64_t speed, Error **errp)
     aio_context_release(aio_context);
 }
 
+void qmp_block_job_set_copy_mode(const char *device, MirrorCopyMode copy_mode,
+                                 Error **errp)
+{
+    AioContext *aio_context;
+    BlockJob *job = find_block_job(device, &aio_context, errp);
+
+    if (!job) {
+        return;
+    }
+
+    if (job->driver->job_type != BLOCK_JOB_TYPE_MIRROR) {
+        error_setg(errp, "Job '%s' is not a mirror job", job->id);
+    } else {
+        mirror_set_copy_mode(job, copy_mode, errp);
+    }
+    aio_context_release(aio_context);
+}
+
 void qmp_block_job_cancel(const char *device,
                           bool has_force, bool force, Error **errp)
 {
@@ -4234,6 +4422,11 @@ QemuOptsList qemu_common_drive_opts = {
             .name = "throttling.group",
             .type = QEMU_OPT_STRING,
             .help = "name of the block throttling group",
+        },{
+            .name = "throttling.latency-target",
+            .type = QEMU_OPT_NUMBER,
+            .help = "average request latency to adjust the limits to,"
+                    " in microseconds",
         },{
             .name = "copy-on-read",
             .type = QEMU_OPT_BOOL,
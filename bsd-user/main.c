@@ -31,6 +31,8 @@
 #include "exec/log.h"
 
 int singlestep;
+bool tb_profile_enabled;
+int tcg_pinned_regs;
 unsigned long mmap_min_addr;
 unsigned long guest_base;
 int have_guest_base;
@@ -0,0 +1,988 @@
+/*
+ * vhost-user-blk sample application
+ *
+ * Serves a raw image file to a vhost-user-blk-pci device, so that the
+ * vhost-user storage path can be exercised without an external target:
+ *
+ *   vhost-user-blk -b disk.img -s /tmp/vhost-blk.sock
+ *   qemu -chardev socket,id=char0,path=/tmp/vhost-blk.sock \
+ *        -device vhost-user-blk-pci,chardev=char0 \
+ *        -object memory-backend-file,id=mem,size=1G,mem-path=/dev/shm,share=on \
+ *        -numa node,memdev=mem ...
+ *
+ * Guest memory must be shared (share=on) for the backend to map it.  Only
+ * split virtqueues are supported; requests are served synchronously from
+ * the thread that polls the kick eventfds.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <linux/vhost.h>
+
+#include "qemu/atomic.h"
+#include "qemu/bswap.h"
+#include "qemu/iov.h"
+#include "standard-headers/linux/virtio_blk.h"
+#include "standard-headers/linux/virtio_config.h"
+#include "standard-headers/linux/virtio_ring.h"
+
+#define VUB_DEFAULT_UNIX_SOCK_PATH "/tmp/vhost-user-blk.sock"
+#define VUB_MAX_QUEUES             8
+#define VUB_MAX_SEGMENTS           126
+#define VUB_SECTOR_BITS            9
+
+/* Based on qemu/hw/virtio/vhost-user.c */
+
+#define VHOST_MEMORY_MAX_NREGIONS    8
+#define VHOST_USER_F_PROTOCOL_FEATURES 30
+
+enum VhostUserProtocolFeature {
+    VHOST_USER_PROTOCOL_F_MQ = 0,
+    VHOST_USER_PROTOCOL_F_CONFIG = 9,
+};
+
+typedef enum VhostUserRequest {
+    VHOST_USER_NONE = 0,
+    VHOST_USER_GET_FEATURES = 1,
+    VHOST_USER_SET_FEATURES = 2,
+    VHOST_USER_SET_OWNER = 3,
+    VHOST_USER_RESET_OWNER = 4,
+    VHOST_USER_SET_MEM_TABLE = 5,
+    VHOST_USER_SET_LOG_BASE = 6,
+    VHOST_USER_SET_LOG_FD = 7,
+    VHOST_USER_SET_VRING_NUM = 8,
+    VHOST_USER_SET_VRING_ADDR = 9,
+    VHOST_USER_SET_VRING_BASE = 10,
+    VHOST_USER_GET_VRING_BASE = 11,
+    VHOST_USER_SET_VRING_KICK = 12,
+    VHOST_USER_SET_VRING_CALL = 13,
+    VHOST_USER_SET_VRING_ERR = 14,
+    VHOST_USER_GET_PROTOCOL_FEATURES = 15,
+    VHOST_USER_SET_PROTOCOL_FEATURES = 16,
+    VHOST_USER_GET_QUEUE_NUM = 17,
+    VHOST_USER_SET_VRING_ENABLE = 18,
+    VHOST_USER_SEND_RARP = 19,
+    VHOST_USER_GET_CONFIG = 24,
+    VHOST_USER_MAX
+} VhostUserRequest;
+
+typedef struct VhostUserMemoryRegion {
+    uint64_t guest_phys_addr;
+    uint64_t memory_size;
+    uint64_t userspace_addr;
+    uint64_t mmap_offset;
+} VhostUserMemoryRegion;
+
+typedef struct VhostUserMemory {
+    uint32_t nregions;
+    uint32_t padding;
+    VhostUserMemoryRegion regions[VHOST_MEMORY_MAX_NREGIONS];
+} VhostUserMemory;
+
+#define VHOST_USER_MAX_CONFIG_SIZE 256
+
+typedef struct VhostUserConfig {
+    uint32_t offset;
+    uint32_t size;
+    uint32_t flags;
+    uint8_t region[VHOST_USER_MAX_CONFIG_SIZE];
+} VhostUserConfig;
+
+/* Only the requested size bytes of region[] are sent */
+#define VHOST_USER_CONFIG_HDR_SIZE (offsetof(VhostUserConfig, region))
+
+typedef struct VhostUserMsg {
+    VhostUserRequest request;
+
+#define VHOST_USER_VERSION_MASK     (0x3)
+#define VHOST_USER_REPLY_MASK       (0x1<<2)
+    uint32_t flags;
+    uint32_t size; /* the following payload size */
+    union {
+#define VHOST_USER_VRING_IDX_MASK   (0xff)
+#define VHOST_USER_VRING_NOFD_MASK  (0x1<<8)
+        uint64_t u64;
+        struct vhost_vring_state state;
+        struct vhost_vring_addr addr;
+        VhostUserMemory memory;
+        VhostUserConfig config;
+    } payload;
+    int fds[VHOST_MEMORY_MAX_NREGIONS];
+    int fd_num;
+} QEMU_PACKED VhostUserMsg;
+
+#define VHOST_USER_HDR_SIZE offsetof(VhostUserMsg, payload.u64)
+
+/* The version of the protocol we support */
+#define VHOST_USER_VERSION    (0x1)
+
+typedef struct VubDevRegion {
+    /* Guest Physical address. */
+    uint64_t gpa;
+    /* Memory region size. */
+    uint64_t size;
+    /* QEMU virtual address (userspace). */
+    uint64_t qva;
+    /* Starting offset in our mmaped space. */
+    uint64_t mmap_offset;
+    /* Start address of mmaped space. */
+    uint64_t mmap_addr;
+} VubDevRegion;
+
+typedef struct VubVirtq {
+    int call_fd;
+    int kick_fd;
+    uint32_t size;
+    uint16_t last_avail_index;
+    uint16_t used_index;
+    struct vring_desc *desc;
+    struct vring_avail *avail;
+    struct vring_used *used;
+    bool enable;
+    bool started;
+} VubVirtq;
+
+typedef struct VubDev {
+    int listen_fd;
+    int conn_fd;
+    int blk_fd;
+    bool readonly;
+    uint64_t capacity;      /* in 512-byte sectors */
+    uint64_t features;
+    uint64_t protocol_features;
+    uint32_t nregions;
+    VubDevRegion regions[VHOST_MEMORY_MAX_NREGIONS];
+    VubVirtq vq[VUB_MAX_QUEUES];
+} VubDev;
+
+static bool vub_verbose;
+
+#define DPRINT(...) \
+    do { \
+        if (vub_verbose) { \
+            printf(__VA_ARGS__); \
+        } \
+    } while (0)
+
+static void
+vub_die(const char *s)
+{
+    perror(s);
+    exit(1);
+}
+
+/* Translate guest physical address to our virtual address, checking that
+ * [guest_addr, guest_addr + len) lies within one region.
+ */
+static void *
+vub_gpa_to_va(VubDev *dev, uint64_t guest_addr, uint64_t len)
+{
+    int i;
+
+    for (i = 0; i < dev->nregions; i++) {
+        VubDevRegion *r = &dev->regions[i];
+
+        if (guest_addr >= r->gpa && guest_addr - r->gpa < r->size &&
+            len <= r->size - (guest_addr - r->gpa)) {
+            return (void *)(uintptr_t)(guest_addr - r->gpa + r->mmap_addr +
+                                       r->mmap_offset);
+        }
+    }
+
+    return NULL;
+}
+
+/* Translate qemu virtual address to our virtual address.  */
+static void *
+vub_qva_to_va(VubDev *dev, uint64_t qemu_addr)
+{
+    int i;
+
+    for (i = 0; i < dev->nregions; i++) {
+        VubDevRegion *r = &dev->regions[i];
+
+        if (qemu_addr >= r->qva && qemu_addr - r->qva < r->size) {
+            return (void *)(uintptr_t)(qemu_addr - r->qva + r->mmap_addr +
+                                       r->mmap_offset);
+        }
+    }
+
+    return NULL;
+}
+
+static void
+vub_unmap_regions(VubDev *dev)
+{
+    int i;
+
+    for (i = 0; i < dev->nregions; i++) {
+        VubDevRegion *r = &dev->regions[i];
+
+        munmap((void *)(uintptr_t)r->mmap_addr, r->size + r->mmap_offset);
+    }
+    dev->nregions = 0;
+}
+
+static void
+vub_reset_vq(VubVirtq *vq)
+{
+    if (vq->call_fd != -1) {
+        close(vq->call_fd);
+    }
+    if (vq->kick_fd != -1) {
+        close(vq->kick_fd);
+    }
+    *vq = (VubVirtq) {
+        .call_fd = -1,
+        .kick_fd = -1,
+    };
+}
+
+/* Forget everything about the current master, e.g. when QEMU goes away */
+static void
+vub_reset(VubDev *dev)
+{
+    int i;
+
+    for (i = 0; i < VUB_MAX_QUEUES; i++) {
+        vub_reset_vq(&dev->vq[i]);
+    }
+    vub_unmap_regions(dev);
+    dev->features = 0;
+    dev->protocol_features = 0;
+}
+
+/*
+ * Requests
+ */
+
+/* Collect the buffers of one request into @out (device-readable) and @in
+ * (device-writable); returns false if the chain is malformed.
+ */
+static bool
+vub_map_chain(VubDev *dev, VubVirtq *vq, uint16_t head,
+              struct iovec *out, unsigned *out_num,
+              struct iovec *in, unsigned *in_num)
+{
+    struct vring_desc *desc = vq->desc;
+    unsigned max = vq->size, i = head, n = 0;
+
+    *out_num = *in_num = 0;
+
+    if (le16_to_cpu(desc[i].flags) & VRING_DESC_F_INDIRECT) {
+        uint32_t len = le32_to_cpu(desc[i].len);
+
+        if (len % sizeof(struct vring_desc)) {
+            return false;
+        }
+        desc = vub_gpa_to_va(dev, le64_to_cpu(desc[i].addr), len);
+        if (!desc) {
+            return false;
+        }
+        max = len / sizeof(struct vring_desc);
+        i = 0;
+    }
+
+    for (;;) {
+        uint16_t flags;
+        uint32_t len;
+        void *p;
+
+        if (i >= max || ++n > max ||
+            *out_num + *in_num >= VUB_MAX_SEGMENTS + 2) {
+            return false;
+        }
+
+        flags = le16_to_cpu(desc[i].flags);
+        len = le32_to_cpu(desc[i].len);
+        p = vub_gpa_to_va(dev, le64_to_cpu(desc[i].addr), len);
+        if (!p) {
+            return false;
+        }
+
+        if (flags & VRING_DESC_F_WRITE) {
+            in[*in_num].iov_base = p;
+            in[(*in_num)++].iov_len = len;
+        } else {
+            if (*in_num) {
+                /* readable buffers must come first */
+                return false;
+            }
+            out[*out_num].iov_base = p;
+            out[(*out_num)++].iov_len = len;
+        }
+
+        if (!(flags & VRING_DESC_F_NEXT)) {
+            break;
+        }
+        i = le16_to_cpu(desc[i].next);
+    }
+
+    return true;
+}
+
+static ssize_t
+vub_rw(VubDev *dev, struct iovec *iov, unsigned iov_num, uint64_t sector,
+       bool write)
+{
+    off_t offset = sector << VUB_SECTOR_BITS;
+    size_t len = iov_size(iov, iov_num);
+    ssize_t ret;
+
+    if (sector > dev->capacity ||
+        (len >> VUB_SECTOR_BITS) > dev->capacity - sector) {
+        return -EINVAL;
+    }
+
+    do {
+        ret = write ? pwritev(dev->blk_fd, iov, iov_num, offset)
+                    : preadv(dev->blk_fd, iov, iov_num, offset);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) {
+        return -errno;
+    }
+    /* Treat short transfers as errors, the image does not change size */
+    return ret == len ? ret : -EIO;
+}
+
+/* Serve one request; returns the number of bytes written to guest memory */
+static uint32_t
+vub_handle_request(VubDev *dev, struct iovec *out, unsigned out_num,
+                   struct iovec *in, unsigned in_num)
+{
+    struct virtio_blk_outhdr hdr;
+    struct iovec *last;
+    uint8_t *status;
+    uint32_t type;
+    uint64_t sector;
+    ssize_t ret;
+
+    if (!in_num || iov_to_buf(out, out_num, 0, &hdr, sizeof(hdr)) !=
+        sizeof(hdr)) {
+        fprintf(stderr, "vhost-user-blk: malformed request\n");
+        return 0;
+    }
+    iov_discard_front(&out, &out_num, sizeof(hdr));
+
+    last = &in[in_num - 1];
+    if (last->iov_len < 1) {
+        return 0;
+    }
+    status = (uint8_t *)last->iov_base + last->iov_len - 1;
+    iov_discard_back(in, &in_num, 1);
+
+    type = le32_to_cpu(hdr.type);
+    sector = le64_to_cpu(hdr.sector);
+
+    switch (type & ~VIRTIO_BLK_T_BARRIER) {
+    case VIRTIO_BLK_T_IN:
+        ret = vub_rw(dev, in, in_num, sector, false);
+        if (ret < 0) {
+            *status = VIRTIO_BLK_S_IOERR;
+            return 1;
+        }
+        *status = VIRTIO_BLK_S_OK;
+        return ret + 1;
+
+    case VIRTIO_BLK_T_OUT:
+        if (dev->readonly) {
+            *status = VIRTIO_BLK_S_IOERR;
+            return 1;
+        }
+        ret = vub_rw(dev, out, out_num, sector, true);
+        *status = ret < 0 ? VIRTIO_BLK_S_IOERR : VIRTIO_BLK_S_OK;
+        return 1;
+
+    case VIRTIO_BLK_T_FLUSH:
+        *status = fdatasync(dev->blk_fd) < 0 ? VIRTIO_BLK_S_IOERR
+                                             : VIRTIO_BLK_S_OK;
+        return 1;
+
+    case VIRTIO_BLK_T_GET_ID: {
+        char id[VIRTIO_BLK_ID_BYTES] = "vhost_user_blk";
+        size_t len = iov_from_buf(in, in_num, 0, id, sizeof(id));
+
+        *status = VIRTIO_BLK_S_OK;
+        return len + 1;
+    }
+
+    default:
+        *status = VIRTIO_BLK_S_UNSUPP;
+        return 1;
+    }
+}
+
+static void
+vub_process_vq(VubDev *dev, VubVirtq *vq)
+{
+    struct iovec out[VUB_MAX_SEGMENTS + 2], in[VUB_MAX_SEGMENTS + 2];
+    unsigned out_num, in_num;
+    bool notify = false;
+
+    if (!vq->enable || !vq->started || !vq->desc) {
+        return;
+    }
+
+    while (vq->last_avail_index != le16_to_cpu(atomic_read(&vq->avail->idx))) {
+        uint16_t head;
+        uint32_t len = 0;
+        struct vring_used_elem *elem;
+
+        /* Read the ring entry only after seeing the index move */
+        smp_rmb();
+        head = le16_to_cpu(vq->avail->ring[vq->last_avail_index % vq->size]);
+        if (head >= vq->size) {
+            fprintf(stderr, "vhost-user-blk: bad descriptor index %u\n", head);
+            vq->started = false;
+            break;
+        }
+
+        if (vub_map_chain(dev, vq, head, out, &out_num, in, &in_num)) {
+            len = vub_handle_request(dev, out, out_num, in, in_num);
+        } else {
+            fprintf(stderr, "vhost-user-blk: bad descriptor chain\n");
+        }
+
+        elem = &vq->used->ring[vq->used_index % vq->size];
+        elem->id = cpu_to_le32(head);
+        elem->len = cpu_to_le32(len);
+        vq->last_avail_index++;
+        vq->used_index++;
+        notify = true;
+    }
+
+    if (!notify) {
+        return;
+    }
+
+    /* Publish the used entries before the index that covers them */
+    smp_wmb();
+    atomic_set(&vq->used->idx, cpu_to_le16(vq->used_index));
+    smp_mb();
+
+    if (vq->call_fd != -1 &&
+        !(le16_to_cpu(atomic_read(&vq->avail->flags)) &
+          VRING_AVAIL_F_NO_INTERRUPT)) {
+        eventfd_write(vq->call_fd, 1);
+    }
+}
+
+/*
+ * vhost-user messages
+ */
+
+static void
+vub_message_close_fds(VhostUserMsg *vmsg)
+{
+    int i;
+
+    for (i = 0; i < vmsg->fd_num; i++) {
+        close(vmsg->fds[i]);
+    }
+    vmsg->fd_num = 0;
+}
+
+/* Returns false if the master went away */
+static bool
+vub_message_read(int conn_fd, VhostUserMsg *vmsg)
+{
+    char control[CMSG_SPACE(VHOST_MEMORY_MAX_NREGIONS * sizeof(int))] = { };
+    struct iovec iov = {
+        .iov_base = (char *)vmsg,
+        .iov_len = VHOST_USER_HDR_SIZE,
+    };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+    };
+    struct cmsghdr *cmsg;
+    size_t done = 0;
+    ssize_t rc;
+
+    do {
+        rc = recvmsg(conn_fd, &msg, 0);
+    } while (rc < 0 && errno == EINTR);
+
+    if (rc != VHOST_USER_HDR_SIZE) {
+        return false;
+    }
+
+    vmsg->fd_num = 0;
+    for (cmsg = CMSG_FIRSTHDR(&msg);
+         cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            size_t fd_size = cmsg->cmsg_len - CMSG_LEN(0);
+
+            vmsg->fd_num = fd_size / sizeof(int);
+            memcpy(vmsg->fds, CMSG_DATA(cmsg), fd_size);
+            break;
+        }
+    }
+
+    if (vmsg->size > sizeof(vmsg->payload)) {
+        fprintf(stderr, "vhost-user-blk: message %d too big: %u bytes\n",
+                vmsg->request, vmsg->size);
+        vub_message_close_fds(vmsg);
+        return false;
+    }
+
+    while (done < vmsg->size) {
+        rc = read(conn_fd, (char *)&vmsg->payload + done, vmsg->size - done);
+        if (rc < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rc <= 0) {
+            vub_message_close_fds(vmsg);
+            return false;
+        }
+        done += rc;
+    }
+
+    return true;
+}
+
+static bool
+vub_message_write(int conn_fd, VhostUserMsg *vmsg)
+{
+    size_t len = VHOST_USER_HDR_SIZE + vmsg->size;
+
+    vmsg->flags &= ~VHOST_USER_VERSION_MASK;
+    vmsg->flags |= VHOST_USER_VERSION | VHOST_USER_REPLY_MASK;
+
+    return qemu_write_full(conn_fd, vmsg, len) == len;
+}
+
+static int
+vub_set_mem_table_exec(VubDev *dev, VhostUserMsg *vmsg)
+{
+    VhostUserMemory *memory = &vmsg->payload.memory;
+    int i;
+
+    if (memory->nregions > VHOST_MEMORY_MAX_NREGIONS ||
+        memory->nregions != vmsg->fd_num) {
+        fprintf(stderr, "vhost-user-blk: bad memory table\n");
+        return -1;
+    }
+
+    vub_unmap_regions(dev);
+
+    for (i = 0; i < memory->nregions; i++) {
+        VhostUserMemoryRegion *msg_region = &memory->regions[i];
+        VubDevRegion *dev_region = &dev->regions[i];
+        void *mmap_addr;
+
+        dev_region->gpa = msg_region->guest_phys_addr;
+        dev_region->size = msg_region->memory_size;
+        dev_region->qva = msg_region->userspace_addr;
+        dev_region->mmap_offset = msg_region->mmap_offset;
+
+        /* We don't use offset argument of mmap() since the
+         * mapped address has to be page aligned, and we use huge
+         * pages.  */
+        mmap_addr = mmap(0, dev_region->size + dev_region->mmap_offset,
+                         PROT_READ | PROT_WRITE, MAP_SHARED,
+                         vmsg->fds[i], 0);
+        close(vmsg->fds[i]);
+
+        if (mmap_addr == MAP_FAILED) {
+            perror("mmap");
+            dev->nregions = i;
+            return -1;
+        }
+        dev_region->mmap_addr = (uint64_t)(uintptr_t)mmap_addr;
+        DPRINT("region %d: gpa 0x%" PRIx64 " size 0x%" PRIx64 "\n",
+               i, dev_region->gpa, dev_region->size);
+    }
+    dev->nregions = memory->nregions;
+    vmsg->fd_num = 0;
+
+    return 0;
+}
+
+static int
+vub_set_vring_addr_exec(VubDev *dev, VhostUserMsg *vmsg)
+{
+    struct vhost_vring_addr *vra = &vmsg->payload.addr;
+    VubVirtq *vq = &dev->vq[vra->index];
+
+    vq->desc = vub_qva_to_va(dev, vra->desc_user_addr);
+    vq->used = vub_qva_to_va(dev, vra->used_user_addr);
+    vq->avail = vub_qva_to_va(dev, vra->avail_user_addr);
+    if (!vq->desc || !vq->used || !vq->avail) {
+        fprintf(stderr, "vhost-user-blk: ring %u is not in guest memory\n",
+                vra->index);
+        return -1;
+    }
+
+    vq->used_index = le16_to_cpu(vq->used->idx);
+    return 0;
+}
+
+static int
+vub_set_vring_fd_exec(VubDev *dev, VhostUserMsg *vmsg, bool kick)
+{
+    unsigned index = vmsg->payload.u64 & VHOST_USER_VRING_IDX_MASK;
+    VubVirtq *vq;
+    int *fd;
+
+    if (index >= VUB_MAX_QUEUES) {
+        return -1;
+    }
+    vq = &dev->vq[index];
+    fd = kick ? &vq->kick_fd : &vq->call_fd;
+
+    if (*fd != -1) {
+        close(*fd);
+        *fd = -1;
+    }
+
+    if (!(vmsg->payload.u64 & VHOST_USER_VRING_NOFD_MASK)) {
+        if (vmsg->fd_num != 1) {
+            return -1;
+        }
+        *fd = vmsg->fds[0];
+        vmsg->fd_num = 0;
+    }
+
+    if (kick) {
+        /* Without protocol features there is no SET_VRING_ENABLE */
+        if (!(dev->features & (1ULL << VHOST_USER_F_PROTOCOL_FEATURES))) {
+            vq->enable = true;
+        }
+        vq->started = vq->kick_fd != -1;
+        /* Pick up whatever the guest queued before the ring was handed to us */
+        vub_process_vq(dev, vq);
+    }
+    return 0;
+}
+
+static int
+vub_get_config_exec(VubDev *dev, VhostUserMsg *vmsg)
+{
+    struct virtio_blk_config blkcfg = { };
+    uint32_t size = vmsg->payload.config.size;
+
+    if (vmsg->payload.config.offset != 0 || size > sizeof(blkcfg)) {
+        return -1;
+    }
+
+    blkcfg.capacity = cpu_to_le64(dev->capacity);
+    blkcfg.seg_max = cpu_to_le32(VUB_MAX_SEGMENTS);
+    blkcfg.blk_size = cpu_to_le32(1 << VUB_SECTOR_BITS);
+    blkcfg.num_queues = cpu_to_le16(VUB_MAX_QUEUES);
+
+    memset(vmsg->payload.config.region, 0,
+           sizeof(vmsg->payload.config.region));
+    memcpy(vmsg->payload.config.region, &blkcfg, size);
+    vmsg->size = VHOST_USER_CONFIG_HDR_SIZE + size;
+    return 1;
+}
+
+/* Returns 1 if a reply must be sent, 0 if not, -1 on a protocol error */
+static int
+vub_execute_request(VubDev *dev, VhostUserMsg *vmsg)
+{
+    unsigned index;
+
+    DPRINT("request %d, flags 0x%x, size %u, %d fds\n",
+           vmsg->request, vmsg->flags, vmsg->size, vmsg->fd_num);
+
+    switch (vmsg->request) {
+    case VHOST_USER_GET_FEATURES:
+        vmsg->payload.u64 =
+            (1ULL << VIRTIO_BLK_F_SEG_MAX) |
+            (1ULL << VIRTIO_BLK_F_BLK_SIZE) |
+            (1ULL << VIRTIO_BLK_F_FLUSH) |
+            (1ULL << VIRTIO_BLK_F_MQ) |
+            (1ULL << VIRTIO_RING_F_INDIRECT_DESC) |
+            (1ULL << VIRTIO_F_VERSION_1) |
+            (1ULL << VHOST_USER_F_PROTOCOL_FEATURES);
+        if (dev->readonly) {
+            vmsg->payload.u64 |= 1ULL << VIRTIO_BLK_F_RO;
+        }
+        vmsg->size = sizeof(vmsg->payload.u64);
+        return 1;
+
+    case VHOST_USER_SET_FEATURES:
+        dev->features = vmsg->payload.u64;
+        return 0;
+
+    case VHOST_USER_GET_PROTOCOL_FEATURES:
+        vmsg->payload.u64 = (1ULL << VHOST_USER_PROTOCOL_F_MQ) |
+                            (1ULL << VHOST_USER_PROTOCOL_F_CONFIG);
+        vmsg->size = sizeof(vmsg->payload.u64);
+        return 1;
+
+    case VHOST_USER_SET_PROTOCOL_FEATURES:
+        dev->protocol_features = vmsg->payload.u64;
+        return 0;
+
+    case VHOST_USER_GET_QUEUE_NUM:
+        vmsg->payload.u64 = VUB_MAX_QUEUES;
+        vmsg->size = sizeof(vmsg->payload.u64);
+        return 1;
+
+    case VHOST_USER_SET_OWNER:
+        return 0;
+
+    case VHOST_USER_RESET_OWNER:
+        vub_reset(dev);
+        return 0;
+
+    case VHOST_USER_SET_MEM_TABLE:
+        return vub_set_mem_table_exec(dev, vmsg);
+
+    case VHOST_USER_GET_CONFIG:
+        return vub_get_config_exec(dev, vmsg);
+
+    case VHOST_USER_SET_VRING_KICK:
+        return vub_set_vring_fd_exec(dev, vmsg, true);
+
+    case VHOST_USER_SET_VRING_CALL:
+        return vub_set_vring_fd_exec(dev, vmsg, false);
+
+    case VHOST_USER_SET_VRING_ERR:
+        return 0;
+
+    default:
+        break;
+    }
+
+    /* The remaining requests carry a vring index */
+    index = vmsg->request == VHOST_USER_SET_VRING_ADDR ?
+            vmsg->payload.addr.index : vmsg->payload.state.index;
+    if (index >= VUB_MAX_QUEUES) {
+        fprintf(stderr, "vhost-user-blk: bad vring index %u\n", index);
+        return -1;
+    }
+
+    switch (vmsg->request) {
+    case VHOST_USER_SET_VRING_NUM:
+        if (vmsg->payload.state.num == 0 ||
+            (vmsg->payload.state.num & (vmsg->payload.state.num - 1))) {
+            return -1;
+        }
+        dev->vq[index].size = vmsg->payload.state.num;
+        return 0;
+
+    case VHOST_USER_SET_VRING_ADDR:
+        return vub_set_vring_addr_exec(dev, vmsg);
+
+    case VHOST_USER_SET_VRING_BASE:
+        dev->vq[index].last_avail_index = vmsg->payload.state.num;
+        return 0;
+
+    case VHOST_USER_GET_VRING_BASE:
+        /* Stops the ring */
+        vmsg->payload.state.num = dev->vq[index].last_avail_index;
+        vmsg->size = sizeof(vmsg->payload.state);
+        vub_reset_vq(&dev->vq[index]);
+        return 1;
+
+    case VHOST_USER_SET_VRING_ENABLE:
+        dev->vq[index].enable = vmsg->payload.state.num;
+        vub_process_vq(dev, &dev->vq[index]);
+        return 0;
+
+    default:
+        fprintf(stderr, "vhost-user-blk: unsupported request %d\n",
+                vmsg->request);
+        return -1;
+    }
+}
+
+/* Returns false if the connection must be dropped */
+static bool
+vub_receive(VubDev *dev)
+{
+    VhostUserMsg vmsg;
+    int ret;
+
+    if (!vub_message_read(dev->conn_fd, &vmsg)) {
+        return false;
+    }
+
+    ret = vub_execute_request(dev, &vmsg);
+    vub_message_close_fds(&vmsg);
+    if (ret < 0) {
+        return false;
+    }
+    if (ret > 0 && !vub_message_write(dev->conn_fd, &vmsg)) {
+        return false;
+    }
+    return true;
+}
+
+static void
+vub_run(VubDev *dev)
+{
+    for (;;) {
+        struct pollfd fds[VUB_MAX_QUEUES + 1];
+        VubVirtq *vqs[VUB_MAX_QUEUES + 1];
+        int i, n = 0;
+
+        fds[n].fd = dev->conn_fd != -1 ? dev->conn_fd : dev->listen_fd;
+        fds[n].events = POLLIN;
+        vqs[n++] = NULL;
+        for (i = 0; i < VUB_MAX_QUEUES; i++) {
+            if (dev->vq[i].kick_fd != -1) {
+                fds[n].fd = dev->vq[i].kick_fd;
+                fds[n].events = POLLIN;
+                vqs[n++] = &dev->vq[i];
+            }
+        }
+
+        if (poll(fds, n, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            vub_die("poll");
+        }
+
+        for (i = 1; i < n; i++) {
+            if (fds[i].revents & POLLIN) {
+                eventfd_t kick_data;
+
+                if (eventfd_read(fds[i].fd, &kick_data) == 0) {
+                    vub_process_vq(dev, vqs[i]);
+                }
+            }
+        }
+
+        if (!fds[0].revents) {
+            continue;
+        }
+
+        if (dev->conn_fd == -1) {
+            dev->conn_fd = accept(dev->listen_fd, NULL, NULL);
+            if (dev->conn_fd == -1 && errno != EINTR) {
+                vub_die("accept");
+            }
+            DPRINT("master connected\n");
+        } else if (!vub_receive(dev)) {
+            /* Wait for QEMU to reconnect */
+            DPRINT("master disconnected\n");
+            close(dev->conn_fd);
+            dev->conn_fd = -1;
+            vub_reset(dev);
+        }
+    }
+}
+
+static void
+vub_listen(VubDev *dev, const char *path)
+{
+    struct sockaddr_un un = { .sun_family = AF_UNIX };
+
+    if (strlen(path) >= sizeof(un.sun_path)) {
+        fprintf(stderr, "socket path too long: %s\n", path);
+        exit(1);
+    }
+    pstrcpy(un.sun_path, sizeof(un.sun_path), path);
+
+    dev->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (dev->listen_fd == -1) {
+        vub_die("socket");
+    }
+
+    unlink(path);
+    if (bind(dev->listen_fd, (struct sockaddr *)&un, sizeof(un)) == -1) {
+        vub_die("bind");
+    }
+    if (listen(dev->listen_fd, 1) == -1) {
+        vub_die("listen");
+    }
+}
+
+static void
+vub_open_image(VubDev *dev, const char *path)
+{
+    off_t size;
+
+    dev->blk_fd = open(path, dev->readonly ? O_RDONLY : O_RDWR);
+    if (dev->blk_fd < 0) {
+        vub_die(path);
+    }
+
+    size = lseek(dev->blk_fd, 0, SEEK_END);
+    if (size < 0) {
+        vub_die("lseek");
+    }
+    dev->capacity = size >> VUB_SECTOR_BITS;
+}
+
+static void
+vub_usage(const char *progname)
+{
+    printf("Usage: %s [OPTION]...\n"
+           "  -h: show this help\n"
+           "  -v: verbose mode\n"
+           "  -b <image>: raw image file to serve (required)\n"
+           "  -r: export the image read-only\n"
+           "  -s <unix-socket-path>: path to the unix socket to listen to\n"
+           "     default " VUB_DEFAULT_UNIX_SOCK_PATH "\n",
+           progname);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *sock_path = VUB_DEFAULT_UNIX_SOCK_PATH;
+    const char *blk_path = NULL;
+    VubDev dev = { .conn_fd = -1 };
+    int c, i;
+
+    while ((c = getopt(argc, argv, "hvb:rs:")) != -1) {
+        switch (c) {
+        case 'h':
+            vub_usage(argv[0]);
+            return 0;
+        case 'v':
+            vub_verbose = true;
+            break;
+        case 'b':
+            blk_path = optarg;
+            break;
+        case 'r':
+            dev.readonly = true;
+            break;
+        case 's':
+            sock_path = optarg;
+            break;
+        default:
+            vub_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!blk_path) {
+        vub_usage(argv[0]);
+        return 1;
+    }
+
+    for (i = 0; i < VUB_MAX_QUEUES; i++) {
+        dev.vq[i] = (VubVirtq) { .call_fd = -1, .kick_fd = -1 };
+    }
+
+    vub_open_image(&dev, blk_path);
+    vub_listen(&dev, sock_path);
+    printf("Serving %s (%" PRIu64 " sectors) on %s\n",
+           blk_path, dev.capacity, sock_path);
+    fflush(stdout);
+
+    vub_run(&dev);
+    return 0;
+}
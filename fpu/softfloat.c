@@ -83,6 +83,8 @@ this code that are retained.
  * target-dependent and needs the TARGET_* macros.
  */
 #include "qemu/osdep.h"
+#include <math.h>
+#include <float.h>
 
 #include "fpu/softfloat.h"
 
@@ -1990,6 +1992,189 @@ float32 float32_round_to_int(float32 a, float_status *status)
 
 }
 
+/*----------------------------------------------------------------------------
+| Host FPU fast paths.
+|
+| When the rounding mode is round-to-nearest-even and the inexact flag is
+| already raised, the only flags the basic operations can still raise are
+| invalid, divbyzero, overflow and underflow.  For zero or normal inputs
+| the host FPU computes exactly the same result as the code below, and
+| those flags are easy to detect from the inputs and the result, so the
+| host FPU is used in that case.  Everything else (NaNs, infinities,
+| denormals, tiny results, other rounding modes) takes the software path.
+|
+| This requires a host whose compiler evaluates float and double
+| operations in their own precision, i.e. not the x87 FPU.
+*----------------------------------------------------------------------------*/
+
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0 && \
+    !defined(__FAST_MATH__)
+#define SOFTFLOAT_HOST_FPU 1
+#else
+#define SOFTFLOAT_HOST_FPU 0
+#endif
+
+typedef enum {
+    HOST_FPU_ADD,
+    HOST_FPU_SUB,
+    HOST_FPU_MUL,
+    HOST_FPU_DIV,
+    HOST_FPU_SQRT,
+} HostFPUOp;
+
+typedef union {
+    uint32_t i;
+    float h;
+} HostFloat32;
+
+typedef union {
+    uint64_t i;
+    double h;
+} HostFloat64;
+
+static inline bool host_fpu_usable(float_status *status)
+{
+    return SOFTFLOAT_HOST_FPU &&
+        likely((status->float_exception_flags & float_flag_inexact) &&
+               status->float_rounding_mode == float_round_nearest_even);
+}
+
+/* Check the inputs for OP: both must be zero or normal, the divisor must
+   not be zero and the square root operand not negative.  */
+static inline bool float32_host_fpu_args(HostFPUOp op, float32 a, float32 b)
+{
+    int aExp = extractFloat32Exp(a);
+    int bExp = extractFloat32Exp(b);
+
+    if (aExp == 0xFF || (aExp == 0 && extractFloat32Frac(a))) {
+        return false;
+    }
+    switch (op) {
+    case HOST_FPU_SQRT:
+        return !extractFloat32Sign(a) || float32_is_zero(a);
+    case HOST_FPU_DIV:
+        return bExp != 0 && bExp != 0xFF;
+    default:
+        return bExp != 0xFF && (bExp != 0 || !extractFloat32Frac(b));
+    }
+}
+
+static inline bool float64_host_fpu_args(HostFPUOp op, float64 a, float64 b)
+{
+    int aExp = extractFloat64Exp(a);
+    int bExp = extractFloat64Exp(b);
+
+    if (aExp == 0x7FF || (aExp == 0 && extractFloat64Frac(a))) {
+        return false;
+    }
+    switch (op) {
+    case HOST_FPU_SQRT:
+        return !extractFloat64Sign(a) || float64_is_zero(a);
+    case HOST_FPU_DIV:
+        return bExp != 0 && bExp != 0x7FF;
+    default:
+        return bExp != 0x7FF && (bExp != 0 || !extractFloat64Frac(b));
+    }
+}
+
+/* A zero result is exact if it comes from a cancelling addition or from
+   a zero operand; any other result that is not normal may have underflowed
+   and needs the software path to get the flags right.  */
+static inline bool host_fpu_zero_ok(HostFPUOp op, bool a_zero, bool b_zero)
+{
+    switch (op) {
+    case HOST_FPU_ADD:
+    case HOST_FPU_SUB:
+        return true;
+    case HOST_FPU_MUL:
+        return a_zero || b_zero;
+    default:
+        return a_zero;
+    }
+}
+
+static inline bool float32_host_fpu(HostFPUOp op, float32 a, float32 b,
+                                    float32 *res, float_status *status)
+{
+    HostFloat32 ua, ub, ur;
+
+    if (!host_fpu_usable(status) || !float32_host_fpu_args(op, a, b)) {
+        return false;
+    }
+
+    ua.i = float32_val(a);
+    ub.i = float32_val(b);
+    switch (op) {
+    case HOST_FPU_ADD:
+        ur.h = ua.h + ub.h;
+        break;
+    case HOST_FPU_SUB:
+        ur.h = ua.h - ub.h;
+        break;
+    case HOST_FPU_MUL:
+        ur.h = ua.h * ub.h;
+        break;
+    case HOST_FPU_DIV:
+        ur.h = ua.h / ub.h;
+        break;
+    case HOST_FPU_SQRT:
+        ur.h = sqrtf(ua.h);
+        break;
+    }
+
+    if (unlikely(isinf(ur.h))) {
+        float_raise(float_flag_overflow | float_flag_inexact, status);
+    } else if (unlikely(fabsf(ur.h) <= FLT_MIN)) {
+        if (ur.h != 0 ||
+            !host_fpu_zero_ok(op, float32_is_zero(a), float32_is_zero(b))) {
+            return false;
+        }
+    }
+    *res = make_float32(ur.i);
+    return true;
+}
+
+static inline bool float64_host_fpu(HostFPUOp op, float64 a, float64 b,
+                                    float64 *res, float_status *status)
+{
+    HostFloat64 ua, ub, ur;
+
+    if (!host_fpu_usable(status) || !float64_host_fpu_args(op, a, b)) {
+        return false;
+    }
+
+    ua.i = float64_val(a);
+    ub.i = float64_val(b);
+    switch (op) {
+    case HOST_FPU_ADD:
+        ur.h = ua.h + ub.h;
+        break;
+    case HOST_FPU_SUB:
+        ur.h = ua.h - ub.h;
+        break;
+    case HOST_FPU_MUL:
+        ur.h = ua.h * ub.h;
+        break;
+    case HOST_FPU_DIV:
+        ur.h = ua.h / ub.h;
+        break;
+    case HOST_FPU_SQRT:
+        ur.h = sqrt(ua.h);
+        break;
+    }
+
+    if (unlikely(isinf(ur.h))) {
+        float_raise(float_flag_overflow | float_flag_inexact, status);
+    } else if (unlikely(fabs(ur.h) <= DBL_MIN)) {
+        if (ur.h != 0 ||
+            !host_fpu_zero_ok(op, float64_is_zero(a), float64_is_zero(b))) {
+            return false;
+        }
+    }
+    *res = make_float64(ur.i);
+    return true;
+}
+
 /*----------------------------------------------------------------------------
 | Returns the result of adding the absolute values of the single-precision
 | floating-point values `a' and `b'.  If `zSign' is 1, the sum is negated
@@ -2167,6 +2352,12 @@ static float32 subFloat32Sigs(float32 a, float32 b, flag zSign,
 float32 float32_add(float32 a, float32 b, float_status *status)
 {
     flag aSign, bSign;
+    float32 res;
+
+    if (float32_host_fpu(HOST_FPU_ADD, a, b, &res, status)) {
+        return res;
+    }
+
     a = float32_squash_input_denormal(a, status);
     b = float32_squash_input_denormal(b, status);
 
@@ -2190,6 +2381,12 @@ float32 float32_add(float32 a, float32 b, float_status *status)
 float32 float32_sub(float32 a, float32 b, float_status *status)
 {
     flag aSign, bSign;
+    float32 res;
+
+    if (float32_host_fpu(HOST_FPU_SUB, a, b, &res, status)) {
+        return res;
+    }
+
     a = float32_squash_input_denormal(a, status);
     b = float32_squash_input_denormal(b, status);
 
@@ -2217,6 +2414,11 @@ float32 float32_mul(float32 a, float32 b, float_status *status)
     uint32_t aSig, bSig;
     uint64_t zSig64;
     uint32_t zSig;
+    float32 res;
+
+    if (float32_host_fpu(HOST_FPU_MUL, a, b, &res, status)) {
+        return res;
+    }
 
     a = float32_squash_input_denormal(a, status);
     b = float32_squash_input_denormal(b, status);
@@ -2280,6 +2482,12 @@ float32 float32_div(float32 a, float32 b, float_status *status)
     flag aSign, bSign, zSign;
     int aExp, bExp, zExp;
     uint32_t aSig, bSig, zSig;
+    float32 res;
+
+    if (float32_host_fpu(HOST_FPU_DIV, a, b, &res, status)) {
+        return res;
+    }
+
     a = float32_squash_input_denormal(a, status);
     b = float32_squash_input_denormal(b, status);
 
@@ -2679,6 +2887,12 @@ float32 float32_sqrt(float32 a, float_status *status)
     int aExp, zExp;
     uint32_t aSig, zSig;
     uint64_t rem, term;
+    float32 res;
+
+    if (float32_host_fpu(HOST_FPU_SQRT, a, a, &res, status)) {
+        return res;
+    }
+
     a = float32_squash_input_denormal(a, status);
 
     aSig = extractFloat32Frac( a );
@@ -3958,6 +4172,12 @@ static float64 subFloat64Sigs(float64 a, float64 b, flag zSign,
 float64 float64_add(float64 a, float64 b, float_status *status)
 {
     flag aSign, bSign;
+    float64 res;
+
+    if (float64_host_fpu(HOST_FPU_ADD, a, b, &res, status)) {
+        return res;
+    }
+
     a = float64_squash_input_denormal(a, status);
     b = float64_squash_input_denormal(b, status);
 
@@ -3981,6 +4201,12 @@ float64 float64_add(float64 a, float64 b, float_status *status)
 float64 float64_sub(float64 a, float64 b, float_status *status)
 {
     flag aSign, bSign;
+    float64 res;
+
+    if (float64_host_fpu(HOST_FPU_SUB, a, b, &res, status)) {
+        return res;
+    }
+
     a = float64_squash_input_denormal(a, status);
     b = float64_squash_input_denormal(b, status);
 
@@ -4006,6 +4232,11 @@ float64 float64_mul(float64 a, float64 b, float_status *status)
     flag aSign, bSign, zSign;
     int aExp, bExp, zExp;
     uint64_t aSig, bSig, zSig0, zSig1;
+    float64 res;
+
+    if (float64_host_fpu(HOST_FPU_MUL, a, b, &res, status)) {
+        return res;
+    }
 
     a = float64_squash_input_denormal(a, status);
     b = float64_squash_input_denormal(b, status);
@@ -4071,6 +4302,12 @@ float64 float64_div(float64 a, float64 b, float_status *status)
     uint64_t aSig, bSig, zSig;
     uint64_t rem0, rem1;
     uint64_t term0, term1;
+    float64 res;
+
+    if (float64_host_fpu(HOST_FPU_DIV, a, b, &res, status)) {
+        return res;
+    }
+
     a = float64_squash_input_denormal(a, status);
     b = float64_squash_input_denormal(b, status);
 
@@ -4483,6 +4720,12 @@ float64 float64_sqrt(float64 a, float_status *status)
     int aExp, zExp;
     uint64_t aSig, zSig, doubleZSig;
     uint64_t rem0, rem1, term0, term1;
+    float64 res;
+
+    if (float64_host_fpu(HOST_FPU_SQRT, a, a, &res, status)) {
+        return res;
+    }
+
     a = float64_squash_input_denormal(a, status);
 
     aSig = extractFloat64Frac( a );
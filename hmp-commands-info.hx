@@ -302,6 +302,23 @@ STEXI
 @item info opcount
 @findex opcount
 Show dynamic compiler opcode counters
+ETEXI
+
+    {
+        .name       = "tbprofile",
+        .args_type  = "max:i?",
+        .params     = "[max]",
+        .help       = "show the most executed translated blocks "
+                      "(requires -tb-profile)",
+        .mhandler.cmd = hmp_info_tb_profile,
+    },
+
+STEXI
+@item info tbprofile [@var{max}]
+@findex tbprofile
+Show the @var{max} (default 20) most frequently executed translated blocks
+with their guest address and guest/host code size, followed by a histogram
+of translation times.  Requires QEMU to be started with @option{-tb-profile}.
 ETEXI
 
     {
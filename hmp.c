@@ -512,6 +512,28 @@ void hmp_info_block(Monitor *mon, const QDict *qdict)
     qapi_free_BlockDeviceInfoList(blockdev_list);
 }
 
+static void print_latency_histogram(Monitor *mon, const char *name,
+                                    BlockLatencyHistogramInfo *hist)
+{
+    uint64List *bound = hist->boundaries;
+    uint64List *bin = hist->bins;
+    uint64_t start = 0;
+
+    monitor_printf(mon, "    %s_latency_histogram:", name);
+    for (; bin; bin = bin->next) {
+        if (bound) {
+            monitor_printf(mon, " [%" PRIu64 ", %" PRIu64 "):%" PRIu64,
+                           start, bound->value, bin->value);
+            start = bound->value;
+            bound = bound->next;
+        } else {
+            monitor_printf(mon, " [%" PRIu64 ", +inf):%" PRIu64,
+                           start, bin->value);
+        }
+    }
+    monitor_printf(mon, "\n");
+}
+
 void hmp_info_blockstats(Monitor *mon, const QDict *qdict)
 {
     BlockStatsList *stats_list, *stats;
@@ -519,6 +541,8 @@ void hmp_info_blockstats(Monitor *mon, const QDict *qdict)
     stats_list = qmp_query_blockstats(false, false, NULL);
 
     for (stats = stats_list; stats; stats = stats->next) {
+        BlockDeviceStats *ds = stats->value->stats;
+
         if (!stats->value->has_device) {
             continue;
         }
@@ -547,6 +571,16 @@ void hmp_info_blockstats(Monitor *mon, const QDict *qdict)
                        stats->value->stats->rd_merged,
                        stats->value->stats->wr_merged,
                        stats->value->stats->idle_time_ns);
+
+        if (ds->has_rd_latency_histogram) {
+            print_latency_histogram(mon, "rd", ds->rd_latency_histogram);
+        }
+        if (ds->has_wr_latency_histogram) {
+            print_latency_histogram(mon, "wr", ds->wr_latency_histogram);
+        }
+        if (ds->has_flush_latency_histogram) {
+            print_latency_histogram(mon, "flush", ds->flush_latency_histogram);
+        }
     }
 
     qapi_free_BlockStatsList(stats_list);
@@ -1083,7 +1117,7 @@ void hmp_drive_mirror(Monitor *mon, const QDict *qdict)
                      false, NULL, false, NULL,
                      full ? MIRROR_SYNC_MODE_FULL : MIRROR_SYNC_MODE_TOP,
                      true, mode, false, 0, false, 0, false, 0,
-                     false, 0, false, 0, false, true, &err);
+                     false, 0, false, 0, false, true, false, 0, &err);
     hmp_handle_error(mon, &err);
 }
 
@@ -1112,7 +1146,7 @@ void hmp_drive_backup(Monitor *mon, const QDict *qdict)
     qmp_drive_backup(device, filename, !!format, format,
                      full ? MIRROR_SYNC_MODE_FULL : MIRROR_SYNC_MODE_TOP,
                      true, mode, false, 0, false, NULL,
-                     false, 0, false, 0, &err);
+                     false, 0, false, 0, false, 0, false, 0, &err);
     hmp_handle_error(mon, &err);
 }
 
@@ -1430,7 +1464,9 @@ void hmp_block_set_io_throttle(Monitor *mon, const QDict *qdict)
                               false, /* No default I/O size */
                               0,
                               false,
-                              NULL, &err);
+                              NULL,
+                              false, /* No latency target */
+                              0, &err);
     hmp_handle_error(mon, &err);
 }
 
@@ -2381,3 +2417,38 @@ void hmp_info_dump(Monitor *mon, const QDict *qdict)
 
     qapi_free_DumpQueryResult(result);
 }
+
+void hmp_info_tb_profile(Monitor *mon, const QDict *qdict)
+{
+    int64_t max = qdict_get_try_int(qdict, "max", 20);
+    TBProfileEntryList *entry;
+    TBGenTimeBucketList *bucket;
+    TBProfileInfo *info;
+    Error *err = NULL;
+
+    info = qmp_x_query_tb_profile(true, max, &err);
+    if (err) {
+        hmp_handle_error(mon, &err);
+        return;
+    }
+
+    monitor_printf(mon, "%-18s %8s %8s %20s\n",
+                   "pc", "guest", "host", "executions");
+    for (entry = info->blocks; entry; entry = entry->next) {
+        monitor_printf(mon, "0x%016" PRIx64 " %8" PRId64 " %8" PRId64
+                       " %20" PRIu64 "\n",
+                       entry->value->pc, entry->value->guest_size,
+                       entry->value->host_size, entry->value->count);
+    }
+
+    monitor_printf(mon, "\nTranslation time:\n");
+    for (bucket = info->translation_time; bucket; bucket = bucket->next) {
+        monitor_printf(mon, "%s%6" PRIu64 " us %20" PRIu64 "\n",
+                       bucket->next ? "< " : ">=",
+                       bucket->next ? bucket->next->value->lower_us
+                                    : bucket->value->lower_us,
+                       bucket->value->count);
+    }
+
+    qapi_free_TBProfileInfo(info);
+}
@@ -49,6 +49,7 @@ static const int kernel_feature_bits[] = {
     VIRTIO_F_NOTIFY_ON_EMPTY,
     VIRTIO_RING_F_INDIRECT_DESC,
     VIRTIO_RING_F_EVENT_IDX,
+    VIRTIO_F_RING_PACKED,
     VIRTIO_NET_F_MRG_RXBUF,
     VIRTIO_F_VERSION_1,
     VHOST_INVALID_FEATURE_BIT
@@ -59,6 +60,7 @@ static const int user_feature_bits[] = {
     VIRTIO_F_NOTIFY_ON_EMPTY,
     VIRTIO_RING_F_INDIRECT_DESC,
     VIRTIO_RING_F_EVENT_IDX,
+    VIRTIO_F_RING_PACKED,
 
     VIRTIO_F_ANY_LAYOUT,
     VIRTIO_F_VERSION_1,
@@ -115,6 +117,11 @@ void vhost_net_ack_features(struct vhost_net *net, uint64_t features)
     vhost_ack_features(&net->dev, vhost_net_get_feature_bits(net), features);
 }
 
+uint64_t vhost_net_get_acked_features(VHostNetState *net)
+{
+    return net->dev.acked_features;
+}
+
 uint64_t vhost_net_get_max_queues(VHostNetState *net)
 {
     return net->dev.max_queues;
@@ -185,6 +192,21 @@ struct vhost_net *vhost_net_init(VhostNetOptions *options)
     }
     /* Set sane init value. Override when guest acks. */
     vhost_net_ack_features(net, 0);
+
+    /* A vhost-user backend reconnecting while the guest runs must offer
+     * what the guest already acked */
+    if (options->backend_type == VHOST_BACKEND_TYPE_USER) {
+        uint64_t features = vhost_user_get_acked_features(net->nc);
+
+        if (~net->dev.features & features) {
+            fprintf(stderr, "vhost lacks feature mask %" PRIu64
+                    " for backend\n",
+                    (uint64_t)(~net->dev.features & features));
+            vhost_dev_cleanup(&net->dev);
+            goto fail;
+        }
+        net->dev.acked_features |= features;
+    }
     return net;
 fail:
     g_free(net);
@@ -446,6 +468,11 @@ void vhost_net_ack_features(struct vhost_net *net, uint64_t features)
 {
 }
 
+uint64_t vhost_net_get_acked_features(VHostNetState *net)
+{
+    return 0;
+}
+
 bool vhost_net_virtqueue_pending(VHostNetState *net, int idx)
 {
     return false;
@@ -16,6 +16,7 @@
 #include "hw/virtio/virtio.h"
 #include "net/net.h"
 #include "net/checksum.h"
+#include "net/eth.h"
 #include "net/tap.h"
 #include "qemu/error-report.h"
 #include "qemu/timer.h"
@@ -39,17 +40,21 @@
     (offsetof(container, field) + sizeof(((container *)0)->field))
 
 typedef struct VirtIOFeature {
-    uint32_t flags;
+    uint64_t flags;
     size_t end;
 } VirtIOFeature;
 
 static VirtIOFeature feature_sizes[] = {
-    {.flags = 1 << VIRTIO_NET_F_MAC,
+    {.flags = 1ULL << VIRTIO_NET_F_MAC,
      .end = endof(struct virtio_net_config, mac)},
-    {.flags = 1 << VIRTIO_NET_F_STATUS,
+    {.flags = 1ULL << VIRTIO_NET_F_STATUS,
      .end = endof(struct virtio_net_config, status)},
-    {.flags = 1 << VIRTIO_NET_F_MQ,
+    {.flags = 1ULL << VIRTIO_NET_F_MQ,
      .end = endof(struct virtio_net_config, max_virtqueue_pairs)},
+    {.flags = 1ULL << VIRTIO_NET_F_RSS,
+     .end = endof(struct virtio_net_config, supported_hash_types)},
+    {.flags = 1ULL << VIRTIO_NET_F_HASH_REPORT,
+     .end = endof(struct virtio_net_config, supported_hash_types)},
     {}
 };
 
@@ -72,11 +77,20 @@ static int vq2q(int queue_index)
 static void virtio_net_get_config(VirtIODevice *vdev, uint8_t *config)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
-    struct virtio_net_config netcfg;
+    struct virtio_net_config netcfg = {};
 
     virtio_stw_p(vdev, &netcfg.status, n->status);
     virtio_stw_p(vdev, &netcfg.max_virtqueue_pairs, n->max_queues);
     memcpy(netcfg.mac, n->mac, ETH_ALEN);
+    /* Link speed and duplex are not offered, report them as unknown */
+    virtio_stl_p(vdev, &netcfg.speed, UINT32_MAX);
+    netcfg.duplex = 0xff;
+    netcfg.rss_max_key_size = VIRTIO_NET_RSS_MAX_KEY_SIZE;
+    virtio_stw_p(vdev, &netcfg.rss_max_indirection_table_length,
+                 virtio_host_has_feature(vdev, VIRTIO_NET_F_RSS) ?
+                 VIRTIO_NET_RSS_MAX_TABLE_LEN : 1);
+    virtio_stl_p(vdev, &netcfg.supported_hash_types,
+                 VIRTIO_NET_RSS_SUPPORTED_HASHES);
     memcpy(config, &netcfg, n->config_size);
 }
 
@@ -193,7 +207,7 @@ static bool virtio_net_set_vnet_endian(VirtIODevice *vdev, NetClientState *ncs,
 static void virtio_net_vnet_endian_status(VirtIONet *n, uint8_t status)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
-    int queues = n->multiqueue ? n->max_queues : 1;
+    int queues = n->multiqueue ? n->backend_queues : 1;
 
     if (virtio_net_started(n, status)) {
         /* Before using the device, we tell the network backend about the
@@ -213,16 +227,30 @@ static void virtio_net_vnet_endian_status(VirtIONet *n, uint8_t status)
     }
 }
 
+static bool virtio_net_dataplane_wanted(VirtIONet *n, uint8_t status);
+static void virtio_net_dataplane_start(VirtIONet *n);
+static void virtio_net_dataplane_stop(VirtIONet *n);
+
 static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     VirtIONetQueue *q;
+    AioContext *ctx = NULL;
     int i;
     uint8_t queue_status;
 
+    if (n->dataplane_started && !virtio_net_dataplane_wanted(n, status)) {
+        virtio_net_dataplane_stop(n);
+    }
+
     virtio_net_vnet_endian_status(n, status);
     virtio_net_vhost_status(n, status);
 
+    if (n->dataplane_started) {
+        ctx = iothread_get_aio_context(n->net_conf.iothread);
+        aio_context_acquire(ctx);
+    }
+
     for (i = 0; i < n->max_queues; i++) {
         NetClientState *ncs = qemu_get_subqueue(n->nic, i);
         bool queue_started;
@@ -245,7 +273,7 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
         }
 
         if (queue_started) {
-            if (q->tx_timer) {
+            if (q->tx_mode == VIRTIO_NET_TX_TIMER) {
                 timer_mod(q->tx_timer,
                                qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + n->tx_timeout);
             } else {
@@ -254,11 +282,19 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
         } else {
             if (q->tx_timer) {
                 timer_del(q->tx_timer);
-            } else {
+            }
+            if (q->tx_bh) {
                 qemu_bh_cancel(q->tx_bh);
             }
         }
     }
+
+    if (ctx) {
+        aio_context_release(ctx);
+    }
+    if (!n->dataplane_started && virtio_net_dataplane_wanted(n, status)) {
+        virtio_net_dataplane_start(n);
+    }
 }
 
 static void virtio_net_set_link_status(NetClientState *nc)
@@ -380,6 +416,12 @@ static RxFilterInfo *virtio_net_query_rxfilter(NetClientState *nc)
     return info;
 }
 
+static void virtio_net_disable_rss(VirtIONet *n)
+{
+    n->rss_data.enabled = false;
+    n->rss_data.redirect = false;
+}
+
 static void virtio_net_reset(VirtIODevice *vdev)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
@@ -406,6 +448,7 @@ static void virtio_net_reset(VirtIODevice *vdev)
     memcpy(&n->mac[0], &n->nic->conf->macaddr, sizeof(n->mac));
     qemu_format_nic_info_str(qemu_get_queue(n->nic), n->mac);
     memset(n->vlans, 0, MAX_VLAN >> 3);
+    virtio_net_disable_rss(n);
 }
 
 static void peer_test_vnet_hdr(VirtIONet *n)
@@ -441,7 +484,9 @@ static void virtio_net_set_mrg_rx_bufs(VirtIONet *n, int mergeable_rx_bufs,
 
     n->mergeable_rx_bufs = mergeable_rx_bufs;
 
-    if (version_1) {
+    if (n->rss_data.populate_hash) {
+        n->guest_hdr_len = sizeof(struct virtio_net_hdr_v1_hash);
+    } else if (version_1) {
         n->guest_hdr_len = sizeof(struct virtio_net_hdr_mrg_rxbuf);
     } else {
         n->guest_hdr_len = n->mergeable_rx_bufs ?
@@ -544,9 +589,19 @@ static uint64_t virtio_net_get_features(VirtIODevice *vdev, uint64_t features,
         virtio_clear_feature(&features, VIRTIO_NET_F_HOST_UFO);
     }
 
+    /* RSS is configured through the control virtqueue */
+    if (!virtio_has_feature(features, VIRTIO_NET_F_CTRL_VQ)) {
+        virtio_clear_feature(&features, VIRTIO_NET_F_RSS);
+        virtio_clear_feature(&features, VIRTIO_NET_F_HASH_REPORT);
+    }
+
     if (!get_vhost_net(nc->peer)) {
         return features;
     }
+
+    /* vhost places received packets itself, without looking at them */
+    virtio_clear_feature(&features, VIRTIO_NET_F_RSS);
+    virtio_clear_feature(&features, VIRTIO_NET_F_HASH_REPORT);
     return vhost_net_get_features(get_vhost_net(nc->peer), features);
 }
 
@@ -599,8 +654,19 @@ static void virtio_net_set_features(VirtIODevice *vdev, uint64_t features)
     int i;
 
     virtio_net_set_multiqueue(n,
+                              virtio_has_feature(features, VIRTIO_NET_F_RSS) ||
                               virtio_has_feature(features, VIRTIO_NET_F_MQ));
 
+    n->rss_data.populate_hash = virtio_has_feature(features,
+                                                   VIRTIO_NET_F_HASH_REPORT);
+    if (!virtio_has_feature(features, VIRTIO_NET_F_RSS)) {
+        n->rss_data.redirect = false;
+    }
+    if (!virtio_has_feature(features, VIRTIO_NET_F_RSS) &&
+        !n->rss_data.populate_hash) {
+        virtio_net_disable_rss(n);
+    }
+
     virtio_net_set_mrg_rx_bufs(n,
                                virtio_has_feature(features,
                                                   VIRTIO_NET_F_MRG_RXBUF),
@@ -841,6 +907,108 @@ static int virtio_net_handle_announce(VirtIONet *n, uint8_t cmd,
     }
 }
 
+/* Parse VIRTIO_NET_CTRL_MQ_RSS_CONFIG, or VIRTIO_NET_CTRL_MQ_HASH_CONFIG
+ * if !DO_RSS.  The two share their layout up to the key, the fields that
+ * only matter for steering are reserved in the latter.  Returns the number
+ * of queue pairs to use, or 0 if the command is invalid.
+ */
+static uint16_t virtio_net_handle_rss(VirtIONet *n, struct iovec *iov,
+                                      unsigned int iov_cnt, bool do_rss)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    struct virtio_net_rss_config cfg;
+    struct {
+        uint16_t max_tx_vq;
+        uint8_t hash_key_length;
+    } QEMU_PACKED tail;
+    size_t s, offset = 0, size_get;
+    uint16_t queues, len, default_queue, i;
+    uint16_t *table = NULL;
+
+    if (do_rss && !virtio_vdev_has_feature(vdev, VIRTIO_NET_F_RSS)) {
+        goto error;
+    }
+    if (!do_rss && !virtio_vdev_has_feature(vdev, VIRTIO_NET_F_HASH_REPORT)) {
+        goto error;
+    }
+
+    size_get = offsetof(struct virtio_net_rss_config, indirection_table);
+    s = iov_to_buf(iov, iov_cnt, offset, &cfg, size_get);
+    if (s != size_get) {
+        goto error;
+    }
+    offset += size_get;
+
+    len = do_rss ? virtio_lduw_p(vdev, &cfg.indirection_table_mask) + 1 : 1;
+    if (!is_power_of_2(len) || len > VIRTIO_NET_RSS_MAX_TABLE_LEN) {
+        goto error;
+    }
+    default_queue = do_rss ? virtio_lduw_p(vdev, &cfg.unclassified_queue) : 0;
+    if (default_queue >= n->max_queues) {
+        goto error;
+    }
+
+    size_get = sizeof(uint16_t) * len;
+    table = g_malloc(size_get);
+    s = iov_to_buf(iov, iov_cnt, offset, table, size_get);
+    if (s != size_get) {
+        goto error;
+    }
+    offset += size_get;
+    for (i = 0; i < len; i++) {
+        table[i] = do_rss ? virtio_lduw_p(vdev, &table[i]) : 0;
+        if (table[i] >= n->max_queues) {
+            goto error;
+        }
+    }
+
+    s = iov_to_buf(iov, iov_cnt, offset, &tail, sizeof(tail));
+    if (s != sizeof(tail)) {
+        goto error;
+    }
+    offset += sizeof(tail);
+
+    queues = do_rss ? virtio_lduw_p(vdev, &tail.max_tx_vq) : n->curr_queues;
+    if (queues == 0 || queues > n->max_queues) {
+        goto error;
+    }
+    if (tail.hash_key_length > VIRTIO_NET_RSS_MAX_KEY_SIZE) {
+        goto error;
+    }
+
+    n->rss_data.hash_types = virtio_ldl_p(vdev, &cfg.hash_types);
+    if (!tail.hash_key_length) {
+        if (n->rss_data.hash_types) {
+            goto error;
+        }
+        /* No hash at all turns the whole thing off */
+        g_free(table);
+        virtio_net_disable_rss(n);
+        return queues;
+    }
+
+    /* Shorter keys are padded with zeroes, which the hash then ignores */
+    memset(n->rss_data.key, 0, sizeof(n->rss_data.key));
+    s = iov_to_buf(iov, iov_cnt, offset, n->rss_data.key,
+                   tail.hash_key_length);
+    if (s != tail.hash_key_length) {
+        goto error;
+    }
+
+    g_free(n->rss_data.indirections_table);
+    n->rss_data.indirections_table = table;
+    n->rss_data.indirections_len = len;
+    n->rss_data.default_queue = default_queue;
+    n->rss_data.enabled = true;
+    n->rss_data.redirect = do_rss;
+    return queues;
+
+error:
+    g_free(table);
+    virtio_net_disable_rss(n);
+    return 0;
+}
+
 static int virtio_net_handle_mq(VirtIONet *n, uint8_t cmd,
                                 struct iovec *iov, unsigned int iov_cnt)
 {
@@ -849,17 +1017,27 @@ static int virtio_net_handle_mq(VirtIONet *n, uint8_t cmd,
     size_t s;
     uint16_t queues;
 
-    s = iov_to_buf(iov, iov_cnt, 0, &mq, sizeof(mq));
-    if (s != sizeof(mq)) {
-        return VIRTIO_NET_ERR;
-    }
-
-    if (cmd != VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET) {
+    if (cmd == VIRTIO_NET_CTRL_MQ_HASH_CONFIG) {
+        /* Only changes what goes in the header, not the queues */
+        return virtio_net_handle_rss(n, iov, iov_cnt, false) ?
+               VIRTIO_NET_OK : VIRTIO_NET_ERR;
+    } else if (cmd == VIRTIO_NET_CTRL_MQ_RSS_CONFIG) {
+        queues = virtio_net_handle_rss(n, iov, iov_cnt, true);
+        if (!queues) {
+            return VIRTIO_NET_ERR;
+        }
+    } else if (cmd == VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET) {
+        s = iov_to_buf(iov, iov_cnt, 0, &mq, sizeof(mq));
+        if (s != sizeof(mq)) {
+            return VIRTIO_NET_ERR;
+        }
+        queues = virtio_lduw_p(vdev, &mq.virtqueue_pairs);
+        /* Back to whatever queue the backend delivers to */
+        n->rss_data.redirect = false;
+    } else {
         return VIRTIO_NET_ERR;
     }
 
-    queues = virtio_lduw_p(vdev, &mq.virtqueue_pairs);
-
     if (queues < VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MIN ||
         queues > VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MAX ||
         queues > n->max_queues ||
@@ -884,6 +1062,13 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
     size_t s;
     struct iovec *iov, *iov2;
     unsigned int iov_cnt;
+    AioContext *ctx = NULL;
+
+    /* Commands change state that the rx and tx paths look at */
+    if (n->dataplane_started) {
+        ctx = iothread_get_aio_context(n->net_conf.iothread);
+        aio_context_acquire(ctx);
+    }
 
     for (;;) {
         elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
@@ -924,6 +1109,27 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
         g_free(iov2);
         g_free(elem);
     }
+
+    if (ctx) {
+        aio_context_release(ctx);
+    }
+}
+
+/* Called from the thread servicing the queue.  With the dataplane running
+ * the guest notifier is signalled directly, as the interrupt injection
+ * paths behind virtio_notify() expect the QEMU global mutex.
+ */
+static void virtio_net_notify(VirtIONet *n, VirtQueue *vq)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+
+    if (!n->dataplane_started) {
+        virtio_notify(vdev, vq);
+        return;
+    }
+    if (virtio_should_notify(vdev, vq)) {
+        event_notifier_set(virtio_queue_get_guest_notifier(vq));
+    }
 }
 
 /* RX */
@@ -932,8 +1138,19 @@ static void virtio_net_handle_rx(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     int queue_index = vq2q(virtio_get_queue_index(vq));
+    int i;
 
     qemu_flush_queued_packets(qemu_get_subqueue(n->nic, queue_index));
+
+    /* With RSS, packets waiting for this queue may be held back on the
+     * queue of the backend they came from */
+    if (n->rss_data.redirect) {
+        for (i = 0; i < n->backend_queues && i < n->curr_queues; i++) {
+            if (i != queue_index) {
+                qemu_flush_queued_packets(qemu_get_subqueue(n->nic, i));
+            }
+        }
+    }
 }
 
 static int virtio_net_can_receive(NetClientState *nc)
@@ -1089,15 +1306,172 @@ static int receive_filter(VirtIONet *n, const uint8_t *buf, int size)
     return 0;
 }
 
-static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf, size_t size)
+/* Receive-side scaling */
+
+/* Toeplitz hash of INPUT, as specified for RSS.  KEY must have 4 bytes
+ * more than INPUT.
+ */
+static uint32_t virtio_net_toeplitz(const uint8_t *key, const uint8_t *input,
+                                    size_t len)
+{
+    uint32_t hash = 0;
+    uint32_t window = ldl_be_p(key);
+    size_t i;
+    int bit;
+
+    for (i = 0; i < len; i++) {
+        for (bit = 7; bit >= 0; bit--) {
+            if (input[i] & (1 << bit)) {
+                hash ^= window;
+            }
+            window = (window << 1) | ((key[i + 4] >> bit) & 1);
+        }
+    }
+    return hash;
+}
+
+/* Gather the addresses and ports that the configured hash types cover
+ * into INPUT.  Returns the VIRTIO_NET_HASH_REPORT_* type, and the input
+ * length in *LEN.
+ */
+static uint16_t virtio_net_rss_input(VirtIONet *n, const uint8_t *buf,
+                                     size_t size, uint8_t *input, size_t *len)
+{
+    uint32_t types = n->rss_data.hash_types;
+    size_t l3 = ETH_HLEN, l4, addr_len;
+    uint16_t proto;
+    uint8_t l4_proto;
+    bool first_fragment = true;
+    uint16_t report;
+
+    if (size < ETH_HLEN) {
+        return VIRTIO_NET_HASH_REPORT_NONE;
+    }
+    proto = lduw_be_p(buf + 12);
+    if (proto == ETH_P_VLAN) {
+        if (size < ETH_HLEN + 4) {
+            return VIRTIO_NET_HASH_REPORT_NONE;
+        }
+        proto = lduw_be_p(buf + 16);
+        l3 += 4;
+    }
+
+    if (proto == ETH_P_IP) {
+        size_t ihl;
+
+        if (size < l3 + 20 || (buf[l3] >> 4) != 4) {
+            return VIRTIO_NET_HASH_REPORT_NONE;
+        }
+        ihl = (buf[l3] & 0xf) * 4;
+        l4 = l3 + MAX(ihl, 20);
+        l4_proto = buf[l3 + 9];
+        /* Only the first fragment has the ports */
+        first_fragment = !(lduw_be_p(buf + l3 + 6) & (IP_MF | IP_OFFMASK));
+        addr_len = 4;
+        memcpy(input, buf + l3 + 12, 2 * addr_len);
+
+        if (l4_proto == IP_PROTO_TCP && first_fragment &&
+            (types & VIRTIO_NET_RSS_HASH_TYPE_TCPv4)) {
+            report = VIRTIO_NET_HASH_REPORT_TCPv4;
+        } else if (l4_proto == IP_PROTO_UDP && first_fragment &&
+                   (types & VIRTIO_NET_RSS_HASH_TYPE_UDPv4)) {
+            report = VIRTIO_NET_HASH_REPORT_UDPv4;
+        } else if (types & VIRTIO_NET_RSS_HASH_TYPE_IPv4) {
+            report = VIRTIO_NET_HASH_REPORT_IPv4;
+        } else {
+            return VIRTIO_NET_HASH_REPORT_NONE;
+        }
+    } else if (proto == ETH_P_IPV6) {
+        if (size < l3 + 40 || (buf[l3] >> 4) != 6) {
+            return VIRTIO_NET_HASH_REPORT_NONE;
+        }
+        /* Extension headers are not walked, packets that have them only
+         * get the address hash */
+        l4 = l3 + 40;
+        l4_proto = buf[l3 + 6];
+        addr_len = 16;
+        memcpy(input, buf + l3 + 8, 2 * addr_len);
+
+        if (l4_proto == IP_PROTO_TCP &&
+            (types & VIRTIO_NET_RSS_HASH_TYPE_TCPv6)) {
+            report = VIRTIO_NET_HASH_REPORT_TCPv6;
+        } else if (l4_proto == IP_PROTO_UDP &&
+                   (types & VIRTIO_NET_RSS_HASH_TYPE_UDPv6)) {
+            report = VIRTIO_NET_HASH_REPORT_UDPv6;
+        } else if (types & VIRTIO_NET_RSS_HASH_TYPE_IPv6) {
+            report = VIRTIO_NET_HASH_REPORT_IPv6;
+        } else {
+            return VIRTIO_NET_HASH_REPORT_NONE;
+        }
+    } else {
+        return VIRTIO_NET_HASH_REPORT_NONE;
+    }
+
+    *len = 2 * addr_len;
+    if (report != VIRTIO_NET_HASH_REPORT_IPv4 &&
+        report != VIRTIO_NET_HASH_REPORT_IPv6) {
+        if (size < l4 + 4) {
+            return VIRTIO_NET_HASH_REPORT_NONE;
+        }
+        memcpy(input + *len, buf + l4, 4);
+        *len += 4;
+    }
+    return report;
+}
+
+/* Hash the packet in BUF, which starts with the host's vnet header.
+ * Returns the subqueue the packet is steered to, which is NC's unless
+ * RSS redirects it elsewhere.
+ */
+static NetClientState *virtio_net_process_rss(NetClientState *nc,
+                                              const uint8_t *buf, size_t size,
+                                              uint32_t *hash, uint16_t *report)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
-    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    uint8_t input[2 * 16 + 4];
+    size_t len = 0;
+    uint16_t index;
+
+    *hash = 0;
+    *report = virtio_net_rss_input(n, buf + n->host_hdr_len,
+                                   size - n->host_hdr_len, input, &len);
+    if (*report == VIRTIO_NET_HASH_REPORT_NONE) {
+        index = n->rss_data.default_queue;
+    } else {
+        *hash = virtio_net_toeplitz(n->rss_data.key, input, len);
+        index = n->rss_data.indirections_table[*hash &
+                                               (n->rss_data.indirections_len -
+                                                1)];
+    }
+
+    if (!n->rss_data.redirect || index >= n->curr_queues) {
+        return nc;
+    }
+    return qemu_get_subqueue(n->nic, index);
+}
+
+/* Place one packet in the rx ring of the queue it is steered to.  Its
+ * buffers are filled at used ring offsets following the queue's rx_used,
+ * which is advanced past them; publishing them with
+ * virtio_net_rx_push_used() is up to the caller.
+ */
+static ssize_t virtio_net_receive_one(NetClientState *nc, const uint8_t *buf,
+                                      size_t size)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     struct iovec mhdr_sg[VIRTQUEUE_MAX_SIZE];
     struct virtio_net_hdr_mrg_rxbuf mhdr;
     unsigned mhdr_cnt = 0;
     size_t offset, i, guest_offset;
+    uint32_t hash = 0;
+    uint16_t hash_report = VIRTIO_NET_HASH_REPORT_NONE;
+
+    if (n->rss_data.enabled && virtio_net_can_receive(nc)) {
+        nc = virtio_net_process_rss(nc, buf, size, &hash, &hash_report);
+    }
+    q = virtio_net_get_subqueue(nc);
 
     if (!virtio_net_can_receive(nc)) {
         return -1;
@@ -1150,6 +1524,17 @@ static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf, size_t
             }
 
             receive_header(n, sg, elem->in_num, buf, size);
+            if (n->rss_data.populate_hash) {
+                size_t hash_off = offsetof(struct virtio_net_hdr_v1_hash,
+                                           hash_value);
+                struct virtio_net_hdr_v1_hash hhdr;
+
+                virtio_stl_p(vdev, &hhdr.hash_value, hash);
+                virtio_stw_p(vdev, &hhdr.hash_report, hash_report);
+                hhdr.padding = 0;
+                iov_from_buf(sg, elem->in_num, hash_off, &hhdr.hash_value,
+                             sizeof(hhdr) - hash_off);
+            }
             offset = n->host_hdr_len;
             total += n->guest_hdr_len;
             guest_offset = n->guest_hdr_len;
@@ -1167,13 +1552,13 @@ static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf, size_t
          * Otherwise, drop it. */
         if (!n->mergeable_rx_bufs && offset < size) {
             virtqueue_discard(q->rx_vq, elem, total);
-            g_free(elem);
+            virtqueue_element_free(q->rx_vq, elem);
             return size;
         }
 
         /* signal other side */
-        virtqueue_fill(q->rx_vq, elem, total, i++);
-        g_free(elem);
+        virtqueue_fill(q->rx_vq, elem, total, q->rx_used + i++);
+        virtqueue_element_free(q->rx_vq, elem);
     }
 
     if (mhdr_cnt) {
@@ -1183,24 +1568,90 @@ static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf, size_t
                      &mhdr.num_buffers, sizeof mhdr.num_buffers);
     }
 
-    virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
-
+    q->rx_used += i;
     return size;
 }
 
+static void virtio_net_rx_push_used(VirtIONetQueue *q)
+{
+    if (q->rx_used) {
+        virtqueue_flush(q->rx_vq, q->rx_used);
+        q->rx_used = 0;
+        virtio_net_notify(q->n, q->rx_vq);
+    }
+}
+
+/* Publish what virtio_net_receive_one() placed for packets that came in
+ * on NC, which RSS may have spread over all the queues.
+ */
+static void virtio_net_rx_push_all(NetClientState *nc)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    int i;
+
+    if (!n->rss_data.redirect) {
+        virtio_net_rx_push_used(virtio_net_get_subqueue(nc));
+        return;
+    }
+    for (i = 0; i < n->curr_queues; i++) {
+        virtio_net_rx_push_used(&n->vqs[i]);
+    }
+}
+
+static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf, size_t size)
+{
+    ssize_t ret;
+
+    ret = virtio_net_receive_one(nc, buf, size);
+    virtio_net_rx_push_all(nc);
+    return ret;
+}
+
+/* Receive a burst of packets with a single used index update and guest
+ * notification.  Stops at the first packet that does not fit in the ring.
+ */
+static int virtio_net_receive_batch(NetClientState *nc,
+                                    const NetIOVPacket *pkts, int count)
+{
+    uint8_t *linear = NULL;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        const uint8_t *buf;
+        size_t size;
+
+        if (pkts[i].iovcnt == 1) {
+            buf = pkts[i].iov[0].iov_base;
+            size = pkts[i].iov[0].iov_len;
+        } else {
+            if (!linear) {
+                linear = g_malloc(NET_BUFSIZE);
+            }
+            size = iov_to_buf(pkts[i].iov, pkts[i].iovcnt, 0, linear,
+                              NET_BUFSIZE);
+            buf = linear;
+        }
+        if (virtio_net_receive_one(nc, buf, size) == 0) {
+            break;
+        }
+    }
+
+    virtio_net_rx_push_all(nc);
+    g_free(linear);
+    return i;
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q);
 
 static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q = virtio_net_get_subqueue(nc);
-    VirtIODevice *vdev = VIRTIO_DEVICE(n);
 
     virtqueue_push(q->tx_vq, q->async_tx.elem, 0);
-    virtio_notify(vdev, q->tx_vq);
+    virtio_net_notify(n, q->tx_vq);
 
-    g_free(q->async_tx.elem);
+    virtqueue_element_free(q->tx_vq, q->async_tx.elem);
     q->async_tx.elem = NULL;
 
     virtio_queue_set_notification(q->tx_vq, 1);
@@ -1208,12 +1659,140 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 }
 
 /* TX */
+static void virtio_net_tx_push_used(VirtIONetQueue *q, unsigned int count)
+{
+    if (count) {
+        virtqueue_flush(q->tx_vq, count);
+        virtio_net_notify(q->n, q->tx_vq);
+    }
+}
+
+/* Packets per VIRTIO_NET_TX_RATE_WINDOW above which tx=adaptive defers
+ * flushing to a bottom half, resp. to the tx timer.  A mode is left again
+ * once the rate drops below half its threshold.
+ */
+#define VIRTIO_NET_TX_RATE_WINDOW       (10 * SCALE_MS)
+#define VIRTIO_NET_TX_BH_THRESHOLD      100
+#define VIRTIO_NET_TX_TIMER_THRESHOLD   1000
+
+static void virtio_net_tx_update_mode(VirtIONetQueue *q, int32_t packets)
+{
+    int64_t now, elapsed;
+    uint64_t rate;
+
+    if (!q->tx_adaptive) {
+        return;
+    }
+    q->tx_window_packets += packets;
+
+    now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    elapsed = now - q->tx_window_start;
+    if (elapsed < VIRTIO_NET_TX_RATE_WINDOW) {
+        return;
+    }
+    rate = (uint64_t)q->tx_window_packets * VIRTIO_NET_TX_RATE_WINDOW /
+           elapsed;
+    q->tx_window_start = now;
+    q->tx_window_packets = 0;
+
+    switch (q->tx_mode) {
+    case VIRTIO_NET_TX_IMMEDIATE:
+        if (rate >= VIRTIO_NET_TX_TIMER_THRESHOLD) {
+            q->tx_mode = VIRTIO_NET_TX_TIMER;
+        } else if (rate >= VIRTIO_NET_TX_BH_THRESHOLD) {
+            q->tx_mode = VIRTIO_NET_TX_BH;
+        }
+        break;
+    case VIRTIO_NET_TX_BH:
+        if (rate >= VIRTIO_NET_TX_TIMER_THRESHOLD) {
+            q->tx_mode = VIRTIO_NET_TX_TIMER;
+        } else if (rate < VIRTIO_NET_TX_BH_THRESHOLD / 2) {
+            q->tx_mode = VIRTIO_NET_TX_IMMEDIATE;
+        }
+        break;
+    case VIRTIO_NET_TX_TIMER:
+        if (rate < VIRTIO_NET_TX_BH_THRESHOLD / 2) {
+            q->tx_mode = VIRTIO_NET_TX_IMMEDIATE;
+        } else if (rate < VIRTIO_NET_TX_TIMER_THRESHOLD / 2) {
+            q->tx_mode = VIRTIO_NET_TX_BH;
+        }
+        break;
+    }
+}
+
+/* Packets handed to the net layer in one qemu_sendv_packets_async() call */
+#define VIRTIO_NET_TX_BATCH 32
+
+/* Queue pairs past backend_queues only exist for RSS, and what the guest
+ * sends on them goes out through the backend's first queue.  They have no
+ * completion callback of their own, so whatever the backend cannot take
+ * right away is copied into the net queue instead of being held in the
+ * ring.  Always takes all packets.
+ */
+static int virtio_net_tx_send_shared(VirtIONet *n, const NetIOVPacket *pkts,
+                                     int count)
+{
+    NetClientState *nc = qemu_get_queue(n->nic);
+    int i;
+
+    i = qemu_sendv_packets_async(nc, pkts, count, NULL);
+    for (i++; i < count; i++) {
+        qemu_sendv_packet_async(nc, pkts[i].iov, pkts[i].iovcnt, NULL);
+    }
+    return count;
+}
+
+/* Send the packets collected in BATCH.  Returns false if the backend could
+ * not take all of them: the first one it refused becomes async_tx.elem,
+ * and the ones after it are given back to the ring.
+ */
+static bool virtio_net_tx_send_batch(VirtIONetQueue *q,
+                                     VirtQueueElement **batch,
+                                     const NetIOVPacket *pkts, int count,
+                                     unsigned int *num_used)
+{
+    VirtIONet *n = q->n;
+    int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
+    int i, sent;
+
+    if (!count) {
+        return true;
+    }
+    if (queue_index >= n->backend_queues) {
+        sent = virtio_net_tx_send_shared(n, pkts, count);
+    } else {
+        sent = qemu_sendv_packets_async(qemu_get_subqueue(n->nic, queue_index),
+                                        pkts, count, virtio_net_tx_complete);
+    }
+    for (i = 0; i < sent; i++) {
+        virtqueue_fill(q->tx_vq, batch[i], 0, (*num_used)++);
+        virtqueue_element_free(q->tx_vq, batch[i]);
+    }
+    if (sent == count) {
+        return true;
+    }
+
+    /* Newest first, virtqueue_discard() rewinds the avail index */
+    for (i = count - 1; i > sent; i--) {
+        virtqueue_discard(q->tx_vq, batch[i], 0);
+        virtqueue_element_free(q->tx_vq, batch[i]);
+    }
+    virtio_queue_set_notification(q->tx_vq, 0);
+    q->async_tx.elem = batch[sent];
+    return false;
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     VirtQueueElement *elem;
     int32_t num_packets = 0;
+    /* Completed packets whose used entries are not yet published */
+    unsigned int num_used = 0;
+    VirtQueueElement *batch[VIRTIO_NET_TX_BATCH];
+    NetIOVPacket pkts[VIRTIO_NET_TX_BATCH];
+    int num_batched = 0;
     int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
         return num_packets;
@@ -1242,6 +1821,37 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
             exit(1);
         }
 
+        /* Common case: the guest's buffers go out unmodified, so they can
+         * be collected and sent as a burst.  This depends on the device
+         * configuration only, so packets are never mixed with the ones
+         * sent one by one below.
+         */
+        if (!n->needs_vnet_hdr_swap &&
+            n->host_hdr_len == n->guest_hdr_len) {
+            if (n->has_vnet_hdr && iov_size(out_sg, out_num) <
+                n->guest_hdr_len) {
+                error_report("virtio-net header incorrect");
+                exit(1);
+            }
+            batch[num_batched] = elem;
+            pkts[num_batched].iov = out_sg;
+            pkts[num_batched].iovcnt = out_num;
+            num_batched++;
+            num_packets++;
+            if (num_batched == VIRTIO_NET_TX_BATCH ||
+                num_packets >= n->tx_burst) {
+                if (!virtio_net_tx_send_batch(q, batch, pkts, num_batched,
+                                              &num_used)) {
+                    goto busy;
+                }
+                num_batched = 0;
+            }
+            if (num_packets >= n->tx_burst) {
+                break;
+            }
+            continue;
+        }
+
         if (n->has_vnet_hdr) {
             if (iov_to_buf(out_sg, out_num, 0, &mhdr, n->guest_hdr_len) <
                 n->guest_hdr_len) {
@@ -1279,24 +1889,39 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
             out_sg = sg;
         }
 
+        if (queue_index >= n->backend_queues) {
+            NetIOVPacket pkt = { .iov = out_sg, .iovcnt = out_num };
+
+            virtio_net_tx_send_shared(n, &pkt, 1);
+            goto drop;
+        }
         ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
                                       out_sg, out_num, virtio_net_tx_complete);
         if (ret == 0) {
             virtio_queue_set_notification(q->tx_vq, 0);
             q->async_tx.elem = elem;
-            return -EBUSY;
+            goto busy;
         }
 
 drop:
-        virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
-        g_free(elem);
+        virtqueue_fill(q->tx_vq, elem, 0, num_used++);
+        virtqueue_element_free(q->tx_vq, elem);
 
         if (++num_packets >= n->tx_burst) {
             break;
         }
     }
+    if (!virtio_net_tx_send_batch(q, batch, pkts, num_batched, &num_used)) {
+        goto busy;
+    }
+    virtio_net_tx_push_used(q, num_used);
+    virtio_net_tx_update_mode(q, num_packets);
     return num_packets;
+
+busy:
+    virtio_net_tx_push_used(q, num_used);
+    virtio_net_tx_update_mode(q, num_used);
+    return -EBUSY;
 }
 
 static void virtio_net_handle_tx_timer(VirtIODevice *vdev, VirtQueue *vq)
@@ -1340,6 +1965,41 @@ static void virtio_net_handle_tx_bh(VirtIODevice *vdev, VirtQueue *vq)
     qemu_bh_schedule(q->tx_bh);
 }
 
+static void virtio_net_handle_tx_adaptive(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    VirtIONetQueue *q = &n->vqs[vq2q(virtio_get_queue_index(vq))];
+
+    switch (q->tx_mode) {
+    case VIRTIO_NET_TX_TIMER:
+        virtio_net_handle_tx_timer(vdev, vq);
+        return;
+    case VIRTIO_NET_TX_BH:
+        virtio_net_handle_tx_bh(vdev, vq);
+        return;
+    case VIRTIO_NET_TX_IMMEDIATE:
+        break;
+    }
+
+    /* A bottom half or timer from a previous mode is still pending */
+    if (q->tx_waiting) {
+        return;
+    }
+    /* This happens when device was stopped but VCPU wasn't. */
+    if (!vdev->vm_running) {
+        q->tx_waiting = 1;
+        return;
+    }
+
+    /* At low rates deferring only adds latency; leave whatever does not
+     * fit in a burst to the bottom half. */
+    if (virtio_net_flush_tx(q) >= n->tx_burst) {
+        virtio_queue_set_notification(vq, 0);
+        qemu_bh_schedule(q->tx_bh);
+        q->tx_waiting = 1;
+    }
+}
+
 static void virtio_net_tx_timer(void *opaque)
 {
     VirtIONetQueue *q = opaque;
@@ -1408,6 +2068,168 @@ static void virtio_net_tx_bh(void *opaque)
     }
 }
 
+/* Host notifier handler for the tx virtqueues when they are serviced by
+ * an IOThread; in the main loop each tx=... mode installs its own.
+ */
+static void virtio_net_handle_tx(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    VirtIONetQueue *q = &n->vqs[vq2q(virtio_get_queue_index(vq))];
+
+    if (q->tx_adaptive) {
+        virtio_net_handle_tx_adaptive(vdev, vq);
+    } else if (q->tx_mode == VIRTIO_NET_TX_TIMER) {
+        virtio_net_handle_tx_timer(vdev, vq);
+    } else {
+        virtio_net_handle_tx_bh(vdev, vq);
+    }
+}
+
+/* Recreate the tx timer and bottom half of @q in @ctx, rearming them if
+ * a flush was pending.  Called with @q quiescent.
+ */
+static void virtio_net_set_tx_context(VirtIONetQueue *q, AioContext *ctx)
+{
+    VirtIONet *n = q->n;
+
+    if (q->tx_timer) {
+        timer_del(q->tx_timer);
+        timer_free(q->tx_timer);
+        q->tx_timer = aio_timer_new(ctx, QEMU_CLOCK_VIRTUAL, SCALE_NS,
+                                    virtio_net_tx_timer, q);
+    }
+    if (q->tx_bh) {
+        qemu_bh_delete(q->tx_bh);
+        q->tx_bh = aio_bh_new(ctx, virtio_net_tx_bh, q);
+    }
+
+    if (!q->tx_waiting) {
+        return;
+    }
+    if (q->tx_mode == VIRTIO_NET_TX_TIMER) {
+        timer_mod(q->tx_timer,
+                  qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + n->tx_timeout);
+    } else {
+        qemu_bh_schedule(q->tx_bh);
+    }
+}
+
+/* Dataplane: with iothread=... set, the rx/tx virtqueues, their timers and
+ * bottom halves and the backends' file descriptors are all serviced by the
+ * IOThread's AioContext.  The control virtqueue stays in the main loop and
+ * takes the AioContext lock around its commands.
+ */
+
+static bool virtio_net_dataplane_wanted(VirtIONet *n, uint8_t status)
+{
+    int queues = n->multiqueue ? n->max_queues : 1;
+    int i;
+
+    if (!n->net_conf.iothread || !virtio_net_started(n, status)) {
+        return false;
+    }
+    /* vhost has its own notifier plumbing */
+    if (get_vhost_net(qemu_get_queue(n->nic)->peer)) {
+        return false;
+    }
+    /* Filters expect to run in the main loop; netfilter_complete refuses
+     * new ones while the backend is attached to the IOThread */
+    for (i = 0; i < MIN(queues, n->backend_queues); i++) {
+        NetClientState *nc = qemu_get_subqueue(n->nic, i);
+
+        if (!nc->peer || !nc->peer->info->set_aio_context ||
+            !QTAILQ_EMPTY(&nc->filters) ||
+            !QTAILQ_EMPTY(&nc->peer->filters)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Context: QEMU global mutex held */
+static void virtio_net_dataplane_start(VirtIONet *n)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    AioContext *ctx = iothread_get_aio_context(n->net_conf.iothread);
+    int queues = n->multiqueue ? n->max_queues : 1;
+    int i, r;
+
+    r = k->set_guest_notifiers(qbus->parent, queues * 2, true);
+    if (r != 0) {
+        error_report("virtio-net failed to set guest notifiers (%d), "
+                     "falling back on the main loop", r);
+        return;
+    }
+    for (i = 0; i < queues * 2; i++) {
+        r = k->set_host_notifier(qbus->parent, i, true);
+        if (r != 0) {
+            error_report("virtio-net failed to set host notifier (%d), "
+                         "falling back on the main loop", r);
+            while (--i >= 0) {
+                k->set_host_notifier(qbus->parent, i, false);
+            }
+            k->set_guest_notifiers(qbus->parent, queues * 2, false);
+            return;
+        }
+    }
+    n->dataplane_started = true;
+
+    aio_context_acquire(ctx);
+    for (i = 0; i < queues; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+        NetClientState *peer = qemu_get_subqueue(n->nic, i)->peer;
+
+        virtio_net_set_tx_context(q, ctx);
+        if (peer) {
+            peer->info->set_aio_context(peer, ctx);
+            peer->iothread_attached = 1;
+        }
+        virtio_queue_aio_set_host_notifier_handler(q->rx_vq, ctx,
+                                                   virtio_net_handle_rx);
+        virtio_queue_aio_set_host_notifier_handler(q->tx_vq, ctx,
+                                                   virtio_net_handle_tx);
+
+        /* Pick up buffers the guest made available in the meantime */
+        event_notifier_set(virtio_queue_get_host_notifier(q->rx_vq));
+        event_notifier_set(virtio_queue_get_host_notifier(q->tx_vq));
+    }
+    aio_context_release(ctx);
+}
+
+/* Context: QEMU global mutex held */
+static void virtio_net_dataplane_stop(VirtIONet *n)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    AioContext *ctx = iothread_get_aio_context(n->net_conf.iothread);
+    int queues = n->multiqueue ? n->max_queues : 1;
+    int i;
+
+    aio_context_acquire(ctx);
+    for (i = 0; i < queues; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+        NetClientState *peer = qemu_get_subqueue(n->nic, i)->peer;
+
+        virtio_queue_aio_set_host_notifier_handler(q->rx_vq, ctx, NULL);
+        virtio_queue_aio_set_host_notifier_handler(q->tx_vq, ctx, NULL);
+        if (peer && peer->info->set_aio_context) {
+            peer->info->set_aio_context(peer, NULL);
+            peer->iothread_attached = 0;
+        }
+        virtio_net_set_tx_context(q, qemu_get_aio_context());
+    }
+    aio_context_release(ctx);
+
+    for (i = 0; i < queues * 2; i++) {
+        k->set_host_notifier(qbus->parent, i, false);
+    }
+    k->set_guest_notifiers(qbus->parent, queues * 2, false);
+    n->dataplane_started = false;
+}
+
 static void virtio_net_add_queue(VirtIONet *n, int index)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
@@ -1419,10 +2241,23 @@ static void virtio_net_add_queue(VirtIONet *n, int index)
         n->vqs[index].tx_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
                                               virtio_net_tx_timer,
                                               &n->vqs[index]);
+        n->vqs[index].tx_mode = VIRTIO_NET_TX_TIMER;
+    } else if (n->net_conf.tx && !strcmp(n->net_conf.tx, "adaptive")) {
+        n->vqs[index].tx_vq =
+            virtio_add_queue(vdev, 256, virtio_net_handle_tx_adaptive);
+        n->vqs[index].tx_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                              virtio_net_tx_timer,
+                                              &n->vqs[index]);
+        n->vqs[index].tx_bh = qemu_bh_new(virtio_net_tx_bh, &n->vqs[index]);
+        n->vqs[index].tx_mode = VIRTIO_NET_TX_IMMEDIATE;
+        n->vqs[index].tx_adaptive = true;
+        n->vqs[index].tx_window_start = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+        n->vqs[index].tx_window_packets = 0;
     } else {
         n->vqs[index].tx_vq =
             virtio_add_queue(vdev, 256, virtio_net_handle_tx_bh);
         n->vqs[index].tx_bh = qemu_bh_new(virtio_net_tx_bh, &n->vqs[index]);
+        n->vqs[index].tx_mode = VIRTIO_NET_TX_BH;
     }
 
     n->vqs[index].tx_waiting = 0;
@@ -1441,8 +2276,11 @@ static void virtio_net_del_queue(VirtIONet *n, int index)
     if (q->tx_timer) {
         timer_del(q->tx_timer);
         timer_free(q->tx_timer);
-    } else {
+        q->tx_timer = NULL;
+    }
+    if (q->tx_bh) {
         qemu_bh_delete(q->tx_bh);
+        q->tx_bh = NULL;
     }
     virtio_del_queue(vdev, index * 2 + 1);
 }
@@ -1536,6 +2374,22 @@ static void virtio_net_save_device(VirtIODevice *vdev, QEMUFile *f)
     if (virtio_vdev_has_feature(vdev, VIRTIO_NET_F_CTRL_GUEST_OFFLOADS)) {
         qemu_put_be64(f, n->curr_guest_offloads);
     }
+
+    /* The high feature bits are loaded after the device state, so key
+     * the RSS section on the host features, which both ends share.
+     */
+    if (n->host_features & ((1ULL << VIRTIO_NET_F_RSS) |
+                            (1ULL << VIRTIO_NET_F_HASH_REPORT))) {
+        qemu_put_byte(f, n->rss_data.enabled);
+        qemu_put_byte(f, n->rss_data.redirect);
+        qemu_put_be32(f, n->rss_data.hash_types);
+        qemu_put_buffer(f, n->rss_data.key, VIRTIO_NET_RSS_MAX_KEY_SIZE);
+        qemu_put_be16(f, n->rss_data.indirections_len);
+        for (i = 0; i < n->rss_data.indirections_len; i++) {
+            qemu_put_be16(f, n->rss_data.indirections_table[i]);
+        }
+        qemu_put_be16(f, n->rss_data.default_queue);
+    }
 }
 
 static int virtio_net_load(QEMUFile *f, void *opaque, int version_id)
@@ -1649,6 +2503,44 @@ static int virtio_net_load_device(VirtIODevice *vdev, QEMUFile *f,
         n->curr_guest_offloads = virtio_net_supported_guest_offloads(n);
     }
 
+    if (n->host_features & ((1ULL << VIRTIO_NET_F_RSS) |
+                            (1ULL << VIRTIO_NET_F_HASH_REPORT))) {
+        VirtioNetRssData *rss = &n->rss_data;
+
+        rss->enabled = qemu_get_byte(f);
+        rss->redirect = qemu_get_byte(f);
+        rss->hash_types = qemu_get_be32(f);
+        qemu_get_buffer(f, rss->key, VIRTIO_NET_RSS_MAX_KEY_SIZE);
+        rss->indirections_len = qemu_get_be16(f);
+        if (rss->indirections_len > VIRTIO_NET_RSS_MAX_TABLE_LEN ||
+            (rss->indirections_len &&
+             !is_power_of_2(rss->indirections_len))) {
+            error_report("virtio-net: invalid RSS indirection table "
+                         "length %u", rss->indirections_len);
+            return -1;
+        }
+        g_free(rss->indirections_table);
+        rss->indirections_table = g_new(uint16_t, rss->indirections_len);
+        for (i = 0; i < rss->indirections_len; i++) {
+            rss->indirections_table[i] = qemu_get_be16(f);
+            if (rss->indirections_table[i] >= n->max_queues) {
+                error_report("virtio-net: RSS queue %u out of range",
+                             rss->indirections_table[i]);
+                return -1;
+            }
+        }
+        rss->default_queue = qemu_get_be16(f);
+        if (rss->default_queue >= n->max_queues) {
+            error_report("virtio-net: RSS default queue %u out of range",
+                         rss->default_queue);
+            return -1;
+        }
+        if (rss->enabled && !rss->indirections_len) {
+            error_report("virtio-net: RSS enabled without a table");
+            return -1;
+        }
+    }
+
     if (peer_has_vnet_hdr(n)) {
         virtio_net_apply_guest_offloads(n);
     }
@@ -1684,6 +2576,7 @@ static NetClientInfo net_virtio_info = {
     .size = sizeof(NICState),
     .can_receive = virtio_net_can_receive,
     .receive = virtio_net_receive,
+    .receive_iov_batch = virtio_net_receive_batch,
     .link_status_changed = virtio_net_set_link_status,
     .query_rx_filter = virtio_net_query_rxfilter,
 };
@@ -1743,6 +2636,19 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
     virtio_init(vdev, "virtio-net", VIRTIO_ID_NET, n->config_size);
 
     n->max_queues = MAX(n->nic_conf.peers.queues, 1);
+    n->backend_queues = n->max_queues;
+    if (n->net_conf.queues > n->max_queues) {
+        /* Extra queue pairs that only RSS feeds */
+        if (n->max_queues > 1 ||
+            get_vhost_net(n->nic_conf.peers.ncs[0])) {
+            error_setg(errp, "virtio-net: queues=%" PRIu16 " needs a "
+                       "single queue backend without vhost",
+                       n->net_conf.queues);
+            virtio_cleanup(vdev);
+            return;
+        }
+        n->max_queues = n->net_conf.queues;
+    }
     if (n->max_queues * 2 + 1 > VIRTIO_QUEUE_MAX) {
         error_setg(errp, "Invalid number of queues (= %" PRIu32 "), "
                    "must be a positive integer less than %d.",
@@ -1750,14 +2656,38 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
         virtio_cleanup(vdev);
         return;
     }
+
+    if (n->net_conf.iothread) {
+        BusState *qbus = qdev_get_parent_bus(dev);
+        VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+
+        if (!k->set_guest_notifiers || !k->set_host_notifier) {
+            error_setg(errp, "device is incompatible with iothread "
+                       "(transport does not support notifiers)");
+            virtio_cleanup(vdev);
+            return;
+        }
+        for (i = 0; i < n->backend_queues; i++) {
+            NetClientState *peer = n->nic_conf.peers.ncs[i];
+
+            if (!peer || !peer->info->set_aio_context) {
+                error_setg(errp, "iothread is only supported with "
+                           "tap and shm backends");
+                virtio_cleanup(vdev);
+                return;
+            }
+        }
+    }
+
     n->vqs = g_malloc0(sizeof(VirtIONetQueue) * n->max_queues);
     n->curr_queues = 1;
     n->tx_timeout = n->net_conf.txtimer;
 
     if (n->net_conf.tx && strcmp(n->net_conf.tx, "timer")
-                       && strcmp(n->net_conf.tx, "bh")) {
-        error_report("virtio-net: "
-                     "Unknown option tx=%s, valid options: \"timer\" \"bh\"",
+                       && strcmp(n->net_conf.tx, "bh")
+                       && strcmp(n->net_conf.tx, "adaptive")) {
+        error_report("virtio-net: Unknown option tx=%s, "
+                     "valid options: \"timer\" \"bh\" \"adaptive\"",
                      n->net_conf.tx);
         error_report("Defaulting to \"bh\"");
     }
@@ -1773,6 +2703,9 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
     n->announce_timer = timer_new_ms(QEMU_CLOCK_VIRTUAL,
                                      virtio_net_announce_timer, n);
 
+    /* The NIC gets one subqueue per queue pair, including any that RSS
+     * feeds without a peer */
+    n->nic_conf.peers.queues = n->max_queues;
     if (n->netclient_type) {
         /*
          * Happen when virtio_net_set_netclient_name has been called.
@@ -1831,6 +2764,8 @@ static void virtio_net_device_unrealize(DeviceState *dev, Error **errp)
 
     g_free(n->mac_table.macs);
     g_free(n->vlans);
+    g_free(n->rss_data.indirections_table);
+    n->rss_data.indirections_table = NULL;
 
     max_queues = n->multiqueue ? n->max_queues : 1;
     for (i = 0; i < max_queues; i++) {
@@ -1853,56 +2788,66 @@ static void virtio_net_instance_init(Object *obj)
      * Can be overriden with virtio_net_set_config_size.
      */
     n->config_size = sizeof(struct virtio_net_config);
+    object_property_add_link(obj, "iothread", TYPE_IOTHREAD,
+                             (Object **)&n->net_conf.iothread,
+                             qdev_prop_allow_set_link_before_realize,
+                             OBJ_PROP_LINK_UNREF_ON_RELEASE, NULL);
     device_add_bootindex_property(obj, &n->nic_conf.bootindex,
                                   "bootindex", "/ethernet-phy@0",
                                   DEVICE(n), NULL);
 }
 
 static Property virtio_net_properties[] = {
-    DEFINE_PROP_BIT("csum", VirtIONet, host_features, VIRTIO_NET_F_CSUM, true),
-    DEFINE_PROP_BIT("guest_csum", VirtIONet, host_features,
-                    VIRTIO_NET_F_GUEST_CSUM, true),
-    DEFINE_PROP_BIT("gso", VirtIONet, host_features, VIRTIO_NET_F_GSO, true),
-    DEFINE_PROP_BIT("guest_tso4", VirtIONet, host_features,
-                    VIRTIO_NET_F_GUEST_TSO4, true),
-    DEFINE_PROP_BIT("guest_tso6", VirtIONet, host_features,
-                    VIRTIO_NET_F_GUEST_TSO6, true),
-    DEFINE_PROP_BIT("guest_ecn", VirtIONet, host_features,
-                    VIRTIO_NET_F_GUEST_ECN, true),
-    DEFINE_PROP_BIT("guest_ufo", VirtIONet, host_features,
-                    VIRTIO_NET_F_GUEST_UFO, true),
-    DEFINE_PROP_BIT("guest_announce", VirtIONet, host_features,
-                    VIRTIO_NET_F_GUEST_ANNOUNCE, true),
-    DEFINE_PROP_BIT("host_tso4", VirtIONet, host_features,
-                    VIRTIO_NET_F_HOST_TSO4, true),
-    DEFINE_PROP_BIT("host_tso6", VirtIONet, host_features,
-                    VIRTIO_NET_F_HOST_TSO6, true),
-    DEFINE_PROP_BIT("host_ecn", VirtIONet, host_features,
-                    VIRTIO_NET_F_HOST_ECN, true),
-    DEFINE_PROP_BIT("host_ufo", VirtIONet, host_features,
-                    VIRTIO_NET_F_HOST_UFO, true),
-    DEFINE_PROP_BIT("mrg_rxbuf", VirtIONet, host_features,
-                    VIRTIO_NET_F_MRG_RXBUF, true),
-    DEFINE_PROP_BIT("status", VirtIONet, host_features,
-                    VIRTIO_NET_F_STATUS, true),
-    DEFINE_PROP_BIT("ctrl_vq", VirtIONet, host_features,
-                    VIRTIO_NET_F_CTRL_VQ, true),
-    DEFINE_PROP_BIT("ctrl_rx", VirtIONet, host_features,
-                    VIRTIO_NET_F_CTRL_RX, true),
-    DEFINE_PROP_BIT("ctrl_vlan", VirtIONet, host_features,
-                    VIRTIO_NET_F_CTRL_VLAN, true),
-    DEFINE_PROP_BIT("ctrl_rx_extra", VirtIONet, host_features,
-                    VIRTIO_NET_F_CTRL_RX_EXTRA, true),
-    DEFINE_PROP_BIT("ctrl_mac_addr", VirtIONet, host_features,
-                    VIRTIO_NET_F_CTRL_MAC_ADDR, true),
-    DEFINE_PROP_BIT("ctrl_guest_offloads", VirtIONet, host_features,
-                    VIRTIO_NET_F_CTRL_GUEST_OFFLOADS, true),
-    DEFINE_PROP_BIT("mq", VirtIONet, host_features, VIRTIO_NET_F_MQ, false),
+    DEFINE_PROP_BIT64("csum", VirtIONet, host_features,
+                      VIRTIO_NET_F_CSUM, true),
+    DEFINE_PROP_BIT64("guest_csum", VirtIONet, host_features,
+                      VIRTIO_NET_F_GUEST_CSUM, true),
+    DEFINE_PROP_BIT64("gso", VirtIONet, host_features, VIRTIO_NET_F_GSO, true),
+    DEFINE_PROP_BIT64("guest_tso4", VirtIONet, host_features,
+                      VIRTIO_NET_F_GUEST_TSO4, true),
+    DEFINE_PROP_BIT64("guest_tso6", VirtIONet, host_features,
+                      VIRTIO_NET_F_GUEST_TSO6, true),
+    DEFINE_PROP_BIT64("guest_ecn", VirtIONet, host_features,
+                      VIRTIO_NET_F_GUEST_ECN, true),
+    DEFINE_PROP_BIT64("guest_ufo", VirtIONet, host_features,
+                      VIRTIO_NET_F_GUEST_UFO, true),
+    DEFINE_PROP_BIT64("guest_announce", VirtIONet, host_features,
+                      VIRTIO_NET_F_GUEST_ANNOUNCE, true),
+    DEFINE_PROP_BIT64("host_tso4", VirtIONet, host_features,
+                      VIRTIO_NET_F_HOST_TSO4, true),
+    DEFINE_PROP_BIT64("host_tso6", VirtIONet, host_features,
+                      VIRTIO_NET_F_HOST_TSO6, true),
+    DEFINE_PROP_BIT64("host_ecn", VirtIONet, host_features,
+                      VIRTIO_NET_F_HOST_ECN, true),
+    DEFINE_PROP_BIT64("host_ufo", VirtIONet, host_features,
+                      VIRTIO_NET_F_HOST_UFO, true),
+    DEFINE_PROP_BIT64("mrg_rxbuf", VirtIONet, host_features,
+                      VIRTIO_NET_F_MRG_RXBUF, true),
+    DEFINE_PROP_BIT64("status", VirtIONet, host_features,
+                      VIRTIO_NET_F_STATUS, true),
+    DEFINE_PROP_BIT64("ctrl_vq", VirtIONet, host_features,
+                      VIRTIO_NET_F_CTRL_VQ, true),
+    DEFINE_PROP_BIT64("ctrl_rx", VirtIONet, host_features,
+                      VIRTIO_NET_F_CTRL_RX, true),
+    DEFINE_PROP_BIT64("ctrl_vlan", VirtIONet, host_features,
+                      VIRTIO_NET_F_CTRL_VLAN, true),
+    DEFINE_PROP_BIT64("ctrl_rx_extra", VirtIONet, host_features,
+                      VIRTIO_NET_F_CTRL_RX_EXTRA, true),
+    DEFINE_PROP_BIT64("ctrl_mac_addr", VirtIONet, host_features,
+                      VIRTIO_NET_F_CTRL_MAC_ADDR, true),
+    DEFINE_PROP_BIT64("ctrl_guest_offloads", VirtIONet, host_features,
+                      VIRTIO_NET_F_CTRL_GUEST_OFFLOADS, true),
+    DEFINE_PROP_BIT64("mq", VirtIONet, host_features, VIRTIO_NET_F_MQ, false),
+    DEFINE_PROP_BIT64("rss", VirtIONet, host_features,
+                      VIRTIO_NET_F_RSS, false),
+    DEFINE_PROP_BIT64("hash", VirtIONet, host_features,
+                      VIRTIO_NET_F_HASH_REPORT, false),
     DEFINE_NIC_PROPERTIES(VirtIONet, nic_conf),
     DEFINE_PROP_UINT32("x-txtimer", VirtIONet, net_conf.txtimer,
                        TX_TIMER_INTERVAL),
     DEFINE_PROP_INT32("x-txburst", VirtIONet, net_conf.txburst, TX_BURST),
     DEFINE_PROP_STRING("tx", VirtIONet, net_conf.tx),
+    DEFINE_PROP_UINT16("queues", VirtIONet, net_conf.queues, 0),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -26,17 +26,28 @@
 #include <linux/vhost.h>
 
 #define VHOST_MEMORY_MAX_NREGIONS    8
+/* Cap on what VHOST_USER_GET_MAX_MEM_SLOTS may raise the limit to */
+#define VHOST_USER_MAX_RAM_SLOTS     512
 #define VHOST_USER_F_PROTOCOL_FEATURES 30
 
+/* Feature bits and request numbers follow the assignments of the
+ * vhost-user specification, which leaves gaps for messages we do not
+ * implement.
+ */
 enum VhostUserProtocolFeature {
     VHOST_USER_PROTOCOL_F_MQ = 0,
     VHOST_USER_PROTOCOL_F_LOG_SHMFD = 1,
     VHOST_USER_PROTOCOL_F_RARP = 2,
-
-    VHOST_USER_PROTOCOL_F_MAX
+    VHOST_USER_PROTOCOL_F_CONFIG = 9,
+    VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS = 15,
 };
 
-#define VHOST_USER_PROTOCOL_FEATURE_MASK ((1 << VHOST_USER_PROTOCOL_F_MAX) - 1)
+#define VHOST_USER_PROTOCOL_FEATURE_MASK \
+    ((1ULL << VHOST_USER_PROTOCOL_F_MQ) | \
+     (1ULL << VHOST_USER_PROTOCOL_F_LOG_SHMFD) | \
+     (1ULL << VHOST_USER_PROTOCOL_F_RARP) | \
+     (1ULL << VHOST_USER_PROTOCOL_F_CONFIG) | \
+     (1ULL << VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS))
 
 typedef enum VhostUserRequest {
     VHOST_USER_NONE = 0,
@@ -59,6 +70,10 @@ typedef enum VhostUserRequest {
     VHOST_USER_GET_QUEUE_NUM = 17,
     VHOST_USER_SET_VRING_ENABLE = 18,
     VHOST_USER_SEND_RARP = 19,
+    VHOST_USER_GET_CONFIG = 24,
+    VHOST_USER_GET_MAX_MEM_SLOTS = 36,
+    VHOST_USER_ADD_MEM_REG = 37,
+    VHOST_USER_REM_MEM_REG = 38,
     VHOST_USER_MAX
 } VhostUserRequest;
 
@@ -75,11 +90,28 @@ typedef struct VhostUserMemory {
     VhostUserMemoryRegion regions[VHOST_MEMORY_MAX_NREGIONS];
 } VhostUserMemory;
 
+typedef struct VhostUserMemRegMsg {
+    uint64_t padding;
+    VhostUserMemoryRegion region;
+} VhostUserMemRegMsg;
+
 typedef struct VhostUserLog {
     uint64_t mmap_size;
     uint64_t mmap_offset;
 } VhostUserLog;
 
+#define VHOST_USER_MAX_CONFIG_SIZE 256
+
+typedef struct VhostUserConfig {
+    uint32_t offset;
+    uint32_t size;
+    uint32_t flags;
+    uint8_t region[VHOST_USER_MAX_CONFIG_SIZE];
+} VhostUserConfig;
+
+/* Only config_len bytes of region[] are sent */
+#define VHOST_USER_CONFIG_HDR_SIZE (offsetof(VhostUserConfig, region))
+
 typedef struct VhostUserMsg {
     VhostUserRequest request;
 
@@ -94,7 +126,9 @@ typedef struct VhostUserMsg {
         struct vhost_vring_state state;
         struct vhost_vring_addr addr;
         VhostUserMemory memory;
+        VhostUserMemRegMsg mem_reg;
         VhostUserLog log;
+        VhostUserConfig config;
     } payload;
 } QEMU_PACKED VhostUserMsg;
 
@@ -108,6 +142,15 @@ static VhostUserMsg m __attribute__ ((unused));
 /* The version of the protocol we support */
 #define VHOST_USER_VERSION    (0x1)
 
+struct vhost_user {
+    CharDriverState *chr;
+    /* With VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS: the regions the
+     * backend has mapped, and how many it can map */
+    uint64_t max_mem_slots;
+    int num_shadow_regions;
+    VhostUserMemoryRegion *shadow_regions;
+};
+
 static bool ioeventfd_enabled(void)
 {
     return kvm_enabled() && kvm_eventfds_enabled();
@@ -115,7 +158,8 @@ static bool ioeventfd_enabled(void)
 
 static int vhost_user_read(struct vhost_dev *dev, VhostUserMsg *msg)
 {
-    CharDriverState *chr = dev->opaque;
+    struct vhost_user *u = dev->opaque;
+    CharDriverState *chr = u->chr;
     uint8_t *p = (uint8_t *) msg;
     int r, size = VHOST_USER_HDR_SIZE;
 
@@ -166,6 +210,8 @@ static bool vhost_user_one_time_request(VhostUserRequest request)
     case VHOST_USER_RESET_OWNER:
     case VHOST_USER_SET_MEM_TABLE:
     case VHOST_USER_GET_QUEUE_NUM:
+    case VHOST_USER_ADD_MEM_REG:
+    case VHOST_USER_REM_MEM_REG:
         return true;
     default:
         return false;
@@ -176,7 +222,8 @@ static bool vhost_user_one_time_request(VhostUserRequest request)
 static int vhost_user_write(struct vhost_dev *dev, VhostUserMsg *msg,
                             int *fds, int fd_num)
 {
-    CharDriverState *chr = dev->opaque;
+    struct vhost_user *u = dev->opaque;
+    CharDriverState *chr = u->chr;
     int size = VHOST_USER_HDR_SIZE + msg->size;
 
     /*
@@ -234,6 +281,132 @@ static int vhost_user_set_log_base(struct vhost_dev *dev, uint64_t base,
     return 0;
 }
 
+/* Describe @reg for the backend; returns the fd backing it, or -1 if it
+ * is not shareable memory.
+ */
+static int vhost_user_fill_region(struct vhost_memory_region *reg,
+                                  VhostUserMemoryRegion *out)
+{
+    ram_addr_t ram_addr;
+    int fd;
+
+    assert((uintptr_t)reg->userspace_addr == reg->userspace_addr);
+    qemu_ram_addr_from_host((void *)(uintptr_t)reg->userspace_addr,
+                            &ram_addr);
+    fd = qemu_get_ram_fd(ram_addr);
+    if (fd <= 0) {
+        return -1;
+    }
+
+    out->userspace_addr = reg->userspace_addr;
+    out->memory_size = reg->memory_size;
+    out->guest_phys_addr = reg->guest_phys_addr;
+    out->mmap_offset = reg->userspace_addr -
+        (uintptr_t) qemu_get_ram_block_host_ptr(ram_addr);
+    return fd;
+}
+
+static bool vhost_user_region_equal(const VhostUserMemoryRegion *a,
+                                    const VhostUserMemoryRegion *b)
+{
+    return a->guest_phys_addr == b->guest_phys_addr &&
+           a->memory_size == b->memory_size &&
+           a->userspace_addr == b->userspace_addr &&
+           a->mmap_offset == b->mmap_offset;
+}
+
+static int vhost_user_send_mem_reg(struct vhost_dev *dev,
+                                   VhostUserRequest request,
+                                   const VhostUserMemoryRegion *region,
+                                   int fd)
+{
+    VhostUserMsg msg = {
+        .request = request,
+        .flags = VHOST_USER_VERSION,
+        .payload.mem_reg.region = *region,
+        .size = sizeof(msg.payload.mem_reg),
+    };
+
+    return vhost_user_write(dev, &msg, &fd, fd < 0 ? 0 : 1);
+}
+
+/* Bring the backend's mappings in line with @mem one region at a time, so
+ * that a memory hotplug does not make it drop and remap everything.
+ * Regions are removed before any is added, so the backend never needs
+ * more than max_mem_slots of them.
+ */
+static int vhost_user_update_mem_regions(struct vhost_dev *dev,
+                                         struct vhost_memory *mem)
+{
+    struct vhost_user *u = dev->opaque;
+    VhostUserMemoryRegion *regions;
+    int *fds;
+    int i, j, nregions = 0, ret = 0;
+
+    regions = g_new(VhostUserMemoryRegion, mem->nregions);
+    fds = g_new(int, mem->nregions);
+    for (i = 0; i < mem->nregions; i++) {
+        fds[nregions] = vhost_user_fill_region(mem->regions + i,
+                                               &regions[nregions]);
+        if (fds[nregions] >= 0) {
+            nregions++;
+        }
+    }
+
+    if (!nregions) {
+        error_report("Failed initializing vhost-user memory map, "
+                     "consider using -object memory-backend-file share=on");
+        ret = -1;
+        goto out;
+    }
+    if (nregions > u->max_mem_slots) {
+        error_report("vhost-user backend supports %" PRIu64 " memory "
+                     "regions, %d needed", u->max_mem_slots, nregions);
+        ret = -1;
+        goto out;
+    }
+
+    for (i = 0; i < u->num_shadow_regions; ) {
+        for (j = 0; j < nregions; j++) {
+            if (vhost_user_region_equal(&u->shadow_regions[i], &regions[j])) {
+                break;
+            }
+        }
+        if (j < nregions) {
+            i++;
+            continue;
+        }
+        if (vhost_user_send_mem_reg(dev, VHOST_USER_REM_MEM_REG,
+                                    &u->shadow_regions[i], -1) < 0) {
+            ret = -1;
+            goto out;
+        }
+        u->shadow_regions[i] = u->shadow_regions[--u->num_shadow_regions];
+    }
+
+    for (j = 0; j < nregions; j++) {
+        for (i = 0; i < u->num_shadow_regions; i++) {
+            if (vhost_user_region_equal(&u->shadow_regions[i], &regions[j])) {
+                break;
+            }
+        }
+        if (i < u->num_shadow_regions) {
+            continue;
+        }
+        if (vhost_user_send_mem_reg(dev, VHOST_USER_ADD_MEM_REG,
+                                    &regions[j], fds[j]) < 0) {
+            ret = -1;
+            goto out;
+        }
+        u->shadow_regions[u->num_shadow_regions++] = regions[j];
+    }
+
+out:
+    g_free(regions);
+    g_free(fds);
+    return ret;
+}
+
 static int vhost_user_set_mem_table(struct vhost_dev *dev,
                                     struct vhost_memory *mem)
 {
@@ -245,20 +418,15 @@ static int vhost_user_set_mem_table(struct vhost_dev *dev,
         .flags = VHOST_USER_VERSION,
     };
 
+    if (virtio_has_feature(dev->protocol_features,
+                           VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS)) {
+        return vhost_user_update_mem_regions(dev, mem);
+    }
+
     for (i = 0; i < dev->mem->nregions; ++i) {
-        struct vhost_memory_region *reg = dev->mem->regions + i;
-        ram_addr_t ram_addr;
-
-        assert((uintptr_t)reg->userspace_addr == reg->userspace_addr);
-        qemu_ram_addr_from_host((void *)(uintptr_t)reg->userspace_addr,
-                                &ram_addr);
-        fd = qemu_get_ram_fd(ram_addr);
-        if (fd > 0) {
-            msg.payload.memory.regions[fd_num].userspace_addr = reg->userspace_addr;
-            msg.payload.memory.regions[fd_num].memory_size  = reg->memory_size;
-            msg.payload.memory.regions[fd_num].guest_phys_addr = reg->guest_phys_addr;
-            msg.payload.memory.regions[fd_num].mmap_offset = reg->userspace_addr -
-                (uintptr_t) qemu_get_ram_block_host_ptr(ram_addr);
+        fd = vhost_user_fill_region(dev->mem->regions + i,
+                                    &msg.payload.memory.regions[fd_num]);
+        if (fd >= 0) {
             assert(fd_num < VHOST_MEMORY_MAX_NREGIONS);
             fds[fd_num++] = fd;
         }
@@ -361,10 +529,14 @@ static int vhost_user_get_vring_base(struct vhost_dev *dev,
         .size = sizeof(msg.payload.state),
     };
 
-    vhost_user_write(dev, &msg, NULL, 0);
+    /* Unlike the other getters a failure must be reported here, or the
+     * ring would be restarted from a bogus index */
+    if (vhost_user_write(dev, &msg, NULL, 0) < 0) {
+        return -1;
+    }
 
     if (vhost_user_read(dev, &msg) < 0) {
-        return 0;
+        return -1;
     }
 
     if (msg.request != VHOST_USER_GET_VRING_BASE) {
@@ -509,16 +681,20 @@ static int vhost_user_reset_device(struct vhost_dev *dev)
 
 static int vhost_user_init(struct vhost_dev *dev, void *opaque)
 {
+    struct vhost_user *u;
     uint64_t features;
     int err;
 
     assert(dev->vhost_ops->backend_type == VHOST_BACKEND_TYPE_USER);
 
-    dev->opaque = opaque;
+    u = g_new0(struct vhost_user, 1);
+    u->chr = opaque;
+    u->max_mem_slots = VHOST_MEMORY_MAX_NREGIONS;
+    dev->opaque = u;
 
     err = vhost_user_get_features(dev, &features);
     if (err < 0) {
-        return err;
+        goto fail;
     }
 
     if (virtio_has_feature(features, VHOST_USER_F_PROTOCOL_FEATURES)) {
@@ -527,13 +703,13 @@ static int vhost_user_init(struct vhost_dev *dev, void *opaque)
         err = vhost_user_get_u64(dev, VHOST_USER_GET_PROTOCOL_FEATURES,
                                  &features);
         if (err < 0) {
-            return err;
+            goto fail;
         }
 
         dev->protocol_features = features & VHOST_USER_PROTOCOL_FEATURE_MASK;
         err = vhost_user_set_protocol_features(dev, dev->protocol_features);
         if (err < 0) {
-            return err;
+            goto fail;
         }
 
         /* query the max queues we support if backend supports Multiple Queue */
@@ -541,11 +717,30 @@ static int vhost_user_init(struct vhost_dev *dev, void *opaque)
             err = vhost_user_get_u64(dev, VHOST_USER_GET_QUEUE_NUM,
                                      &dev->max_queues);
             if (err < 0) {
-                return err;
+                goto fail;
             }
         }
+
+        if (virtio_has_feature(dev->protocol_features,
+                               VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS)) {
+            uint64_t slots = 0;
+
+            err = vhost_user_get_u64(dev, VHOST_USER_GET_MAX_MEM_SLOTS,
+                                     &slots);
+            if (err < 0) {
+                goto fail;
+            }
+            if (!slots) {
+                error_report("vhost-user backend reports no memory slots");
+                err = -1;
+                goto fail;
+            }
+            u->max_mem_slots = MIN(slots, VHOST_USER_MAX_RAM_SLOTS);
+        }
     }
 
+    u->shadow_regions = g_new0(VhostUserMemoryRegion, u->max_mem_slots);
+
     if (dev->migration_blocker == NULL &&
         !virtio_has_feature(dev->protocol_features,
                             VHOST_USER_PROTOCOL_F_LOG_SHMFD)) {
@@ -555,12 +750,21 @@ static int vhost_user_init(struct vhost_dev *dev, void *opaque)
     }
 
     return 0;
+
+fail:
+    g_free(u);
+    dev->opaque = 0;
+    return err;
 }
 
 static int vhost_user_cleanup(struct vhost_dev *dev)
 {
+    struct vhost_user *u = dev->opaque;
+
     assert(dev->vhost_ops->backend_type == VHOST_BACKEND_TYPE_USER);
 
+    g_free(u->shadow_regions);
+    g_free(u);
     dev->opaque = 0;
 
     return 0;
@@ -575,7 +779,9 @@ static int vhost_user_get_vq_index(struct vhost_dev *dev, int idx)
 
 static int vhost_user_memslots_limit(struct vhost_dev *dev)
 {
-    return VHOST_MEMORY_MAX_NREGIONS;
+    struct vhost_user *u = dev->opaque;
+
+    return u->max_mem_slots;
 }
 
 static bool vhost_user_requires_shm_log(struct vhost_dev *dev)
@@ -612,6 +818,52 @@ static int vhost_user_migration_done(struct vhost_dev *dev, char* mac_addr)
     return -1;
 }
 
+static int vhost_user_get_config(struct vhost_dev *dev, uint8_t *config,
+                                 uint32_t config_len)
+{
+    VhostUserMsg msg = {
+        .request = VHOST_USER_GET_CONFIG,
+        .flags = VHOST_USER_VERSION,
+        .size = VHOST_USER_CONFIG_HDR_SIZE + config_len,
+    };
+
+    if (!virtio_has_feature(dev->protocol_features,
+                            VHOST_USER_PROTOCOL_F_CONFIG)) {
+        return -ENOTSUP;
+    }
+
+    if (config_len == 0 || config_len > VHOST_USER_MAX_CONFIG_SIZE) {
+        return -EINVAL;
+    }
+
+    msg.payload.config.offset = 0;
+    msg.payload.config.size = config_len;
+
+    if (vhost_user_write(dev, &msg, NULL, 0) < 0) {
+        return -1;
+    }
+
+    if (vhost_user_read(dev, &msg) < 0) {
+        return -1;
+    }
+
+    if (msg.request != VHOST_USER_GET_CONFIG) {
+        error_report("Received unexpected msg type. Expected %d received %d",
+                     VHOST_USER_GET_CONFIG, msg.request);
+        return -1;
+    }
+
+    if (msg.size != VHOST_USER_CONFIG_HDR_SIZE + config_len ||
+        msg.payload.config.size != config_len) {
+        error_report("Received bad msg size.");
+        return -1;
+    }
+
+    memcpy(config, msg.payload.config.region, config_len);
+
+    return 0;
+}
+
 static bool vhost_user_can_merge(struct vhost_dev *dev,
                                  uint64_t start1, uint64_t size1,
                                  uint64_t start2, uint64_t size2)
@@ -654,4 +906,5 @@ const VhostOps user_ops = {
         .vhost_requires_shm_log = vhost_user_requires_shm_log,
         .vhost_migration_done = vhost_user_migration_done,
         .vhost_backend_can_merge = vhost_user_can_merge,
+        .vhost_get_config = vhost_user_get_config,
 };
@@ -119,6 +119,15 @@ static int vhost_sync_dirty_bitmap(struct vhost_dev *dev,
         struct vhost_virtqueue *vq = dev->vqs + i;
         vhost_dev_sync_region(dev, section, start_addr, end_addr, vq->used_phys,
                               range_get_last(vq->used_phys, vq->used_size));
+        /* The packed layout has the device write the descriptor ring too,
+         * and it does not contain the used area. */
+        if (!ranges_overlap(vq->ring_phys, vq->ring_size,
+                            vq->used_phys, vq->used_size)) {
+            vhost_dev_sync_region(dev, section, start_addr, end_addr,
+                                  vq->ring_phys,
+                                  range_get_last(vq->ring_phys,
+                                                 vq->ring_size));
+        }
     }
     return 0;
 }
@@ -310,6 +319,8 @@ static uint64_t vhost_get_log_size(struct vhost_dev *dev)
         struct vhost_virtqueue *vq = dev->vqs + i;
         uint64_t last = vq->used_phys + vq->used_size - 1;
         log_size = MAX(log_size, last / VHOST_LOG_CHUNK + 1);
+        last = vq->ring_phys + vq->ring_size - 1;
+        log_size = MAX(log_size, last / VHOST_LOG_CHUNK + 1);
     }
     return log_size;
 }
@@ -923,10 +934,13 @@ static void vhost_virtqueue_stop(struct vhost_dev *dev,
 
     r = dev->vhost_ops->vhost_get_vring_base(dev, &state);
     if (r < 0) {
+        /* The backend is gone; resume from what it completed */
         fprintf(stderr, "vhost VQ %d ring restore failed: %d\n", idx, r);
         fflush(stderr);
+        virtio_queue_restore_last_avail_idx(vdev, idx);
+    } else {
+        virtio_queue_set_last_avail_idx(vdev, idx, state.num);
     }
-    virtio_queue_set_last_avail_idx(vdev, idx, state.num);
     virtio_queue_invalidate_signalled_used(vdev, idx);
 
     /* In the cross-endian case, we need to reset the vring endianness to
@@ -941,7 +955,6 @@ static void vhost_virtqueue_stop(struct vhost_dev *dev,
         }
     }
 
-    assert (r >= 0);
     cpu_physical_memory_unmap(vq->ring, virtio_queue_get_ring_size(vdev, idx),
                               0, virtio_queue_get_ring_size(vdev, idx));
     cpu_physical_memory_unmap(vq->used, virtio_queue_get_used_size(vdev, idx),
@@ -1221,6 +1234,18 @@ void vhost_ack_features(struct vhost_dev *hdev, const int *feature_bits,
     }
 }
 
+int vhost_dev_get_config(struct vhost_dev *hdev, uint8_t *config,
+                         uint32_t config_len)
+{
+    assert(hdev->vhost_ops);
+
+    if (hdev->vhost_ops->vhost_get_config) {
+        return hdev->vhost_ops->vhost_get_config(hdev, config, config_len);
+    }
+
+    return -ENOTSUP;
+}
+
 /* Host notifiers must be enabled at this point. */
 int vhost_dev_start(struct vhost_dev *hdev, VirtIODevice *vdev)
 {
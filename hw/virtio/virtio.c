@@ -20,6 +20,7 @@
 #include "qemu/error-report.h"
 #include "hw/virtio/virtio.h"
 #include "qemu/atomic.h"
+#include "qemu/rcu.h"
 #include "hw/virtio/virtio-bus.h"
 #include "migration/migration.h"
 #include "hw/virtio/virtio-access.h"
@@ -31,6 +32,13 @@
  */
 #define VIRTIO_PCI_VRING_ALIGN         4096
 
+/* Per-queue cache of popped elements: up to VIRTQUEUE_POOL_SIZE blocks, each
+ * large enough for VIRTQUEUE_POOL_SG input and VIRTQUEUE_POOL_SG output
+ * buffers.
+ */
+#define VIRTQUEUE_POOL_SIZE            64
+#define VIRTQUEUE_POOL_SG              32
+
 typedef struct VRingDesc
 {
     uint64_t addr;
@@ -59,6 +67,55 @@ typedef struct VRingUsed
     VRingUsedElem ring[0];
 } VRingUsed;
 
+typedef struct VRingPackedDesc
+{
+    uint64_t addr;
+    uint32_t len;
+    uint16_t id;
+    uint16_t flags;
+} VRingPackedDesc;
+
+typedef struct VRingPackedDescEvent
+{
+    uint16_t off_wrap;
+    uint16_t flags;
+} VRingPackedDescEvent;
+
+/* A completion waiting for virtqueue_flush() on a packed ring */
+typedef struct VRingPackedUsedElem
+{
+    unsigned int index;
+    unsigned int len;
+    unsigned int ndescs;
+} VRingPackedUsedElem;
+
+/* Host mappings of the three ring areas, so that the hot paths do not
+ * have to walk the memory map for every access.  Rebuilt whenever the ring
+ * addresses or the guest memory map change, and freed after an RCU grace
+ * period since the data plane may be using them concurrently.
+ */
+enum {
+    VRING_AREA_DESC,
+    VRING_AREA_AVAIL,
+    VRING_AREA_USED,
+    VRING_NR_AREAS,
+};
+
+typedef struct VRingRegionCache
+{
+    hwaddr addr;
+    hwaddr len;
+    MemoryRegion *mr;
+    hwaddr xlat;
+    uint8_t *ptr;
+} VRingRegionCache;
+
+typedef struct VRingCaches
+{
+    VRingRegionCache area[VRING_NR_AREAS];
+    struct rcu_head rcu;
+} VRingCaches;
+
 typedef struct VRing
 {
     unsigned int num;
@@ -75,11 +132,25 @@ struct VirtQueue
 
     /* Next head to pop */
     uint16_t last_avail_idx;
+    bool last_avail_wrap_counter;
 
     /* Last avail_idx read from VQ. */
     uint16_t shadow_avail_idx;
+    bool shadow_avail_wrap_counter;
 
     uint16_t used_idx;
+    bool used_wrap_counter;
+
+    /* Packed layout: elements filled but not yet flushed */
+    VRingPackedUsedElem *used_elems;
+
+    /* Ring mappings, NULL if not set up; RCU protected */
+    VRingCaches *caches;
+
+    /* Recycled elements, see virtqueue_element_free() */
+    void *pool[VIRTQUEUE_POOL_SIZE];
+    unsigned int pool_len;
+    size_t pool_elem_sz;
 
     /* Last used index value we have signalled on */
     uint16_t signalled_used;
@@ -103,6 +174,166 @@ struct VirtQueue
     QLIST_ENTRY(VirtQueue) node;
 };
 
+static void vring_region_cache_init(VRingRegionCache *c, hwaddr addr,
+                                    hwaddr len)
+{
+    MemoryRegion *mr;
+    hwaddr l = len;
+
+    c->addr = addr;
+    c->len = 0;
+    c->mr = NULL;
+    c->ptr = NULL;
+    if (!addr || !len) {
+        return;
+    }
+
+    rcu_read_lock();
+    mr = address_space_translate(&address_space_memory, addr, &c->xlat, &l,
+                                 true);
+    if (l == len && memory_region_is_ram(mr) && !mr->readonly) {
+        memory_region_ref(mr);
+        c->mr = mr;
+        c->len = len;
+        c->ptr = (uint8_t *)memory_region_get_ram_ptr(mr) + c->xlat;
+    }
+    rcu_read_unlock();
+}
+
+static void vring_caches_free(VRingCaches *caches)
+{
+    int i;
+
+    for (i = 0; i < VRING_NR_AREAS; i++) {
+        if (caches->area[i].mr) {
+            memory_region_unref(caches->area[i].mr);
+        }
+    }
+    g_free(caches);
+}
+
+static void virtio_init_region_cache(VirtIODevice *vdev, int n)
+{
+    VirtQueue *vq = &vdev->vq[n];
+    VRingCaches *old = vq->caches;
+    VRingCaches *new = NULL;
+    hwaddr event_size = 0;
+
+    if (vq->vring.desc && vq->vring.num) {
+        new = g_new0(VRingCaches, 1);
+        if (!virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+            /* used_event and avail_event follow the rings */
+            event_size = sizeof(uint16_t);
+        }
+        vring_region_cache_init(&new->area[VRING_AREA_DESC], vq->vring.desc,
+                                virtio_queue_get_desc_size(vdev, n));
+        vring_region_cache_init(&new->area[VRING_AREA_AVAIL], vq->vring.avail,
+                                virtio_queue_get_avail_size(vdev, n) +
+                                event_size);
+        vring_region_cache_init(&new->area[VRING_AREA_USED], vq->vring.used,
+                                virtio_queue_get_used_size(vdev, n) +
+                                event_size);
+    }
+
+    atomic_rcu_set(&vq->caches, new);
+    if (old) {
+        call_rcu(old, vring_caches_free, rcu);
+    }
+}
+
+static void virtio_init_region_caches(VirtIODevice *vdev)
+{
+    int i;
+
+    for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
+        if (vdev->vq[i].vring.num == 0) {
+            break;
+        }
+        virtio_init_region_cache(vdev, i);
+    }
+}
+
+static void virtio_memory_listener_commit(MemoryListener *listener)
+{
+    VirtIODevice *vdev = container_of(listener, VirtIODevice, listener);
+
+    virtio_init_region_caches(vdev);
+}
+
+/* Accessors for the rings.  They go through the cached mapping of AREA
+ * when it covers the access, and through the memory API otherwise (for
+ * example for indirect descriptor tables).
+ */
+static VRingRegionCache *vring_cache_lookup(VirtQueue *vq, int area,
+                                            hwaddr pa, hwaddr len)
+{
+    VRingCaches *caches = atomic_rcu_read(&vq->caches);
+    VRingRegionCache *c;
+
+    if (!caches) {
+        return NULL;
+    }
+    c = &caches->area[area];
+    if (!c->ptr || pa < c->addr || len > c->len ||
+        pa - c->addr > c->len - len) {
+        return NULL;
+    }
+    return c;
+}
+
+static void vring_read(VirtQueue *vq, int area, hwaddr pa, void *buf,
+                       hwaddr len)
+{
+    VRingRegionCache *c;
+
+    rcu_read_lock();
+    c = vring_cache_lookup(vq, area, pa, len);
+    if (c) {
+        memcpy(buf, c->ptr + (pa - c->addr), len);
+    } else {
+        address_space_read(&address_space_memory, pa, MEMTXATTRS_UNSPECIFIED,
+                           buf, len);
+    }
+    rcu_read_unlock();
+}
+
+static void vring_write(VirtQueue *vq, int area, hwaddr pa, const void *buf,
+                        hwaddr len)
+{
+    VRingRegionCache *c;
+
+    rcu_read_lock();
+    c = vring_cache_lookup(vq, area, pa, len);
+    if (c) {
+        memcpy(c->ptr + (pa - c->addr), buf, len);
+        memory_region_set_dirty(c->mr, c->xlat + (pa - c->addr), len);
+    } else {
+        address_space_write(&address_space_memory, pa, MEMTXATTRS_UNSPECIFIED,
+                            buf, len);
+    }
+    rcu_read_unlock();
+}
+
+static inline uint16_t vring_lduw(VirtQueue *vq, int area, hwaddr pa)
+{
+    uint16_t val;
+
+    vring_read(vq, area, pa, &val, sizeof(val));
+    return virtio_tswap16(vq->vdev, val);
+}
+
+static inline void vring_stw(VirtQueue *vq, int area, hwaddr pa, uint16_t val)
+{
+    val = virtio_tswap16(vq->vdev, val);
+    vring_write(vq, area, pa, &val, sizeof(val));
+}
+
+static inline void vring_stl(VirtQueue *vq, int area, hwaddr pa, uint32_t val)
+{
+    val = virtio_tswap32(vq->vdev, val);
+    vring_write(vq, area, pa, &val, sizeof(val));
+}
+
 /* virt queue functions */
 void virtio_queue_update_rings(VirtIODevice *vdev, int n)
 {
@@ -116,13 +347,16 @@ void virtio_queue_update_rings(VirtIODevice *vdev, int n)
     vring->used = vring_align(vring->avail +
                               offsetof(VRingAvail, ring[vring->num]),
                               vring->align);
+    virtio_init_region_cache(vdev, n);
 }
 
-static void vring_desc_read(VirtIODevice *vdev, VRingDesc *desc,
+static void vring_desc_read(VirtQueue *vq, VRingDesc *desc,
                             hwaddr desc_pa, int i)
 {
-    address_space_read(&address_space_memory, desc_pa + i * sizeof(VRingDesc),
-                       MEMTXATTRS_UNSPECIFIED, (void *)desc, sizeof(VRingDesc));
+    VirtIODevice *vdev = vq->vdev;
+
+    vring_read(vq, VRING_AREA_DESC, desc_pa + i * sizeof(VRingDesc),
+               desc, sizeof(VRingDesc));
     virtio_tswap64s(vdev, &desc->addr);
     virtio_tswap32s(vdev, &desc->len);
     virtio_tswap16s(vdev, &desc->flags);
@@ -133,14 +367,14 @@ static inline uint16_t vring_avail_flags(VirtQueue *vq)
 {
     hwaddr pa;
     pa = vq->vring.avail + offsetof(VRingAvail, flags);
-    return virtio_lduw_phys(vq->vdev, pa);
+    return vring_lduw(vq, VRING_AREA_AVAIL, pa);
 }
 
 static inline uint16_t vring_avail_idx(VirtQueue *vq)
 {
     hwaddr pa;
     pa = vq->vring.avail + offsetof(VRingAvail, idx);
-    vq->shadow_avail_idx = virtio_lduw_phys(vq->vdev, pa);
+    vq->shadow_avail_idx = vring_lduw(vq, VRING_AREA_AVAIL, pa);
     return vq->shadow_avail_idx;
 }
 
@@ -148,7 +382,7 @@ static inline uint16_t vring_avail_ring(VirtQueue *vq, int i)
 {
     hwaddr pa;
     pa = vq->vring.avail + offsetof(VRingAvail, ring[i]);
-    return virtio_lduw_phys(vq->vdev, pa);
+    return vring_lduw(vq, VRING_AREA_AVAIL, pa);
 }
 
 static inline uint16_t vring_get_used_event(VirtQueue *vq)
@@ -163,39 +397,38 @@ static inline void vring_used_write(VirtQueue *vq, VRingUsedElem *uelem,
     virtio_tswap32s(vq->vdev, &uelem->id);
     virtio_tswap32s(vq->vdev, &uelem->len);
     pa = vq->vring.used + offsetof(VRingUsed, ring[i]);
-    address_space_write(&address_space_memory, pa, MEMTXATTRS_UNSPECIFIED,
-                       (void *)uelem, sizeof(VRingUsedElem));
+    vring_write(vq, VRING_AREA_USED, pa, uelem, sizeof(VRingUsedElem));
 }
 
 static uint16_t vring_used_idx(VirtQueue *vq)
 {
     hwaddr pa;
     pa = vq->vring.used + offsetof(VRingUsed, idx);
-    return virtio_lduw_phys(vq->vdev, pa);
+    return vring_lduw(vq, VRING_AREA_USED, pa);
 }
 
 static inline void vring_used_idx_set(VirtQueue *vq, uint16_t val)
 {
     hwaddr pa;
     pa = vq->vring.used + offsetof(VRingUsed, idx);
-    virtio_stw_phys(vq->vdev, pa, val);
+    vring_stw(vq, VRING_AREA_USED, pa, val);
     vq->used_idx = val;
 }
 
 static inline void vring_used_flags_set_bit(VirtQueue *vq, int mask)
 {
-    VirtIODevice *vdev = vq->vdev;
     hwaddr pa;
     pa = vq->vring.used + offsetof(VRingUsed, flags);
-    virtio_stw_phys(vdev, pa, virtio_lduw_phys(vdev, pa) | mask);
+    vring_stw(vq, VRING_AREA_USED, pa,
+              vring_lduw(vq, VRING_AREA_USED, pa) | mask);
 }
 
 static inline void vring_used_flags_unset_bit(VirtQueue *vq, int mask)
 {
-    VirtIODevice *vdev = vq->vdev;
     hwaddr pa;
     pa = vq->vring.used + offsetof(VRingUsed, flags);
-    virtio_stw_phys(vdev, pa, virtio_lduw_phys(vdev, pa) & ~mask);
+    vring_stw(vq, VRING_AREA_USED, pa,
+              vring_lduw(vq, VRING_AREA_USED, pa) & ~mask);
 }
 
 static inline void vring_set_avail_event(VirtQueue *vq, uint16_t val)
@@ -205,12 +438,88 @@ static inline void vring_set_avail_event(VirtQueue *vq, uint16_t val)
         return;
     }
     pa = vq->vring.used + offsetof(VRingUsed, ring[vq->vring.num]);
-    virtio_stw_phys(vq->vdev, pa, val);
+    vring_stw(vq, VRING_AREA_USED, pa, val);
 }
 
-void virtio_queue_set_notification(VirtQueue *vq, int enable)
+/* Packed virtqueue layout (virtio 1.1): a single descriptor ring that the
+ * device writes back in place, plus one event suppression structure in
+ * each direction.  vring.avail and vring.used point to the driver and
+ * device event suppression areas respectively.
+ */
+static inline bool vring_is_packed(VirtQueue *vq)
+{
+    return virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED);
+}
+
+static inline uint16_t vring_packed_desc_read_flags(VirtQueue *vq,
+                                                    hwaddr desc_pa, int i)
+{
+    return vring_lduw(vq, VRING_AREA_DESC,
+                      desc_pa + i * sizeof(VRingPackedDesc) +
+                      offsetof(VRingPackedDesc, flags));
+}
+
+static void vring_packed_desc_read(VirtQueue *vq, VRingPackedDesc *desc,
+                                   hwaddr desc_pa, int i, bool strict_order)
+{
+    VirtIODevice *vdev = vq->vdev;
+    uint16_t flags = 0;
+
+    if (strict_order) {
+        flags = vring_packed_desc_read_flags(vq, desc_pa, i);
+        /* Make sure flags is read before the rest of the descriptor. */
+        smp_rmb();
+    }
+    vring_read(vq, VRING_AREA_DESC, desc_pa + i * sizeof(VRingPackedDesc),
+               desc, sizeof(VRingPackedDesc));
+    virtio_tswap64s(vdev, &desc->addr);
+    virtio_tswap32s(vdev, &desc->len);
+    virtio_tswap16s(vdev, &desc->id);
+    if (strict_order) {
+        desc->flags = flags;
+    } else {
+        virtio_tswap16s(vdev, &desc->flags);
+    }
+}
+
+static void vring_packed_desc_write(VirtQueue *vq, VRingPackedDesc *desc,
+                                    hwaddr desc_pa, int i, bool strict_order)
+{
+    hwaddr pa = desc_pa + i * sizeof(VRingPackedDesc);
+
+    vring_stw(vq, VRING_AREA_DESC, pa + offsetof(VRingPackedDesc, id),
+              desc->id);
+    vring_stl(vq, VRING_AREA_DESC, pa + offsetof(VRingPackedDesc, len),
+              desc->len);
+    if (strict_order) {
+        /* Make sure id and len are written before flags. */
+        smp_wmb();
+    }
+    vring_stw(vq, VRING_AREA_DESC, pa + offsetof(VRingPackedDesc, flags),
+              desc->flags);
+}
+
+static void vring_packed_event_read(VirtQueue *vq, VRingPackedDescEvent *e,
+                                    hwaddr pa)
+{
+    e->flags = vring_lduw(vq, VRING_AREA_AVAIL,
+                          pa + offsetof(VRingPackedDescEvent, flags));
+    /* Make sure flags is read before off_wrap. */
+    smp_rmb();
+    e->off_wrap = vring_lduw(vq, VRING_AREA_AVAIL,
+                             pa + offsetof(VRingPackedDescEvent, off_wrap));
+}
+
+static inline bool is_desc_avail(uint16_t flags, bool wrap_counter)
+{
+    bool avail = !!(flags & (1 << VRING_PACKED_DESC_F_AVAIL));
+    bool used = !!(flags & (1 << VRING_PACKED_DESC_F_USED));
+
+    return avail != used && avail == wrap_counter;
+}
+
+static void virtio_queue_split_set_notification(VirtQueue *vq, int enable)
 {
-    vq->notification = enable;
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
         vring_set_avail_event(vq, vring_avail_idx(vq));
     } else if (enable) {
@@ -218,6 +527,39 @@ void virtio_queue_set_notification(VirtQueue *vq, int enable)
     } else {
         vring_used_flags_set_bit(vq, VRING_USED_F_NO_NOTIFY);
     }
+}
+
+static void virtio_queue_packed_set_notification(VirtQueue *vq, int enable)
+{
+    VirtIODevice *vdev = vq->vdev;
+    hwaddr pa = vq->vring.used;
+    uint16_t off_wrap, flags;
+
+    if (!enable) {
+        flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+    } else if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        off_wrap = vq->shadow_avail_idx |
+                   vq->shadow_avail_wrap_counter << VRING_PACKED_EVENT_F_WRAP_CTR;
+        vring_stw(vq, VRING_AREA_USED,
+                  pa + offsetof(VRingPackedDescEvent, off_wrap), off_wrap);
+        /* Make sure off_wrap is written before flags. */
+        smp_wmb();
+        flags = VRING_PACKED_EVENT_FLAG_DESC;
+    } else {
+        flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+    }
+    vring_stw(vq, VRING_AREA_USED, pa + offsetof(VRingPackedDescEvent, flags),
+              flags);
+}
+
+void virtio_queue_set_notification(VirtQueue *vq, int enable)
+{
+    vq->notification = enable;
+    if (vring_is_packed(vq)) {
+        virtio_queue_packed_set_notification(vq, enable);
+    } else {
+        virtio_queue_split_set_notification(vq, enable);
+    }
     if (enable) {
         /* Expose avail event/used flags before caller checks the avail idx. */
         smp_mb();
@@ -231,7 +573,7 @@ int virtio_queue_ready(VirtQueue *vq)
 
 /* Fetch avail_idx from VQ memory only when we really need to know if
  * guest has added some buffers. */
-int virtio_queue_empty(VirtQueue *vq)
+static int virtio_queue_split_empty(VirtQueue *vq)
 {
     if (vq->shadow_avail_idx != vq->last_avail_idx) {
         return 0;
@@ -240,6 +582,27 @@ int virtio_queue_empty(VirtQueue *vq)
     return vring_avail_idx(vq) == vq->last_avail_idx;
 }
 
+static int virtio_queue_packed_empty(VirtQueue *vq)
+{
+    uint16_t flags;
+
+    if (unlikely(!vq->vring.desc)) {
+        return 1;
+    }
+
+    flags = vring_packed_desc_read_flags(vq, vq->vring.desc,
+                                         vq->last_avail_idx);
+    return !is_desc_avail(flags, vq->last_avail_wrap_counter);
+}
+
+int virtio_queue_empty(VirtQueue *vq)
+{
+    if (vring_is_packed(vq)) {
+        return virtio_queue_packed_empty(vq);
+    }
+    return virtio_queue_split_empty(vq);
+}
+
 static void virtqueue_unmap_sg(VirtQueue *vq, const VirtQueueElement *elem,
                                unsigned int len)
 {
@@ -266,20 +629,28 @@ static void virtqueue_unmap_sg(VirtQueue *vq, const VirtQueueElement *elem,
 void virtqueue_discard(VirtQueue *vq, const VirtQueueElement *elem,
                        unsigned int len)
 {
-    vq->last_avail_idx--;
-    vq->inuse--;
+    if (vring_is_packed(vq)) {
+        if (vq->last_avail_idx < elem->ndescs) {
+            vq->last_avail_idx += vq->vring.num - elem->ndescs;
+            vq->last_avail_wrap_counter ^= 1;
+        } else {
+            vq->last_avail_idx -= elem->ndescs;
+        }
+        vq->shadow_avail_idx = vq->last_avail_idx;
+        vq->shadow_avail_wrap_counter = vq->last_avail_wrap_counter;
+        vq->inuse -= elem->ndescs;
+    } else {
+        vq->last_avail_idx--;
+        vq->inuse--;
+    }
     virtqueue_unmap_sg(vq, elem, len);
 }
 
-void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
-                    unsigned int len, unsigned int idx)
+static void virtqueue_split_fill(VirtQueue *vq, const VirtQueueElement *elem,
+                                 unsigned int len, unsigned int idx)
 {
     VRingUsedElem uelem;
 
-    trace_virtqueue_fill(vq, elem, len, idx);
-
-    virtqueue_unmap_sg(vq, elem, len);
-
     idx = (idx + vq->used_idx) % vq->vring.num;
 
     uelem.id = elem->index;
@@ -287,7 +658,40 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
     vring_used_write(vq, &uelem, idx);
 }
 
-void virtqueue_flush(VirtQueue *vq, unsigned int count)
+/* The packed ring has no separate used ring, completions are written over
+ * the descriptors they came from.  Keep them until virtqueue_flush(), which
+ * has to make the first one visible last.
+ */
+static void virtqueue_packed_fill(VirtQueue *vq, const VirtQueueElement *elem,
+                                  unsigned int len, unsigned int idx)
+{
+    if (idx >= vq->vring.num) {
+        error_report("virtio: too many used elements in flight");
+        exit(1);
+    }
+    if (!vq->used_elems) {
+        vq->used_elems = g_new(VRingPackedUsedElem, VIRTQUEUE_MAX_SIZE);
+    }
+    vq->used_elems[idx].index = elem->index;
+    vq->used_elems[idx].len = len;
+    vq->used_elems[idx].ndescs = elem->ndescs;
+}
+
+void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
+                    unsigned int len, unsigned int idx)
+{
+    trace_virtqueue_fill(vq, elem, len, idx);
+
+    virtqueue_unmap_sg(vq, elem, len);
+
+    if (vring_is_packed(vq)) {
+        virtqueue_packed_fill(vq, elem, len, idx);
+    } else {
+        virtqueue_split_fill(vq, elem, len, idx);
+    }
+}
+
+static void virtqueue_split_flush(VirtQueue *vq, unsigned int count)
 {
     uint16_t old, new;
     /* Make sure buffer is written before we update index. */
@@ -301,6 +705,68 @@ void virtqueue_flush(VirtQueue *vq, unsigned int count)
         vq->signalled_used_valid = false;
 }
 
+static void virtqueue_packed_fill_desc(VirtQueue *vq,
+                                       const VRingPackedUsedElem *uelem,
+                                       unsigned int offset, bool strict_order)
+{
+    VRingPackedDesc desc = {
+        .id = uelem->index,
+        .len = uelem->len,
+    };
+    bool wrap_counter = vq->used_wrap_counter;
+    unsigned int head = vq->used_idx + offset;
+
+    if (head >= vq->vring.num) {
+        head -= vq->vring.num;
+        wrap_counter ^= 1;
+    }
+    if (wrap_counter) {
+        desc.flags = (1 << VRING_PACKED_DESC_F_AVAIL) |
+                     (1 << VRING_PACKED_DESC_F_USED);
+    } else {
+        desc.flags = 0;
+    }
+    vring_packed_desc_write(vq, &desc, vq->vring.desc, head,
+                            strict_order);
+}
+
+static void virtqueue_packed_flush(VirtQueue *vq, unsigned int count)
+{
+    unsigned int i, ndescs;
+
+    if (!count) {
+        return;
+    }
+
+    trace_virtqueue_flush(vq, count);
+
+    /* The guest stops at the first descriptor that is not marked used, so
+     * publishing the head of the batch last exposes all of it at once.
+     */
+    ndescs = vq->used_elems[0].ndescs;
+    for (i = 1; i < count; i++) {
+        virtqueue_packed_fill_desc(vq, &vq->used_elems[i], ndescs, false);
+        ndescs += vq->used_elems[i].ndescs;
+    }
+    virtqueue_packed_fill_desc(vq, &vq->used_elems[0], 0, true);
+
+    vq->inuse -= ndescs;
+    vq->used_idx += ndescs;
+    if (vq->used_idx >= vq->vring.num) {
+        vq->used_idx -= vq->vring.num;
+        vq->used_wrap_counter ^= 1;
+    }
+}
+
+void virtqueue_flush(VirtQueue *vq, unsigned int count)
+{
+    if (vring_is_packed(vq)) {
+        virtqueue_packed_flush(vq, count);
+    } else {
+        virtqueue_split_flush(vq, count);
+    }
+}
+
 void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
                     unsigned int len)
 {
@@ -308,6 +774,21 @@ void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
     virtqueue_flush(vq, 1);
 }
 
+/* Complete COUNT elements with a single update of the used index.  */
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement **elems,
+                          const unsigned int *lens, unsigned int count)
+{
+    unsigned int i;
+
+    if (!count) {
+        return;
+    }
+    for (i = 0; i < count; i++) {
+        virtqueue_fill(vq, elems[i], lens[i], i);
+    }
+    virtqueue_flush(vq, count);
+}
+
 static int virtqueue_num_heads(VirtQueue *vq, unsigned int idx)
 {
     uint16_t num_heads = vring_avail_idx(vq) - idx;
@@ -344,7 +825,7 @@ static unsigned int virtqueue_get_head(VirtQueue *vq, unsigned int idx)
     return head;
 }
 
-static unsigned virtqueue_read_next_desc(VirtIODevice *vdev, VRingDesc *desc,
+static unsigned virtqueue_read_next_desc(VirtQueue *vq, VRingDesc *desc,
                                          hwaddr desc_pa, unsigned int max)
 {
     unsigned int next;
@@ -364,13 +845,15 @@ static unsigned virtqueue_read_next_desc(VirtIODevice *vdev, VRingDesc *desc,
         exit(1);
     }
 
-    vring_desc_read(vdev, desc, desc_pa, next);
+    vring_desc_read(vq, desc, desc_pa, next);
     return next;
 }
 
-void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
-                               unsigned int *out_bytes,
-                               unsigned max_in_bytes, unsigned max_out_bytes)
+static void virtqueue_split_get_avail_bytes(VirtQueue *vq,
+                                            unsigned int *in_bytes,
+                                            unsigned int *out_bytes,
+                                            unsigned max_in_bytes,
+                                            unsigned max_out_bytes)
 {
     unsigned int idx;
     unsigned int total_bufs, in_total, out_total;
@@ -379,7 +862,6 @@ void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
 
     total_bufs = in_total = out_total = 0;
     while (virtqueue_num_heads(vq, idx)) {
-        VirtIODevice *vdev = vq->vdev;
         unsigned int max, num_bufs, indirect = 0;
         VRingDesc desc;
         hwaddr desc_pa;
@@ -389,7 +871,7 @@ void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
         num_bufs = total_bufs;
         i = virtqueue_get_head(vq, idx++);
         desc_pa = vq->vring.desc;
-        vring_desc_read(vdev, &desc, desc_pa, i);
+        vring_desc_read(vq, &desc, desc_pa, i);
 
         if (desc.flags & VRING_DESC_F_INDIRECT) {
             if (desc.len % sizeof(VRingDesc)) {
@@ -408,7 +890,7 @@ void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
             max = desc.len / sizeof(VRingDesc);
             desc_pa = desc.addr;
             num_bufs = i = 0;
-            vring_desc_read(vdev, &desc, desc_pa, i);
+            vring_desc_read(vq, &desc, desc_pa, i);
         }
 
         do {
@@ -426,7 +908,7 @@ void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
             if (in_total >= max_in_bytes && out_total >= max_out_bytes) {
                 goto done;
             }
-        } while ((i = virtqueue_read_next_desc(vdev, &desc, desc_pa, max)) != max);
+        } while ((i = virtqueue_read_next_desc(vq, &desc, desc_pa, max)) != max);
 
         if (!indirect)
             total_bufs = num_bufs;
@@ -442,6 +924,126 @@ done:
     }
 }
 
+/* Unlike the split ring, chains in a packed ring are laid out one after
+ * the other and wrap around the end of the ring; an indirect table is used
+ * in full and does not chain with VRING_DESC_F_NEXT.
+ */
+static unsigned virtqueue_packed_read_next_desc(VirtQueue *vq,
+                                                VRingPackedDesc *desc,
+                                                hwaddr desc_pa,
+                                                unsigned int i,
+                                                unsigned int max,
+                                                bool indirect)
+{
+    if (!indirect && !(desc->flags & VRING_DESC_F_NEXT)) {
+        return max;
+    }
+
+    if (++i == max) {
+        if (indirect) {
+            return max;
+        }
+        i = 0;
+    }
+
+    vring_packed_desc_read(vq, desc, desc_pa, i, false);
+    return i;
+}
+
+static void virtqueue_packed_get_avail_bytes(VirtQueue *vq,
+                                             unsigned int *in_bytes,
+                                             unsigned int *out_bytes,
+                                             unsigned max_in_bytes,
+                                             unsigned max_out_bytes)
+{
+    unsigned int idx, total_bufs, in_total, out_total;
+    bool wrap_counter;
+
+    idx = vq->last_avail_idx;
+    wrap_counter = vq->last_avail_wrap_counter;
+
+    total_bufs = in_total = out_total = 0;
+    while (total_bufs < vq->vring.num) {
+        unsigned int max, num_bufs, i;
+        VRingPackedDesc desc;
+        hwaddr desc_pa;
+        bool indirect = false;
+
+        max = vq->vring.num;
+        num_bufs = total_bufs;
+        i = idx;
+        desc_pa = vq->vring.desc;
+        vring_packed_desc_read(vq, &desc, desc_pa, i, true);
+        if (!is_desc_avail(desc.flags, wrap_counter)) {
+            break;
+        }
+
+        if (desc.flags & VRING_DESC_F_INDIRECT) {
+            if (desc.len % sizeof(VRingPackedDesc)) {
+                error_report("Invalid size for indirect buffer table");
+                exit(1);
+            }
+
+            /* loop over the indirect descriptor table */
+            indirect = true;
+            max = desc.len / sizeof(VRingPackedDesc);
+            desc_pa = desc.addr;
+            num_bufs = i = 0;
+            vring_packed_desc_read(vq, &desc, desc_pa, i, false);
+        }
+
+        do {
+            /* If we've got too many, that implies a descriptor loop. */
+            if (++num_bufs > max) {
+                error_report("Looped descriptor");
+                exit(1);
+            }
+
+            if (desc.flags & VRING_DESC_F_WRITE) {
+                in_total += desc.len;
+            } else {
+                out_total += desc.len;
+            }
+            if (in_total >= max_in_bytes && out_total >= max_out_bytes) {
+                goto done;
+            }
+        } while ((i = virtqueue_packed_read_next_desc(vq, &desc, desc_pa, i,
+                                                      max, indirect)) != max);
+
+        if (indirect) {
+            idx++;
+            total_bufs++;
+        } else {
+            idx += num_bufs - total_bufs;
+            total_bufs = num_bufs;
+        }
+        if (idx >= vq->vring.num) {
+            idx -= vq->vring.num;
+            wrap_counter ^= 1;
+        }
+    }
+done:
+    if (in_bytes) {
+        *in_bytes = in_total;
+    }
+    if (out_bytes) {
+        *out_bytes = out_total;
+    }
+}
+
+void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
+                               unsigned int *out_bytes,
+                               unsigned max_in_bytes, unsigned max_out_bytes)
+{
+    if (vring_is_packed(vq)) {
+        virtqueue_packed_get_avail_bytes(vq, in_bytes, out_bytes,
+                                         max_in_bytes, max_out_bytes);
+    } else {
+        virtqueue_split_get_avail_bytes(vq, in_bytes, out_bytes,
+                                        max_in_bytes, max_out_bytes);
+    }
+}
+
 int virtqueue_avail_bytes(VirtQueue *vq, unsigned int in_bytes,
                           unsigned int out_bytes)
 {
@@ -536,14 +1138,70 @@ void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
     elem->out_addr = (void *)elem + out_addr_ofs;
     elem->in_sg = (void *)elem + in_sg_ofs;
     elem->out_sg = (void *)elem + out_sg_ofs;
+    elem->pool_sz = 0;
     return elem;
 }
 
-void *virtqueue_pop(VirtQueue *vq, size_t sz)
+static void virtqueue_pool_drain(VirtQueue *vq)
+{
+    while (vq->pool_len) {
+        g_free(vq->pool[--vq->pool_len]);
+    }
+}
+
+/* Elements with few enough buffers are carved out of blocks sized for
+ * VIRTQUEUE_POOL_SG buffers, which virtqueue_element_free() recycles.
+ * Must be called from the context that processes the queue.
+ */
+static void *virtqueue_pool_alloc_element(VirtQueue *vq, size_t sz,
+                                          unsigned out_num, unsigned in_num)
+{
+    VirtQueueElement *elem;
+
+    if (out_num > VIRTQUEUE_POOL_SG || in_num > VIRTQUEUE_POOL_SG) {
+        return virtqueue_alloc_element(sz, out_num, in_num);
+    }
+    if (vq->pool_elem_sz != sz) {
+        virtqueue_pool_drain(vq);
+        vq->pool_elem_sz = sz;
+    }
+    if (vq->pool_len) {
+        elem = vq->pool[--vq->pool_len];
+    } else {
+        elem = virtqueue_alloc_element(sz, VIRTQUEUE_POOL_SG,
+                                       VIRTQUEUE_POOL_SG);
+        elem->pool_sz = sz;
+    }
+    elem->out_num = out_num;
+    elem->in_num = in_num;
+    return elem;
+}
+
+/* Release an element returned by virtqueue_pop() or virtqueue_pop_batch().
+ * Plain g_free() is also fine, but skips the recycling.
+ */
+void virtqueue_element_free(VirtQueue *vq, void *opaque)
+{
+    VirtQueueElement *elem = opaque;
+
+    if (!elem) {
+        return;
+    }
+    if (elem->pool_sz && elem->pool_sz == vq->pool_elem_sz &&
+        vq->pool_len < VIRTQUEUE_POOL_SIZE) {
+        vq->pool[vq->pool_len++] = elem;
+        return;
+    }
+    g_free(elem);
+}
+
+/* The caller updates avail_event, see virtqueue_pop() and
+ * virtqueue_pop_batch().
+ */
+static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
 {
     unsigned int i, head, max;
     hwaddr desc_pa = vq->vring.desc;
-    VirtIODevice *vdev = vq->vdev;
     VirtQueueElement *elem;
     unsigned out_num, in_num;
     hwaddr addr[VIRTQUEUE_MAX_SIZE];
@@ -568,11 +1226,8 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     }
 
     i = head = virtqueue_get_head(vq, vq->last_avail_idx++);
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
-        vring_set_avail_event(vq, vq->last_avail_idx);
-    }
 
-    vring_desc_read(vdev, &desc, desc_pa, i);
+    vring_desc_read(vq, &desc, desc_pa, i);
     if (desc.flags & VRING_DESC_F_INDIRECT) {
         if (desc.len % sizeof(VRingDesc)) {
             error_report("Invalid size for indirect buffer table");
@@ -583,7 +1238,7 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
         max = desc.len / sizeof(VRingDesc);
         desc_pa = desc.addr;
         i = 0;
-        vring_desc_read(vdev, &desc, desc_pa, i);
+        vring_desc_read(vq, &desc, desc_pa, i);
     }
 
     /* Collect all the descriptors */
@@ -605,11 +1260,12 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
             error_report("Looped descriptor");
             exit(1);
         }
-    } while ((i = virtqueue_read_next_desc(vdev, &desc, desc_pa, max)) != max);
+    } while ((i = virtqueue_read_next_desc(vq, &desc, desc_pa, max)) != max);
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_pool_alloc_element(vq, sz, out_num, in_num);
     elem->index = head;
+    elem->ndescs = 1;
     for (i = 0; i < out_num; i++) {
         elem->out_addr[i] = addr[i];
         elem->out_sg[i] = iov[i];
@@ -625,6 +1281,157 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     return elem;
 }
 
+static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
+{
+    unsigned int i, max, ndescs;
+    hwaddr desc_pa = vq->vring.desc;
+    VirtQueueElement *elem;
+    unsigned out_num, in_num;
+    hwaddr addr[VIRTQUEUE_MAX_SIZE];
+    struct iovec iov[VIRTQUEUE_MAX_SIZE];
+    VRingPackedDesc desc;
+    bool indirect = false;
+    uint16_t id;
+
+    if (virtio_queue_packed_empty(vq)) {
+        return NULL;
+    }
+    /* Make sure the descriptor is not read before its flags, see
+     * virtio_queue_packed_empty(). */
+    smp_rmb();
+
+    /* When we start there are none of either input nor output. */
+    out_num = in_num = 0;
+    ndescs = 0;
+
+    max = vq->vring.num;
+
+    if (vq->inuse >= vq->vring.num) {
+        error_report("Virtqueue size exceeded");
+        exit(1);
+    }
+
+    i = vq->last_avail_idx;
+    vring_packed_desc_read(vq, &desc, desc_pa, i, true);
+    id = desc.id;
+    if (desc.flags & VRING_DESC_F_INDIRECT) {
+        if (desc.len % sizeof(VRingPackedDesc)) {
+            error_report("Invalid size for indirect buffer table");
+            exit(1);
+        }
+
+        /* loop over the indirect descriptor table */
+        indirect = true;
+        max = desc.len / sizeof(VRingPackedDesc);
+        desc_pa = desc.addr;
+        i = 0;
+        vring_packed_desc_read(vq, &desc, desc_pa, i, false);
+    }
+
+    /* Collect all the descriptors */
+    do {
+        if (desc.flags & VRING_DESC_F_WRITE) {
+            virtqueue_map_desc(&in_num, addr + out_num, iov + out_num,
+                               VIRTQUEUE_MAX_SIZE - out_num, true, desc.addr, desc.len);
+        } else {
+            if (in_num) {
+                error_report("Incorrect order for descriptors");
+                exit(1);
+            }
+            virtqueue_map_desc(&out_num, addr, iov,
+                               VIRTQUEUE_MAX_SIZE, false, desc.addr, desc.len);
+        }
+
+        /* If we've got too many, that implies a descriptor loop. */
+        if (++ndescs > max || (in_num + out_num) > max) {
+            error_report("Looped descriptor");
+            exit(1);
+        }
+    } while ((i = virtqueue_packed_read_next_desc(vq, &desc, desc_pa, i, max,
+                                                  indirect)) != max);
+
+    /* Now copy what we have collected and mapped */
+    elem = virtqueue_pool_alloc_element(vq, sz, out_num, in_num);
+    elem->index = id;
+    elem->ndescs = indirect ? 1 : ndescs;
+    for (i = 0; i < out_num; i++) {
+        elem->out_addr[i] = addr[i];
+        elem->out_sg[i] = iov[i];
+    }
+    for (i = 0; i < in_num; i++) {
+        elem->in_addr[i] = addr[out_num + i];
+        elem->in_sg[i] = iov[out_num + i];
+    }
+
+    vq->inuse += elem->ndescs;
+    vq->last_avail_idx += elem->ndescs;
+    if (vq->last_avail_idx >= vq->vring.num) {
+        vq->last_avail_idx -= vq->vring.num;
+        vq->last_avail_wrap_counter ^= 1;
+    }
+    vq->shadow_avail_idx = vq->last_avail_idx;
+    vq->shadow_avail_wrap_counter = vq->last_avail_wrap_counter;
+
+    trace_virtqueue_pop(vq, elem, elem->in_num, elem->out_num);
+    return elem;
+}
+
+void *virtqueue_pop(VirtQueue *vq, size_t sz)
+{
+    void *elem;
+
+    if (vring_is_packed(vq)) {
+        return virtqueue_packed_pop(vq, sz);
+    }
+    elem = virtqueue_split_pop(vq, sz);
+    if (elem && virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    return elem;
+}
+
+/* Pop up to MAX elements into ELEMS and return how many were popped.
+ * With the split layout avail_event is only written once the batch is
+ * complete, instead of once per element.
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max)
+{
+    bool event_idx;
+    uint16_t event;
+    unsigned int n = 0;
+
+    if (vring_is_packed(vq)) {
+        while (n < max && (elems[n] = virtqueue_packed_pop(vq, sz))) {
+            n++;
+        }
+        return n;
+    }
+
+    event_idx = virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX);
+    event = vq->last_avail_idx;
+    while (n < max) {
+        elems[n] = virtqueue_split_pop(vq, sz);
+        if (elems[n]) {
+            n++;
+            continue;
+        }
+        if (!event_idx || event == vq->last_avail_idx) {
+            break;
+        }
+        /* Publish avail_event before looking at the ring one last time,
+         * or a buffer added in between would not be notified.
+         */
+        event = vq->last_avail_idx;
+        vring_set_avail_event(vq, event);
+        smp_mb();
+    }
+    if (event_idx && event != vq->last_avail_idx) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    return n;
+}
+
 /* Reading and writing a structure directly to QEMUFile is *awful*, but
  * it is what QEMU has always done by mistake.  We can change it sooner
  * or later by bumping the version number of the affected vm states.
@@ -642,7 +1449,7 @@ typedef struct VirtQueueElementOld {
     struct iovec out_sg[VIRTQUEUE_MAX_SIZE];
 } VirtQueueElementOld;
 
-void *qemu_get_virtqueue_element(QEMUFile *f, size_t sz)
+void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz)
 {
     VirtQueueElement *elem;
     VirtQueueElementOld data;
@@ -673,11 +1480,19 @@ void *qemu_get_virtqueue_element(QEMUFile *f, size_t sz)
         elem->out_sg[i].iov_len = data.out_sg[i].iov_len;
     }
 
+    /* The packed ring needs to know how many descriptors to skip when
+     * the element is completed. */
+    elem->ndescs = 1;
+    if (virtio_host_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+        elem->ndescs = qemu_get_be32(f);
+    }
+
     virtqueue_map(elem);
     return elem;
 }
 
-void qemu_put_virtqueue_element(QEMUFile *f, VirtQueueElement *elem)
+void qemu_put_virtqueue_element(VirtIODevice *vdev, QEMUFile *f,
+                                VirtQueueElement *elem)
 {
     VirtQueueElementOld data;
     int i;
@@ -706,6 +1521,10 @@ void qemu_put_virtqueue_element(QEMUFile *f, VirtQueueElement *elem)
         data.out_sg[i].iov_len = elem->out_sg[i].iov_len;
     }
     qemu_put_buffer(f, (uint8_t *)&data, sizeof(VirtQueueElementOld));
+
+    if (virtio_host_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+        qemu_put_be32(f, elem->ndescs);
+    }
 }
 
 /* virtio device */
@@ -811,12 +1630,17 @@ void virtio_reset(void *opaque)
         vdev->vq[i].last_avail_idx = 0;
         vdev->vq[i].shadow_avail_idx = 0;
         vdev->vq[i].used_idx = 0;
+        /* Packed ring wrap counters start out set */
+        vdev->vq[i].last_avail_wrap_counter = true;
+        vdev->vq[i].shadow_avail_wrap_counter = true;
+        vdev->vq[i].used_wrap_counter = true;
         virtio_queue_set_vector(vdev, i, VIRTIO_NO_VECTOR);
         vdev->vq[i].signalled_used = 0;
         vdev->vq[i].signalled_used_valid = false;
         vdev->vq[i].notification = true;
         vdev->vq[i].vring.num = vdev->vq[i].vring.num_default;
         vdev->vq[i].inuse = 0;
+        virtio_init_region_cache(vdev, i);
     }
 }
 
@@ -1026,6 +1850,7 @@ void virtio_queue_set_rings(VirtIODevice *vdev, int n, hwaddr desc,
     vdev->vq[n].vring.desc = desc;
     vdev->vq[n].vring.avail = avail;
     vdev->vq[n].vring.used = used;
+    virtio_init_region_cache(vdev, n);
 }
 
 void virtio_queue_set_num(VirtIODevice *vdev, int n, int num)
@@ -1039,6 +1864,7 @@ void virtio_queue_set_num(VirtIODevice *vdev, int n, int num)
         return;
     }
     vdev->vq[n].vring.num = num;
+    virtio_init_region_cache(vdev, n);
 }
 
 VirtQueue *virtio_vector_first_queue(VirtIODevice *vdev, uint16_t vector)
@@ -1162,6 +1988,9 @@ VirtQueue *virtio_add_queue(VirtIODevice *vdev, int queue_size,
     vdev->vq[i].vring.align = VIRTIO_PCI_VRING_ALIGN;
     vdev->vq[i].handle_output = handle_output;
     vdev->vq[i].handle_aio_output = NULL;
+    vdev->vq[i].last_avail_wrap_counter = true;
+    vdev->vq[i].shadow_avail_wrap_counter = true;
+    vdev->vq[i].used_wrap_counter = true;
 
     return &vdev->vq[i];
 }
@@ -1174,6 +2003,10 @@ void virtio_del_queue(VirtIODevice *vdev, int n)
 
     vdev->vq[n].vring.num = 0;
     vdev->vq[n].vring.num_default = 0;
+    g_free(vdev->vq[n].used_elems);
+    vdev->vq[n].used_elems = NULL;
+    virtqueue_pool_drain(&vdev->vq[n]);
+    virtio_init_region_cache(vdev, n);
 }
 
 void virtio_irq(VirtQueue *vq)
@@ -1183,6 +2016,42 @@ void virtio_irq(VirtQueue *vq)
     virtio_notify_vector(vq->vdev, vq->vector);
 }
 
+static bool vring_packed_need_event(VirtQueue *vq, bool wrap,
+                                    uint16_t off_wrap, uint16_t new,
+                                    uint16_t old)
+{
+    int off = off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+
+    if (wrap != off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR) {
+        off -= vq->vring.num;
+    }
+
+    return vring_need_event(off, new, old);
+}
+
+static bool virtio_packed_should_notify(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VRingPackedDescEvent e;
+    uint16_t old, new;
+    bool v;
+
+    vring_packed_event_read(vq, &e, vq->vring.avail);
+
+    old = vq->signalled_used;
+    new = vq->signalled_used = vq->used_idx;
+    v = vq->signalled_used_valid;
+    vq->signalled_used_valid = true;
+
+    if (e.flags == VRING_PACKED_EVENT_FLAG_DISABLE) {
+        return false;
+    } else if (e.flags == VRING_PACKED_EVENT_FLAG_ENABLE) {
+        return true;
+    }
+
+    return !v || vring_packed_need_event(vq, vq->used_wrap_counter,
+                                         e.off_wrap, new, old);
+}
+
 bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq)
 {
     uint16_t old, new;
@@ -1195,6 +2064,10 @@ bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq)
         return true;
     }
 
+    if (vring_is_packed(vq)) {
+        return virtio_packed_should_notify(vdev, vq);
+    }
+
     if (!virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
         return !(vring_avail_flags(vq) & VRING_AVAIL_F_NO_INTERRUPT);
     }
@@ -1253,6 +2126,13 @@ static bool virtio_virtqueue_needed(void *opaque)
     return virtio_host_has_feature(vdev, VIRTIO_F_VERSION_1);
 }
 
+static bool virtio_packed_virtqueue_needed(void *opaque)
+{
+    VirtIODevice *vdev = opaque;
+
+    return virtio_host_has_feature(vdev, VIRTIO_F_RING_PACKED);
+}
+
 static bool virtio_ringsize_needed(void *opaque)
 {
     VirtIODevice *vdev = opaque;
@@ -1299,6 +2179,32 @@ static const VMStateDescription vmstate_virtio_virtqueues = {
     }
 };
 
+static const VMStateDescription vmstate_packed_virtqueue = {
+    .name = "packed_virtqueue_state",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT16(last_avail_idx, struct VirtQueue),
+        VMSTATE_BOOL(last_avail_wrap_counter, struct VirtQueue),
+        VMSTATE_UINT16(used_idx, struct VirtQueue),
+        VMSTATE_BOOL(used_wrap_counter, struct VirtQueue),
+        VMSTATE_INT32(inuse, struct VirtQueue),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_virtio_packed_virtqueues = {
+    .name = "virtio/packed_virtqueues",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = &virtio_packed_virtqueue_needed,
+    .fields = (VMStateField[]) {
+        VMSTATE_STRUCT_VARRAY_POINTER_KNOWN(vq, struct VirtIODevice,
+                      VIRTIO_QUEUE_MAX, 0, vmstate_packed_virtqueue, VirtQueue),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static const VMStateDescription vmstate_ringsize = {
     .name = "ringsize_state",
     .version_id = 1,
@@ -1404,6 +2310,7 @@ static const VMStateDescription vmstate_virtio = {
         &vmstate_virtio_virtqueues,
         &vmstate_virtio_ringsize,
         &vmstate_virtio_extra_state,
+        &vmstate_virtio_packed_virtqueues,
         NULL
     }
 };
@@ -1477,10 +2384,15 @@ int virtio_set_features(VirtIODevice *vdev, uint64_t val)
      * The driver must not attempt to set features after feature negotiation
      * has finished.
      */
+    int ret;
+
     if (vdev->status & VIRTIO_CONFIG_S_FEATURES_OK) {
         return -EINVAL;
     }
-    return virtio_set_features_nocheck(vdev, val);
+    ret = virtio_set_features_nocheck(vdev, val);
+    /* VIRTIO_F_RING_PACKED changes the size of the rings */
+    virtio_init_region_caches(vdev);
+    return ret;
 }
 
 int virtio_load(VirtIODevice *vdev, QEMUFile *f, int version_id)
@@ -1612,7 +2524,16 @@ int virtio_load(VirtIODevice *vdev, QEMUFile *f, int version_id)
     }
 
     for (i = 0; i < num; i++) {
-        if (vdev->vq[i].vring.desc) {
+        /* The layout, and so the ring sizes, are only known now */
+        virtio_init_region_cache(vdev, i);
+        if (vdev->vq[i].vring.desc &&
+            virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+            /* Indexes, wrap counters and inuse came with the
+             * packed_virtqueues subsection. */
+            vdev->vq[i].shadow_avail_idx = vdev->vq[i].last_avail_idx;
+            vdev->vq[i].shadow_avail_wrap_counter =
+                vdev->vq[i].last_avail_wrap_counter;
+        } else if (vdev->vq[i].vring.desc) {
             uint16_t nheads;
             nheads = vring_avail_idx(&vdev->vq[i]) - vdev->vq[i].last_avail_idx;
             /* Check it isn't doing strange things with descriptor numbers. */
@@ -1649,7 +2570,16 @@ int virtio_load(VirtIODevice *vdev, QEMUFile *f, int version_id)
 
 void virtio_cleanup(VirtIODevice *vdev)
 {
+    int i;
+
     qemu_del_vm_change_state_handler(vdev->vmstate);
+    for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
+        g_free(vdev->vq[i].used_elems);
+        virtqueue_pool_drain(&vdev->vq[i]);
+        if (vdev->vq[i].caches) {
+            vring_caches_free(vdev->vq[i].caches);
+        }
+    }
     g_free(vdev->config);
     g_free(vdev->vq);
     g_free(vdev->vector_queues);
@@ -1748,36 +2678,100 @@ hwaddr virtio_queue_get_ring_addr(VirtIODevice *vdev, int n)
 
 hwaddr virtio_queue_get_desc_size(VirtIODevice *vdev, int n)
 {
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+        return sizeof(VRingPackedDesc) * vdev->vq[n].vring.num;
+    }
     return sizeof(VRingDesc) * vdev->vq[n].vring.num;
 }
 
 hwaddr virtio_queue_get_avail_size(VirtIODevice *vdev, int n)
 {
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+        return sizeof(VRingPackedDescEvent);
+    }
     return offsetof(VRingAvail, ring) +
         sizeof(uint16_t) * vdev->vq[n].vring.num;
 }
 
 hwaddr virtio_queue_get_used_size(VirtIODevice *vdev, int n)
 {
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+        return sizeof(VRingPackedDescEvent);
+    }
     return offsetof(VRingUsed, ring) +
         sizeof(VRingUsedElem) * vdev->vq[n].vring.num;
 }
 
+/* With the packed layout the three areas need not be contiguous, and the
+ * descriptor ring is the one written by the device. */
 hwaddr virtio_queue_get_ring_size(VirtIODevice *vdev, int n)
 {
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+        return virtio_queue_get_desc_size(vdev, n);
+    }
     return vdev->vq[n].vring.used - vdev->vq[n].vring.desc +
 	    virtio_queue_get_used_size(vdev, n);
 }
 
-uint16_t virtio_queue_get_last_avail_idx(VirtIODevice *vdev, int n)
+/* For the packed layout, the vhost ring state carries the wrap counters
+ * in bit 15 of the avail index (low half) and of the used index (high
+ * half), as in the vhost-user specification.
+ */
+unsigned int virtio_queue_get_last_avail_idx(VirtIODevice *vdev, int n)
 {
-    return vdev->vq[n].last_avail_idx;
+    VirtQueue *vq = &vdev->vq[n];
+
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+        unsigned int avail, used;
+
+        avail = vq->last_avail_idx |
+                vq->last_avail_wrap_counter << VRING_PACKED_EVENT_F_WRAP_CTR;
+        used = vq->used_idx |
+               vq->used_wrap_counter << VRING_PACKED_EVENT_F_WRAP_CTR;
+        return avail | used << 16;
+    }
+    return vq->last_avail_idx;
 }
 
-void virtio_queue_set_last_avail_idx(VirtIODevice *vdev, int n, uint16_t idx)
+void virtio_queue_set_last_avail_idx(VirtIODevice *vdev, int n,
+                                     unsigned int idx)
 {
-    vdev->vq[n].last_avail_idx = idx;
-    vdev->vq[n].shadow_avail_idx = idx;
+    VirtQueue *vq = &vdev->vq[n];
+
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+        vq->last_avail_idx = idx & 0x7fff;
+        vq->last_avail_wrap_counter = !!(idx & 0x8000);
+        vq->used_idx = (idx >> 16) & 0x7fff;
+        vq->used_wrap_counter = !!(idx & 0x80000000);
+        vq->shadow_avail_wrap_counter = vq->last_avail_wrap_counter;
+    } else {
+        vq->last_avail_idx = idx;
+    }
+    vq->shadow_avail_idx = vq->last_avail_idx;
+}
+
+/* The external backend processing queue @n went away without reporting
+ * where it stopped: treat every buffer that did not make it to the used
+ * ring as never taken, so that it is processed again.
+ */
+void virtio_queue_restore_last_avail_idx(VirtIODevice *vdev, int n)
+{
+    VirtQueue *vq = &vdev->vq[n];
+
+    if (!vq->vring.desc) {
+        return;
+    }
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+        /* Used descriptors do not record the length of their chain, so
+         * the ring cannot be walked to find where the backend stopped. */
+        error_report("virtio: cannot recover position of packed "
+                     "virtqueue %d", n);
+        return;
+    }
+
+    vq->used_idx = vring_used_idx(vq);
+    vq->last_avail_idx = vq->used_idx;
+    vq->shadow_avail_idx = vq->last_avail_idx;
 }
 
 void virtio_queue_invalidate_signalled_used(VirtIODevice *vdev, int n)
@@ -1903,6 +2897,9 @@ static void virtio_device_realize(DeviceState *dev, Error **errp)
         error_propagate(errp, err);
         return;
     }
+
+    vdev->listener.commit = virtio_memory_listener_commit;
+    memory_listener_register(&vdev->listener, &address_space_memory);
 }
 
 static void virtio_device_unrealize(DeviceState *dev, Error **errp)
@@ -1911,6 +2908,7 @@ static void virtio_device_unrealize(DeviceState *dev, Error **errp)
     VirtioDeviceClass *vdc = VIRTIO_DEVICE_GET_CLASS(dev);
     Error *err = NULL;
 
+    memory_listener_unregister(&vdev->listener);
     virtio_bus_device_unplugged(vdev);
 
     if (vdc->unrealize != NULL) {
@@ -42,6 +42,16 @@ struct BlockAcctTimedStats {
     QSLIST_ENTRY(BlockAcctTimedStats) entries;
 };
 
+/* Bin i counts the requests with a latency in [boundaries[i - 1],
+ * boundaries[i]), where boundaries[-1] is 0 and boundaries[nbins - 1]
+ * is infinity.  An unused histogram has no bins.
+ */
+typedef struct BlockLatencyHistogram {
+    unsigned nbins;
+    uint64_t *boundaries;     /* nbins - 1 values in ns, ascending */
+    uint64_t *bins;
+} BlockLatencyHistogram;
+
 typedef struct BlockAcctStats {
     uint64_t nr_bytes[BLOCK_MAX_IOTYPE];
     uint64_t nr_ops[BLOCK_MAX_IOTYPE];
@@ -51,6 +61,7 @@ typedef struct BlockAcctStats {
     uint64_t merged[BLOCK_MAX_IOTYPE];
     int64_t last_access_time_ns;
     QSLIST_HEAD(, BlockAcctTimedStats) intervals;
+    BlockLatencyHistogram latency_histogram[BLOCK_MAX_IOTYPE];
     bool account_invalid;
     bool account_failed;
 } BlockAcctStats;
@@ -77,5 +88,12 @@ void block_acct_merge_done(BlockAcctStats *stats, enum BlockAcctType type,
 int64_t block_acct_idle_time_ns(BlockAcctStats *stats);
 double block_acct_queue_depth(BlockAcctTimedStats *stats,
                               enum BlockAcctType type);
+bool block_latency_histogram_is_valid(const uint64_t *boundaries,
+                                      unsigned nb_boundaries);
+void block_latency_histogram_set(BlockAcctStats *stats,
+                                 enum BlockAcctType type,
+                                 const uint64_t *boundaries,
+                                 unsigned nb_boundaries);
+void block_latency_histograms_clear(BlockAcctStats *stats);
 
 #endif
@@ -65,6 +65,11 @@ typedef enum {
     BDRV_REQ_MAY_UNMAP          = 0x4,
     BDRV_REQ_NO_SERIALISING     = 0x8,
     BDRV_REQ_FUA                = 0x10,
+    /* Fail a write zeroes request with -ENOTSUP if it cannot be done any
+     * faster than writing a buffer full of zeroes, instead of falling back
+     * to that.
+     */
+    BDRV_REQ_NO_FALLBACK        = 0x20,
 } BdrvRequestFlags;
 
 typedef struct BlockSizes {
@@ -94,6 +99,7 @@ typedef struct HDGeometry {
                                       select an appropriate protocol driver,
                                       ignoring the format layer */
 #define BDRV_O_NO_IO       0x10000 /* don't initialize for I/O */
+#define BDRV_O_IO_URING    0x20000 /* use io_uring instead of the thread pool */
 
 #define BDRV_O_CACHE_MASK  (BDRV_O_NOCACHE | BDRV_O_NO_FLUSH)
 
@@ -261,6 +267,18 @@ int coroutine_fn bdrv_co_writev(BlockDriverState *bs, int64_t sector_num,
  */
 int coroutine_fn bdrv_co_write_zeroes(BlockDriverState *bs, int64_t sector_num,
     int nb_sectors, BdrvRequestFlags flags);
+/*
+ * Copy a range of sectors from @src to @dst.  If the nodes sit on the same
+ * storage, the drivers may copy the data without passing it through QEMU
+ * memory, for example with copy_file_range().  Otherwise the data is read
+ * into a bounce buffer and written back, unless @flags contains
+ * BDRV_REQ_NO_FALLBACK, in which case -ENOTSUP is returned.
+ * BDRV_REQ_NO_SERIALISING applies to the read from @src.  I/O limits of
+ * @src and @dst apply as they would to the read and the write.
+ */
+int coroutine_fn bdrv_co_copy_range(BlockDriverState *src, int64_t src_sector,
+                                    BlockDriverState *dst, int64_t dst_sector,
+                                    int nb_sectors, BdrvRequestFlags flags);
 BlockDriverState *bdrv_find_backing_image(BlockDriverState *bs,
     const char *backing_file);
 int bdrv_get_backing_file_depth(BlockDriverState *bs);
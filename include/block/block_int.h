@@ -85,6 +85,16 @@ typedef struct BdrvTrackedRequest {
     struct BdrvTrackedRequest *waiting_for;
 } BdrvTrackedRequest;
 
+/* Passed to after-write notifiers */
+typedef struct BdrvCompletedWrite {
+    BdrvTrackedRequest *req;
+    int64_t offset;
+    unsigned int bytes;
+    QEMUIOVector *qiov; /* NULL if zeroes were written or for discard */
+    bool discard;
+    int ret;
+} BdrvCompletedWrite;
+
 struct BlockDriver {
     const char *format_name;
     int instance_size;
@@ -170,6 +180,22 @@ struct BlockDriver {
         int64_t sector_num, int nb_sectors, BdrvRequestFlags flags);
     int coroutine_fn (*bdrv_co_discard)(BlockDriverState *bs,
         int64_t sector_num, int nb_sectors);
+
+    /*
+     * Copy a range of sectors without going through a bounce buffer.
+     * .bdrv_co_copy_range_from() is called on the source node; formats and
+     * filters map the range to their children and call
+     * bdrv_co_copy_range_from() on them.  Once the node that stores the
+     * data is reached, it calls bdrv_co_copy_range_to() on the destination,
+     * which is resolved in the same way until a protocol driver can do the
+     * copy.  Return -ENOTSUP if the copy cannot be offloaded.
+     */
+    int coroutine_fn (*bdrv_co_copy_range_from)(BlockDriverState *bs,
+        int64_t src_sector, BlockDriverState *dst, int64_t dst_sector,
+        int nb_sectors, BdrvRequestFlags flags);
+    int coroutine_fn (*bdrv_co_copy_range_to)(BlockDriverState *bs,
+        BlockDriverState *src, int64_t src_sector, int64_t dst_sector,
+        int nb_sectors, BdrvRequestFlags flags);
     int64_t coroutine_fn (*bdrv_co_get_block_status)(BlockDriverState *bs,
         int64_t sector_num, int nb_sectors, int *pnum,
         BlockDriverState **file);
@@ -419,6 +445,9 @@ struct BlockDriverState {
     /* Callback before write request is processed */
     NotifierWithReturnList before_write_notifiers;
 
+    /* Callback after write request is processed */
+    NotifierList after_write_notifiers;
+
     /* number of in-flight serialising requests */
     unsigned int serialising_in_flight;
 
@@ -434,6 +463,13 @@ struct BlockDriverState {
     ThrottleTimers throttle_timers;
     unsigned       pending_reqs[2];
     QLIST_ENTRY(BlockDriverState) round_robin;
+    /* These are only used from the AioContext of the BDS, so requests
+     * can be let through without taking the ThrottleGroup lock. */
+    ThrottleCredit throttle_credit[2];
+    unsigned       throttle_credit_generation[2];
+    /* Completed requests and their latency after being let through */
+    uint64_t       throttle_latency_ops;
+    uint64_t       throttle_latency_ns;
 
     /* Offset after the highest byte written to */
     uint64_t wr_highest_offset;
@@ -541,6 +577,32 @@ void bdrv_set_io_limits(BlockDriverState *bs,
 void bdrv_add_before_write_notifier(BlockDriverState *bs,
                                     NotifierWithReturn *notifier);
 
+/**
+ * bdrv_add_after_write_notifier:
+ *
+ * Register a callback that is invoked after a write or discard request has
+ * been processed and the dirty bitmaps have been updated, but before the
+ * request completes.  The callback gets a BdrvCompletedWrite and is invoked
+ * even if the request failed.
+ */
+void bdrv_add_after_write_notifier(BlockDriverState *bs,
+                                   Notifier *notifier);
+
+/**
+ * bdrv_co_copy_range_from:
+ * bdrv_co_copy_range_to:
+ *
+ * Used by drivers to pass a copy offload request down to a child of the
+ * source or the destination node.  Unlike bdrv_co_copy_range(), these never
+ * fall back to a bounce buffer and return -ENOTSUP instead.
+ */
+int coroutine_fn bdrv_co_copy_range_from(BlockDriverState *src,
+    int64_t src_sector, BlockDriverState *dst, int64_t dst_sector,
+    int nb_sectors, BdrvRequestFlags flags);
+int coroutine_fn bdrv_co_copy_range_to(BlockDriverState *dst,
+    BlockDriverState *src, int64_t src_sector, int64_t dst_sector,
+    int nb_sectors, BdrvRequestFlags flags);
+
 /**
  * bdrv_detach_aio_context:
  *
@@ -664,6 +726,8 @@ void commit_active_start(BlockDriverState *bs, BlockDriverState *base,
  * @on_source_error: The action to take upon error reading from the source.
  * @on_target_error: The action to take upon error writing to the target.
  * @unmap: Whether to unmap target where source sectors only contain zeroes.
+ * @copy_mode: Whether guest writes are also written to @target before they
+ *             complete.
  * @cb: Completion function for the job.
  * @opaque: Opaque pointer value passed to @cb.
  * @errp: Error object.
@@ -678,10 +742,22 @@ void mirror_start(BlockDriverState *bs, BlockDriverState *target,
                   int64_t speed, uint32_t granularity, int64_t buf_size,
                   MirrorSyncMode mode, BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
-                  bool unmap,
+                  bool unmap, MirrorCopyMode copy_mode,
                   BlockCompletionFunc *cb,
                   void *opaque, Error **errp);
 
+/*
+ * mirror_set_copy_mode:
+ * @job: A job started with mirror_start().
+ * @copy_mode: The new copy mode.
+ * @errp: Error object.
+ *
+ * Switch a running mirror job to @copy_mode.  Only switching from background
+ * to write-blocking mode is supported.
+ */
+void mirror_set_copy_mode(BlockJob *job, MirrorCopyMode copy_mode,
+                          Error **errp);
+
 /*
  * backup_start:
  * @bs: Block device to operate on.
@@ -691,6 +767,10 @@ void mirror_start(BlockDriverState *bs, BlockDriverState *target,
  * @sync_bitmap: The dirty bitmap if sync_mode is MIRROR_SYNC_MODE_INCREMENTAL.
  * @on_source_error: The action to take upon error reading from the source.
  * @on_target_error: The action to take upon error writing to the target.
+ * @max_workers: The maximum number of copy requests in flight, or 0 for the
+ *               default.
+ * @max_chunk: The maximum number of bytes per copy request, or 0 for the
+ *             default.
  * @cb: Completion function for the job.
  * @opaque: Opaque pointer value passed to @cb.
  * @txn: Transaction that this job is part of (may be NULL).
@@ -703,6 +783,7 @@ void backup_start(BlockDriverState *bs, BlockDriverState *target,
                   BdrvDirtyBitmap *sync_bitmap,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
+                  int64_t max_workers, int64_t max_chunk,
                   BlockCompletionFunc *cb, void *opaque,
                   BlockJobTxn *txn, Error **errp);
 
@@ -33,18 +33,48 @@ struct nbd_request {
     uint32_t len;
 } QEMU_PACKED;
 
+/* Either a simple reply, or the header of one chunk of a structured reply;
+ * nbd_reply_is_structured() tells them apart.
+ */
 struct nbd_reply {
     uint32_t magic;
-    uint32_t error;
+    uint32_t error;         /* simple replies only */
     uint64_t handle;
+    uint16_t flags;         /* structured replies only */
+    uint16_t type;
+    uint32_t length;
 } QEMU_PACKED;
 
+/* A block status descriptor, in host byte order */
+typedef struct NBDExtent {
+    uint32_t length;
+    uint32_t flags;         /* NBD_STATE_* */
+} QEMU_PACKED NBDExtent;
+
+/* Parameters and results of the handshake */
+typedef struct NBDExportInfo {
+    /* Set by the caller: ask for structured replies and base:allocation */
+    bool request_structured;
+
+    /* Set by nbd_receive_negotiate() */
+    bool structured_reply;
+    bool base_allocation;
+    uint32_t meta_base_allocation_id;
+    uint16_t flags;
+    off_t size;
+} NBDExportInfo;
+
 #define NBD_FLAG_HAS_FLAGS      (1 << 0)        /* Flags are there */
 #define NBD_FLAG_READ_ONLY      (1 << 1)        /* Device is read-only */
 #define NBD_FLAG_SEND_FLUSH     (1 << 2)        /* Send FLUSH */
 #define NBD_FLAG_SEND_FUA       (1 << 3)        /* Send FUA (Force Unit Access) */
 #define NBD_FLAG_ROTATIONAL     (1 << 4)        /* Use elevator algorithm - rotational media */
 #define NBD_FLAG_SEND_TRIM      (1 << 5)        /* Send TRIM (discard) */
+#define NBD_FLAG_SEND_WRITE_ZEROES (1 << 6)     /* Send WRITE_ZEROES */
+#define NBD_FLAG_SEND_DF        (1 << 7)        /* Send DF (Do not Fragment) */
+#define NBD_FLAG_CAN_MULTI_CONN (1 << 8)        /* Multiple connections OK */
+#define NBD_FLAG_SEND_FAST_ZERO (1 << 11)       /* FAST_ZERO flag for
+                                                   WRITE_ZEROES */
 
 /* New-style global flags. */
 #define NBD_FLAG_FIXED_NEWSTYLE     (1 << 0)    /* Fixed newstyle protocol. */
@@ -55,23 +85,56 @@ struct nbd_reply {
 /* Reply types. */
 #define NBD_REP_ACK             (1)             /* Data sending finished. */
 #define NBD_REP_SERVER          (2)             /* Export description. */
+#define NBD_REP_META_CONTEXT    (4)             /* Meta context id. */
 #define NBD_REP_ERR_UNSUP       ((UINT32_C(1) << 31) | 1) /* Unknown option. */
 #define NBD_REP_ERR_POLICY      ((UINT32_C(1) << 31) | 2) /* Server denied */
 #define NBD_REP_ERR_INVALID     ((UINT32_C(1) << 31) | 3) /* Invalid length. */
 #define NBD_REP_ERR_TLS_REQD    ((UINT32_C(1) << 31) | 5) /* TLS required */
+#define NBD_REP_ERR_UNKNOWN     ((UINT32_C(1) << 31) | 6) /* No such export */
 
 
 #define NBD_CMD_MASK_COMMAND	0x0000ffff
 #define NBD_CMD_FLAG_FUA	(1 << 16)
+#define NBD_CMD_FLAG_NO_HOLE    (1 << 17)   /* WRITE_ZEROES: no unmap */
+#define NBD_CMD_FLAG_DF         (1 << 18)   /* READ: one data chunk */
+#define NBD_CMD_FLAG_REQ_ONE    (1 << 19)   /* BLOCK_STATUS: one extent */
+#define NBD_CMD_FLAG_FAST_ZERO  (1 << 20)   /* WRITE_ZEROES: fail if slow */
 
 enum {
     NBD_CMD_READ = 0,
     NBD_CMD_WRITE = 1,
     NBD_CMD_DISC = 2,
     NBD_CMD_FLUSH = 3,
-    NBD_CMD_TRIM = 4
+    NBD_CMD_TRIM = 4,
+    NBD_CMD_WRITE_ZEROES = 6,
+    NBD_CMD_BLOCK_STATUS = 7,
 };
 
+/* Structured replies */
+#define NBD_STRUCTURED_REPLY_MAGIC      0x668e33ef
+
+#define NBD_REPLY_FLAG_DONE             (1 << 0)  /* Last chunk of a reply */
+
+#define NBD_REPLY_TYPE_NONE             0
+#define NBD_REPLY_TYPE_OFFSET_DATA      1
+#define NBD_REPLY_TYPE_OFFSET_HOLE      2
+#define NBD_REPLY_TYPE_BLOCK_STATUS     5
+#define NBD_REPLY_TYPE_ERROR            ((1 << 15) | 1)
+#define NBD_REPLY_TYPE_ERROR_OFFSET     ((1 << 15) | 2)
+
+#define NBD_REPLY_TYPE_IS_ERR(type)     (!!((type) & (1 << 15)))
+
+/* The only metadata context we know about, and its block status flags */
+#define NBD_META_BASE_ALLOCATION        "base:allocation"
+
+#define NBD_STATE_HOLE                  (1 << 0)  /* Unallocated */
+#define NBD_STATE_ZERO                  (1 << 1)  /* Reads as zeroes */
+
+static inline bool nbd_reply_is_structured(struct nbd_reply *reply)
+{
+    return reply->magic == NBD_STRUCTURED_REPLY_MAGIC;
+}
+
 #define NBD_DEFAULT_PORT	10809
 
 /* Maximum size of a single READ/WRITE data buffer */
@@ -84,13 +147,14 @@ ssize_t nbd_wr_syncv(QIOChannel *ioc,
                      size_t offset,
                      size_t length,
                      bool do_read);
-int nbd_receive_negotiate(QIOChannel *ioc, const char *name, uint16_t *flags,
+int nbd_receive_negotiate(QIOChannel *ioc, const char *name,
                           QCryptoTLSCreds *tlscreds, const char *hostname,
                           QIOChannel **outioc,
-                          off_t *size, Error **errp);
+                          NBDExportInfo *info, Error **errp);
 int nbd_init(int fd, QIOChannelSocket *sioc, uint16_t flags, off_t size);
 ssize_t nbd_send_request(QIOChannel *ioc, struct nbd_request *request);
 ssize_t nbd_receive_reply(QIOChannel *ioc, struct nbd_reply *reply);
+int nbd_errno_to_system_errno(int err);
 int nbd_client(int fd);
 int nbd_disconnect(int fd);
 
@@ -39,8 +39,8 @@ void throttle_group_get_config(BlockDriverState *bs, ThrottleConfig *cfg);
 void throttle_group_register_bs(BlockDriverState *bs, const char *groupname);
 void throttle_group_unregister_bs(BlockDriverState *bs);
 
-void coroutine_fn throttle_group_co_io_limits_intercept(BlockDriverState *bs,
-                                                        unsigned int bytes,
-                                                        bool is_write);
+int64_t coroutine_fn throttle_group_co_io_limits_intercept(
+    BlockDriverState *bs, unsigned int bytes, bool is_write);
+void throttle_group_co_io_done(BlockDriverState *bs, int64_t start_ns);
 
 #endif
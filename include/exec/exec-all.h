@@ -271,12 +271,24 @@ struct TranslationBlock {
        jmp_first */
     struct TranslationBlock *jmp_next[2];
     struct TranslationBlock *jmp_first;
+    /* direct jumps from other TBs enter the code at this offset, after
+       the loads of the pinned globals */
+    uint16_t tc_chain_offset;
+
+    /* profiling data, only maintained when tb_profile_enabled is set */
+    uint32_t tc_size;    /* size of the generated host code */
+    uint64_t exec_count; /* number of times the block was entered */
 };
 
 #include "qemu/thread.h"
 
 typedef struct TBContext TBContext;
 
+/* Bucket 0 counts translations faster than 1us, bucket i counts the
+ * ones that took [2^(i-1), 2^i) us and the last one everything slower.
+ */
+#define TB_GEN_TIME_HIST_SIZE 12
+
 struct TBContext {
 
     TranslationBlock *tbs;
@@ -288,6 +300,8 @@ struct TBContext {
     /* statistics */
     int tb_flush_count;
     int tb_phys_invalidate_count;
+    /* translation time histogram, see TB_GEN_TIME_HIST_SIZE */
+    uint64_t tb_gen_time_hist[TB_GEN_TIME_HIST_SIZE];
 
     int tb_invalidated_flag;
 };
@@ -385,7 +399,8 @@ static inline void tb_add_jump(TranslationBlock *tb, int n,
                                tb->tc_ptr, tb->pc, n,
                                tb_next->tc_ptr, tb_next->pc);
         /* patch the native jump address */
-        tb_set_jmp_target(tb, n, (uintptr_t)tb_next->tc_ptr);
+        tb_set_jmp_target(tb, n, (uintptr_t)tb_next->tc_ptr +
+                          tb_next->tc_chain_offset);
 
         /* add in TB jmp circular list */
         tb->jmp_next[n] = tb_next->jmp_first;
@@ -460,6 +475,8 @@ bool memory_region_is_unassigned(MemoryRegion *mr);
 
 /* vl.c */
 extern int singlestep;
+extern bool tb_profile_enabled;
+extern int tcg_pinned_regs;
 
 /* cpu-exec.c, accessed with atomic_mb_read/atomic_mb_set */
 extern CPUState *tcg_current_cpu;
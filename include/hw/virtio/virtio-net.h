@@ -16,6 +16,7 @@
 
 #include "standard-headers/linux/virtio_net.h"
 #include "hw/virtio/virtio.h"
+#include "sysemu/iothread.h"
 
 #define TYPE_VIRTIO_NET "virtio-net-device"
 #define VIRTIO_NET(obj) \
@@ -35,20 +36,59 @@ typedef struct virtio_net_conf
     uint32_t txtimer;
     int32_t txburst;
     char *tx;
+    IOThread *iothread;
+    uint16_t queues;
 } virtio_net_conf;
 
 /* Maximum packet size we can receive from tap device: header + 64k */
 #define VIRTIO_NET_MAX_BUFSIZE (sizeof(struct virtio_net_hdr) + (64 << 10))
 
+/* Receive-side scaling limits advertised in the config space */
+#define VIRTIO_NET_RSS_MAX_KEY_SIZE     40
+#define VIRTIO_NET_RSS_MAX_TABLE_LEN    128
+
+#define VIRTIO_NET_RSS_SUPPORTED_HASHES (VIRTIO_NET_RSS_HASH_TYPE_IPv4 | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_TCPv4 | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_UDPv4 | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_IPv6 | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_TCPv6 | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_UDPv6)
+
+typedef struct VirtioNetRssData {
+    bool enabled;               /* a hash is computed for received packets */
+    bool redirect;              /* ... and picks their rx queue */
+    bool populate_hash;         /* ... and is reported in the header */
+    uint32_t hash_types;
+    uint8_t key[VIRTIO_NET_RSS_MAX_KEY_SIZE];
+    uint16_t indirections_len;
+    uint16_t *indirections_table;
+    uint16_t default_queue;
+} VirtioNetRssData;
+
+/* How a tx queue defers flushing after a guest notification */
+typedef enum VirtIONetTxMode {
+    VIRTIO_NET_TX_IMMEDIATE,    /* flush from the notification itself */
+    VIRTIO_NET_TX_BH,           /* flush from a bottom half */
+    VIRTIO_NET_TX_TIMER,        /* flush tx_timeout ns later */
+} VirtIONetTxMode;
+
 typedef struct VirtIONetQueue {
     VirtQueue *rx_vq;
     VirtQueue *tx_vq;
     QEMUTimer *tx_timer;
     QEMUBH *tx_bh;
     int tx_waiting;
+    VirtIONetTxMode tx_mode;
+    /* tx=adaptive: tx_mode follows the packet rate measured over
+     * windows starting at tx_window_start */
+    bool tx_adaptive;
+    int64_t tx_window_start;
+    uint32_t tx_window_packets;
     struct {
         VirtQueueElement *elem;
     } async_tx;
+    /* rx buffers filled but not yet published in the used ring */
+    unsigned int rx_used;
     struct VirtIONet *n;
 } VirtIONetQueue;
 
@@ -64,7 +104,7 @@ typedef struct VirtIONet {
     uint32_t has_vnet_hdr;
     size_t host_hdr_len;
     size_t guest_hdr_len;
-    uint32_t host_features;
+    uint64_t host_features;
     uint8_t has_ufo;
     int mergeable_rx_bufs;
     uint8_t promisc;
@@ -74,6 +114,8 @@ typedef struct VirtIONet {
     uint8_t nouni;
     uint8_t nobcast;
     uint8_t vhost_started;
+    /* rx/tx virtqueues and the backends are serviced by net_conf.iothread */
+    bool dataplane_started;
     struct {
         uint32_t in_use;
         uint32_t first_multi;
@@ -95,6 +137,9 @@ typedef struct VirtIONet {
     QEMUTimer *announce_timer;
     int announce_counter;
     bool needs_vnet_hdr_swap;
+    /* Queue pairs that have a backend; any others are fed by RSS */
+    uint16_t backend_queues;
+    VirtioNetRssData rss_data;
 } VirtIONet;
 
 void virtio_net_set_netclient_name(VirtIONet *n, const char *name,
@@ -72,5 +72,6 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
 
 void qemu_net_queue_purge(NetQueue *queue, NetClientState *from);
 bool qemu_net_queue_flush(NetQueue *queue);
+bool qemu_net_queue_delivering(NetQueue *queue);
 
 #endif /* QEMU_NET_QUEUE_H */
@@ -30,6 +30,12 @@
 
 #define THROTTLE_VALUE_MAX 1000000000000000LL
 
+/* Upper limit for ThrottleConfig.latency_target (60 seconds) */
+#define THROTTLE_LATENCY_TARGET_MAX 60000000ULL
+
+/* Lower limit for ThrottleState.scale */
+#define THROTTLE_SCALE_MIN 0.05
+
 typedef enum {
     THROTTLE_BPS_TOTAL,
     THROTTLE_BPS_READ,
@@ -92,13 +98,30 @@ typedef struct LeakyBucket {
 typedef struct ThrottleConfig {
     LeakyBucket buckets[BUCKETS_COUNT]; /* leaky buckets */
     uint64_t op_size;         /* size of an operation in bytes */
+    uint64_t latency_target;  /* wanted average request latency in us */
 } ThrottleConfig;
 
+/* The rates of all buckets are multiplied by ThrottleState.scale, which
+ * is 1 unless the user of the ThrottleState lowers it.  Throttle groups
+ * do that to keep request latency under ThrottleConfig.latency_target.
+ */
 typedef struct ThrottleState {
     ThrottleConfig cfg;       /* configuration */
     int64_t previous_leak;    /* timestamp of the last leak done */
+    double scale;             /* fraction of the configured rates in use */
 } ThrottleState;
 
+/* Bucket space that has been accounted in advance with throttle_reserve().
+ * I/O can be charged against it with throttle_credit_consume() without
+ * touching the ThrottleState, and what is left is given back with
+ * throttle_release().
+ */
+typedef struct ThrottleCredit {
+    double size;              /* bytes left */
+    double units;             /* operations left */
+    uint64_t op_size;         /* cfg.op_size when the credit was reserved */
+} ThrottleCredit;
+
 typedef struct ThrottleTimers {
     QEMUTimer *timers[2];     /* timers used to do the throttling */
     QEMUClockType clock_type; /* the clock used */
@@ -153,4 +176,14 @@ bool throttle_schedule_timer(ThrottleState *ts,
 
 void throttle_account(ThrottleState *ts, bool is_write, uint64_t size);
 
+void throttle_reserve(ThrottleState *ts, bool is_write, double fraction,
+                      ThrottleCredit *credit);
+
+void throttle_release(ThrottleState *ts, bool is_write,
+                      ThrottleCredit *credit);
+
+bool throttle_credit_consume(ThrottleCredit *credit, uint64_t size);
+
+void throttle_update_scale(ThrottleState *ts, uint64_t latency_ns);
+
 #endif
@@ -79,6 +79,8 @@ struct CharDriverState {
     void (*chr_set_echo)(struct CharDriverState *chr, bool echo);
     void (*chr_set_fe_open)(struct CharDriverState *chr, int fe_open);
     void (*chr_fe_event)(struct CharDriverState *chr, int event);
+    int (*chr_wait_connected)(struct CharDriverState *chr, Error **errp);
+    void (*chr_disconnect)(struct CharDriverState *chr);
     void *opaque;
     char *label;
     char *filename;
@@ -217,6 +219,24 @@ void qemu_chr_fe_printf(CharDriverState *s, const char *fmt, ...)
 int qemu_chr_fe_add_watch(CharDriverState *s, GIOCondition cond,
                           GIOFunc func, void *user_data);
 
+/**
+ * @qemu_chr_wait_connected:
+ *
+ * Block until a connected backend has a peer: a listening socket accepts
+ * a client, a client socket connects.  Other backends return at once.
+ *
+ * Returns: 0 on success, -1 with @errp set if the connection failed.
+ */
+int qemu_chr_wait_connected(CharDriverState *chr, Error **errp);
+
+/**
+ * @qemu_chr_disconnect:
+ *
+ * Drop the current connection of a socket backend, as if the peer had
+ * closed it; a client set to reconnect will try again later.
+ */
+void qemu_chr_disconnect(CharDriverState *chr);
+
 /**
  * @qemu_chr_fe_write:
  *
@@ -35,11 +35,14 @@
 char *exec_path;
 
 int singlestep;
+bool tb_profile_enabled;
+int tcg_pinned_regs;
 static const char *filename;
 static const char *argv0;
 static int gdbstub_port;
 static envlist_t *envlist;
 static const char *cpu_model;
+static const char *tb_cache_path;
 unsigned long mmap_min_addr;
 unsigned long guest_base;
 int have_guest_base;
@@ -3907,6 +3910,22 @@ static void handle_arg_singlestep(const char *arg)
     singlestep = 1;
 }
 
+static void handle_arg_tb_cache(const char *arg)
+{
+    tb_cache_path = arg;
+}
+
+static void handle_arg_tcg_pin_regs(const char *arg)
+{
+    long n;
+
+    if (qemu_strtol(arg, NULL, 0, &n) < 0 || n < 0 || n > INT_MAX) {
+        fprintf(stderr, "Invalid number of pinned registers: %s\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    tcg_pinned_regs = n;
+}
+
 static void handle_arg_strace(const char *arg)
 {
     do_strace = 1;
@@ -3962,6 +3981,10 @@ static const struct qemu_argument arg_table[] = {
      "pagesize",   "set the host page size to 'pagesize'"},
     {"singlestep", "QEMU_SINGLESTEP",  false, handle_arg_singlestep,
      "",           "run in singlestep mode"},
+    {"tb-cache",   "QEMU_TB_CACHE",    true,  handle_arg_tb_cache,
+     "dir",        "keep a persistent translation cache in 'dir'"},
+    {"tcg-pin-regs", "QEMU_TCG_PIN_REGS", true, handle_arg_tcg_pin_regs,
+     "n",          "keep up to 'n' guest registers in host registers"},
     {"strace",     "QEMU_STRACE",      false, handle_arg_strace,
      "",           "log system calls"},
     {"seed",       "QEMU_RAND_SEED",   true,  handle_arg_randseed,
@@ -4225,6 +4248,8 @@ int main(int argc, char **argv, char **envp)
 
     thread_cpu = cpu;
 
+    tb_cache_init(tb_cache_path, cpu_model);
+
     if (getenv("QEMU_STRACE")) {
         do_strace = 1;
     }
@@ -255,6 +255,15 @@ void cpu_list_unlock(void);
 void mmap_fork_start(void);
 void mmap_fork_end(int child);
 
+/* tbcache.c */
+void tb_cache_init(const char *dir, const char *cpu_model);
+void tb_cache_map(abi_ulong start, abi_ulong len, int prot, int flags,
+                  int fd, abi_ulong offset);
+void tb_cache_unmap(abi_ulong start, abi_ulong len);
+bool tb_cache_lookup(TranslationBlock *tb, int *code_size, int *search_size);
+void tb_cache_add(TranslationBlock *tb, int code_size, int search_size);
+void tb_cache_save(void);
+
 /* main.c */
 extern unsigned long guest_stack_size;
 
@@ -0,0 +1,617 @@
+/*
+ * Persistent translation cache for user mode emulation
+ *
+ * Copyright (c) 2016 QEMU contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Blocks translated from read-only, executable, private file mappings
+ * are saved at exit together with the relocations recorded by the TCG
+ * backend.  There is one cache file per mapped file, named after a hash
+ * of the identity of the QEMU binary, the CPU model and the identity
+ * (device, inode, size, mtime) of the mapped file, so that modifying the
+ * file invalidates its cache.  When a block is needed again its host
+ * code is copied into code_gen_buffer and relocated instead of being
+ * translated.  The guest code is compared byte for byte with the copy
+ * stored in the cache before an entry is used.
+ *
+ * Addresses inside the QEMU binary are stored relative to tb_gen_code,
+ * so that cache files remain usable when the same binary is loaded at a
+ * different address.  Cache files also depend on the host CPU features,
+ * so a cache directory must not be shared between different hosts.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "qemu.h"
+#include "tcg.h"
+
+#if TCG_TARGET_HAS_code_relocs && defined(USE_DIRECT_JUMP)
+
+#define TB_CACHE_MAGIC          "QEMUTBC"
+#define TB_CACHE_VERSION        4
+#define TB_CACHE_MAX_FILE_SIZE  (64 * 1024 * 1024)
+
+typedef struct TBCacheFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nb_entries;
+    uint64_t guest_base;
+} TBCacheFileHeader;
+
+/* Followed by the guest code, the relocations and the host code plus
+   search data, each padded to 8 bytes.  */
+typedef struct TBCacheEntryHeader {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint64_t flags;
+    uint64_t offset;        /* of pc in the mapped file */
+    uint32_t cflags;
+    uint32_t code_size;
+    uint32_t search_size;
+    uint16_t size;
+    uint16_t icount;
+    uint16_t nb_relocs;
+    uint16_t tb_next_offset[2];
+    uint16_t tb_jmp_offset[2];
+    uint16_t tc_chain_offset;
+} TBCacheEntryHeader;
+
+typedef struct TBCacheEntry {
+    const TBCacheEntryHeader *hdr;
+    const uint8_t *guest_code;
+    const TCGCodeReloc *relocs;
+    const uint8_t *host_code;
+    struct TBCacheEntry *next;  /* same pc */
+} TBCacheEntry;
+
+typedef struct TBCacheFile {
+    char *path;
+    bool loaded;
+    /* raw contents of the file, entries point into it */
+    uint8_t *data;
+    size_t data_size;
+    uint32_t nb_entries;
+    /* entries translated by this process, not yet saved */
+    GPtrArray *new_entries;
+    size_t new_size;
+    /* pc -> TBCacheEntry list */
+    GHashTable *entries;
+} TBCacheFile;
+
+typedef struct TBCacheRegion {
+    abi_ulong start;
+    abi_ulong end;
+    abi_ulong offset;
+    TBCacheFile *file;
+} TBCacheRegion;
+
+/* Provided by the linker, they delimit the image of the QEMU binary.  */
+extern char __executable_start[], _end[];
+
+static char *tb_cache_dir;
+static char *tb_cache_ident;
+static GHashTable *tb_cache_files;
+static GSList *tb_cache_regions;
+
+static size_t tb_cache_entry_size(const TBCacheEntryHeader *hdr)
+{
+    return sizeof(*hdr) + ROUND_UP(hdr->size, 8)
+        + hdr->nb_relocs * sizeof(TCGCodeReloc)
+        + ROUND_UP(hdr->code_size + hdr->search_size, 8);
+}
+
+/* Entries come from a file that may be truncated or corrupt, check
+   everything that is used to patch the copied host code.  */
+static bool tb_cache_entry_valid(const TBCacheEntryHeader *hdr)
+{
+    const TCGCodeReloc *relocs = (const TCGCodeReloc *)
+        ((const uint8_t *)(hdr + 1) + ROUND_UP(hdr->size, 8));
+    int i;
+
+    if (hdr->tc_chain_offset > hdr->code_size) {
+        return false;
+    }
+    for (i = 0; i < 2; i++) {
+        if (hdr->tb_next_offset[i] != 0xffff &&
+            (hdr->tb_next_offset[i] > hdr->code_size ||
+             hdr->tb_jmp_offset[i] + 4 > hdr->code_size)) {
+            return false;
+        }
+    }
+
+    for (i = 0; i < hdr->nb_relocs; i++) {
+        const TCGCodeReloc *r = &relocs[i];
+        uint32_t width;
+
+        switch (r->type) {
+        case TCG_CODE_RELOC_PCREL32:
+            width = 4;
+            break;
+        case TCG_CODE_RELOC_ABS:
+            width = sizeof(uintptr_t);
+            break;
+        default:
+            return false;
+        }
+        switch (r->base) {
+        case TCG_CODE_RELOC_BASE_PROLOGUE:
+        case TCG_CODE_RELOC_BASE_TB:
+        case TCG_CODE_RELOC_BASE_BINARY:
+            break;
+        default:
+            return false;
+        }
+        if (r->offset > hdr->code_size || width > hdr->code_size - r->offset) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void tb_cache_insert(TBCacheFile *file, const TBCacheEntryHeader *hdr)
+{
+    TBCacheEntry *e = g_new0(TBCacheEntry, 1);
+    const uint8_t *p = (const uint8_t *)(hdr + 1);
+
+    e->hdr = hdr;
+    e->guest_code = p;
+    p += ROUND_UP(hdr->size, 8);
+    e->relocs = (const TCGCodeReloc *)p;
+    p += hdr->nb_relocs * sizeof(TCGCodeReloc);
+    e->host_code = p;
+
+    e->next = g_hash_table_lookup(file->entries, &hdr->pc);
+    g_hash_table_insert(file->entries, (gpointer)&hdr->pc, e);
+}
+
+static void tb_cache_load(TBCacheFile *file)
+{
+    const TBCacheFileHeader *fh;
+    gchar *data;
+    gsize size, pos;
+    uint32_t i;
+
+    file->loaded = true;
+    if (!g_file_get_contents(file->path, &data, &size, NULL)) {
+        return;
+    }
+
+    fh = (const TBCacheFileHeader *)data;
+    if (size < sizeof(*fh) ||
+        memcmp(fh->magic, TB_CACHE_MAGIC, sizeof(fh->magic)) ||
+        fh->version != TB_CACHE_VERSION ||
+        fh->guest_base != guest_base) {
+        g_free(data);
+        return;
+    }
+
+    pos = sizeof(*fh);
+    for (i = 0; i < fh->nb_entries; i++) {
+        const TBCacheEntryHeader *hdr = (const void *)(data + pos);
+
+        if (size - pos < sizeof(*hdr) ||
+            size - pos < tb_cache_entry_size(hdr)) {
+            break;
+        }
+        if (tb_cache_entry_valid(hdr)) {
+            tb_cache_insert(file, hdr);
+        }
+        pos += tb_cache_entry_size(hdr);
+    }
+
+    file->data = (uint8_t *)data;
+    file->data_size = pos;
+    file->nb_entries = i;
+}
+
+static TBCacheFile *tb_cache_file_get(int fd)
+{
+    struct stat st;
+    TBCacheFile *file;
+    char *ident, *hash, *path;
+
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        return NULL;
+    }
+
+    ident = g_strdup_printf("%s %" PRIu64 ":%" PRIu64 ":%" PRId64 ":%" PRId64
+                            ".%ld", tb_cache_ident,
+                            (uint64_t)st.st_dev, (uint64_t)st.st_ino,
+                            (int64_t)st.st_size, (int64_t)st.st_mtime,
+                            (long)st.st_mtim.tv_nsec);
+    hash = g_compute_checksum_for_string(G_CHECKSUM_SHA256, ident, -1);
+    path = g_strdup_printf("%s/%s.tbc", tb_cache_dir, hash);
+    g_free(ident);
+    g_free(hash);
+
+    file = g_hash_table_lookup(tb_cache_files, path);
+    if (file) {
+        g_free(path);
+        return file;
+    }
+
+    file = g_new0(TBCacheFile, 1);
+    file->path = path;
+    file->new_entries = g_ptr_array_new();
+    file->entries = g_hash_table_new(g_int64_hash, g_int64_equal);
+    g_hash_table_insert(tb_cache_files, file->path, file);
+    return file;
+}
+
+/* Called with mmap_lock held.  */
+void tb_cache_map(abi_ulong start, abi_ulong len, int prot, int flags,
+                  int fd, abi_ulong offset)
+{
+    TBCacheRegion *r;
+    TBCacheFile *file;
+
+    if (!tb_cache_dir || !len || (flags & MAP_ANONYMOUS) ||
+        (flags & MAP_TYPE) != MAP_PRIVATE ||
+        (prot & (PROT_READ | PROT_WRITE | PROT_EXEC)) !=
+        (PROT_READ | PROT_EXEC)) {
+        return;
+    }
+
+    file = tb_cache_file_get(fd);
+    if (!file) {
+        return;
+    }
+
+    r = g_new(TBCacheRegion, 1);
+    r->start = start;
+    r->end = start + len;
+    r->offset = offset;
+    r->file = file;
+    tb_cache_regions = g_slist_prepend(tb_cache_regions, r);
+}
+
+/* Called with mmap_lock held.  */
+void tb_cache_unmap(abi_ulong start, abi_ulong len)
+{
+    abi_ulong end = start + len;
+    GSList *l, *next;
+
+    for (l = tb_cache_regions; l; l = next) {
+        TBCacheRegion *r = l->data;
+
+        next = l->next;
+        if (r->end <= start || r->start >= end) {
+            continue;
+        }
+        if (r->start < start && r->end > end) {
+            TBCacheRegion *tail = g_new(TBCacheRegion, 1);
+
+            *tail = *r;
+            tail->start = end;
+            tail->offset += end - r->start;
+            tb_cache_regions = g_slist_prepend(tb_cache_regions, tail);
+            r->end = start;
+        } else if (r->start < start) {
+            r->end = start;
+        } else if (r->end > end) {
+            r->offset += end - r->start;
+            r->start = end;
+        } else {
+            tb_cache_regions = g_slist_delete_link(tb_cache_regions, l);
+            g_free(r);
+        }
+    }
+}
+
+static TBCacheRegion *tb_cache_find_region(TranslationBlock *tb,
+                                           unsigned size)
+{
+    target_ulong pc = tb->pc;
+    GSList *l;
+
+    if (!tb_cache_dir || (tb->cflags & CF_NOCACHE)) {
+        return NULL;
+    }
+    for (l = tb_cache_regions; l; l = l->next) {
+        TBCacheRegion *r = l->data;
+
+        if (pc >= r->start && pc < r->end) {
+            return size <= r->end - pc ? r : NULL;
+        }
+    }
+    return NULL;
+}
+
+static bool tb_cache_relocate(uint8_t *code, const TCGCodeReloc *relocs,
+                              int nb_relocs, TranslationBlock *tb)
+{
+    int i;
+
+    for (i = 0; i < nb_relocs; i++) {
+        const TCGCodeReloc *r = &relocs[i];
+        uint8_t *where = code + r->offset;
+        uintptr_t target;
+
+        switch (r->base) {
+        case TCG_CODE_RELOC_BASE_PROLOGUE:
+            target = (uintptr_t)tcg_ctx.code_gen_prologue + r->addend;
+            break;
+        case TCG_CODE_RELOC_BASE_TB:
+            target = (uintptr_t)tb + r->addend;
+            break;
+        case TCG_CODE_RELOC_BASE_BINARY:
+            target = (uintptr_t)tb_gen_code + r->addend;
+            break;
+        default:
+            return false;
+        }
+
+        switch (r->type) {
+        case TCG_CODE_RELOC_PCREL32: {
+            intptr_t disp = target - (uintptr_t)(where + 4);
+            int32_t disp32 = disp;
+
+            if (disp != disp32) {
+                return false;
+            }
+            memcpy(where, &disp32, sizeof(disp32));
+            break;
+        }
+        case TCG_CODE_RELOC_ABS:
+            memcpy(where, &target, sizeof(target));
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Try to fill in TB from the cache.  On success, the host code and the
+   search data are copied to tb->tc_ptr and their sizes are returned.
+   Called with mmap_lock held.  */
+bool tb_cache_lookup(TranslationBlock *tb, int *code_size, int *search_size)
+{
+    TBCacheRegion *r;
+    TBCacheEntry *e;
+    const TBCacheEntryHeader *hdr;
+    uint64_t pc = tb->pc;
+
+    r = tb_cache_find_region(tb, 1);
+    if (!r) {
+        return false;
+    }
+    if (!r->file->loaded) {
+        tb_cache_load(r->file);
+    }
+
+    for (e = g_hash_table_lookup(r->file->entries, &pc); e; e = e->next) {
+        hdr = e->hdr;
+        if (hdr->cs_base == tb->cs_base && hdr->flags == tb->flags &&
+            hdr->cflags == tb->cflags &&
+            hdr->offset == r->offset + (tb->pc - r->start) &&
+            hdr->size <= r->end - tb->pc &&
+            page_check_range(tb->pc, hdr->size, PAGE_READ) == 0 &&
+            memcmp(g2h(tb->pc), e->guest_code, hdr->size) == 0) {
+            break;
+        }
+    }
+    if (!e) {
+        return false;
+    }
+
+    if (tcg_ctx.code_gen_ptr + hdr->code_size + hdr->search_size >
+        tcg_ctx.code_gen_highwater) {
+        return false;
+    }
+
+    memcpy(tb->tc_ptr, e->host_code, hdr->code_size + hdr->search_size);
+    if (!tb_cache_relocate(tb->tc_ptr, e->relocs, hdr->nb_relocs, tb)) {
+        return false;
+    }
+    flush_icache_range((uintptr_t)tb->tc_ptr,
+                       (uintptr_t)tb->tc_ptr + hdr->code_size);
+
+    tb->size = hdr->size;
+    tb->icount = hdr->icount;
+    tb->tc_search = tb->tc_ptr + hdr->code_size;
+    tb->tb_next_offset[0] = hdr->tb_next_offset[0];
+    tb->tb_next_offset[1] = hdr->tb_next_offset[1];
+    tb->tb_jmp_offset[0] = hdr->tb_jmp_offset[0];
+    tb->tb_jmp_offset[1] = hdr->tb_jmp_offset[1];
+    tb->tc_chain_offset = hdr->tc_chain_offset;
+
+    *code_size = hdr->code_size;
+    *search_size = hdr->search_size;
+    return true;
+}
+
+/* Remember the freshly generated TB so that it is saved at exit.
+   Called with mmap_lock held.  */
+void tb_cache_add(TranslationBlock *tb, int code_size, int search_size)
+{
+    TBCacheRegion *r;
+    TBCacheEntryHeader *hdr;
+    TBCacheFile *file;
+    uint64_t pc = tb->pc;
+    uint8_t *p;
+    size_t size;
+
+    if (!tcg_ctx.code_relocatable) {
+        return;
+    }
+    r = tb_cache_find_region(tb, tb->size);
+    if (!r) {
+        return;
+    }
+    file = r->file;
+    if (!file->loaded) {
+        tb_cache_load(file);
+    }
+    if (g_hash_table_lookup(file->entries, &pc)) {
+        /* Do not bother with multiple versions of the same block.  */
+        return;
+    }
+
+    size = sizeof(*hdr) + ROUND_UP(tb->size, 8)
+        + tcg_ctx.nb_code_relocs * sizeof(TCGCodeReloc)
+        + ROUND_UP(code_size + search_size, 8);
+    if (file->data_size + file->new_size + size > TB_CACHE_MAX_FILE_SIZE) {
+        return;
+    }
+
+    hdr = g_malloc0(size);
+    hdr->pc = tb->pc;
+    hdr->cs_base = tb->cs_base;
+    hdr->flags = tb->flags;
+    hdr->offset = r->offset + (tb->pc - r->start);
+    hdr->cflags = tb->cflags;
+    hdr->code_size = code_size;
+    hdr->search_size = search_size;
+    hdr->size = tb->size;
+    hdr->icount = tb->icount;
+    hdr->nb_relocs = tcg_ctx.nb_code_relocs;
+    hdr->tb_next_offset[0] = tb->tb_next_offset[0];
+    hdr->tb_next_offset[1] = tb->tb_next_offset[1];
+    hdr->tb_jmp_offset[0] = tb->tb_jmp_offset[0];
+    hdr->tb_jmp_offset[1] = tb->tb_jmp_offset[1];
+    hdr->tc_chain_offset = tb->tc_chain_offset;
+
+    p = (uint8_t *)(hdr + 1);
+    memcpy(p, g2h(tb->pc), tb->size);
+    p += ROUND_UP(tb->size, 8);
+    memcpy(p, tcg_ctx.code_relocs,
+           tcg_ctx.nb_code_relocs * sizeof(TCGCodeReloc));
+    p += tcg_ctx.nb_code_relocs * sizeof(TCGCodeReloc);
+    memcpy(p, tb->tc_ptr, code_size + search_size);
+
+    g_ptr_array_add(file->new_entries, hdr);
+    file->new_size += size;
+    tb_cache_insert(file, hdr);
+}
+
+static void tb_cache_save_file(gpointer key, gpointer value, gpointer opaque)
+{
+    TBCacheFile *file = value;
+    TBCacheFileHeader fh;
+    char *tmp;
+    FILE *f;
+    guint i;
+
+    if (!file->new_entries->len) {
+        return;
+    }
+
+    memset(&fh, 0, sizeof(fh));
+    memcpy(fh.magic, TB_CACHE_MAGIC, sizeof(fh.magic));
+    fh.version = TB_CACHE_VERSION;
+    fh.guest_base = guest_base;
+    fh.nb_entries = file->nb_entries + file->new_entries->len;
+
+    /* Write a private copy and atomically replace the old file, so that
+       concurrent processes never see a partial cache.  */
+    tmp = g_strdup_printf("%s.%d", file->path, (int)getpid());
+    f = fopen(tmp, "wb");
+    if (!f) {
+        g_free(tmp);
+        return;
+    }
+    fwrite(&fh, sizeof(fh), 1, f);
+    if (file->data) {
+        fwrite(file->data + sizeof(fh), file->data_size - sizeof(fh), 1, f);
+    }
+    for (i = 0; i < file->new_entries->len; i++) {
+        TBCacheEntryHeader *hdr = g_ptr_array_index(file->new_entries, i);
+
+        fwrite(hdr, tb_cache_entry_size(hdr), 1, f);
+    }
+    if (fclose(f) != 0 || rename(tmp, file->path) != 0) {
+        unlink(tmp);
+    }
+    g_free(tmp);
+}
+
+/* Write out the blocks translated by this process.  */
+void tb_cache_save(void)
+{
+    if (!tb_cache_dir) {
+        return;
+    }
+    mmap_lock();
+    g_hash_table_foreach(tb_cache_files, tb_cache_save_file, NULL);
+    mmap_unlock();
+}
+
+void tb_cache_init(const char *dir, const char *cpu_model)
+{
+    struct stat st;
+
+    if (!dir || !*dir) {
+        return;
+    }
+    if (g_mkdir_with_parents(dir, 0755) < 0) {
+        fprintf(stderr, "qemu: cannot create translation cache directory "
+                "%s: %s\n", dir, strerror(errno));
+        return;
+    }
+    if (stat("/proc/self/exe", &st) < 0) {
+        return;
+    }
+
+    /* The generated code depends on which globals are pinned.  */
+    tb_cache_ident = g_strdup_printf("%s %s %s pin=%d %" PRIu64 ":%" PRIu64
+                                     ":%" PRId64 ":%" PRId64,
+                                     TARGET_NAME, QEMU_VERSION, cpu_model,
+                                     tcg_ctx.nb_pinned_globals,
+                                     (uint64_t)st.st_dev, (uint64_t)st.st_ino,
+                                     (int64_t)st.st_size,
+                                     (int64_t)st.st_mtime);
+    tb_cache_dir = g_strdup(dir);
+    tb_cache_files = g_hash_table_new(g_str_hash, g_str_equal);
+    tcg_ctx.code_reloc_binary_start = (uintptr_t)__executable_start;
+    tcg_ctx.code_reloc_binary_end = (uintptr_t)_end;
+    tcg_ctx.code_reloc_enabled = true;
+}
+
+#else
+
+void tb_cache_init(const char *dir, const char *cpu_model)
+{
+    if (dir && *dir) {
+        fprintf(stderr, "qemu: translation cache not supported on this "
+                "host\n");
+    }
+}
+
+void tb_cache_map(abi_ulong start, abi_ulong len, int prot, int flags,
+                  int fd, abi_ulong offset)
+{
+}
+
+void tb_cache_unmap(abi_ulong start, abi_ulong len)
+{
+}
+
+bool tb_cache_lookup(TranslationBlock *tb, int *code_size, int *search_size)
+{
+    return false;
+}
+
+void tb_cache_add(TranslationBlock *tb, int code_size, int search_size)
+{
+}
+
+void tb_cache_save(void)
+{
+}
+
+#endif
@@ -20,7 +20,7 @@
 #include "qapi/error.h"
 #include "nbd-internal.h"
 
-static int nbd_errno_to_system_errno(int err)
+int nbd_errno_to_system_errno(int err)
 {
     switch (err) {
     case NBD_SUCCESS:
@@ -33,6 +33,8 @@ static int nbd_errno_to_system_errno(int err)
         return ENOMEM;
     case NBD_ENOSPC:
         return ENOSPC;
+    case NBD_ENOTSUP:
+        return ENOTSUP;
     case NBD_EINVAL:
     default:
         return EINVAL;
@@ -127,6 +129,11 @@ static int nbd_handle_reply_err(QIOChannel *ioc, uint32_t opt, uint32_t type,
                    opt);
         break;
 
+    case NBD_REP_ERR_UNKNOWN:
+        error_setg(errp, "Requested export not available for option %" PRIx32,
+                   opt);
+        break;
+
     default:
         error_setg(errp, "Unknown error code when asking for option %" PRIx32,
                    opt);
@@ -406,20 +413,201 @@ static QIOChannel *nbd_receive_starttls(QIOChannel *ioc,
 }
 
 
-int nbd_receive_negotiate(QIOChannel *ioc, const char *name, uint16_t *flags,
+static int nbd_send_option_request(QIOChannel *ioc, uint32_t opt,
+                                   uint32_t len, const char *data,
+                                   Error **errp)
+{
+    uint64_t magic = cpu_to_be64(NBD_OPTS_MAGIC);
+    uint32_t be_opt = cpu_to_be32(opt);
+    uint32_t be_len = cpu_to_be32(len);
+
+    if (write_sync(ioc, &magic, sizeof(magic)) != sizeof(magic)) {
+        error_setg(errp, "Failed to send option magic");
+        return -1;
+    }
+    if (write_sync(ioc, &be_opt, sizeof(be_opt)) != sizeof(be_opt)) {
+        error_setg(errp, "Failed to send option number");
+        return -1;
+    }
+    if (write_sync(ioc, &be_len, sizeof(be_len)) != sizeof(be_len)) {
+        error_setg(errp, "Failed to send option length");
+        return -1;
+    }
+    if (len && write_sync(ioc, (char *)data, len) != len) {
+        error_setg(errp, "Failed to send option data");
+        return -1;
+    }
+    return 0;
+}
+
+/* Read the header of a reply to option OPT.  Returns 1 with *type and *len
+ * set on success, and otherwise behaves like nbd_handle_reply_err().
+ */
+static int nbd_receive_option_reply(QIOChannel *ioc, uint32_t opt,
+                                    uint32_t *type, uint32_t *len,
+                                    Error **errp)
+{
+    uint64_t magic;
+    uint32_t reply_opt;
+    int error;
+
+    if (read_sync(ioc, &magic, sizeof(magic)) != sizeof(magic)) {
+        error_setg(errp, "failed to read option magic");
+        return -1;
+    }
+    magic = be64_to_cpu(magic);
+    if (magic != NBD_REP_MAGIC) {
+        error_setg(errp, "Unexpected option magic");
+        return -1;
+    }
+    if (read_sync(ioc, &reply_opt, sizeof(reply_opt)) != sizeof(reply_opt)) {
+        error_setg(errp, "failed to read option");
+        return -1;
+    }
+    reply_opt = be32_to_cpu(reply_opt);
+    if (reply_opt != opt) {
+        error_setg(errp, "Unexpected option type %" PRIx32 " expected %x",
+                   reply_opt, opt);
+        return -1;
+    }
+    if (read_sync(ioc, type, sizeof(*type)) != sizeof(*type)) {
+        error_setg(errp, "failed to read option type");
+        return -1;
+    }
+    *type = be32_to_cpu(*type);
+    error = nbd_handle_reply_err(ioc, opt, *type, errp);
+    if (error <= 0) {
+        return error;
+    }
+    if (read_sync(ioc, len, sizeof(*len)) != sizeof(*len)) {
+        error_setg(errp, "failed to read option length");
+        return -1;
+    }
+    *len = be32_to_cpu(*len);
+    return 1;
+}
+
+/* Returns 1 if the server agreed to send structured replies, 0 if it
+ * does not support them, -1 on error.
+ */
+static int nbd_receive_structured_reply(QIOChannel *ioc, Error **errp)
+{
+    uint32_t type, len;
+    int ret;
+
+    TRACE("Requesting structured replies");
+    if (nbd_send_option_request(ioc, NBD_OPT_STRUCTURED_REPLY, 0, NULL,
+                                errp) < 0) {
+        return -1;
+    }
+    ret = nbd_receive_option_reply(ioc, NBD_OPT_STRUCTURED_REPLY,
+                                   &type, &len, errp);
+    if (ret <= 0) {
+        return ret;
+    }
+    if (type != NBD_REP_ACK || len != 0) {
+        error_setg(errp, "Unexpected reply type %" PRIx32
+                   " to structured reply request", type);
+        return -1;
+    }
+    return 1;
+}
+
+/* Select metadata context CONTEXT for export NAME.  Returns 1 with *id
+ * set if the server knows the context, 0 if it does not, -1 on error.
+ */
+static int nbd_receive_meta_context(QIOChannel *ioc, const char *name,
+                                    const char *context, uint32_t *id,
+                                    Error **errp)
+{
+    uint32_t name_len = strlen(name);
+    uint32_t context_len = strlen(context);
+    uint32_t data_len = 4 + name_len + 4 + 4 + context_len;
+    uint32_t type, len;
+    char *data, *p;
+    int found = 0;
+    int ret;
+
+    /* Client sends:
+        [ 0 ..   3]   export name length
+        [ 4 ..  xx]   export name
+        [xx .. +3]    number of queries (1)
+        [xx .. +3]    query length
+        [xx .. yy]    query
+     */
+    TRACE("Requesting meta context '%s'", context);
+    data = p = g_malloc(data_len);
+    stl_be_p(p, name_len);
+    memcpy(p + 4, name, name_len);
+    p += 4 + name_len;
+    stl_be_p(p, 1);
+    stl_be_p(p + 4, context_len);
+    memcpy(p + 8, context, context_len);
+    ret = nbd_send_option_request(ioc, NBD_OPT_SET_META_CONTEXT, data_len,
+                                  data, errp);
+    g_free(data);
+    if (ret < 0) {
+        return -1;
+    }
+
+    while (1) {
+        char buf[64];
+
+        ret = nbd_receive_option_reply(ioc, NBD_OPT_SET_META_CONTEXT,
+                                       &type, &len, errp);
+        if (ret <= 0) {
+            return ret;
+        }
+        if (type == NBD_REP_ACK) {
+            if (len != 0) {
+                error_setg(errp, "length too long for option end");
+                return -1;
+            }
+            return found;
+        }
+        if (type != NBD_REP_META_CONTEXT) {
+            error_setg(errp, "Unexpected reply type %" PRIx32 " expected %x",
+                       type, NBD_REP_META_CONTEXT);
+            return -1;
+        }
+
+        /* We asked for a single context, so that is all we may get */
+        if (found || len != sizeof(*id) + context_len ||
+            context_len > sizeof(buf)) {
+            error_setg(errp, "Unexpected meta context reply");
+            return -1;
+        }
+        if (read_sync(ioc, id, sizeof(*id)) != sizeof(*id) ||
+            read_sync(ioc, buf, context_len) != context_len) {
+            error_setg(errp, "failed to read meta context");
+            return -1;
+        }
+        if (memcmp(buf, context, context_len) != 0) {
+            error_setg(errp, "Unexpected meta context reply");
+            return -1;
+        }
+        *id = be32_to_cpu(*id);
+        TRACE("Meta context '%s' has id %" PRIu32, context, *id);
+        found = 1;
+    }
+}
+
+int nbd_receive_negotiate(QIOChannel *ioc, const char *name,
                           QCryptoTLSCreds *tlscreds, const char *hostname,
                           QIOChannel **outioc,
-                          off_t *size, Error **errp)
+                          NBDExportInfo *info, Error **errp)
 {
     char buf[256];
     uint64_t magic, s;
-    int rc;
+    int rc, result;
 
     TRACE("Receiving negotiation tlscreds=%p hostname=%s.",
           tlscreds, hostname ? hostname : "<null>");
 
     rc = -EINVAL;
 
+    info->structured_reply = false;
+    info->base_allocation = false;
     if (outioc) {
         *outioc = NULL;
     }
@@ -513,6 +701,25 @@ int nbd_receive_negotiate(QIOChannel *ioc, const char *name, uint16_t *flags,
             if (nbd_receive_query_exports(ioc, name, errp) < 0) {
                 goto fail;
             }
+
+            if (info->request_structured) {
+                result = nbd_receive_structured_reply(ioc, errp);
+                if (result < 0) {
+                    goto fail;
+                }
+                info->structured_reply = result;
+            }
+            if (info->structured_reply) {
+                uint32_t *id = &info->meta_base_allocation_id;
+
+                result = nbd_receive_meta_context(ioc, name,
+                                                  NBD_META_BASE_ALLOCATION,
+                                                  id, errp);
+                if (result < 0) {
+                    goto fail;
+                }
+                info->base_allocation = result;
+            }
         }
         /* write the export name */
         magic = cpu_to_be64(magic);
@@ -540,13 +747,14 @@ int nbd_receive_negotiate(QIOChannel *ioc, const char *name, uint16_t *flags,
             error_setg(errp, "Failed to read export length");
             goto fail;
         }
-        *size = be64_to_cpu(s);
+        info->size = be64_to_cpu(s);
 
-        if (read_sync(ioc, flags, sizeof(*flags)) != sizeof(*flags)) {
+        if (read_sync(ioc, &info->flags, sizeof(info->flags)) !=
+            sizeof(info->flags)) {
             error_setg(errp, "Failed to read export flags");
             goto fail;
         }
-        be16_to_cpus(flags);
+        be16_to_cpus(&info->flags);
     } else if (magic == NBD_CLIENT_MAGIC) {
         uint32_t oldflags;
 
@@ -563,8 +771,8 @@ int nbd_receive_negotiate(QIOChannel *ioc, const char *name, uint16_t *flags,
             error_setg(errp, "Failed to read export length");
             goto fail;
         }
-        *size = be64_to_cpu(s);
-        TRACE("Size is %" PRIu64, *size);
+        info->size = be64_to_cpu(s);
+        TRACE("Size is %" PRIu64, (uint64_t)info->size);
 
         if (read_sync(ioc, &oldflags, sizeof(oldflags)) != sizeof(oldflags)) {
             error_setg(errp, "Failed to read export flags");
@@ -575,13 +783,14 @@ int nbd_receive_negotiate(QIOChannel *ioc, const char *name, uint16_t *flags,
             error_setg(errp, "Unexpected export flags %0x" PRIx32, oldflags);
             goto fail;
         }
-        *flags = oldflags;
+        info->flags = oldflags;
     } else {
         error_setg(errp, "Bad magic received");
         goto fail;
     }
 
-    TRACE("Size is %" PRIu64 ", export flags %" PRIx16, *size, *flags);
+    TRACE("Size is %" PRIu64 ", export flags %" PRIx16,
+          (uint64_t)info->size, info->flags);
     if (read_sync(ioc, &buf, 124) != 124) {
         error_setg(errp, "Failed to read reserved block");
         goto fail;
@@ -711,40 +920,76 @@ ssize_t nbd_send_request(QIOChannel *ioc, struct nbd_request *request)
 
 ssize_t nbd_receive_reply(QIOChannel *ioc, struct nbd_reply *reply)
 {
-    uint8_t buf[NBD_REPLY_SIZE];
-    uint32_t magic;
+    uint8_t buf[NBD_STRUCTURED_REPLY_SIZE];
     ssize_t ret;
 
-    ret = read_sync(ioc, buf, sizeof(buf));
+    ret = read_sync(ioc, buf, NBD_REPLY_SIZE);
     if (ret < 0) {
         return ret;
     }
 
-    if (ret != sizeof(buf)) {
+    if (ret != NBD_REPLY_SIZE) {
         LOG("read failed");
         return -EINVAL;
     }
 
-    /* Reply
+    /* Simple reply
        [ 0 ..  3]    magic   (NBD_REPLY_MAGIC)
        [ 4 ..  7]    error   (0 == no error)
        [ 7 .. 15]    handle
+
+       Structured reply chunk
+       [ 0 ..  3]    magic   (NBD_STRUCTURED_REPLY_MAGIC)
+       [ 4 ..  5]    flags
+       [ 6 ..  7]    type
+       [ 8 .. 15]    handle
+       [16 .. 19]    payload length
      */
 
-    magic = ldl_be_p(buf);
-    reply->error  = ldl_be_p(buf + 4);
+    reply->magic  = ldl_be_p(buf);
     reply->handle = ldq_be_p(buf + 8);
 
-    reply->error = nbd_errno_to_system_errno(reply->error);
+    switch (reply->magic) {
+    case NBD_REPLY_MAGIC:
+        reply->error = nbd_errno_to_system_errno(ldl_be_p(buf + 4));
+        reply->flags = 0;
+        reply->type = 0;
+        reply->length = 0;
+
+        TRACE("Got reply: { magic = 0x%" PRIx32 ", .error = % " PRId32
+              ", handle = %" PRIu64" }",
+              reply->magic, reply->error, reply->handle);
+        break;
+
+    case NBD_STRUCTURED_REPLY_MAGIC:
+        /* The rest of the header is already on its way, so wait for it
+         * even if the socket is non-blocking.
+         */
+        do {
+            ret = read_sync(ioc, buf + NBD_REPLY_SIZE,
+                            NBD_STRUCTURED_REPLY_SIZE - NBD_REPLY_SIZE);
+            if (ret == -EAGAIN) {
+                qio_channel_wait(ioc, G_IO_IN);
+            }
+        } while (ret == -EAGAIN);
+        if (ret != NBD_STRUCTURED_REPLY_SIZE - NBD_REPLY_SIZE) {
+            LOG("read failed");
+            return -EINVAL;
+        }
 
-    TRACE("Got reply: { magic = 0x%" PRIx32 ", .error = % " PRId32
-          ", handle = %" PRIu64" }",
-          magic, reply->error, reply->handle);
+        reply->error  = 0;
+        reply->flags  = lduw_be_p(buf + 4);
+        reply->type   = lduw_be_p(buf + 6);
+        reply->length = ldl_be_p(buf + 16);
 
-    if (magic != NBD_REPLY_MAGIC) {
-        LOG("invalid magic (got 0x%" PRIx32 ")", magic);
+        TRACE("Got reply chunk: { flags = 0x%" PRIx16 ", .type = %" PRIu16
+              ", handle = %" PRIu64 ", length = %" PRIu32 " }",
+              reply->flags, reply->type, reply->handle, reply->length);
+        break;
+
+    default:
+        LOG("invalid magic (got 0x%" PRIx32 ")", reply->magic);
         return -EINVAL;
     }
     return 0;
 }
-
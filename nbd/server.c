@@ -38,12 +38,26 @@ static int system_errno_to_nbd_errno(int err)
     case EFBIG:
     case ENOSPC:
         return NBD_ENOSPC;
+    case ENOTSUP:
+#if ENOTSUP != EOPNOTSUPP
+    case EOPNOTSUPP:
+#endif
+        return NBD_ENOTSUP;
     case EINVAL:
     default:
         return NBD_EINVAL;
     }
 }
 
+/* Cap on the payload of a meta context option */
+#define NBD_MAX_META_CONTEXT_OPT_SIZE 65536
+
+/* Our id for the base:allocation metadata context */
+#define NBD_META_ID_BASE_ALLOCATION 0
+
+/* Cap on the number of descriptors in a block status reply */
+#define NBD_MAX_BLOCK_STATUS_EXTENTS 1024
+
 /* Definitions for opaque data types */
 
 typedef struct NBDRequest NBDRequest;
@@ -64,6 +78,7 @@ struct NBDExport {
     off_t size;
     uint16_t nbdflags;
     QTAILQ_HEAD(, NBDClient) clients;
+    int nb_clients;     /* Read locklessly by nbd_export_find() */
     QTAILQ_ENTRY(NBDExport) next;
 
     AioContext *ctx;
@@ -90,6 +105,9 @@ struct NBDClient {
 
     bool can_read;
 
+    bool structured_reply;
+    bool base_allocation;   /* NBD_CMD_BLOCK_STATUS is allowed */
+
     QTAILQ_ENTRY(NBDClient) next;
     int nb_requests;
     bool closing;
@@ -101,6 +119,29 @@ static void nbd_set_handlers(NBDClient *client);
 static void nbd_unset_handlers(NBDClient *client);
 static void nbd_update_can_read(NBDClient *client);
 
+/* Negotiation always runs in the main loop, but the export may be served
+ * from an AioContext that runs in another thread.  Take that context while
+ * the client is attached to or detached from the export.
+ */
+static AioContext *nbd_client_lock(NBDClient *client)
+{
+    AioContext *ctx;
+
+    if (!client->exp) {
+        return NULL;
+    }
+    ctx = blk_get_aio_context(client->exp->blk);
+    aio_context_acquire(ctx);
+    return ctx;
+}
+
+static void nbd_client_unlock(AioContext *ctx)
+{
+    if (ctx) {
+        aio_context_release(ctx);
+    }
+}
+
 static gboolean nbd_negotiate_continue(QIOChannel *ioc,
                                        GIOCondition condition,
                                        void *opaque)
@@ -191,12 +232,14 @@ static ssize_t nbd_negotiate_drop_sync(QIOChannel *ioc, size_t size)
 
 */
 
-static int nbd_negotiate_send_rep(QIOChannel *ioc, uint32_t type, uint32_t opt)
+/* Send the header of an option reply; LEN bytes of payload must follow */
+static int nbd_negotiate_send_rep_len(QIOChannel *ioc, uint32_t type,
+                                      uint32_t opt, uint32_t len)
 {
     uint64_t magic;
-    uint32_t len;
 
-    TRACE("Reply opt=%" PRIx32 " type=%" PRIx32, type, opt);
+    TRACE("Reply opt=%" PRIx32 " type=%" PRIx32 " len=%" PRIu32,
+          type, opt, len);
 
     magic = cpu_to_be64(NBD_REP_MAGIC);
     if (nbd_negotiate_write(ioc, &magic, sizeof(magic)) != sizeof(magic)) {
@@ -213,7 +256,7 @@ static int nbd_negotiate_send_rep(QIOChannel *ioc, uint32_t type, uint32_t opt)
         LOG("write failed (rep type)");
         return -EINVAL;
     }
-    len = cpu_to_be32(0);
+    len = cpu_to_be32(len);
     if (nbd_negotiate_write(ioc, &len, sizeof(len)) != sizeof(len)) {
         LOG("write failed (rep data length)");
         return -EINVAL;
@@ -221,6 +264,11 @@ static int nbd_negotiate_send_rep(QIOChannel *ioc, uint32_t type, uint32_t opt)
     return 0;
 }
 
+static int nbd_negotiate_send_rep(QIOChannel *ioc, uint32_t type, uint32_t opt)
+{
+    return nbd_negotiate_send_rep_len(ioc, type, opt, 0);
+}
+
 static int nbd_negotiate_send_rep_list(QIOChannel *ioc, NBDExport *exp)
 {
     uint64_t magic, name_len;
@@ -260,6 +308,22 @@ static int nbd_negotiate_send_rep_list(QIOChannel *ioc, NBDExport *exp)
     return 0;
 }
 
+/* Return true if an export earlier in the list has the same name as EXP */
+static bool nbd_export_name_seen(NBDExport *exp)
+{
+    NBDExport *e;
+
+    QTAILQ_FOREACH(e, &exports, next) {
+        if (e == exp) {
+            return false;
+        }
+        if (strcmp(e->name, exp->name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 static int nbd_negotiate_handle_list(NBDClient *client, uint32_t length)
 {
     NBDExport *exp;
@@ -272,8 +336,11 @@ static int nbd_negotiate_handle_list(NBDClient *client, uint32_t length)
                                       NBD_REP_ERR_INVALID, NBD_OPT_LIST);
     }
 
-    /* For each export, send a NBD_REP_SERVER reply. */
+    /* For each export name, send a NBD_REP_SERVER reply. */
     QTAILQ_FOREACH(exp, &exports, next) {
+        if (nbd_export_name_seen(exp)) {
+            continue;
+        }
         if (nbd_negotiate_send_rep_list(client->ioc, exp)) {
             return -EINVAL;
         }
@@ -285,6 +352,7 @@ static int nbd_negotiate_handle_list(NBDClient *client, uint32_t length)
 static int nbd_negotiate_handle_export_name(NBDClient *client, uint32_t length)
 {
     int rc = -EINVAL;
+    AioContext *ctx;
     char name[256];
 
     /* Client sends:
@@ -309,8 +377,11 @@ static int nbd_negotiate_handle_export_name(NBDClient *client, uint32_t length)
         goto fail;
     }
 
+    ctx = nbd_client_lock(client);
     QTAILQ_INSERT_TAIL(&client->exp->clients, client, next);
+    atomic_inc(&client->exp->nb_clients);
     nbd_export_get(client->exp);
+    nbd_client_unlock(ctx);
     rc = 0;
 fail:
     return rc;
@@ -365,6 +436,164 @@ static QIOChannel *nbd_negotiate_handle_starttls(NBDClient *client,
 }
 
 
+static int nbd_negotiate_handle_structured_reply(NBDClient *client,
+                                                 uint32_t length)
+{
+    if (length) {
+        if (nbd_negotiate_drop_sync(client->ioc, length) != length) {
+            return -EIO;
+        }
+        return nbd_negotiate_send_rep(client->ioc, NBD_REP_ERR_INVALID,
+                                      NBD_OPT_STRUCTURED_REPLY);
+    }
+    if (client->structured_reply) {
+        TRACE("Structured replies already enabled");
+        return nbd_negotiate_send_rep(client->ioc, NBD_REP_ERR_INVALID,
+                                      NBD_OPT_STRUCTURED_REPLY);
+    }
+
+    TRACE("Enabling structured replies");
+    client->structured_reply = true;
+    return nbd_negotiate_send_rep(client->ioc, NBD_REP_ACK,
+                                  NBD_OPT_STRUCTURED_REPLY);
+}
+
+/* Does QUERY select base:allocation?  When listing, the bare namespace
+ * stands for all of its contexts.
+ */
+static bool nbd_meta_context_matches(const char *query, uint32_t len,
+                                     bool list)
+{
+    static const char base[] = "base:";
+
+    if (len == strlen(NBD_META_BASE_ALLOCATION) &&
+        !memcmp(query, NBD_META_BASE_ALLOCATION, len)) {
+        return true;
+    }
+    return list && len == strlen(base) && !memcmp(query, base, len);
+}
+
+static int nbd_negotiate_send_meta_context(QIOChannel *ioc, uint32_t opt,
+                                           uint32_t id, const char *name)
+{
+    uint32_t name_len = strlen(name);
+    int ret;
+
+    ret = nbd_negotiate_send_rep_len(ioc, NBD_REP_META_CONTEXT, opt,
+                                     sizeof(id) + name_len);
+    if (ret < 0) {
+        return ret;
+    }
+    id = cpu_to_be32(id);
+    if (nbd_negotiate_write(ioc, &id, sizeof(id)) != sizeof(id)) {
+        LOG("write failed (context id)");
+        return -EINVAL;
+    }
+    if (nbd_negotiate_write(ioc, (char *)name, name_len) != name_len) {
+        LOG("write failed (context name)");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static int nbd_negotiate_handle_meta_context(NBDClient *client, uint32_t opt,
+                                             uint32_t length)
+{
+    bool list = opt == NBD_OPT_LIST_META_CONTEXT;
+    bool base_allocation;
+    uint32_t pos, name_len, nqueries, i;
+    uint8_t *buf;
+    char *name;
+    NBDExport *exp;
+    int ret;
+
+    /* Client sends:
+        [ 0 ..   3]   export name length
+        [ 4 ..  xx]   export name
+        [xx .. +3]    number of queries
+        ...           queries, each a 32-bit length followed by the string
+     */
+    if (!list) {
+        client->base_allocation = false;
+    }
+    if (length > NBD_MAX_META_CONTEXT_OPT_SIZE ||
+        (!list && !client->structured_reply)) {
+        if (nbd_negotiate_drop_sync(client->ioc, length) != length) {
+            return -EIO;
+        }
+        return nbd_negotiate_send_rep(client->ioc, NBD_REP_ERR_INVALID, opt);
+    }
+
+    buf = g_malloc(length);
+    if (nbd_negotiate_read(client->ioc, buf, length) != length) {
+        LOG("read failed");
+        g_free(buf);
+        return -EIO;
+    }
+
+    if (length < 8) {
+        goto invalid;
+    }
+    name_len = ldl_be_p(buf);
+    if (name_len > 255 || name_len > length - 8) {
+        goto invalid;
+    }
+    name = g_strndup((char *)buf + 4, name_len);
+    exp = nbd_export_find(name);
+    TRACE("Meta context query for export '%s'", name);
+    g_free(name);
+    if (!exp) {
+        ret = nbd_negotiate_send_rep(client->ioc, NBD_REP_ERR_UNKNOWN, opt);
+        goto out;
+    }
+
+    pos = 4 + name_len;
+    nqueries = ldl_be_p(buf + pos);
+    pos += 4;
+
+    /* No queries means all contexts when listing, and none when setting */
+    base_allocation = list && nqueries == 0;
+    for (i = 0; i < nqueries; i++) {
+        uint32_t query_len;
+
+        if (length - pos < 4) {
+            goto invalid;
+        }
+        query_len = ldl_be_p(buf + pos);
+        pos += 4;
+        if (query_len > length - pos) {
+            goto invalid;
+        }
+        if (nbd_meta_context_matches((char *)buf + pos, query_len, list)) {
+            base_allocation = true;
+        }
+        pos += query_len;
+    }
+    if (pos != length) {
+        goto invalid;
+    }
+
+    if (base_allocation) {
+        ret = nbd_negotiate_send_meta_context(client->ioc, opt,
+                                              NBD_META_ID_BASE_ALLOCATION,
+                                              NBD_META_BASE_ALLOCATION);
+        if (ret < 0) {
+            goto out;
+        }
+    }
+    if (!list) {
+        client->base_allocation = base_allocation;
+    }
+    ret = nbd_negotiate_send_rep(client->ioc, NBD_REP_ACK, opt);
+    goto out;
+
+invalid:
+    ret = nbd_negotiate_send_rep(client->ioc, NBD_REP_ERR_INVALID, opt);
+out:
+    g_free(buf);
+    return ret;
+}
+
 static int nbd_negotiate_options(NBDClient *client)
 {
     uint32_t flags;
@@ -493,6 +722,23 @@ static int nbd_negotiate_options(NBDClient *client)
                                            clientflags);
                 }
                 break;
+
+            case NBD_OPT_STRUCTURED_REPLY:
+                ret = nbd_negotiate_handle_structured_reply(client, length);
+                if (ret < 0) {
+                    return ret;
+                }
+                break;
+
+            case NBD_OPT_LIST_META_CONTEXT:
+            case NBD_OPT_SET_META_CONTEXT:
+                ret = nbd_negotiate_handle_meta_context(client, clientflags,
+                                                        length);
+                if (ret < 0) {
+                    return ret;
+                }
+                break;
+
             default:
                 TRACE("Unsupported option 0x%" PRIx32, clientflags);
                 if (nbd_negotiate_drop_sync(client->ioc, length) != length) {
@@ -529,8 +775,9 @@ static coroutine_fn int nbd_negotiate(NBDClientNewData *data)
     NBDClient *client = data->client;
     char buf[8 + 8 + 8 + 128];
     int rc;
-    const uint16_t myflags = (NBD_FLAG_HAS_FLAGS | NBD_FLAG_SEND_TRIM |
-                              NBD_FLAG_SEND_FLUSH | NBD_FLAG_SEND_FUA);
+    uint16_t myflags = (NBD_FLAG_HAS_FLAGS | NBD_FLAG_SEND_TRIM |
+                        NBD_FLAG_SEND_FLUSH | NBD_FLAG_SEND_FUA |
+                        NBD_FLAG_SEND_WRITE_ZEROES | NBD_FLAG_SEND_FAST_ZERO);
     bool oldStyle;
 
     /* Old style negotiation header without options
@@ -589,6 +836,9 @@ static coroutine_fn int nbd_negotiate(NBDClientNewData *data)
             LOG("option negotiation failed");
             goto fail;
         }
+        if (client->structured_reply) {
+            myflags |= NBD_FLAG_SEND_DF;
+        }
 
         TRACE("advertising size %" PRIu64 " and flags %x",
               client->exp->size, client->exp->nbdflags | myflags);
@@ -722,6 +972,7 @@ void nbd_client_put(NBDClient *client)
         g_free(client->tlsaclname);
         if (client->exp) {
             QTAILQ_REMOVE(&client->exp->clients, client, next);
+            atomic_dec(&client->exp->nb_clients);
             nbd_export_put(client->exp);
         }
         g_free(client);
@@ -851,16 +1102,21 @@ fail:
     return NULL;
 }
 
+/* Several exports may share a name, for example when qemu-nbd opens a
+ * read-only image once per thread; return the one with the fewest clients.
+ */
 NBDExport *nbd_export_find(const char *name)
 {
-    NBDExport *exp;
+    NBDExport *exp, *found = NULL;
     QTAILQ_FOREACH(exp, &exports, next) {
-        if (strcmp(name, exp->name) == 0) {
-            return exp;
+        if (strcmp(name, exp->name) == 0 &&
+            (!found ||
+             atomic_read(&exp->nb_clients) < atomic_read(&found->nb_clients))) {
+            found = exp;
         }
     }
 
-    return NULL;
+    return found;
 }
 
 void nbd_export_set_name(NBDExport *exp, const char *name)
@@ -973,6 +1229,337 @@ static ssize_t nbd_co_send_reply(NBDRequest *req, struct nbd_reply *reply,
     return rc;
 }
 
+/* Structured reply chunk
+   [ 0 ..  3]    magic   (NBD_STRUCTURED_REPLY_MAGIC)
+   [ 4 ..  5]    flags
+   [ 6 ..  7]    type
+   [ 8 .. 15]    handle
+   [16 .. 19]    payload length
+ */
+static void nbd_set_chunk_header(uint8_t *buf, uint16_t flags, uint16_t type,
+                                 uint64_t handle, uint32_t length)
+{
+    TRACE("Sending chunk: { flags = 0x%" PRIx16 ", .type = %" PRIu16
+          ", handle = %" PRIu64 ", length = %" PRIu32 " }",
+          flags, type, handle, length);
+
+    stl_be_p(buf, NBD_STRUCTURED_REPLY_MAGIC);
+    stw_be_p(buf + 4, flags);
+    stw_be_p(buf + 6, type);
+    stq_be_p(buf + 8, handle);
+    stl_be_p(buf + 16, length);
+}
+
+/* Send the chunks of a structured reply in one go */
+static ssize_t nbd_co_send_iov(NBDRequest *req, struct iovec *iov,
+                               unsigned niov)
+{
+    NBDClient *client = req->client;
+    size_t len = iov_size(iov, niov);
+    ssize_t rc = 0;
+
+    g_assert(qemu_in_coroutine());
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+    nbd_set_handlers(client);
+
+    qio_channel_set_cork(client->ioc, true);
+    if (nbd_wr_syncv(client->ioc, iov, niov, 0, len, false) != len) {
+        rc = -EIO;
+    }
+    qio_channel_set_cork(client->ioc, false);
+
+    client->send_coroutine = NULL;
+    nbd_set_handlers(client);
+    qemu_co_mutex_unlock(&client->send_lock);
+    return rc;
+}
+
+static ssize_t nbd_co_send_structured_error(NBDRequest *req, uint64_t handle,
+                                            int error)
+{
+    /* Payload: 32-bit error, 16-bit message length, no message */
+    uint8_t buf[NBD_STRUCTURED_REPLY_SIZE + 4 + 2];
+    struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+
+    nbd_set_chunk_header(buf, NBD_REPLY_FLAG_DONE, NBD_REPLY_TYPE_ERROR,
+                         handle, sizeof(buf) - NBD_STRUCTURED_REPLY_SIZE);
+    stl_be_p(buf + NBD_STRUCTURED_REPLY_SIZE,
+             system_errno_to_nbd_errno(error));
+    stw_be_p(buf + NBD_STRUCTURED_REPLY_SIZE + 4, 0);
+    return nbd_co_send_iov(req, &iov, 1);
+}
+
+/* Once structured replies are negotiated, READ and BLOCK_STATUS must be
+ * answered with chunks even when they fail.
+ */
+static ssize_t nbd_co_send_error(NBDRequest *req, struct nbd_reply *reply,
+                                 uint32_t command)
+{
+    if (req->client->structured_reply &&
+        (command == NBD_CMD_READ || command == NBD_CMD_BLOCK_STATUS)) {
+        return nbd_co_send_structured_error(req, reply->handle, reply->error);
+    }
+    return nbd_co_send_reply(req, reply, 0);
+}
+
+/* Describe [from, from + len) of the export as NBD_STATE_* extents,
+ * merging neighbours with the same state.  At most MAX_EXTENTS are
+ * appended to EXTENTS, so they may cover less than LEN bytes.
+ */
+static int coroutine_fn nbd_co_get_extents(NBDExport *exp, uint64_t from,
+                                           uint32_t len, unsigned max_extents,
+                                           GArray *extents)
+{
+    BlockDriverState *bs = blk_bs(exp->blk);
+    BlockDriverState *file;
+    uint64_t pos = from + exp->dev_offset;
+    uint64_t end = pos + len;
+    int64_t end_sector = DIV_ROUND_UP(end, BDRV_SECTOR_SIZE);
+
+    if (!bs) {
+        return -ENOMEDIUM;
+    }
+
+    while (pos < end) {
+        int64_t sector_num = pos >> BDRV_SECTOR_BITS;
+        int nb_sectors = end_sector - sector_num;
+        uint64_t next;
+        uint32_t flags;
+        int64_t ret;
+        int pnum;
+
+        ret = bdrv_get_block_status_above(bs, NULL, sector_num, nb_sectors,
+                                          &pnum, &file);
+        if (ret < 0) {
+            return ret;
+        }
+        if (pnum == 0) {
+            /* Past the end of the image; report the rest as data */
+            pnum = nb_sectors;
+            ret = BDRV_BLOCK_DATA;
+        }
+
+        flags = (ret & BDRV_BLOCK_DATA ? 0 : NBD_STATE_HOLE) |
+                (ret & BDRV_BLOCK_ZERO ? NBD_STATE_ZERO : 0);
+        next = MIN((uint64_t)(sector_num + pnum) << BDRV_SECTOR_BITS, end);
+
+        if (extents->len &&
+            g_array_index(extents, NBDExtent, extents->len - 1).flags ==
+            flags) {
+            g_array_index(extents, NBDExtent, extents->len - 1).length +=
+                next - pos;
+        } else {
+            NBDExtent extent = { .length = next - pos, .flags = flags };
+
+            if (extents->len == max_extents) {
+                break;
+            }
+            g_array_append_val(extents, extent);
+        }
+        pos = next;
+    }
+
+    return 0;
+}
+
+/* Answer a READ with structured replies, sending ranges that read as zero
+ * as hole chunks instead of data.  Returns a negative value only if the
+ * reply could not be sent.
+ */
+static ssize_t coroutine_fn
+nbd_co_send_sparse_read(NBDRequest *req, struct nbd_request *request)
+{
+    /* The largest chunk header is a hole: offset and length */
+    enum { CHUNK_SIZE = NBD_STRUCTURED_REPLY_SIZE + 8 + 4 };
+    NBDExport *exp = req->client->exp;
+    GArray *extents = g_array_new(false, false, sizeof(NBDExtent));
+    uint8_t *headers = NULL;
+    struct iovec *iov = NULL;
+    unsigned niov = 0;
+    uint32_t offset;
+    ssize_t ret;
+    guint i;
+
+    if (request->len == 0) {
+        uint8_t buf[NBD_STRUCTURED_REPLY_SIZE];
+        struct iovec none = { .iov_base = buf, .iov_len = sizeof(buf) };
+
+        nbd_set_chunk_header(buf, NBD_REPLY_FLAG_DONE, NBD_REPLY_TYPE_NONE,
+                             request->handle, 0);
+        ret = nbd_co_send_iov(req, &none, 1);
+        goto out;
+    }
+
+    ret = nbd_co_get_extents(exp, request->from, request->len, UINT_MAX,
+                             extents);
+    for (i = 0, offset = 0; ret >= 0 && i < extents->len; i++) {
+        NBDExtent *extent = &g_array_index(extents, NBDExtent, i);
+
+        if (!(extent->flags & NBD_STATE_ZERO)) {
+            ret = blk_pread(exp->blk,
+                            request->from + exp->dev_offset + offset,
+                            req->data + offset, extent->length);
+        }
+        offset += extent->length;
+    }
+    if (ret < 0) {
+        LOG("reading from file failed");
+        ret = nbd_co_send_structured_error(req, request->handle, -ret);
+        goto out;
+    }
+
+    headers = g_malloc(extents->len * CHUNK_SIZE);
+    iov = g_new(struct iovec, extents->len * 2);
+    for (i = 0, offset = 0; i < extents->len; i++) {
+        NBDExtent *extent = &g_array_index(extents, NBDExtent, i);
+        uint8_t *buf = headers + i * CHUNK_SIZE;
+        uint16_t flags = i == extents->len - 1 ? NBD_REPLY_FLAG_DONE : 0;
+
+        if (extent->flags & NBD_STATE_ZERO) {
+            nbd_set_chunk_header(buf, flags, NBD_REPLY_TYPE_OFFSET_HOLE,
+                                 request->handle, 8 + 4);
+            stq_be_p(buf + NBD_STRUCTURED_REPLY_SIZE, request->from + offset);
+            stl_be_p(buf + NBD_STRUCTURED_REPLY_SIZE + 8, extent->length);
+            iov[niov++] = (struct iovec) {
+                .iov_base = buf, .iov_len = CHUNK_SIZE
+            };
+        } else {
+            nbd_set_chunk_header(buf, flags, NBD_REPLY_TYPE_OFFSET_DATA,
+                                 request->handle, 8 + extent->length);
+            stq_be_p(buf + NBD_STRUCTURED_REPLY_SIZE, request->from + offset);
+            iov[niov++] = (struct iovec) {
+                .iov_base = buf, .iov_len = NBD_STRUCTURED_REPLY_SIZE + 8
+            };
+            iov[niov++] = (struct iovec) {
+                .iov_base = req->data + offset, .iov_len = extent->length
+            };
+        }
+        offset += extent->length;
+    }
+
+    TRACE("Read %" PRIu32 " byte(s) in %u chunk(s)", request->len,
+          extents->len);
+    ret = nbd_co_send_iov(req, iov, niov);
+
+out:
+    g_free(iov);
+    g_free(headers);
+    g_array_free(extents, true);
+    return ret;
+}
+
+/* Answer a READ with a single data chunk, as requested by NBD_CMD_FLAG_DF */
+static ssize_t nbd_co_send_structured_read(NBDRequest *req,
+                                           struct nbd_request *request)
+{
+    uint8_t buf[NBD_STRUCTURED_REPLY_SIZE + 8];
+    struct iovec iov[2] = {
+        { .iov_base = buf, .iov_len = sizeof(buf) },
+        { .iov_base = req->data, .iov_len = request->len },
+    };
+
+    nbd_set_chunk_header(buf, NBD_REPLY_FLAG_DONE, NBD_REPLY_TYPE_OFFSET_DATA,
+                         request->handle, 8 + request->len);
+    stq_be_p(buf + NBD_STRUCTURED_REPLY_SIZE, request->from);
+    return nbd_co_send_iov(req, iov, 2);
+}
+
+/* Answer a BLOCK_STATUS request for the base:allocation context.  Returns
+ * a negative value only if the reply could not be sent.
+ */
+static ssize_t coroutine_fn
+nbd_co_send_block_status(NBDRequest *req, struct nbd_request *request)
+{
+    NBDExport *exp = req->client->exp;
+    GArray *extents = g_array_new(false, false, sizeof(NBDExtent));
+    unsigned max_extents = request->type & NBD_CMD_FLAG_REQ_ONE ?
+                           1 : NBD_MAX_BLOCK_STATUS_EXTENTS;
+    struct iovec iov;
+    uint8_t *buf;
+    ssize_t ret;
+    guint i;
+
+    ret = nbd_co_get_extents(exp, request->from, request->len, max_extents,
+                             extents);
+    if (ret < 0) {
+        LOG("block status failed");
+        ret = nbd_co_send_structured_error(req, request->handle, -ret);
+        goto out;
+    }
+
+    /* Payload: context id, then a length and flags per descriptor */
+    iov.iov_len = NBD_STRUCTURED_REPLY_SIZE + 4 + extents->len * 8;
+    iov.iov_base = buf = g_malloc(iov.iov_len);
+    nbd_set_chunk_header(buf, NBD_REPLY_FLAG_DONE, NBD_REPLY_TYPE_BLOCK_STATUS,
+                         request->handle,
+                         iov.iov_len - NBD_STRUCTURED_REPLY_SIZE);
+    stl_be_p(buf + NBD_STRUCTURED_REPLY_SIZE, NBD_META_ID_BASE_ALLOCATION);
+    for (i = 0; i < extents->len; i++) {
+        NBDExtent *extent = &g_array_index(extents, NBDExtent, i);
+        uint8_t *p = buf + NBD_STRUCTURED_REPLY_SIZE + 4 + i * 8;
+
+        stl_be_p(p, extent->length);
+        stl_be_p(p + 4, extent->flags);
+    }
+
+    ret = nbd_co_send_iov(req, &iov, 1);
+    g_free(buf);
+
+out:
+    g_array_free(extents, true);
+    return ret;
+}
+
+/* Zero [from, from + len) of the export.  Partial sectors at either end
+ * are written out, the rest goes through blk_co_write_zeroes().  Writing
+ * them out is not fast, so with BDRV_REQ_NO_FALLBACK an unaligned request
+ * fails with -ENOTSUP before anything is written.
+ */
+static int coroutine_fn nbd_co_write_zeroes(NBDExport *exp, uint64_t from,
+                                            uint32_t len,
+                                            BdrvRequestFlags flags)
+{
+    static const uint8_t zeroes[BDRV_SECTOR_SIZE];
+    uint64_t start = from + exp->dev_offset;
+    uint64_t end = start + len;
+    uint64_t aligned_start = QEMU_ALIGN_UP(start, BDRV_SECTOR_SIZE);
+    uint64_t aligned_end = QEMU_ALIGN_DOWN(end, BDRV_SECTOR_SIZE);
+    int ret;
+
+    if (aligned_start >= aligned_end) {
+        /* No whole sector, just a head and/or a tail */
+        aligned_start = aligned_end = MIN(aligned_start, end);
+    }
+
+    if ((flags & BDRV_REQ_NO_FALLBACK) &&
+        (start < aligned_start || aligned_end < end)) {
+        return -ENOTSUP;
+    }
+
+    if (start < aligned_start) {
+        ret = blk_pwrite(exp->blk, start, zeroes, aligned_start - start);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    if (aligned_start < aligned_end) {
+        ret = blk_co_write_zeroes(exp->blk, aligned_start >> BDRV_SECTOR_BITS,
+                                  (aligned_end - aligned_start) >>
+                                  BDRV_SECTOR_BITS, flags);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    if (aligned_end < end) {
+        ret = blk_pwrite(exp->blk, aligned_end, zeroes, end - aligned_end);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
 static ssize_t nbd_co_receive_request(NBDRequest *req, struct nbd_request *request)
 {
     NBDClient *client = req->client;
@@ -1040,6 +1627,7 @@ static void nbd_trip(void *opaque)
     NBDRequest *req;
     struct nbd_request request;
     struct nbd_reply reply;
+    BdrvRequestFlags flags;
     ssize_t ret;
     uint32_t command;
 
@@ -1060,11 +1648,11 @@ static void nbd_trip(void *opaque)
     reply.handle = request.handle;
     reply.error = 0;
 
+    command = request.type & NBD_CMD_MASK_COMMAND;
     if (ret < 0) {
         reply.error = -ret;
         goto error_reply;
     }
-    command = request.type & NBD_CMD_MASK_COMMAND;
     if (command != NBD_CMD_DISC && (request.from + request.len) > exp->size) {
             LOG("From: %" PRIu64 ", Len: %" PRIu32", Size: %" PRIu64
                 ", Offset: %" PRIu64 "\n",
@@ -1095,6 +1683,14 @@ static void nbd_trip(void *opaque)
             }
         }
 
+        if (client->structured_reply &&
+            !(request.type & NBD_CMD_FLAG_DF)) {
+            if (nbd_co_send_sparse_read(req, &request) < 0) {
+                goto out;
+            }
+            break;
+        }
+
         ret = blk_pread(exp->blk, request.from + exp->dev_offset,
                         req->data, request.len);
         if (ret < 0) {
@@ -1104,8 +1700,14 @@ static void nbd_trip(void *opaque)
         }
 
         TRACE("Read %" PRIu32" byte(s)", request.len);
-        if (nbd_co_send_reply(req, &reply, request.len) < 0)
+        if (client->structured_reply) {
+            ret = nbd_co_send_structured_read(req, &request);
+        } else {
+            ret = nbd_co_send_reply(req, &reply, request.len);
+        }
+        if (ret < 0) {
             goto out;
+        }
         break;
     case NBD_CMD_WRITE:
         TRACE("Request type is WRITE");
@@ -1176,12 +1778,58 @@ static void nbd_trip(void *opaque)
             goto out;
         }
         break;
+    case NBD_CMD_WRITE_ZEROES:
+        TRACE("Request type is WRITE_ZEROES");
+
+        if (exp->nbdflags & NBD_FLAG_READ_ONLY) {
+            TRACE("Server is read-only, return error");
+            reply.error = EROFS;
+            goto error_reply;
+        }
+
+        flags = 0;
+        if (!(request.type & NBD_CMD_FLAG_NO_HOLE)) {
+            flags |= BDRV_REQ_MAY_UNMAP;
+        }
+        if (request.type & NBD_CMD_FLAG_FAST_ZERO) {
+            flags |= BDRV_REQ_NO_FALLBACK;
+        }
+        ret = nbd_co_write_zeroes(exp, request.from, request.len, flags);
+        if (ret < 0) {
+            LOG("writing zeroes failed");
+            reply.error = -ret;
+            goto error_reply;
+        }
+
+        if (request.type & NBD_CMD_FLAG_FUA) {
+            ret = blk_co_flush(exp->blk);
+            if (ret < 0) {
+                LOG("flush failed");
+                reply.error = -ret;
+                goto error_reply;
+            }
+        }
+
+        if (nbd_co_send_reply(req, &reply, 0) < 0) {
+            goto out;
+        }
+        break;
+    case NBD_CMD_BLOCK_STATUS:
+        TRACE("Request type is BLOCK_STATUS");
+
+        if (!client->base_allocation || request.len == 0) {
+            goto invalid_request;
+        }
+        if (nbd_co_send_block_status(req, &request) < 0) {
+            goto out;
+        }
+        break;
     default:
         LOG("invalid request type (%" PRIu32 ") received", request.type);
     invalid_request:
         reply.error = EINVAL;
     error_reply:
-        if (nbd_co_send_reply(req, &reply, 0) < 0) {
+        if (nbd_co_send_error(req, &reply, command) < 0) {
             goto out;
         }
         break;
@@ -1254,20 +1902,28 @@ static coroutine_fn void nbd_co_client_start(void *opaque)
     NBDClientNewData *data = opaque;
     NBDClient *client = data->client;
     NBDExport *exp = client->exp;
+    AioContext *ctx;
 
+    ctx = nbd_client_lock(client);
     if (exp) {
         nbd_export_get(exp);
     }
+    nbd_client_unlock(ctx);
     if (nbd_negotiate(data)) {
+        ctx = nbd_client_lock(client);
         client_close(client);
+        nbd_client_unlock(ctx);
         goto out;
     }
     qemu_co_mutex_init(&client->send_lock);
-    nbd_set_handlers(client);
 
+    ctx = nbd_client_lock(client);
+    nbd_set_handlers(client);
     if (exp) {
         QTAILQ_INSERT_TAIL(&exp->clients, client, next);
+        atomic_inc(&exp->nb_clients);
     }
+    nbd_client_unlock(ctx);
 out:
     g_free(data);
 }
@@ -62,4 +62,7 @@ int net_init_netmap(const NetClientOptions *opts, const char *name,
 int net_init_vhost_user(const NetClientOptions *opts, const char *name,
                         NetClientState *peer, Error **errp);
 
+int net_init_shm(const NetClientOptions *opts, const char *name,
+                 NetClientState *peer, Error **errp);
+
 #endif /* QEMU_NET_CLIENTS_H */
@@ -217,6 +217,12 @@ static void netfilter_complete(UserCreatable *uc, Error **errp)
         return;
     }
 
+    if (ncs[0]->iothread_attached) {
+        error_setg(errp, "netdev '%s' is serviced by an iothread, "
+                   "filters are not supported", ncs[0]->name);
+        return;
+    }
+
     nf->netdev = ncs[0];
 
     if (nfc->setup) {
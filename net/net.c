@@ -73,6 +73,9 @@ const char *host_net_devices[] = {
     "vde",
 #endif
     "vhost-user",
+#ifdef CONFIG_LINUX
+    "shm",
+#endif
     NULL,
 };
 
@@ -768,6 +771,50 @@ ssize_t qemu_sendv_packet_async(NetClientState *sender,
                                    iov, iovcnt, sent_cb);
 }
 
+/* Send a burst of COUNT packets.  Returns the number of packets that
+ * were sent (or dropped).  If this is less than COUNT, the packet after
+ * them was queued and SENT_CB will be called for it, as if
+ * qemu_sendv_packet_async() had returned 0 for it; the remaining packets
+ * were not touched and must be sent again later.
+ */
+int qemu_sendv_packets_async(NetClientState *sender,
+                             const NetIOVPacket *pkts, int count,
+                             NetPacketSent *sent_cb)
+{
+    NetClientState *peer = sender->peer;
+    int i = 0;
+
+    if (sender->link_down || !peer) {
+        return count;
+    }
+
+    /* Without filters and with nothing in flight the whole burst can go
+     * to the peer in one call, instead of walking the filters and flushing
+     * the queue for each packet.
+     */
+    if (peer->info->receive_iov_batch && !peer->link_down &&
+        QTAILQ_EMPTY(&sender->filters) && QTAILQ_EMPTY(&peer->filters) &&
+        !qemu_net_queue_delivering(peer->incoming_queue) &&
+        qemu_can_send_packet(sender)) {
+        i = peer->info->receive_iov_batch(peer, pkts, count);
+        if (i < count) {
+            /* As in qemu_deliver_packet_iov(), until the peer flushes */
+            peer->receive_disabled = 1;
+        }
+    }
+
+    /* Whatever the peer did not take goes through the queue, which
+     * takes care of the packet that blocked.
+     */
+    for (; i < count; i++) {
+        if (qemu_sendv_packet_async(sender, pkts[i].iov, pkts[i].iovcnt,
+                                    sent_cb) == 0) {
+            return i;
+        }
+    }
+    return count;
+}
+
 ssize_t
 qemu_sendv_packet(NetClientState *nc, const struct iovec *iov, int iovcnt)
 {
@@ -959,6 +1006,9 @@ static int (* const net_client_init_fun[NET_CLIENT_OPTIONS_KIND__MAX])(
 #ifdef CONFIG_L2TPV3
         [NET_CLIENT_OPTIONS_KIND_L2TPV3]    = net_init_l2tpv3,
 #endif
+#ifdef CONFIG_LINUX
+        [NET_CLIENT_OPTIONS_KIND_SHM]       = net_init_shm,
+#endif
 };
 
 
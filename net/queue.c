@@ -232,6 +232,11 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
     return ret;
 }
 
+bool qemu_net_queue_delivering(NetQueue *queue)
+{
+    return queue->delivering;
+}
+
 void qemu_net_queue_purge(NetQueue *queue, NetClientState *from)
 {
     NetPacket *packet, *next;
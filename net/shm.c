@@ -0,0 +1,762 @@
+/*
+ * Shared memory network backend
+ *
+ * Connects two QEMU processes on the same host through a pair of
+ * single-producer/single-consumer packet rings in a memfd.  The side
+ * started with server=on creates the rings and two eventfd doorbells and
+ * hands them to the other side over a unix socket; after that, frames
+ * move between the two NICs without any system call other than the
+ * doorbell writes, which are skipped while the other side is busy.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+
+#include "net/net.h"
+#include "clients.h"
+#include "qapi/error.h"
+#include "qemu-common.h"
+#include "qemu/error-report.h"
+#include "qemu/sockets.h"
+#include "qemu/atomic.h"
+#include "qemu/iov.h"
+#include "qemu/memfd.h"
+#include "qemu/event_notifier.h"
+#include "qmp-commands.h"
+#include "block/aio.h"
+
+#define SHM_NET_MAGIC           0x4d485351      /* "QSHM" */
+#define SHM_NET_VERSION         1
+
+#define SHM_NET_RING_SIZE_DEFAULT   (1 << 20)
+#define SHM_NET_RING_SIZE_MIN       (256 << 10)
+#define SHM_NET_RING_SIZE_MAX       (64 << 20)
+
+/* Frames handed to the peer per doorbell before yielding */
+#define SHM_NET_RX_BURST        64
+
+/* A record is a 32-bit length followed by the frame, padded to 8 bytes.
+ * A length of SHM_NET_WRAP means the rest of the ring is unused and the
+ * next record starts at offset 0.
+ */
+#define SHM_NET_WRAP            UINT32_MAX
+#define SHM_NET_RECORD_LEN(len) QEMU_ALIGN_UP(sizeof(uint32_t) + (len), 8)
+
+/* Shared between the two processes, one per direction.  head and tail
+ * are free running byte counts; each is written by one side only and
+ * lives in its own cache line.
+ */
+typedef struct ShmNetRing {
+    uint32_t head QEMU_ALIGNED(64);     /* written by the producer */
+    uint32_t producer_waiting;          /* producer ran out of space */
+    uint32_t tail QEMU_ALIGNED(64);     /* written by the consumer */
+    uint32_t consumer_waiting;          /* consumer wants a doorbell */
+} ShmNetRing;
+
+/* Sent by the server along with the memfd and the two doorbells.  The
+ * memfd holds ring[0] (server to client) and ring[1] (client to server),
+ * followed by their data areas.
+ */
+typedef struct ShmNetHello {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ring_size;
+} ShmNetHello;
+
+enum {
+    SHM_NET_FD_MEM,
+    SHM_NET_FD_SERVER_KICK,
+    SHM_NET_FD_CLIENT_KICK,
+    SHM_NET_FD_MAX
+};
+
+typedef struct ShmNetState {
+    NetClientState nc;
+    bool server;
+    char *path;
+    int listen_fd;              /* server only */
+    int fd;                     /* connection to the peer, -1 if none */
+    int mem_fd;
+    void *mem;
+    size_t mem_size;
+    uint32_t ring_size;
+    ShmNetRing *tx;
+    ShmNetRing *rx;
+    uint8_t *tx_data;
+    uint8_t *rx_data;
+    uint32_t tx_head;           /* not yet published to tx->head */
+    uint32_t rx_tail;
+    EventNotifier kick[2];      /* indexed like the rings, by receiver */
+    EventNotifier *rx_kick;     /* rung by the peer */
+    EventNotifier *tx_kick;     /* rung by us */
+    bool connected;
+    bool rx_paused;
+    bool tx_blocked;
+    AioContext *ctx;            /* NULL: handled by the main loop */
+} ShmNetState;
+
+static void shm_net_kicked(void *opaque);
+
+static size_t shm_net_mem_size(uint32_t ring_size)
+{
+    return 2 * sizeof(ShmNetRing) + 2 * (size_t)ring_size;
+}
+
+static void shm_net_map(ShmNetState *s)
+{
+    ShmNetRing *rings = s->mem;
+    uint8_t *data = (uint8_t *)&rings[2];
+    int tx = s->server ? 0 : 1;
+
+    s->tx = &rings[tx];
+    s->rx = &rings[!tx];
+    s->tx_data = data + tx * s->ring_size;
+    s->rx_data = data + !tx * s->ring_size;
+    s->rx_kick = &s->kick[!tx];
+    s->tx_kick = &s->kick[tx];
+}
+
+static void shm_net_update_fd_handler(ShmNetState *s, bool enable)
+{
+    int fd = event_notifier_get_fd(s->rx_kick);
+    IOHandler *fd_read = enable ? shm_net_kicked : NULL;
+
+    if (s->ctx) {
+        aio_set_fd_handler(s->ctx, fd, true, fd_read, NULL, s);
+    } else {
+        qemu_set_fd_handler(fd, fd_read, NULL, s);
+    }
+}
+
+/* Copy one frame into the tx ring without publishing it */
+static bool shm_net_ring_put(ShmNetState *s, const struct iovec *iov,
+                             int iovcnt, size_t len)
+{
+    uint32_t head = s->tx_head;
+    uint32_t off = head & (s->ring_size - 1);
+    uint32_t need = SHM_NET_RECORD_LEN(len);
+    uint32_t pad = 0;
+
+    if (off + need > s->ring_size) {
+        pad = s->ring_size - off;
+    }
+    if (head - atomic_read(&s->tx->tail) + pad + need > s->ring_size) {
+        return false;
+    }
+    /* Do not overwrite records before the consumer is done with them */
+    smp_mb();
+
+    if (pad) {
+        atomic_set((uint32_t *)(s->tx_data + off), SHM_NET_WRAP);
+        head += pad;
+        off = 0;
+    }
+    atomic_set((uint32_t *)(s->tx_data + off), len);
+    iov_to_buf(iov, iovcnt, 0, s->tx_data + off + sizeof(uint32_t), len);
+    s->tx_head = head + need;
+    return true;
+}
+
+static bool shm_net_ring_put_or_wait(ShmNetState *s, const struct iovec *iov,
+                                     int iovcnt, size_t len)
+{
+    if (shm_net_ring_put(s, iov, iovcnt, len)) {
+        return true;
+    }
+
+    /* Ask for a doorbell once space frees up, then check again in case
+     * the consumer drained the ring before it could see the flag.
+     */
+    atomic_set(&s->tx->producer_waiting, 1);
+    smp_mb();
+    if (shm_net_ring_put(s, iov, iovcnt, len)) {
+        return true;
+    }
+    s->tx_blocked = true;
+    return false;
+}
+
+static void shm_net_tx_publish(ShmNetState *s)
+{
+    smp_wmb();
+    atomic_set(&s->tx->head, s->tx_head);
+    smp_mb();
+    if (atomic_xchg(&s->tx->consumer_waiting, 0)) {
+        event_notifier_set(s->tx_kick);
+    }
+}
+
+static ssize_t shm_net_receive_iov(NetClientState *nc, const struct iovec *iov,
+                                   int iovcnt)
+{
+    ShmNetState *s = DO_UPCAST(ShmNetState, nc, nc);
+    size_t len = iov_size(iov, iovcnt);
+
+    /* Nobody on the other end is like an unplugged cable */
+    if (!s->connected || len > NET_BUFSIZE) {
+        return len;
+    }
+
+    if (!shm_net_ring_put_or_wait(s, iov, iovcnt, len)) {
+        return 0;
+    }
+    shm_net_tx_publish(s);
+    return len;
+}
+
+static int shm_net_receive_iov_batch(NetClientState *nc,
+                                     const NetIOVPacket *pkts, int count)
+{
+    ShmNetState *s = DO_UPCAST(ShmNetState, nc, nc);
+    uint32_t old_head = s->tx_head;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        size_t len = iov_size(pkts[i].iov, pkts[i].iovcnt);
+
+        if (!s->connected || len > NET_BUFSIZE) {
+            continue;
+        }
+        if (!shm_net_ring_put_or_wait(s, pkts[i].iov, pkts[i].iovcnt, len)) {
+            break;
+        }
+    }
+
+    /* One head update and at most one doorbell for the whole burst */
+    if (s->tx_head != old_head) {
+        shm_net_tx_publish(s);
+    }
+    return i;
+}
+
+static ssize_t shm_net_receive(NetClientState *nc, const uint8_t *buf,
+                               size_t size)
+{
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size,
+    };
+
+    return shm_net_receive_iov(nc, &iov, 1);
+}
+
+static void shm_net_rx_release(ShmNetState *s, uint32_t tail)
+{
+    /* Finish reading the records before handing them back */
+    smp_mb();
+    atomic_set(&s->rx->tail, tail);
+    s->rx_tail = tail;
+    smp_mb();
+    if (atomic_xchg(&s->rx->producer_waiting, 0)) {
+        event_notifier_set(s->tx_kick);
+    }
+}
+
+static void shm_net_rx(ShmNetState *s);
+
+static void shm_net_send_completed(NetClientState *nc, ssize_t len)
+{
+    ShmNetState *s = DO_UPCAST(ShmNetState, nc, nc);
+
+    s->rx_paused = false;
+    shm_net_rx(s);
+}
+
+static void shm_net_rx(ShmNetState *s)
+{
+    struct iovec iov[SHM_NET_RX_BURST];
+    NetIOVPacket pkts[SHM_NET_RX_BURST];
+    uint32_t ends[SHM_NET_RX_BURST];
+    uint32_t tail = s->rx_tail;
+    uint32_t head;
+    int packets = 0;
+    int sent;
+
+    if (!s->connected || s->rx_paused) {
+        return;
+    }
+
+    for (;;) {
+        head = atomic_read(&s->rx->head);
+        smp_rmb();
+
+        while (packets < SHM_NET_RX_BURST && tail != head) {
+            uint32_t off = tail & (s->ring_size - 1);
+            uint32_t len = atomic_read((uint32_t *)(s->rx_data + off));
+
+            /* The padding up to the end of the ring must have been
+             * published like any record, or the tail would pass the head.
+             */
+            if (len == SHM_NET_WRAP && head - tail >= s->ring_size - off) {
+                tail += s->ring_size - off;
+                continue;
+            }
+            if (len == SHM_NET_WRAP || len > NET_BUFSIZE ||
+                off + SHM_NET_RECORD_LEN(len) > s->ring_size ||
+                head - tail < SHM_NET_RECORD_LEN(len)) {
+                error_report("shm: corrupt record in ring, disconnecting");
+                /* The main loop sees the hangup and cleans up */
+                s->rx_paused = true;
+                shutdown(s->fd, SHUT_RDWR);
+                return;
+            }
+
+            /* The frames are passed on straight from shared memory; the
+             * NIC copies them into guest buffers, and the net queue
+             * makes its own copy of anything it has to hold on to.
+             */
+            iov[packets].iov_base = s->rx_data + off + sizeof(uint32_t);
+            iov[packets].iov_len = len;
+            pkts[packets].iov = &iov[packets];
+            pkts[packets].iovcnt = 1;
+            tail += SHM_NET_RECORD_LEN(len);
+            ends[packets] = tail;
+            packets++;
+        }
+
+        if (packets || tail != s->rx_tail) {
+            break;
+        }
+
+        /* Empty: sleep until the producer rings, unless it published
+         * more while we were setting the flag.
+         */
+        atomic_set(&s->rx->consumer_waiting, 1);
+        smp_mb();
+        if (atomic_read(&s->rx->head) == tail) {
+            return;
+        }
+        atomic_set(&s->rx->consumer_waiting, 0);
+    }
+
+    sent = packets ? qemu_sendv_packets_async(&s->nc, pkts, packets,
+                                              shm_net_send_completed) : 0;
+    if (sent < packets) {
+        /* The packet at SENT got queued; leave the ones behind it in the
+         * ring until the peer catches up. */
+        s->rx_paused = true;
+        tail = ends[sent];
+    }
+    shm_net_rx_release(s, tail);
+
+    if (s->rx_paused) {
+        return;
+    }
+
+    /* More may be pending; come back after the other handlers ran */
+    if (packets == SHM_NET_RX_BURST) {
+        event_notifier_set(s->rx_kick);
+        return;
+    }
+    atomic_set(&s->rx->consumer_waiting, 1);
+    smp_mb();
+    if (atomic_read(&s->rx->head) != tail) {
+        atomic_set(&s->rx->consumer_waiting, 0);
+        event_notifier_set(s->rx_kick);
+    }
+}
+
+static void shm_net_kicked(void *opaque)
+{
+    ShmNetState *s = opaque;
+
+    event_notifier_test_and_clear(s->rx_kick);
+
+    if (s->tx_blocked) {
+        s->tx_blocked = false;
+        qemu_flush_queued_packets(&s->nc);
+    }
+    shm_net_rx(s);
+}
+
+static void shm_net_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    ShmNetState *s = DO_UPCAST(ShmNetState, nc, nc);
+
+    if (s->ctx == ctx) {
+        return;
+    }
+    if (s->mem) {
+        shm_net_update_fd_handler(s, false);
+    }
+    s->ctx = ctx;
+    if (s->mem) {
+        shm_net_update_fd_handler(s, true);
+    }
+}
+
+/* Called from the main loop; the rings may be in use by an IOThread */
+static void shm_net_set_connected(ShmNetState *s, bool connected)
+{
+    Error *err = NULL;
+
+    if (s->ctx) {
+        aio_context_acquire(s->ctx);
+    }
+    s->connected = connected;
+    s->rx_paused = false;
+    if (s->tx_blocked) {
+        /* Drops them when disconnecting */
+        s->tx_blocked = false;
+        qemu_flush_queued_packets(&s->nc);
+    }
+    if (s->ctx) {
+        aio_context_release(s->ctx);
+    }
+
+    qmp_set_link(s->nc.name, connected, &err);
+    if (err) {
+        error_report_err(err);
+    }
+    if (connected) {
+        event_notifier_set(s->rx_kick);
+    }
+}
+
+static void shm_net_peer_read(void *opaque)
+{
+    ShmNetState *s = opaque;
+    char buf[64];
+    ssize_t ret;
+
+    /* Nothing is sent after the handshake, this only watches for hangup */
+    do {
+        ret = read(s->fd, buf, sizeof(buf));
+    } while (ret < 0 && errno == EINTR);
+    if (ret > 0 || (ret < 0 && errno == EAGAIN)) {
+        return;
+    }
+
+    qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
+    closesocket(s->fd);
+    s->fd = -1;
+    shm_net_set_connected(s, false);
+
+    if (!s->server) {
+        error_report("shm: server at %s went away", s->path);
+    }
+}
+
+static int shm_net_send_hello(ShmNetState *s, int fd)
+{
+    ShmNetHello hello = {
+        .magic = SHM_NET_MAGIC,
+        .version = SHM_NET_VERSION,
+        .ring_size = s->ring_size,
+    };
+    int fds[SHM_NET_FD_MAX] = {
+        [SHM_NET_FD_MEM] = s->mem_fd,
+        [SHM_NET_FD_SERVER_KICK] = event_notifier_get_fd(&s->kick[1]),
+        [SHM_NET_FD_CLIENT_KICK] = event_notifier_get_fd(&s->kick[0]),
+    };
+    struct iovec iov = {
+        .iov_base = &hello,
+        .iov_len = sizeof(hello),
+    };
+    union {
+        struct cmsghdr cmsg;
+        char control[CMSG_SPACE(sizeof(fds))];
+    } msg_control;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = &msg_control,
+        .msg_controllen = sizeof(msg_control),
+    };
+    struct cmsghdr *cmsg;
+    ssize_t ret;
+
+    memset(&msg_control, 0, sizeof(msg_control));
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    do {
+        ret = sendmsg(fd, &msg, 0);
+    } while (ret < 0 && errno == EINTR);
+
+    return ret == sizeof(hello) ? 0 : -1;
+}
+
+static void shm_net_accept(void *opaque)
+{
+    ShmNetState *s = opaque;
+    struct sockaddr_un addr;
+    socklen_t len = sizeof(addr);
+    int fd;
+
+    fd = qemu_accept(s->listen_fd, (struct sockaddr *)&addr, &len);
+    if (fd < 0) {
+        return;
+    }
+
+    /* Point to point only */
+    if (s->fd >= 0) {
+        closesocket(fd);
+        return;
+    }
+
+    /* Start the new client from empty rings; nobody touches them while
+     * we are disconnected.
+     */
+    memset(s->mem, 0, 2 * sizeof(ShmNetRing));
+    s->tx_head = 0;
+    s->rx_tail = 0;
+
+    if (shm_net_send_hello(s, fd) < 0) {
+        error_report("shm: failed to send the rings to the client");
+        closesocket(fd);
+        return;
+    }
+
+    qemu_set_nonblock(fd);
+    s->fd = fd;
+    qemu_set_fd_handler(s->fd, shm_net_peer_read, NULL, s);
+    shm_net_set_connected(s, true);
+}
+
+static int shm_net_server_init(ShmNetState *s, uint32_t ring_size,
+                               Error **errp)
+{
+    s->ring_size = ring_size;
+    s->mem_size = shm_net_mem_size(ring_size);
+    s->mem = qemu_memfd_alloc("qemu-shm-net", s->mem_size,
+                              F_SEAL_GROW | F_SEAL_SHRINK | F_SEAL_SEAL,
+                              &s->mem_fd);
+    if (!s->mem) {
+        error_setg(errp, "shm: failed to allocate the rings");
+        return -1;
+    }
+
+    if (event_notifier_init(&s->kick[0], 0) < 0) {
+        goto fail;
+    }
+    if (event_notifier_init(&s->kick[1], 0) < 0) {
+        event_notifier_cleanup(&s->kick[0]);
+        goto fail;
+    }
+    shm_net_map(s);
+
+    s->listen_fd = unix_listen(s->path, NULL, 0, errp);
+    if (s->listen_fd < 0) {
+        return -1;
+    }
+    qemu_set_fd_handler(s->listen_fd, shm_net_accept, NULL, s);
+    return 0;
+
+fail:
+    error_setg(errp, "shm: failed to create the doorbells");
+    qemu_memfd_free(s->mem, s->mem_size, s->mem_fd);
+    s->mem = NULL;
+    s->mem_fd = -1;
+    return -1;
+}
+
+static int shm_net_recv_hello(int fd, ShmNetHello *hello, int *fds,
+                              Error **errp)
+{
+    struct iovec iov = {
+        .iov_base = hello,
+        .iov_len = sizeof(*hello),
+    };
+    union {
+        struct cmsghdr cmsg;
+        char control[CMSG_SPACE(SHM_NET_FD_MAX * sizeof(int))];
+    } msg_control;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = &msg_control,
+        .msg_controllen = sizeof(msg_control),
+    };
+    struct cmsghdr *cmsg;
+    int nfds = 0;
+    ssize_t ret;
+    int i;
+
+    do {
+        ret = recvmsg(fd, &msg, 0);
+    } while (ret < 0 && errno == EINTR);
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SCM_RIGHTS) {
+            nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            nfds = MIN(nfds, SHM_NET_FD_MAX);
+            memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+            break;
+        }
+    }
+
+    if (ret != sizeof(*hello) || nfds != SHM_NET_FD_MAX) {
+        error_setg(errp, "shm: bad handshake from the server");
+        goto fail;
+    }
+    if (hello->magic != SHM_NET_MAGIC || hello->version != SHM_NET_VERSION) {
+        error_setg(errp, "shm: server speaks an unknown protocol version");
+        goto fail;
+    }
+    if (hello->ring_size < SHM_NET_RING_SIZE_MIN ||
+        hello->ring_size > SHM_NET_RING_SIZE_MAX ||
+        !is_power_of_2(hello->ring_size)) {
+        error_setg(errp, "shm: server sent an invalid ring size");
+        goto fail;
+    }
+    return 0;
+
+fail:
+    for (i = 0; i < nfds; i++) {
+        close(fds[i]);
+    }
+    return -1;
+}
+
+static int shm_net_client_init(ShmNetState *s, Error **errp)
+{
+    ShmNetHello hello;
+    int fds[SHM_NET_FD_MAX];
+    struct stat st;
+    int fd, i;
+
+    fd = unix_connect(s->path, errp);
+    if (fd < 0) {
+        return -1;
+    }
+    if (shm_net_recv_hello(fd, &hello, fds, errp) < 0) {
+        closesocket(fd);
+        return -1;
+    }
+
+    s->ring_size = hello.ring_size;
+    s->mem_size = shm_net_mem_size(hello.ring_size);
+    if (fstat(fds[SHM_NET_FD_MEM], &st) < 0 ||
+        st.st_size < (off_t)s->mem_size) {
+        error_setg(errp, "shm: shared memory is smaller than the rings");
+        goto fail;
+    }
+    s->mem = mmap(NULL, s->mem_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  fds[SHM_NET_FD_MEM], 0);
+    if (s->mem == MAP_FAILED) {
+        s->mem = NULL;
+        error_setg_errno(errp, errno, "shm: failed to map the rings");
+        goto fail;
+    }
+
+    /* The server's doorbell is the one we ring, see shm_net_map() */
+    s->mem_fd = fds[SHM_NET_FD_MEM];
+    event_notifier_init_fd(&s->kick[0], fds[SHM_NET_FD_CLIENT_KICK]);
+    event_notifier_init_fd(&s->kick[1], fds[SHM_NET_FD_SERVER_KICK]);
+    shm_net_map(s);
+
+    qemu_set_nonblock(fd);
+    s->fd = fd;
+    qemu_set_fd_handler(s->fd, shm_net_peer_read, NULL, s);
+    s->connected = true;
+    return 0;
+
+fail:
+    for (i = 0; i < SHM_NET_FD_MAX; i++) {
+        close(fds[i]);
+    }
+    closesocket(fd);
+    return -1;
+}
+
+static void shm_net_cleanup(NetClientState *nc)
+{
+    ShmNetState *s = DO_UPCAST(ShmNetState, nc, nc);
+
+    if (s->fd >= 0) {
+        qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
+        closesocket(s->fd);
+        s->fd = -1;
+    }
+    if (s->listen_fd >= 0) {
+        qemu_set_fd_handler(s->listen_fd, NULL, NULL, NULL);
+        closesocket(s->listen_fd);
+        s->listen_fd = -1;
+        unlink(s->path);
+    }
+    if (s->mem) {
+        shm_net_update_fd_handler(s, false);
+        event_notifier_cleanup(&s->kick[0]);
+        event_notifier_cleanup(&s->kick[1]);
+        if (s->server) {
+            qemu_memfd_free(s->mem, s->mem_size, s->mem_fd);
+        } else {
+            munmap(s->mem, s->mem_size);
+            close(s->mem_fd);
+        }
+        s->mem = NULL;
+        s->mem_fd = -1;
+    }
+    g_free(s->path);
+    s->path = NULL;
+}
+
+static NetClientInfo net_shm_info = {
+    .type = NET_CLIENT_OPTIONS_KIND_SHM,
+    .size = sizeof(ShmNetState),
+    .receive = shm_net_receive,
+    .receive_iov = shm_net_receive_iov,
+    .receive_iov_batch = shm_net_receive_iov_batch,
+    .cleanup = shm_net_cleanup,
+    .set_aio_context = shm_net_set_aio_context,
+};
+
+int net_init_shm(const NetClientOptions *opts, const char *name,
+                 NetClientState *peer, Error **errp)
+{
+    const NetdevShmOptions *shm;
+    NetClientState *nc;
+    ShmNetState *s;
+    uint64_t size = SHM_NET_RING_SIZE_DEFAULT;
+    int ret;
+
+    assert(opts->type == NET_CLIENT_OPTIONS_KIND_SHM);
+    shm = opts->u.shm.data;
+
+    if (shm->has_size) {
+        if (!shm->has_server || !shm->server) {
+            error_setg(errp, "shm: size is chosen by the server");
+            return -1;
+        }
+        size = shm->size;
+    }
+    if (size < SHM_NET_RING_SIZE_MIN || size > SHM_NET_RING_SIZE_MAX ||
+        !is_power_of_2(size)) {
+        error_setg(errp, "shm: size must be a power of 2 between %d and %d",
+                   SHM_NET_RING_SIZE_MIN, SHM_NET_RING_SIZE_MAX);
+        return -1;
+    }
+
+    nc = qemu_new_net_client(&net_shm_info, peer, "shm", name);
+    s = DO_UPCAST(ShmNetState, nc, nc);
+    s->server = shm->has_server && shm->server;
+    s->path = g_strdup(shm->path);
+    s->listen_fd = -1;
+    s->fd = -1;
+    s->mem_fd = -1;
+
+    if (s->server) {
+        ret = shm_net_server_init(s, size, errp);
+    } else {
+        ret = shm_net_client_init(s, errp);
+    }
+    if (ret < 0) {
+        qemu_del_net_client(nc);
+        return -1;
+    }
+
+    shm_net_update_fd_handler(s, true);
+    snprintf(nc->info_str, sizeof(nc->info_str), "shm: %s %s",
+             s->server ? "listening on" : "connected to", s->path);
+    return 0;
+}
@@ -40,17 +40,23 @@
 #include "qemu-common.h"
 #include "qemu/cutils.h"
 #include "qemu/error-report.h"
+#include "block/aio.h"
 
 #include "net/tap.h"
 
 #include "net/vhost_net.h"
 
+/* Frames read per tap_send() call, see the rx-burst option */
+#define TAP_RX_BURST_DEFAULT 50
+#define TAP_RX_BURST_MAX     256
+
 typedef struct TAPState {
     NetClientState nc;
     int fd;
     char down_script[1024];
     char down_script_arg[128];
-    uint8_t buf[NET_BUFSIZE];
+    uint8_t *rx_bufs;           /* rx_burst buffers of NET_BUFSIZE bytes */
+    unsigned int rx_burst;
     bool read_poll;
     bool write_poll;
     bool using_vnet_hdr;
@@ -58,6 +64,7 @@ typedef struct TAPState {
     bool enabled;
     VHostNetState *vhost_net;
     unsigned host_vnet_hdr_len;
+    AioContext *ctx;            /* NULL: handled by the main loop */
 } TAPState;
 
 static void launch_script(const char *setup_script, const char *ifname,
@@ -68,10 +75,14 @@ static void tap_writable(void *opaque);
 
 static void tap_update_fd_handler(TAPState *s)
 {
-    qemu_set_fd_handler(s->fd,
-                        s->read_poll && s->enabled ? tap_send : NULL,
-                        s->write_poll && s->enabled ? tap_writable : NULL,
-                        s);
+    IOHandler *fd_read = s->read_poll && s->enabled ? tap_send : NULL;
+    IOHandler *fd_write = s->write_poll && s->enabled ? tap_writable : NULL;
+
+    if (s->ctx) {
+        aio_set_fd_handler(s->ctx, s->fd, true, fd_read, fd_write, s);
+    } else {
+        qemu_set_fd_handler(s->fd, fd_read, fd_write, s);
+    }
 }
 
 static void tap_read_poll(TAPState *s, bool enable)
@@ -130,6 +141,23 @@ static ssize_t tap_receive_iov(NetClientState *nc, const struct iovec *iov,
     return tap_write_packet(s, iovp, iovcnt);
 }
 
+/* A tap device takes one frame per write, so a burst still costs a
+ * writev() per packet, but skips the per-packet trip through the net
+ * queue.
+ */
+static int tap_receive_iov_batch(NetClientState *nc, const NetIOVPacket *pkts,
+                                 int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (tap_receive_iov(nc, pkts[i].iov, pkts[i].iovcnt) == 0) {
+            break;
+        }
+    }
+    return i;
+}
+
 static ssize_t tap_receive_raw(NetClientState *nc, const uint8_t *buf, size_t size)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
@@ -181,13 +209,26 @@ static void tap_send_completed(NetClientState *nc, ssize_t len)
 static void tap_send(void *opaque)
 {
     TAPState *s = opaque;
+    struct iovec iov[TAP_RX_BURST_MAX];
+    NetIOVPacket pkts[TAP_RX_BURST_MAX];
     int size;
     int packets = 0;
+    int sent;
 
-    while (true) {
-        uint8_t *buf = s->buf;
+    if (!s->rx_bufs) {
+        s->rx_bufs = g_malloc((size_t)s->rx_burst * NET_BUFSIZE);
+    }
+
+    /*
+     * Read everything that is pending, up to rx_burst frames, and pass
+     * it on in one go so that the peer can complete it all at once.
+     * The limit also keeps us from hogging the QEMU global mutex while
+     * the host keeps receiving more packets.
+     */
+    while (packets < s->rx_burst) {
+        uint8_t *buf = s->rx_bufs + (size_t)packets * NET_BUFSIZE;
 
-        size = tap_read_packet(s->fd, s->buf, sizeof(s->buf));
+        size = tap_read_packet(s->fd, buf, NET_BUFSIZE);
         if (size <= 0) {
             break;
         }
@@ -197,23 +238,27 @@ static void tap_send(void *opaque)
             size -= s->host_vnet_hdr_len;
         }
 
-        size = qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
-        if (size == 0) {
-            tap_read_poll(s, false);
-            break;
-        } else if (size < 0) {
-            break;
-        }
-
-        /*
-         * When the host keeps receiving more packets while tap_send() is
-         * running we can hog the QEMU global mutex.  Limit the number of
-         * packets that are processed per tap_send() callback to prevent
-         * stalling the guest.
-         */
+        iov[packets].iov_base = buf;
+        iov[packets].iov_len = size;
+        pkts[packets].iov = &iov[packets];
+        pkts[packets].iovcnt = 1;
         packets++;
-        if (packets >= 50) {
-            break;
+    }
+
+    if (!packets) {
+        return;
+    }
+
+    sent = qemu_sendv_packets_async(&s->nc, pkts, packets,
+                                    tap_send_completed);
+    if (sent < packets) {
+        /* The packet at SENT got queued; the frames behind it have been
+         * read already, so queue them too and stop reading until the
+         * peer catches up. */
+        tap_read_poll(s, false);
+        for (sent++; sent < packets; sent++) {
+            qemu_sendv_packet_async(&s->nc, pkts[sent].iov, pkts[sent].iovcnt,
+                                    tap_send_completed);
         }
     }
 }
@@ -281,6 +326,24 @@ static int tap_set_vnet_be(NetClientState *nc, bool is_be)
     return tap_fd_set_vnet_be(s->fd, is_be);
 }
 
+static void tap_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+    if (s->ctx == ctx) {
+        return;
+    }
+    /* Drop the handlers from the old context before installing them in
+     * the new one, so that the fd is never polled by two threads */
+    if (s->ctx) {
+        aio_set_fd_handler(s->ctx, s->fd, true, NULL, NULL, NULL);
+    } else {
+        qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
+    }
+    s->ctx = ctx;
+    tap_update_fd_handler(s);
+}
+
 static void tap_set_offload(NetClientState *nc, int csum, int tso4,
                      int tso6, int ecn, int ufo)
 {
@@ -315,6 +378,8 @@ static void tap_cleanup(NetClientState *nc)
     tap_write_poll(s, false);
     close(s->fd);
     s->fd = -1;
+    g_free(s->rx_bufs);
+    s->rx_bufs = NULL;
 }
 
 static void tap_poll(NetClientState *nc, bool enable)
@@ -339,6 +404,7 @@ static NetClientInfo net_tap_info = {
     .receive = tap_receive,
     .receive_raw = tap_receive_raw,
     .receive_iov = tap_receive_iov,
+    .receive_iov_batch = tap_receive_iov_batch,
     .poll = tap_poll,
     .cleanup = tap_cleanup,
     .has_ufo = tap_has_ufo,
@@ -349,6 +415,7 @@ static NetClientInfo net_tap_info = {
     .set_vnet_hdr_len = tap_set_vnet_hdr_len,
     .set_vnet_le = tap_set_vnet_le,
     .set_vnet_be = tap_set_vnet_be,
+    .set_aio_context = tap_set_aio_context,
 };
 
 static TAPState *net_tap_fd_init(NetClientState *peer,
@@ -365,6 +432,7 @@ static TAPState *net_tap_fd_init(NetClientState *peer,
     s = DO_UPCAST(TAPState, nc, nc);
 
     s->fd = fd;
+    s->rx_burst = TAP_RX_BURST_DEFAULT;
     s->host_vnet_hdr_len = vnet_hdr ? sizeof(struct virtio_net_hdr) : 0;
     s->using_vnet_hdr = false;
     s->has_ufo = tap_probe_has_ufo(s->fd);
@@ -640,6 +708,15 @@ static void net_init_tap_one(const NetdevTapOptions *tap, NetClientState *peer,
         return;
     }
 
+    if (tap->has_rx_burst) {
+        if (tap->rx_burst < 1 || tap->rx_burst > TAP_RX_BURST_MAX) {
+            error_setg(errp, "tap: rx-burst must be between 1 and %d",
+                       TAP_RX_BURST_MAX);
+            return;
+        }
+        s->rx_burst = tap->rx_burst;
+    }
+
     if (tap->has_fd || tap->has_fds) {
         snprintf(s->nc.info_str, sizeof(s->nc.info_str), "fd=%d", fd);
     } else if (tap->has_helper) {
@@ -22,6 +22,13 @@ typedef struct VhostUserState {
     NetClientState nc;
     CharDriverState *chr;
     VHostNetState *vhost_net;
+    /* features the guest acked, replayed when the backend reconnects */
+    uint64_t acked_features;
+    /* the fields below are only used on queue 0 */
+    guint watch;
+    QEMUBH *stop_bh;
+    bool stop_pending;
+    bool started;
 } VhostUserState;
 
 typedef struct VhostUserChardevProps {
@@ -36,6 +43,13 @@ VHostNetState *vhost_user_get_vhost_net(NetClientState *nc)
     return s->vhost_net;
 }
 
+uint64_t vhost_user_get_acked_features(NetClientState *nc)
+{
+    VhostUserState *s = DO_UPCAST(VhostUserState, nc, nc);
+    assert(nc->info->type == NET_CLIENT_OPTIONS_KIND_VHOST_USER);
+    return s->acked_features;
+}
+
 static int vhost_user_running(VhostUserState *s)
 {
     return (s->vhost_net) ? 1 : 0;
@@ -55,6 +69,7 @@ static void vhost_user_stop(int queues, NetClientState *ncs[])
         }
 
         if (s->vhost_net) {
+            s->acked_features = vhost_net_get_acked_features(s->vhost_net);
             vhost_net_cleanup(s->vhost_net);
             s->vhost_net = NULL;
         }
@@ -140,6 +155,17 @@ static void vhost_user_cleanup(NetClientState *nc)
         vhost_net_cleanup(s->vhost_net);
         s->vhost_net = NULL;
     }
+    if (s->watch) {
+        g_source_remove(s->watch);
+        s->watch = 0;
+    }
+    if (s->stop_bh) {
+        qemu_bh_delete(s->stop_bh);
+        s->stop_bh = NULL;
+    }
+    if (nc->queue_index == 0) {
+        qemu_chr_add_handlers(s->chr, NULL, NULL, NULL, NULL);
+    }
 
     qemu_purge_queued_packets(nc);
 }
@@ -167,6 +193,40 @@ static NetClientInfo net_vhost_user_info = {
         .has_ufo = vhost_user_has_ufo,
 };
 
+/* Take the datapath down after the backend went away.  The vrings
+ * restart from the used index once a backend connects again.
+ */
+static void net_vhost_user_stop_bh(void *opaque)
+{
+    VhostUserState *s = opaque;
+    NetClientState *ncs[MAX_QUEUE_NUM];
+    Error *err = NULL;
+    int queues;
+
+    queues = qemu_find_net_clients_except(s->nc.name, ncs,
+                                          NET_CLIENT_OPTIONS_KIND_NIC,
+                                          MAX_QUEUE_NUM);
+    assert(queues < MAX_QUEUE_NUM);
+
+    s->stop_pending = false;
+    qmp_set_link(s->nc.name, false, &err);
+    vhost_user_stop(queues, ncs);
+
+    if (err) {
+        error_report_err(err);
+    }
+}
+
+static gboolean net_vhost_user_watch(GIOChannel *chan, GIOCondition cond,
+                                     void *opaque)
+{
+    VhostUserState *s = opaque;
+
+    qemu_chr_disconnect(s->chr);
+
+    return FALSE;
+}
+
 static void net_vhost_user_event(void *opaque, int event)
 {
     const char *name = opaque;
@@ -184,14 +244,35 @@ static void net_vhost_user_event(void *opaque, int event)
     trace_vhost_user_event(s->chr->label, event);
     switch (event) {
     case CHR_EVENT_OPENED:
+        /* Finish with the previous connection first */
+        if (s->stop_pending) {
+            qemu_bh_cancel(s->stop_bh);
+            net_vhost_user_stop_bh(s);
+        }
         if (vhost_user_start(queues, ncs) < 0) {
-            exit(1);
+            error_report("vhost-user backend on %s failed to start",
+                         s->chr->label);
+            qemu_chr_disconnect(s->chr);
+            return;
         }
+        /* Nothing is read from the socket between requests, so watch
+         * for the backend hanging up */
+        s->watch = qemu_chr_fe_add_watch(s->chr, G_IO_HUP,
+                                         net_vhost_user_watch, s);
+        s->started = true;
         qmp_set_link(name, true, &err);
         break;
     case CHR_EVENT_CLOSED:
-        qmp_set_link(name, false, &err);
-        vhost_user_stop(queues, ncs);
+        if (s->watch) {
+            g_source_remove(s->watch);
+            s->watch = 0;
+        }
+        /* This can be raised by a failed read in the middle of a
+         * vhost-user request, which must not see vhost_net go away */
+        if (!s->stop_pending) {
+            s->stop_pending = true;
+            qemu_bh_schedule(s->stop_bh);
+        }
         break;
     }
 
@@ -204,7 +285,7 @@ static int net_vhost_user_init(NetClientState *peer, const char *device,
                                const char *name, CharDriverState *chr,
                                int queues)
 {
-    NetClientState *nc;
+    NetClientState *nc, *nc0 = NULL;
     VhostUserState *s;
     int i;
 
@@ -213,6 +294,9 @@ static int net_vhost_user_init(NetClientState *peer, const char *device,
 
     for (i = 0; i < queues; i++) {
         nc = qemu_new_net_client(&net_vhost_user_info, peer, device, name);
+        if (!nc0) {
+            nc0 = nc;
+        }
 
         snprintf(nc->info_str, sizeof(nc->info_str), "vhost-user%d to %s",
                  i, chr->label);
@@ -223,7 +307,21 @@ static int net_vhost_user_init(NetClientState *peer, const char *device,
         s->chr = chr;
     }
 
-    qemu_chr_add_handlers(chr, NULL, NULL, net_vhost_user_event, nc[0].name);
+    s = DO_UPCAST(VhostUserState, nc, nc0);
+    s->stop_bh = qemu_bh_new(net_vhost_user_stop_bh, s);
+
+    /* The features offered to the guest depend on the backend, so the
+     * first connection has to be there before the guest starts */
+    do {
+        Error *err = NULL;
+
+        if (qemu_chr_wait_connected(chr, &err) < 0) {
+            error_report_err(err);
+            return -1;
+        }
+        qemu_chr_add_handlers(chr, NULL, NULL, net_vhost_user_event,
+                              nc0->name);
+    } while (!s->started);
 
     return 0;
 }
@@ -239,6 +337,7 @@ static int net_vhost_chardev_opts(void *opaque,
     } else if (strcmp(name, "path") == 0) {
         props->is_unix = true;
     } else if (strcmp(name, "server") == 0) {
+    } else if (strcmp(name, "reconnect") == 0) {
     } else {
         error_setg(errp,
                    "vhost-user does not support a chardev with option %s=%s",
@@ -32,6 +32,8 @@
 #include "qom/object_interfaces.h"
 #include "io/channel-socket.h"
 #include "crypto/init.h"
+#include "qemu/thread.h"
+#include "qemu/rcu.h"
 
 #include <getopt.h>
 #include <libgen.h>
@@ -45,8 +47,31 @@
 #define QEMU_NBD_OPT_OBJECT        260
 #define QEMU_NBD_OPT_TLSCREDS      261
 #define QEMU_NBD_OPT_IMAGE_OPTS    262
+#define QEMU_NBD_OPT_THREADS       263
 
-static NBDExport *exp;
+#define QEMU_NBD_MAX_THREADS       64
+
+/* A thread running its own AioContext, see --threads */
+typedef struct NBDWorker {
+    QemuThread thread;
+    AioContext *ctx;
+    bool stopping;
+} NBDWorker;
+
+static NBDWorker *workers;
+static int nb_workers;
+
+/* Normally there is one export.  A read-only image is opened once per
+ * worker, and the copies are exported under the same name.
+ */
+static BlockBackend *blks[QEMU_NBD_MAX_THREADS];
+static NBDExport *exps[QEMU_NBD_MAX_THREADS];
+static int nb_exps;
+static int nb_exps_open;
+static int next_exp;
+
+static QEMUBH *client_closed_bh;
+static int nb_clients_closed;
 static bool newproto;
 static int verbose;
 static char *srcpath;
@@ -75,6 +100,7 @@ static void usage(const char *name)
 "                            (default '"SOCKET_PATH"')\n"
 "  -e, --shared=NUM          device can be shared by NUM clients (default '1')\n"
 "  -t, --persistent          don't exit on the last connection\n"
+"      --threads=NUM         serve clients from NUM threads\n"
 "  -v, --verbose             display extra debugging information\n"
 "  -x, --export-name=NAME    expose export by name\n"
 "\n"
@@ -105,7 +131,7 @@ static void usage(const char *name)
 "                            '[ID_OR_NAME]'\n"
 "  -n, --nocache             disable host cache\n"
 "      --cache=MODE          set cache mode (none, writeback, ...)\n"
-"      --aio=MODE            set AIO mode (native or threads)\n"
+"      --aio=MODE            set AIO mode (native, io_uring or threads)\n"
 "      --discard=MODE        set discard mode (ignore, unmap)\n"
 "      --detect-zeroes=MODE  set detect-zeroes mode (off, on, unmap)\n"
 "      --image-opts          treat FILE as a full set of image options\n"
@@ -240,8 +266,7 @@ static void *show_parts(void *arg)
 static void *nbd_client_thread(void *arg)
 {
     char *device = arg;
-    off_t size;
-    uint16_t nbdflags;
+    NBDExportInfo info = { .request_structured = false };
     QIOChannelSocket *sioc;
     int fd;
     int ret;
@@ -256,9 +281,10 @@ static void *nbd_client_thread(void *arg)
         goto out;
     }
 
-    ret = nbd_receive_negotiate(QIO_CHANNEL(sioc), NULL, &nbdflags,
+    /* The kernel client only understands simple replies */
+    ret = nbd_receive_negotiate(QIO_CHANNEL(sioc), NULL,
                                 NULL, NULL, NULL,
-                                &size, &local_error);
+                                &info, &local_error);
     if (ret < 0) {
         if (local_error) {
             error_report_err(local_error);
@@ -273,7 +299,7 @@ static void *nbd_client_thread(void *arg)
         goto out_socket;
     }
 
-    ret = nbd_init(fd, sioc, nbdflags, size);
+    ret = nbd_init(fd, sioc, info.flags, info.size);
     if (ret < 0) {
         goto out_fd;
     }
@@ -312,21 +338,126 @@ static int nbd_can_accept(void)
     return nb_fds < shared;
 }
 
+static void *nbd_worker_run(void *opaque)
+{
+    NBDWorker *worker = opaque;
+    bool blocking;
+
+    rcu_register_thread();
+
+    while (!atomic_read(&worker->stopping)) {
+        aio_context_acquire(worker->ctx);
+        blocking = true;
+        while (!atomic_read(&worker->stopping) &&
+               aio_poll(worker->ctx, blocking)) {
+            /* Progress was made, keep going */
+            blocking = false;
+        }
+        aio_context_release(worker->ctx);
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void nbd_start_workers(int threads)
+{
+    Error *local_err = NULL;
+    int i;
+
+    workers = g_new0(NBDWorker, threads);
+    for (i = 0; i < threads; i++) {
+        workers[i].ctx = aio_context_new(&local_err);
+        if (!workers[i].ctx) {
+            error_report_err(local_err);
+            exit(EXIT_FAILURE);
+        }
+        qemu_thread_create(&workers[i].thread, "nbd-worker",
+                           nbd_worker_run, &workers[i],
+                           QEMU_THREAD_JOINABLE);
+        nb_workers++;
+    }
+}
+
+static void nbd_stop_workers(void)
+{
+    int i;
+
+    for (i = 0; i < nb_workers; i++) {
+        atomic_set(&workers[i].stopping, true);
+        aio_notify(workers[i].ctx);
+        qemu_thread_join(&workers[i].thread);
+        aio_context_unref(workers[i].ctx);
+    }
+    g_free(workers);
+    workers = NULL;
+    nb_workers = 0;
+}
+
+/* Move BLK between the main loop and a worker */
+static void nbd_move_blk(BlockBackend *blk, AioContext *ctx)
+{
+    AioContext *old_ctx = blk_get_aio_context(blk);
+
+    aio_context_acquire(old_ctx);
+    aio_context_acquire(ctx);
+    blk_set_aio_context(blk, ctx);
+    aio_context_release(ctx);
+    aio_context_release(old_ctx);
+}
+
+/* May run in a worker thread, when the last client of the export goes away */
 static void nbd_export_closed(NBDExport *exp)
 {
-    assert(state == TERMINATING);
-    state = TERMINATED;
+    assert(atomic_read(&state) == TERMINATING);
+    if (atomic_fetch_dec(&nb_exps_open) == 1) {
+        atomic_set(&state, TERMINATED);
+        qemu_notify_event();
+    }
+}
+
+static void nbd_close_exports(void)
+{
+    int i;
+
+    for (i = 0; i < nb_exps; i++) {
+        AioContext *ctx = blk_get_aio_context(blks[i]);
+
+        aio_context_acquire(ctx);
+        nbd_export_close(exps[i]);
+        nbd_export_put(exps[i]);
+        aio_context_release(ctx);
+        exps[i] = NULL;
+    }
+}
+
+/* Oldstyle clients do not name an export; spread them round-robin */
+static NBDExport *nbd_next_export(void)
+{
+    NBDExport *exp = exps[next_exp];
+
+    next_exp = (next_exp + 1) % nb_exps;
+    return exp;
 }
 
 static void nbd_update_server_watch(void);
 
-static void nbd_client_closed(NBDClient *client)
+static void nbd_client_closed_bh(void *opaque)
 {
-    nb_fds--;
+    nb_fds -= atomic_xchg(&nb_clients_closed, 0);
     if (nb_fds == 0 && !persistent && state == RUNNING) {
         state = TERMINATE;
     }
     nbd_update_server_watch();
+}
+
+/* Runs in the thread that serves the client, so leave the accounting to
+ * the main loop.
+ */
+static void nbd_client_closed(NBDClient *client)
+{
+    atomic_inc(&nb_clients_closed);
+    qemu_bh_schedule(client_closed_bh);
     nbd_client_put(client);
 }
 
@@ -347,7 +478,7 @@ static gboolean nbd_accept(QIOChannel *ioc, GIOCondition cond, gpointer opaque)
 
     nb_fds++;
     nbd_update_server_watch();
-    nbd_client_new(newproto ? NULL : exp, cioc,
+    nbd_client_new(newproto ? NULL : nbd_next_export(), cioc,
                    tlscreds, NULL, nbd_client_closed);
     object_unref(OBJECT(cioc));
 
@@ -454,6 +585,8 @@ int main(int argc, char **argv)
 {
     BlockBackend *blk;
     BlockDriverState *bs;
+    NBDExport *exp;
+    const char *filename;
     off_t dev_offset = 0;
     uint16_t nbdflags = 0;
     bool disconnect = false;
@@ -492,6 +625,7 @@ int main(int argc, char **argv)
         { "export-name", required_argument, NULL, 'x' },
         { "tls-creds", required_argument, NULL, QEMU_NBD_OPT_TLSCREDS },
         { "image-opts", no_argument, NULL, QEMU_NBD_OPT_IMAGE_OPTS },
+        { "threads", required_argument, NULL, QEMU_NBD_OPT_THREADS },
         { NULL, 0, NULL, 0 }
     };
     int ch;
@@ -512,6 +646,8 @@ int main(int argc, char **argv)
     const char *tlscredsid = NULL;
     bool imageOpts = false;
     bool writethrough = true;
+    int threads = 0;
+    int i;
 
     /* The client thread uses SIGTERM to interrupt the server.  A signal
      * handler ensures that "qemu-nbd -v -c" exits with a nice status code.
@@ -557,6 +693,8 @@ int main(int argc, char **argv)
             seen_aio = true;
             if (!strcmp(optarg, "native")) {
                 flags |= BDRV_O_NATIVE_AIO;
+            } else if (!strcmp(optarg, "io_uring")) {
+                flags |= BDRV_O_IO_URING;
             } else if (!strcmp(optarg, "threads")) {
                 /* this is the default */
             } else {
@@ -700,6 +838,18 @@ int main(int argc, char **argv)
         case QEMU_NBD_OPT_IMAGE_OPTS:
             imageOpts = true;
             break;
+        case QEMU_NBD_OPT_THREADS:
+            threads = strtol(optarg, &end, 0);
+            if (*end) {
+                error_report("Invalid number of threads '%s'", optarg);
+                exit(EXIT_FAILURE);
+            }
+            if (threads < 1 || threads > QEMU_NBD_MAX_THREADS) {
+                error_report("Number of threads must be between 1 and %d",
+                             QEMU_NBD_MAX_THREADS);
+                exit(EXIT_FAILURE);
+            }
+            break;
         }
     }
 
@@ -827,7 +977,18 @@ int main(int argc, char **argv)
     bdrv_init();
     atexit(bdrv_close_all);
 
+    /* The block layer can only serve a BlockBackend from one AioContext,
+     * so the threads can only share the load of a read-only image, which
+     * is safe to open several times.
+     */
+    nb_exps = (threads && !(flags & BDRV_O_RDWR)) ? threads : 1;
+    if (threads) {
+        nbd_start_workers(nb_exps);
+    }
+    client_closed_bh = qemu_bh_new(nbd_client_closed_bh, NULL);
+
     srcpath = argv[optind];
+    filename = srcpath;
     if (imageOpts) {
         QemuOpts *opts;
         if (fmt) {
@@ -841,39 +1002,47 @@ int main(int argc, char **argv)
         }
         options = qemu_opts_to_qdict(opts, NULL);
         qemu_opts_reset(&file_opts);
-        blk = blk_new_open(NULL, NULL, options, flags, &local_err);
-    } else {
-        if (fmt) {
-            options = qdict_new();
-            qdict_put(options, "driver", qstring_from_str(fmt));
-        }
-        blk = blk_new_open(srcpath, NULL, options, flags, &local_err);
+        filename = NULL;
+    } else if (fmt) {
+        options = qdict_new();
+        qdict_put(options, "driver", qstring_from_str(fmt));
     }
 
-    if (!blk) {
-        error_reportf_err(local_err, "Failed to blk_new_open '%s': ",
-                          argv[optind]);
-        exit(EXIT_FAILURE);
-    }
-    bs = blk_bs(blk);
-
-    blk_set_enable_write_cache(blk, !writethrough);
+    for (i = 0; i < nb_exps; i++) {
+        blk = blk_new_open(filename, NULL,
+                           options ? qdict_clone_shallow(options) : NULL,
+                           flags, &local_err);
+        if (!blk) {
+            error_reportf_err(local_err, "Failed to blk_new_open '%s': ",
+                              argv[optind]);
+            exit(EXIT_FAILURE);
+        }
+        blks[i] = blk;
+        bs = blk_bs(blk);
+
+        blk_set_enable_write_cache(blk, !writethrough);
+
+        if (sn_opts) {
+            ret = bdrv_snapshot_load_tmp(bs,
+                                         qemu_opt_get(sn_opts,
+                                                      SNAPSHOT_OPT_ID),
+                                         qemu_opt_get(sn_opts,
+                                                      SNAPSHOT_OPT_NAME),
+                                         &local_err);
+        } else if (sn_id_or_name) {
+            ret = bdrv_snapshot_load_tmp_by_id_or_name(bs, sn_id_or_name,
+                                                       &local_err);
+        }
+        if (ret < 0) {
+            error_reportf_err(local_err, "Failed to load snapshot: ");
+            exit(EXIT_FAILURE);
+        }
 
-    if (sn_opts) {
-        ret = bdrv_snapshot_load_tmp(bs,
-                                     qemu_opt_get(sn_opts, SNAPSHOT_OPT_ID),
-                                     qemu_opt_get(sn_opts, SNAPSHOT_OPT_NAME),
-                                     &local_err);
-    } else if (sn_id_or_name) {
-        ret = bdrv_snapshot_load_tmp_by_id_or_name(bs, sn_id_or_name,
-                                                   &local_err);
-    }
-    if (ret < 0) {
-        error_reportf_err(local_err, "Failed to load snapshot: ");
-        exit(EXIT_FAILURE);
+        bs->detect_zeroes = detect_zeroes;
     }
+    QDECREF(options);
 
-    bs->detect_zeroes = detect_zeroes;
+    blk = blks[0];
     fd_size = blk_getlength(blk);
     if (fd_size < 0) {
         error_report("Failed to determine the image length: %s",
@@ -890,16 +1059,29 @@ int main(int argc, char **argv)
         }
     }
 
-    exp = nbd_export_new(blk, dev_offset, fd_size, nbdflags, nbd_export_closed,
-                         &local_err);
-    if (!exp) {
-        error_report_err(local_err);
-        exit(EXIT_FAILURE);
+    /* Clients only open more connections if they will be accepted */
+    if (shared > 1) {
+        nbdflags |= NBD_FLAG_CAN_MULTI_CONN;
     }
-    if (export_name) {
-        nbd_export_set_name(exp, export_name);
-        newproto = true;
+
+    for (i = 0; i < nb_exps; i++) {
+        if (nb_workers) {
+            nbd_move_blk(blks[i], workers[i].ctx);
+        }
+
+        exp = nbd_export_new(blks[i], dev_offset, fd_size, nbdflags,
+                             nbd_export_closed, &local_err);
+        if (!exp) {
+            error_report_err(local_err);
+            exit(EXIT_FAILURE);
+        }
+        if (export_name) {
+            nbd_export_set_name(exp, export_name);
+            newproto = true;
+        }
+        exps[i] = exp;
     }
+    nb_exps_open = nb_exps;
 
     server_ioc = qio_channel_socket_new();
     if (qio_channel_socket_listen_sync(server_ioc, saddr, &local_err) < 0) {
@@ -936,13 +1118,18 @@ int main(int argc, char **argv)
         main_loop_wait(false);
         if (state == TERMINATE) {
             state = TERMINATING;
-            nbd_export_close(exp);
-            nbd_export_put(exp);
-            exp = NULL;
+            nbd_close_exports();
         }
-    } while (state != TERMINATED);
+    } while (atomic_read(&state) != TERMINATED);
 
-    blk_unref(blk);
+    for (i = 0; i < nb_exps; i++) {
+        if (nb_workers) {
+            nbd_move_blk(blks[i], qemu_get_aio_context());
+        }
+        blk_unref(blks[i]);
+    }
+    nbd_stop_workers();
+    qemu_bh_delete(client_closed_bh);
     if (sockpath) {
         unlink(sockpath);
     }
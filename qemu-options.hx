@@ -521,15 +521,15 @@ DEF("drive", HAS_ARG, QEMU_OPTION_drive,
     "       [,cyls=c,heads=h,secs=s[,trans=t]][,snapshot=on|off]\n"
     "       [,cache=writethrough|writeback|none|directsync|unsafe][,format=f]\n"
     "       [,serial=s][,addr=A][,rerror=ignore|stop|report]\n"
-    "       [,werror=ignore|stop|report|enospc][,id=name][,aio=threads|native]\n"
-    "       [,readonly=on|off][,copy-on-read=on|off]\n"
+    "       [,werror=ignore|stop|report|enospc][,id=name]\n"
+    "       [,aio=threads|native|io_uring][,readonly=on|off][,copy-on-read=on|off]\n"
     "       [,discard=ignore|unmap][,detect-zeroes=on|off|unmap]\n"
     "       [[,bps=b]|[[,bps_rd=r][,bps_wr=w]]]\n"
     "       [[,iops=i]|[[,iops_rd=r][,iops_wr=w]]]\n"
     "       [[,bps_max=bm]|[[,bps_rd_max=rm][,bps_wr_max=wm]]]\n"
     "       [[,iops_max=im]|[[,iops_rd_max=irm][,iops_wr_max=iwm]]]\n"
     "       [[,iops_size=is]]\n"
-    "       [[,group=g]]\n"
+    "       [[,group=g]][[,latency_target=lt]]\n"
     "                use 'file' as a drive image\n", QEMU_ARCH_ALL)
 STEXI
 @item -drive @var{option}[,@var{option}[,@var{option}[,...]]]
@@ -564,7 +564,7 @@ These options have the same definition as they have in @option{-hdachs}.
 @item cache=@var{cache}
 @var{cache} is "none", "writeback", "unsafe", "directsync" or "writethrough" and controls how the host cache is used to access block data.
 @item aio=@var{aio}
-@var{aio} is "threads", or "native" and selects between pthread based disk I/O and native Linux AIO.
+@var{aio} is "threads", "native" or "io_uring" and selects between pthread based disk I/O, native Linux AIO and Linux io_uring.  Native AIO requires @option{cache=none} or @option{cache=directsync}; io_uring works with any cache mode and falls back to "threads" if the host kernel does not support it.
 @item discard=@var{discard}
 @var{discard} is one of "ignore" (or "off") or "unmap" (or "on") and controls whether @dfn{discard} (also known as @dfn{trim} or @dfn{unmap}) requests are ignored or passed to the filesystem.  Some machine types may not support discard requests.
 @item format=@var{format}
@@ -1569,6 +1569,7 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "-netdev tap,id=str[,fd=h][,fds=x:y:...:z][,ifname=name][,script=file][,downscript=dfile]\n"
     "         [,helper=helper][,sndbuf=nbytes][,vnet_hdr=on|off][,vhost=on|off]\n"
     "         [,vhostfd=h][,vhostfds=x:y:...:z][,vhostforce=on|off][,queues=n]\n"
+    "         [,rx-burst=n]\n"
     "                configure a host TAP network backend with ID 'str'\n"
     "                use network scripts 'file' (default=" DEFAULT_NETWORK_SCRIPT ")\n"
     "                to configure it and 'dfile' (default=" DEFAULT_NETWORK_DOWN_SCRIPT ")\n"
@@ -1588,6 +1589,7 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                use 'vhostfd=h' to connect to an already opened vhost net device\n"
     "                use 'vhostfds=x:y:...:z to connect to multiple already opened vhost net devices\n"
     "                use 'queues=n' to specify the number of queues to be created for multiqueue TAP\n"
+    "                use 'rx-burst=n' to read up to n packets (default 50) per wakeup\n"
     "-netdev bridge,id=str[,br=bridge][,helper=helper]\n"
     "                configure a host TAP network backend with ID 'str' that is\n"
     "                connected to a bridge (default=" DEFAULT_BRIDGE_INTERFACE ")\n"
@@ -1644,6 +1646,11 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
 #endif
     "-netdev vhost-user,id=str,chardev=dev[,vhostforce=on|off]\n"
     "                configure a vhost-user network, backed by a chardev 'dev'\n"
+#ifdef CONFIG_LINUX
+    "-netdev shm,id=str,path=path[,server=on|off][,size=n]\n"
+    "                connect to another QEMU on this host through shared memory\n"
+    "                rings, handed over on the unix socket 'path'\n"
+#endif
     "-netdev hubport,id=str,hubid=n\n"
     "                configure a hub port on QEMU VLAN 'n'\n", QEMU_ARCH_ALL)
 DEF("net", HAS_ARG, QEMU_OPTION_net,
@@ -1872,6 +1879,11 @@ helper executable is @file{/path/to/qemu-bridge-helper}.
 @option{fd}=@var{h} can be used to specify the handle of an already
 opened host TAP interface.
 
+@option{rx-burst}=@var{n} sets how many packets, between 1 and 256, are read
+from the TAP interface each time it becomes readable and handed to the guest
+together (default 50).  Larger values cut the per-packet overhead for small
+packets; smaller values bound how long the main loop is kept busy.
+
 Examples:
 
 @example
@@ -2084,6 +2096,13 @@ end of the socket. On non-MSIX guests, the feature can be forced with
 @var{vhostforce}. Use 'queues=@var{n}' to specify the number of queues to
 be created for multiqueue vhost-user.
 
+QEMU waits for the backend to connect before starting the guest.  If the
+backend goes away later, the link goes down until a backend connects
+again: a server chardev accepts the next client, and a client chardev
+created with @option{reconnect=@var{seconds}} retries periodically.  The
+rings are handed over to the new backend from the last used index, so
+requests that were in flight are processed again.
+
 Example:
 @example
 qemu -m 512 -object memory-backend-file,id=mem,size=512M,mem-path=/hugetlbfs,share=on \
@@ -2093,6 +2112,30 @@ qemu -m 512 -object memory-backend-file,id=mem,size=512M,mem-path=/hugetlbfs,sha
      -device virtio-net-pci,netdev=net0
 @end example
 
+@item -netdev shm,id=@var{id},path=@var{path}[,server=on|off][,size=@var{n}]
+
+Connect to another QEMU process on the same host through a pair of packet
+rings in shared memory, one per direction.  The side with @option{server=on}
+allocates the rings (@var{n} bytes each, 1 MiB by default) and listens on
+the unix socket @var{path}; the other side connects to it and receives the
+shared memory and the doorbell eventfds.  Frames go straight from one NIC
+to the other without passing through the host network stack; no offloads
+are negotiated.  Frames are dropped while the other side is not connected;
+the link goes down when it disconnects, and a server accepts a new client
+after the previous one went away.
+
+Example:
+@example
+# first guest
+qemu-system-x86_64 linux.img \
+                   -netdev shm,id=n1,path=/tmp/qemu-shm.sock,server=on \
+                   -device virtio-net-pci,netdev=n1,mac=52:54:00:12:34:56
+# second guest
+qemu-system-x86_64 linux.img \
+                   -netdev shm,id=n1,path=/tmp/qemu-shm.sock \
+                   -device virtio-net-pci,netdev=n1,mac=52:54:00:12:34:57
+@end example
+
 @item -net dump[,vlan=@var{n}][,file=@var{file}][,len=@var{len}]
 Dump network traffic on VLAN @var{n} to file @var{file} (@file{qemu-vlan0.pcap} by default).
 At most @var{len} bytes (64k by default) per packet are stored. The file format is
@@ -3110,6 +3153,30 @@ STEXI
 Run the emulation in single step mode.
 ETEXI
 
+DEF("tb-profile", 0, QEMU_OPTION_tb_profile, \
+    "-tb-profile     count executions of each translated block\n", QEMU_ARCH_ALL)
+STEXI
+@item -tb-profile
+@findex -tb-profile
+Instrument every translated block with an execution counter and record
+how long each translation took.  The results can be inspected with the
+@code{info tbprofile} monitor command.  This slows down TCG execution
+and has no effect when a hardware accelerator is used.
+ETEXI
+
+DEF("tcg-pin-regs", HAS_ARG, QEMU_OPTION_tcg_pin_regs, \
+    "-tcg-pin-regs n keep up to n hot guest registers in host registers\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -tcg-pin-regs @var{n}
+@findex -tcg-pin-regs
+Keep up to @var{n} frequently used guest registers in callee-saved host
+registers while translated code runs, instead of loading and storing
+them in every basic block.  Which registers are candidates depends on
+the guest architecture, and the number of host registers available for
+this depends on the host; currently only x86-64 hosts support it.
+ETEXI
+
 DEF("S", 0, QEMU_OPTION_S, \
     "-S              freeze CPU at startup (use 'c' to start execution)\n",
     QEMU_ARCH_ALL)
@@ -1186,7 +1186,8 @@ EQMP
     {
         .name       = "drive-backup",
         .args_type  = "sync:s,device:B,target:s,speed:i?,mode:s?,format:s?,"
-                      "bitmap:s?,on-source-error:s?,on-target-error:s?",
+                      "bitmap:s?,on-source-error:s?,on-target-error:s?,"
+                      "max-workers:i?,max-chunk:i?",
         .mhandler.cmd_new = qmp_marshal_drive_backup,
     },
 
@@ -1228,6 +1229,10 @@ Arguments:
                      'report' (no limitations, since this applies to
                      a different block device than device).
                      (BlockdevOnError, optional)
+- "max-workers": the maximum number of copy requests in flight, default 8
+                 (json-int, optional)
+- "max-chunk": the maximum number of bytes copied by one request, default
+               1 MiB, rounded up to the cluster size (json-int, optional)
 
 Example:
 -> { "execute": "drive-backup", "arguments": { "device": "drive0",
@@ -1240,7 +1245,8 @@ EQMP
     {
         .name       = "blockdev-backup",
         .args_type  = "sync:s,device:B,target:B,speed:i?,"
-                      "on-source-error:s?,on-target-error:s?",
+                      "on-source-error:s?,on-target-error:s?,"
+                      "max-workers:i?,max-chunk:i?",
         .mhandler.cmd_new = qmp_marshal_blockdev_backup,
     },
 
@@ -1269,6 +1275,10 @@ Arguments:
                      'report' (no limitations, since this applies to
                      a different block device than device).
                      (BlockdevOnError, optional)
+- "max-workers": the maximum number of copy requests in flight, default 8
+                 (json-int, optional)
+- "max-chunk": the maximum number of bytes copied by one request, default
+               1 MiB, rounded up to the cluster size (json-int, optional)
 
 Example:
 -> { "execute": "blockdev-backup", "arguments": { "device": "src-id",
@@ -1284,6 +1294,12 @@ EQMP
         .mhandler.cmd_new = qmp_marshal_block_job_set_speed,
     },
 
+    {
+        .name       = "block-job-set-copy-mode",
+        .args_type  = "device:B,copy-mode:s",
+        .mhandler.cmd_new = qmp_marshal_block_job_set_copy_mode,
+    },
+
     {
         .name       = "block-job-cancel",
         .args_type  = "device:B,force:b?",
@@ -1633,7 +1649,7 @@ EQMP
                       "node-name:s?,replaces:s?,"
                       "on-source-error:s?,on-target-error:s?,"
                       "unmap:b?,"
-                      "granularity:i?,buf-size:i?",
+                      "granularity:i?,buf-size:i?,copy-mode:s?",
         .mhandler.cmd_new = qmp_marshal_drive_mirror,
     },
 
@@ -1674,6 +1690,9 @@ Arguments:
   (BlockdevOnError, default 'report')
 - "unmap": whether the target sectors should be discarded where source has only
   zeroes. (json-bool, optional, default true)
+- "copy-mode": "background" to copy only from the job, or "write-blocking" to
+  also write guest writes to the target before they complete
+  (MirrorCopyMode, optional, default 'background')
 
 The default value of the granularity is the image cluster size clamped
 between 4096 and 65536, if the image format defines one.  If the format
@@ -1695,7 +1714,7 @@ EQMP
         .name       = "blockdev-mirror",
         .args_type  = "sync:s,device:B,target:B,replaces:s?,speed:i?,"
                       "on-source-error:s?,on-target-error:s?,"
-                      "granularity:i?,buf-size:i?",
+                      "granularity:i?,buf-size:i?,copy-mode:s?",
         .mhandler.cmd_new = qmp_marshal_blockdev_mirror,
     },
 
@@ -1725,6 +1744,9 @@ Arguments:
   (BlockdevOnError, default 'report')
 - "on-target-error": the action to take on an error on the target
   (BlockdevOnError, default 'report')
+- "copy-mode": "background" to copy only from the job, or "write-blocking" to
+  also write guest writes to the target before they complete
+  (MirrorCopyMode, optional, default 'background')
 
 The default value of the granularity is the image cluster size clamped
 between 4096 and 65536, if the image format defines one.  If the format
@@ -2033,7 +2055,7 @@ EQMP
 
     {
         .name       = "block_set_io_throttle",
-        .args_type  = "device:B,bps:l,bps_rd:l,bps_wr:l,iops:l,iops_rd:l,iops_wr:l,bps_max:l?,bps_rd_max:l?,bps_wr_max:l?,iops_max:l?,iops_rd_max:l?,iops_wr_max:l?,bps_max_length:l?,bps_rd_max_length:l?,bps_wr_max_length:l?,iops_max_length:l?,iops_rd_max_length:l?,iops_wr_max_length:l?,iops_size:l?,group:s?",
+        .args_type  = "device:B,bps:l,bps_rd:l,bps_wr:l,iops:l,iops_rd:l,iops_wr:l,bps_max:l?,bps_rd_max:l?,bps_wr_max:l?,iops_max:l?,iops_rd_max:l?,iops_wr_max:l?,bps_max_length:l?,bps_rd_max_length:l?,bps_wr_max_length:l?,iops_max_length:l?,iops_rd_max_length:l?,iops_wr_max_length:l?,iops_size:l?,group:s?,latency_target:l?",
         .mhandler.cmd_new = qmp_marshal_block_set_io_throttle,
     },
 
@@ -2066,6 +2088,7 @@ Arguments:
 - "iops_wr_max_length": maximum length of the @iops_wr_max burst period, in seconds (json-int, optional)
 - "iops_size":  I/O size in bytes when limiting (json-int, optional)
 - "group": throttle group name (json-string, optional)
+- "latency_target": average request latency to adjust the limits to, in microseconds (json-int, optional)
 
 Example:
 
@@ -2721,6 +2744,16 @@ Each json-object contain the following:
         - "avg_wr_queue_depth": average number of pending write
                                 operations in the defined interval
                                 (json-number).
+    - "rd_latency_histogram": latency histogram of read operations, set
+                              up with block-latency-histogram-set
+                              (json-object, optional), with the following
+                              members:
+        - "boundaries": interval boundaries in nanoseconds (json-array)
+        - "bins": number of operations per interval (json-array)
+    - "wr_latency_histogram": same for write operations
+                              (json-object, optional)
+    - "flush_latency_histogram": same for flush operations
+                                 (json-object, optional)
 - "parent": Contains recursively the statistics of the underlying
             protocol (e.g. the host file for a qcow2 image). If there is
             no underlying protocol, this field is omitted
@@ -4749,6 +4782,38 @@ Example:
                  "write-threshold": 17179869184 } }
 <- { "return": {} }
 
+EQMP
+
+    {
+        .name       = "block-latency-histogram-set",
+        .args_type  = "device:B,boundaries:q?,boundaries-read:q?,boundaries-write:q?,boundaries-flush:q?",
+        .mhandler.cmd_new = qmp_marshal_block_latency_histogram_set,
+    },
+
+SQMP
+block-latency-histogram-set
+---------------------------
+
+Set up latency histograms for a block device.  Setting a histogram again,
+even with the same boundaries, resets its counters.  Without any
+boundaries, all histograms of the device are removed.
+
+Arguments:
+
+- "device": device name (json-string)
+- "boundaries": interval boundaries in nanoseconds, in ascending order,
+                for all operation types not listed below (json-array, optional)
+- "boundaries-read": boundaries for read operations (json-array, optional)
+- "boundaries-write": boundaries for write operations (json-array, optional)
+- "boundaries-flush": boundaries for flush operations (json-array, optional)
+
+Example:
+
+-> { "execute": "block-latency-histogram-set",
+     "arguments": { "device": "drive0",
+                    "boundaries": [ 100000, 1000000, 10000000 ] } }
+<- { "return": {} }
+
 EQMP
 
     {
@@ -4879,4 +4944,33 @@ Example:
 <- { "return": [{ "version": 2, "emulated": true, "kernel": false },
                 { "version": 3, "emulated": false, "kernel": true } ] }
 
+EQMP
+
+    {
+        .name       = "x-query-tb-profile",
+        .args_type  = "max:i?",
+        .mhandler.cmd_new = qmp_marshal_x_query_tb_profile,
+    },
+
+SQMP
+x-query-tb-profile
+------------------
+
+Return the most frequently executed translated blocks together with a
+histogram of translation times.  QEMU must be started with -tb-profile.
+
+Arguments:
+
+- "max": maximum number of blocks to return (json-int, optional)
+
+Example:
+
+-> { "execute": "x-query-tb-profile", "arguments": { "max": 1 } }
+<- { "return": {
+       "blocks": [ { "pc": 1048816, "guest-size": 12, "host-size": 74,
+                     "count": 2113452 } ],
+       "translation-time": [ { "lower-us": 0, "count": 1422 },
+                             { "lower-us": 1, "count": 310 },
+                             ... ] } }
+
 EQMP
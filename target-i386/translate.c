@@ -8173,6 +8173,12 @@ void tcg_x86_init(void)
                                      bnd_regu_names[i]);
     }
 
+    /* The flags and the stack pointer are touched by most blocks.  */
+    tcg_global_pin(cpu_cc_dst);
+    tcg_global_pin(cpu_cc_src);
+    tcg_global_pin(cpu_regs[R_ESP]);
+    tcg_global_pin(cpu_regs[R_EAX]);
+
     helper_lock_init();
 }
 
@@ -132,6 +132,12 @@ extern bool have_bmi1;
 #define TCG_TARGET_HAS_mulsh_i64        0
 #endif
 
+#define TCG_TARGET_HAS_code_relocs      1
+
+#if TCG_TARGET_REG_BITS == 64
+#define TCG_TARGET_NB_PINNED_REGS       4
+#endif
+
 #define TCG_TARGET_deposit_i32_valid(ofs, len) \
     (((ofs) == 0 && (len) == 8) || ((ofs) == 8 && (len) == 8) || \
      ((ofs) == 0 && (len) == 16))
@@ -38,7 +38,8 @@ struct tcg_temp_info {
     uint16_t prev_copy;
     uint16_t next_copy;
     tcg_target_ulong val;
-    tcg_target_ulong mask;
+    tcg_target_ulong mask;  /* bits that may be set */
+    tcg_target_ulong ones;  /* bits that are known to be set */
 };
 
 static struct tcg_temp_info temps[TCG_MAX_TEMPS];
@@ -63,6 +64,7 @@ static void reset_temp(TCGArg temp)
     temps[temp].prev_copy = temp;
     temps[temp].is_const = false;
     temps[temp].mask = -1;
+    temps[temp].ones = 0;
 }
 
 /* Reset all temporaries, given that there are NB_TEMPS of them.  */
@@ -79,6 +81,7 @@ static void init_temp_info(TCGArg temp)
         temps[temp].prev_copy = temp;
         temps[temp].is_const = false;
         temps[temp].mask = -1;
+        temps[temp].ones = 0;
         set_bit(temp, temps_used.l);
     }
 }
@@ -198,23 +201,31 @@ static bool temps_are_copies(TCGArg arg1, TCGArg arg2)
     return false;
 }
 
-static void tcg_opt_gen_movi(TCGContext *s, TCGOp *op, TCGArg *args,
-                             TCGArg dst, TCGArg val)
+/* Record that DST holds the constant VAL.  */
+static void temp_set_const(TCGArg dst, TCGArg val, bool is_32bit)
 {
-    TCGOpcode new_op = op_to_movi(op->opc);
-    tcg_target_ulong mask;
-
-    op->opc = new_op;
+    tcg_target_ulong mask = val, ones = val;
 
     reset_temp(dst);
     temps[dst].is_const = true;
     temps[dst].val = val;
-    mask = val;
-    if (TCG_TARGET_REG_BITS > 32 && new_op == INDEX_op_movi_i32) {
+    if (TCG_TARGET_REG_BITS > 32 && is_32bit) {
         /* High bits of the destination are now garbage.  */
         mask |= ~0xffffffffull;
+        ones &= 0xffffffffull;
     }
     temps[dst].mask = mask;
+    temps[dst].ones = ones;
+}
+
+static void tcg_opt_gen_movi(TCGContext *s, TCGOp *op, TCGArg *args,
+                             TCGArg dst, TCGArg val)
+{
+    TCGOpcode new_op = op_to_movi(op->opc);
+
+    op->opc = new_op;
+
+    temp_set_const(dst, val, new_op == INDEX_op_movi_i32);
 
     args[0] = dst;
     args[1] = val;
@@ -229,17 +240,20 @@ static void tcg_opt_gen_mov(TCGContext *s, TCGOp *op, TCGArg *args,
     }
 
     TCGOpcode new_op = op_to_mov(op->opc);
-    tcg_target_ulong mask;
+    tcg_target_ulong mask, ones;
 
     op->opc = new_op;
 
     reset_temp(dst);
     mask = temps[src].mask;
+    ones = temps[src].ones;
     if (TCG_TARGET_REG_BITS > 32 && new_op == INDEX_op_mov_i32) {
         /* High bits of the destination are now garbage.  */
         mask |= ~0xffffffffull;
+        ones &= 0xffffffffull;
     }
     temps[dst].mask = mask;
+    temps[dst].ones = ones;
 
     if (s->temps[src].type == s->temps[dst].type) {
         temps[dst].next_copy = temps[src].next_copy;
@@ -570,6 +584,136 @@ static bool swap_commutative2(TCGArg *p1, TCGArg *p2)
     return false;
 }
 
+/* Number of env ranges remembered by tcg_opt_dead_env_stores.  */
+#define MAX_DEAD_ENV_STORES 16
+
+static inline bool temp_is_env(TCGContext *s, TCGArg arg)
+{
+    return s->temps[arg].fixed_reg && s->temps[arg].reg == TCG_AREG0;
+}
+
+/* Remove stores to env that are overwritten by a later store before
+   anything can read them.  The ops are walked backwards, remembering
+   the env ranges that are stored to further down.  Loads from env
+   forget the ranges they overlap.  Loads through other pointers, helper
+   calls, guest memory accesses (which may fault) and the end of a basic
+   block forget everything.  */
+static void tcg_opt_dead_env_stores(TCGContext *s)
+{
+    struct {
+        intptr_t start, end;
+    } ranges[MAX_DEAD_ENV_STORES];
+    int oi, oi_prev, i, nb_ranges = 0;
+
+    for (oi = s->gen_last_op_idx; oi >= 0; oi = oi_prev) {
+        TCGOp * const op = &s->gen_op_buf[oi];
+        TCGArg * const args = &s->gen_opparam_buf[op->args];
+        TCGOpcode opc = op->opc;
+        const TCGOpDef *def = &tcg_op_defs[opc];
+        intptr_t start, end;
+        int size;
+
+        oi_prev = op->prev;
+
+        switch (opc) {
+        CASE_OP_32_64(st8):
+            size = 1;
+            goto do_store;
+        CASE_OP_32_64(st16):
+            size = 2;
+            goto do_store;
+        case INDEX_op_st_i32:
+        case INDEX_op_st32_i64:
+            size = 4;
+            goto do_store;
+        case INDEX_op_st_i64:
+            size = 8;
+        do_store:
+            if (!temp_is_env(s, args[1])) {
+                break;
+            }
+            start = args[2];
+            end = start + size;
+            for (i = 0; i < nb_ranges; i++) {
+                if (ranges[i].start <= start && end <= ranges[i].end) {
+                    tcg_op_remove(s, op);
+                    break;
+                }
+            }
+            if (i == nb_ranges && nb_ranges < MAX_DEAD_ENV_STORES) {
+                ranges[nb_ranges].start = start;
+                ranges[nb_ranges].end = end;
+                nb_ranges++;
+            }
+            break;
+
+        CASE_OP_32_64(ld8u):
+        CASE_OP_32_64(ld8s):
+        CASE_OP_32_64(ld16u):
+        CASE_OP_32_64(ld16s):
+        case INDEX_op_ld_i32:
+        case INDEX_op_ld32u_i64:
+        case INDEX_op_ld32s_i64:
+        case INDEX_op_ld_i64:
+            if (!temp_is_env(s, args[1])) {
+                nb_ranges = 0;
+                break;
+            }
+            /* Any size up to 8 bytes; being conservative is fine.  */
+            start = args[2];
+            end = start + 8;
+            for (i = 0; i < nb_ranges; ) {
+                if (ranges[i].start < end && start < ranges[i].end) {
+                    ranges[i] = ranges[--nb_ranges];
+                } else {
+                    i++;
+                }
+            }
+            break;
+
+        case INDEX_op_insn_start:
+        case INDEX_op_discard:
+            break;
+
+        default:
+            if (opc == INDEX_op_call
+                || (def->flags & (TCG_OPF_BB_END | TCG_OPF_SIDE_EFFECTS))) {
+                nb_ranges = 0;
+            }
+            break;
+        }
+
+        if (opc == INDEX_op_call || nb_ranges == 0) {
+            continue;
+        }
+
+        /* Globals that live in env may be loaded from memory by the
+           register allocator when they are first used.  */
+        for (i = def->nb_oargs; i < def->nb_oargs + def->nb_iargs; i++) {
+            TCGTemp *ts;
+            int j;
+
+            if (args[i] >= s->nb_globals) {
+                continue;
+            }
+            ts = &s->temps[args[i]];
+            if (ts->fixed_reg || !ts->mem_base->fixed_reg
+                || ts->mem_base->reg != TCG_AREG0) {
+                continue;
+            }
+            start = ts->mem_offset;
+            end = start + 8;
+            for (j = 0; j < nb_ranges; ) {
+                if (ranges[j].start < end && start < ranges[j].end) {
+                    ranges[j] = ranges[--nb_ranges];
+                } else {
+                    j++;
+                }
+            }
+        }
+    }
+}
+
 /* Propagate constants and copies, fold constant expressions. */
 void tcg_optimize(TCGContext *s)
 {
@@ -585,7 +729,7 @@ void tcg_optimize(TCGContext *s)
     reset_all_temps(nb_temps);
 
     for (oi = s->gen_first_op_idx; oi >= 0; oi = oi_next) {
-        tcg_target_ulong mask, partmask, affected;
+        tcg_target_ulong mask, partmask, affected, ones;
         int nb_oargs, nb_iargs, i;
         TCGArg tmp;
 
@@ -804,28 +948,33 @@ void tcg_optimize(TCGContext *s)
             break;
         }
 
-        /* Simplify using known-zero bits. Currently only ops with a single
-           output argument is supported. */
+        /* Simplify using known-zero and known-one bits. Currently only ops
+           with a single output argument is supported.  "affected" is the
+           set of bits in which the result may differ from args[1]. */
         mask = -1;
+        ones = 0;
         affected = -1;
         switch (opc) {
         CASE_OP_32_64(ext8s):
             if ((temps[args[1]].mask & 0x80) != 0) {
-                break;
+                tmp = 0x80;
+                goto sext_known_one;
             }
         CASE_OP_32_64(ext8u):
             mask = 0xff;
             goto and_const;
         CASE_OP_32_64(ext16s):
             if ((temps[args[1]].mask & 0x8000) != 0) {
-                break;
+                tmp = 0x8000;
+                goto sext_known_one;
             }
         CASE_OP_32_64(ext16u):
             mask = 0xffff;
             goto and_const;
         case INDEX_op_ext32s_i64:
             if ((temps[args[1]].mask & 0x80000000) != 0) {
-                break;
+                tmp = 0x80000000;
+                goto sext_known_one;
             }
         case INDEX_op_ext32u_i64:
             mask = 0xffffffffU;
@@ -833,10 +982,13 @@ void tcg_optimize(TCGContext *s)
 
         CASE_OP_32_64(and):
             mask = temps[args[2]].mask;
+            ones = temps[args[2]].ones;
             if (temp_is_const(args[2])) {
         and_const:
                 affected = temps[args[1]].mask & ~mask;
+                ones = mask;
             }
+            ones &= temps[args[1]].ones;
             mask = temps[args[1]].mask & mask;
             break;
 
@@ -847,6 +999,7 @@ void tcg_optimize(TCGContext *s)
         case INDEX_op_extu_i32_i64:
             /* We do not compute affected as it is a size changing op.  */
             mask = (uint32_t)temps[args[1]].mask;
+            ones = (uint32_t)temps[args[1]].ones;
             break;
 
         CASE_OP_32_64(andc):
@@ -858,18 +1011,21 @@ void tcg_optimize(TCGContext *s)
             }
             /* But we certainly know nothing outside args[1] may be set. */
             mask = temps[args[1]].mask;
+            ones = temps[args[1]].ones & ~temps[args[2]].mask;
             break;
 
         case INDEX_op_sar_i32:
             if (temp_is_const(args[2])) {
                 tmp = temps[args[2]].val & 31;
                 mask = (int32_t)temps[args[1]].mask >> tmp;
+                ones = (int32_t)temps[args[1]].ones >> tmp;
             }
             break;
         case INDEX_op_sar_i64:
             if (temp_is_const(args[2])) {
                 tmp = temps[args[2]].val & 63;
                 mask = (int64_t)temps[args[1]].mask >> tmp;
+                ones = (int64_t)temps[args[1]].ones >> tmp;
             }
             break;
 
@@ -877,26 +1033,31 @@ void tcg_optimize(TCGContext *s)
             if (temp_is_const(args[2])) {
                 tmp = temps[args[2]].val & 31;
                 mask = (uint32_t)temps[args[1]].mask >> tmp;
+                ones = (uint32_t)temps[args[1]].ones >> tmp;
             }
             break;
         case INDEX_op_shr_i64:
             if (temp_is_const(args[2])) {
                 tmp = temps[args[2]].val & 63;
                 mask = (uint64_t)temps[args[1]].mask >> tmp;
+                ones = (uint64_t)temps[args[1]].ones >> tmp;
             }
             break;
 
         case INDEX_op_extrl_i64_i32:
             mask = (uint32_t)temps[args[1]].mask;
+            ones = (uint32_t)temps[args[1]].ones;
             break;
         case INDEX_op_extrh_i64_i32:
             mask = (uint64_t)temps[args[1]].mask >> 32;
+            ones = (uint64_t)temps[args[1]].ones >> 32;
             break;
 
         CASE_OP_32_64(shl):
             if (temp_is_const(args[2])) {
                 tmp = temps[args[2]].val & (TCG_TARGET_REG_BITS - 1);
                 mask = temps[args[1]].mask << tmp;
+                ones = temps[args[1]].ones << tmp;
             }
             break;
 
@@ -905,14 +1066,30 @@ void tcg_optimize(TCGContext *s)
             mask = -(temps[args[1]].mask & -temps[args[1]].mask);
             break;
 
+        CASE_OP_32_64(not):
+            mask = ~temps[args[1]].ones;
+            ones = ~temps[args[1]].mask;
+            break;
+
         CASE_OP_32_64(deposit):
             mask = deposit64(temps[args[1]].mask, args[3], args[4],
                              temps[args[2]].mask);
+            ones = deposit64(temps[args[1]].ones, args[3], args[4],
+                             temps[args[2]].ones);
             break;
 
         CASE_OP_32_64(or):
+            mask = temps[args[1]].mask | temps[args[2]].mask;
+            ones = temps[args[1]].ones | temps[args[2]].ones;
+            /* Nothing changes if args[2] only has bits that are known
+               to be set in args[1] already.  */
+            affected = temps[args[2]].mask & ~temps[args[1]].ones;
+            break;
+
         CASE_OP_32_64(xor):
             mask = temps[args[1]].mask | temps[args[2]].mask;
+            ones = (temps[args[1]].ones & ~temps[args[2]].mask)
+                | (~temps[args[1]].mask & temps[args[2]].ones);
             break;
 
         CASE_OP_32_64(setcond):
@@ -922,6 +1099,7 @@ void tcg_optimize(TCGContext *s)
 
         CASE_OP_32_64(movcond):
             mask = temps[args[3]].mask | temps[args[4]].mask;
+            ones = temps[args[3]].ones & temps[args[4]].ones;
             break;
 
         CASE_OP_32_64(ld8u):
@@ -944,6 +1122,16 @@ void tcg_optimize(TCGContext *s)
             }
             break;
 
+        sext_known_one:
+            /* The sign bit TMP is not known to be zero.  If it is known
+               to be one, so are all the bits above it.  */
+            if (temps[args[1]].ones & tmp) {
+                mask = temps[args[1]].mask | -tmp;
+                ones = temps[args[1]].ones | -tmp;
+                affected = -tmp & ~temps[args[1]].ones;
+            }
+            break;
+
         default:
             break;
         }
@@ -956,6 +1144,7 @@ void tcg_optimize(TCGContext *s)
             mask |= ~(tcg_target_ulong)0xffffffffu;
             partmask &= 0xffffffffu;
             affected &= 0xffffffffu;
+            ones &= 0xffffffffu;
         }
 
         if (partmask == 0) {
@@ -968,6 +1157,16 @@ void tcg_optimize(TCGContext *s)
             tcg_opt_gen_mov(s, op, args, args[0], args[1]);
             continue;
         }
+        if ((partmask & ~ones) == 0) {
+            /* Every bit that may be set is known to be set.  */
+            tcg_debug_assert(nb_oargs == 1);
+            if (def->flags & TCG_OPF_64BIT) {
+                tcg_opt_gen_movi(s, op, args, args[0], ones);
+            } else {
+                tcg_opt_gen_movi(s, op, args, args[0], (int32_t)ones);
+            }
+            continue;
+        }
 
         /* Simplify expression for "op r, a, 0 => movi r, 0" cases */
         switch (opc) {
@@ -1100,7 +1299,15 @@ void tcg_optimize(TCGContext *s)
                 }
                 break;
             }
-            goto do_default;
+            /* The code following the branch is only reached if the
+               condition is false; what we know still holds there.  */
+            if (tcg_invert_cond(args[2]) == TCG_COND_EQ
+                && temp_is_const(args[1]) && !temp_is_const(args[0])) {
+                reset_temp(args[0]);
+                temp_set_const(args[0], temps[args[1]].val,
+                               opc == INDEX_op_brcond_i32);
+            }
+            break;
 
         CASE_OP_32_64(movcond):
             tmp = do_constant_folding_cond(opc, args[1], args[2], args[5]);
@@ -1179,7 +1386,6 @@ void tcg_optimize(TCGContext *s)
                 /* Simplify LT/GE comparisons vs zero to a single compare
                    vs the high word of the input.  */
             do_brcond_high:
-                reset_all_temps(nb_temps);
                 op->opc = INDEX_op_brcond_i32;
                 args[0] = args[1];
                 args[1] = args[3];
@@ -1203,7 +1409,6 @@ void tcg_optimize(TCGContext *s)
                     goto do_default;
                 }
             do_brcond_low:
-                reset_all_temps(nb_temps);
                 op->opc = INDEX_op_brcond_i32;
                 args[1] = args[2];
                 args[2] = args[4];
@@ -1310,22 +1515,32 @@ void tcg_optimize(TCGContext *s)
             /* Default case: we know nothing about operation (or were unable
                to compute the operation result) so no propagation is done.
                We trash everything if the operation is the end of a basic
-               block, otherwise we only trash the output args.  "mask" is
-               the non-zero bits mask for the first output arg.  */
+               block, otherwise we only trash the output args.  "mask" and
+               "ones" are the known bits for the first output arg.
+               Conditional branches are the exception: the code following
+               them has a single predecessor, so the knowledge carries over
+               within the extended basic block.  Only globals and local
+               temps can be used there, and copy propagation never replaces
+               those by a plain temp.  */
             if (def->flags & TCG_OPF_BB_END) {
-                reset_all_temps(nb_temps);
+                if (!(def->flags & TCG_OPF_COND_BRANCH)) {
+                    reset_all_temps(nb_temps);
+                }
             } else {
         do_reset_output:
                 for (i = 0; i < nb_oargs; i++) {
                     reset_temp(args[i]);
-                    /* Save the corresponding known-zero bits mask for the
-                       first output argument (only one supported so far). */
+                    /* Save the corresponding known bits for the first
+                       output argument (only one supported so far). */
                     if (i == 0) {
                         temps[args[i]].mask = mask;
+                        temps[args[i]].ones = ones;
                     }
                 }
             }
             break;
         }
     }
+
+    tcg_opt_dead_env_stores(s);
 }
@@ -246,6 +246,58 @@ TCGLabel *gen_new_label(void)
     return l;
 }
 
+/* Record that the code at WHERE depends on the absolute host address
+   TARGET, so that it can be fixed up when the code of the block is
+   moved.  Called by backends that set TCG_TARGET_HAS_code_relocs, only
+   where they emit a host address; constants are never recorded.  */
+static void __attribute__((unused))
+tcg_out_code_reloc(TCGContext *s, tcg_insn_unit *where,
+                   TCGCodeRelocType type, uintptr_t target)
+{
+    uintptr_t tb = (uintptr_t)s->code_reloc_tb;
+    TCGCodeReloc *r;
+
+    if (!s->code_reloc_enabled) {
+        return;
+    }
+    if (s->nb_code_relocs == TCG_MAX_CODE_RELOCS) {
+        s->code_relocatable = false;
+        return;
+    }
+
+    r = &s->code_relocs[s->nb_code_relocs++];
+    r->offset = tcg_ptr_byte_diff(where, s->code_buf);
+    r->type = type;
+    r->pad = 0;
+    if (target - (uintptr_t)s->code_gen_buffer < s->code_gen_buffer_size) {
+        if (target >= (uintptr_t)s->code_buf) {
+            /* Within the block itself, nothing to do for relative
+               references.  */
+            if (type == TCG_CODE_RELOC_PCREL32) {
+                s->nb_code_relocs--;
+            } else {
+                s->code_relocatable = false;
+            }
+            return;
+        }
+        r->base = TCG_CODE_RELOC_BASE_PROLOGUE;
+        r->addend = target - (uintptr_t)s->code_gen_prologue;
+    } else if (target - tb < sizeof(TranslationBlock)) {
+        r->base = TCG_CODE_RELOC_BASE_TB;
+        r->addend = target - tb;
+    } else if (target - s->code_reloc_binary_start <
+               s->code_reloc_binary_end - s->code_reloc_binary_start) {
+        /* Helpers and globals move with the load address of QEMU.  */
+        r->base = TCG_CODE_RELOC_BASE_BINARY;
+        r->addend = target - (uintptr_t)tb_gen_code;
+    } else {
+        /* Nothing says the address will still be valid in another
+           process.  */
+        s->nb_code_relocs--;
+        s->code_relocatable = false;
+    }
+}
+
 #include "tcg-target.inc.c"
 
 /* pool based memory allocation */
@@ -436,6 +488,9 @@ void tcg_func_start(TCGContext *s)
     s->gen_next_op_idx = 0;
     s->gen_next_parm_idx = 0;
 
+    s->code_relocatable = TCG_TARGET_HAS_code_relocs;
+    s->nb_code_relocs = 0;
+
     s->be = tcg_malloc(sizeof(TCGBackendData));
 }
 
@@ -513,6 +568,58 @@ TCGv_i64 tcg_global_reg_new_i64(TCGReg reg, const char *name)
     return MAKE_TCGV_I64(idx);
 }
 
+/* Keep the memory global V in a callee-saved host register for as long
+   as generated code runs, instead of loading it in every basic block and
+   storing it back at every basic block end.  The register is loaded when
+   a chain of TBs is entered from the prologue (direct jumps between TBs
+   skip these loads), written back before helpers that may read globals,
+   before qemu_ld/st and before exit_tb, and reloaded after helpers that
+   may write globals.  At most tcg_pinned_regs globals are pinned, in
+   the order the frontend asks for them; this must happen before any
+   code is generated.  Returns true if V was pinned.  */
+static bool tcg_global_pin_internal(TCGContext *s, int idx)
+{
+#if TCG_TARGET_NB_PINNED_REGS > 0
+    TCGTemp *ts = &s->temps[idx];
+    int n = s->nb_pinned_globals;
+    TCGReg reg;
+
+    if (n >= MIN(tcg_pinned_regs, TCG_TARGET_NB_PINNED_REGS)
+        || s->tb_ctx.nb_tbs != 0) {
+        return false;
+    }
+    /* Only direct, full width memory globals can be pinned.  */
+    if (idx >= s->nb_globals || ts->fixed_reg || ts->indirect_reg
+        || ts->base_type != ts->type) {
+        return false;
+    }
+    reg = tcg_target_pinned_regs[n];
+    if (tcg_regset_test_reg(s->reserved_regs, reg)) {
+        return false;
+    }
+
+    tcg_regset_set_reg(s->reserved_regs, reg);
+    ts->fixed_reg = 1;
+    ts->pinned_reg = 1;
+    ts->reg = reg;
+    s->pinned_globals[n] = idx;
+    s->nb_pinned_globals++;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool tcg_global_pin_i32(TCGv_i32 v)
+{
+    return tcg_global_pin_internal(&tcg_ctx, GET_TCGV_I32(v));
+}
+
+bool tcg_global_pin_i64(TCGv_i64 v)
+{
+    return tcg_global_pin_internal(&tcg_ctx, GET_TCGV_I64(v));
+}
+
 int tcg_global_mem_new_internal(TCGType type, TCGv_ptr base,
                                 intptr_t offset, const char *name)
 {
@@ -1300,6 +1407,22 @@ void tcg_op_remove(TCGContext *s, TCGOp *op)
 }
 
 #ifdef USE_LIVENESS_ANALYSIS
+/* liveness analysis: pinned globals stay live in their register across
+   basic blocks, helper calls and TBs.  The register allocator writes
+   them back to memory itself where needed, so they never need a sync
+   at the point they are defined. */
+static inline void tcg_la_pinned(TCGContext *s, uint8_t *dead_temps,
+                                 uint8_t *mem_temps)
+{
+    int i;
+
+    for (i = 0; i < s->nb_pinned_globals; i++) {
+        int idx = s->pinned_globals[i];
+        dead_temps[idx] = 0;
+        mem_temps[idx] = 0;
+    }
+}
+
 /* liveness analysis: end of function: all temps are dead, and globals
    should be in memory. */
 static inline void tcg_la_func_end(TCGContext *s, uint8_t *dead_temps,
@@ -1308,6 +1431,7 @@ static inline void tcg_la_func_end(TCGContext *s, uint8_t *dead_temps,
     memset(dead_temps, 1, s->nb_temps);
     memset(mem_temps, 1, s->nb_globals);
     memset(mem_temps + s->nb_globals, 0, s->nb_temps - s->nb_globals);
+    tcg_la_pinned(s, dead_temps, mem_temps);
 }
 
 /* liveness analysis: end of basic block: all temps are dead, globals
@@ -1322,6 +1446,7 @@ static inline void tcg_la_bb_end(TCGContext *s, uint8_t *dead_temps,
     for(i = s->nb_globals; i < s->nb_temps; i++) {
         mem_temps[i] = s->temps[i].temp_local;
     }
+    tcg_la_pinned(s, dead_temps, mem_temps);
 }
 
 /* Liveness analysis : update the opc_dead_args array to tell if a
@@ -1400,6 +1525,9 @@ static void tcg_liveness_analysis(TCGContext *s)
                         /* globals should go back to memory */
                         memset(dead_temps, 1, s->nb_globals);
                     }
+                    if (!(call_flags & TCG_CALL_NO_READ_GLOBALS)) {
+                        tcg_la_pinned(s, dead_temps, mem_temps);
+                    }
 
                     /* record arguments that die in this helper */
                     for (i = nb_oargs; i < nb_iargs + nb_oargs; i++) {
@@ -1547,6 +1675,7 @@ static void tcg_liveness_analysis(TCGContext *s)
                 } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
                     /* globals should be synced to memory */
                     memset(mem_temps, 1, s->nb_globals);
+                    tcg_la_pinned(s, dead_temps, mem_temps);
                 }
 
                 /* record arguments that die in this opcode */
@@ -1826,6 +1955,45 @@ static inline void temp_save(TCGContext *s, TCGTemp *ts,
     temp_dead(s, ts);
 }
 
+/* write the pinned globals that were modified back to memory */
+static void pinned_globals_sync(TCGContext *s)
+{
+    int i;
+
+    for (i = 0; i < s->nb_pinned_globals; i++) {
+        TCGTemp *ts = &s->temps[s->pinned_globals[i]];
+        if (!ts->mem_coherent) {
+            tcg_out_st(s, ts->type, ts->reg, ts->mem_base->reg,
+                       ts->mem_offset);
+            ts->mem_coherent = 1;
+        }
+    }
+}
+
+/* reload the pinned globals after code that may have modified them in
+   memory */
+static void pinned_globals_load(TCGContext *s)
+{
+    int i;
+
+    for (i = 0; i < s->nb_pinned_globals; i++) {
+        TCGTemp *ts = &s->temps[s->pinned_globals[i]];
+        tcg_out_ld(s, ts->type, ts->reg, ts->mem_base->reg, ts->mem_offset);
+        ts->mem_coherent = 1;
+    }
+}
+
+/* forget that the pinned globals match their memory copy, because the
+   following code may also be reached with other values in the registers */
+static void pinned_globals_invalidate(TCGContext *s)
+{
+    int i;
+
+    for (i = 0; i < s->nb_pinned_globals; i++) {
+        s->temps[s->pinned_globals[i]].mem_coherent = 0;
+    }
+}
+
 /* save globals to their canonical location and assume they can be
    modified be the following code. 'allocated_regs' is used in case a
    temporary registers needs to be allocated to store a constant. */
@@ -1858,14 +2026,20 @@ static void sync_globals(TCGContext *s, TCGRegSet allocated_regs)
 #endif
         temp_sync(s, ts, allocated_regs);
     }
+    pinned_globals_sync(s);
 }
 
 /* at the end of a basic block, we assume all temporaries are dead and
-   all globals are stored at their canonical location. */
+   all globals are stored at their canonical location, except for pinned
+   globals which stay in their register. */
 static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
 {
     int i;
 
+    /* The next basic block may be reached from several places, so the
+       memory copy of the pinned globals can't be trusted anymore.  */
+    pinned_globals_invalidate(s);
+
     for (i = s->nb_globals; i < s->nb_temps; i++) {
         TCGTemp *ts = &s->temps[i];
         if (ts->temp_local) {
@@ -1903,6 +2077,7 @@ static void tcg_reg_alloc_movi(TCGContext *s, const TCGArg *args,
         /* for fixed registers, we do not do any constant
            propagation */
         tcg_out_movi(s, ots->type, ots->reg, val);
+        ots->mem_coherent = 0;
     } else {
         /* The movi is not explicitly generated here */
         if (ots->val_type == TEMP_VAL_REG) {
@@ -2094,6 +2269,10 @@ static void tcg_reg_alloc_op(TCGContext *s,
     }
 
     if (def->flags & TCG_OPF_BB_END) {
+        if (opc == INDEX_op_exit_tb) {
+            /* leaving the TB chain, env must be up to date */
+            pinned_globals_sync(s);
+        }
         tcg_reg_alloc_bb_end(s, allocated_regs);
     } else {
         if (def->flags & TCG_OPF_CALL_CLOBBER) {
@@ -2154,8 +2333,11 @@ static void tcg_reg_alloc_op(TCGContext *s,
     for(i = 0; i < nb_oargs; i++) {
         ts = &s->temps[args[i]];
         reg = new_args[i];
-        if (ts->fixed_reg && ts->reg != reg) {
-            tcg_out_mov(s, ts->type, ts->reg, reg);
+        if (ts->fixed_reg) {
+            if (ts->reg != reg) {
+                tcg_out_mov(s, ts->type, ts->reg, reg);
+            }
+            ts->mem_coherent = 0;
         }
         if (NEED_SYNC_ARG(i)) {
             tcg_reg_sync(s, reg, allocated_regs);
@@ -2269,10 +2451,17 @@ static void tcg_reg_alloc_call(TCGContext *s, int nb_oargs, int nb_iargs,
         sync_globals(s, allocated_regs);
     } else {
         save_globals(s, allocated_regs);
+        pinned_globals_sync(s);
     }
 
     tcg_out_call(s, func_addr);
 
+    /* Pinned globals live in callee-saved registers, only reload them
+       if the helper may have changed them.  */
+    if (!(flags & (TCG_CALL_NO_READ_GLOBALS | TCG_CALL_NO_WRITE_GLOBALS))) {
+        pinned_globals_load(s);
+    }
+
     /* assign output registers and emit moves if needed */
     for(i = 0; i < nb_oargs; i++) {
         arg = args[i];
@@ -2284,6 +2473,7 @@ static void tcg_reg_alloc_call(TCGContext *s, int nb_oargs, int nb_iargs,
             if (ts->reg != reg) {
                 tcg_out_mov(s, ts->type, ts->reg, reg);
             }
+            ts->mem_coherent = 0;
         } else {
             if (ts->val_type == TEMP_VAL_REG) {
                 s->reg_to_temp[ts->reg] = NULL;
@@ -2304,16 +2494,39 @@ static void tcg_reg_alloc_call(TCGContext *s, int nb_oargs, int nb_iargs,
 
 #ifdef CONFIG_PROFILER
 
+/* ops generated by the frontend, and ops left after optimization and
+   liveness analysis */
+static int64_t tcg_table_op_count_in[NB_OPS];
 static int64_t tcg_table_op_count[NB_OPS];
 
+static void tcg_count_ops_in(TCGContext *s)
+{
+    int oi;
+
+    for (oi = s->gen_first_op_idx; oi >= 0; oi = s->gen_op_buf[oi].next) {
+        tcg_table_op_count_in[s->gen_op_buf[oi].opc]++;
+    }
+}
+
 void tcg_dump_op_count(FILE *f, fprintf_function cpu_fprintf)
 {
+    int64_t tot_in = 0, tot_out = 0;
     int i;
 
+    cpu_fprintf(f, "%-20s %12s %12s\n", "op", "generated", "emitted");
     for (i = 0; i < NB_OPS; i++) {
-        cpu_fprintf(f, "%s %" PRId64 "\n", tcg_op_defs[i].name,
+        if (!tcg_table_op_count_in[i] && !tcg_table_op_count[i]) {
+            continue;
+        }
+        cpu_fprintf(f, "%-20s %12" PRId64 " %12" PRId64 "\n",
+                    tcg_op_defs[i].name, tcg_table_op_count_in[i],
                     tcg_table_op_count[i]);
+        tot_in += tcg_table_op_count_in[i];
+        tot_out += tcg_table_op_count[i];
     }
+    cpu_fprintf(f, "%-20s %12" PRId64 " %12" PRId64 " (%0.1f%% removed)\n",
+                "total", tot_in, tot_out,
+                tot_in ? (double)(tot_in - tot_out) * 100.0 / tot_in : 0);
 }
 #else
 void tcg_dump_op_count(FILE *f, fprintf_function cpu_fprintf)
@@ -2323,11 +2536,59 @@ void tcg_dump_op_count(FILE *f, fprintf_function cpu_fprintf)
 #endif
 
 
+/* Instrument the block with an increment of tb->exec_count.  The ops
+   are emitted at the end of the stream and then moved right after the
+   first insn_start, i.e. behind the exit request check of gen_tb_start,
+   so that only real entries into the block are counted.  */
+static void tcg_gen_tb_counter(TCGContext *s, TranslationBlock *tb)
+{
+    int oi, first, last, new_last, next;
+    TCGv_ptr ptr;
+    TCGv_i64 count;
+
+    for (oi = s->gen_first_op_idx; oi >= 0; oi = s->gen_op_buf[oi].next) {
+        if (s->gen_op_buf[oi].opc == INDEX_op_insn_start) {
+            break;
+        }
+    }
+    if (oi < 0 || s->gen_op_buf[oi].next < 0) {
+        return;
+    }
+
+    last = s->gen_last_op_idx;
+    first = s->gen_next_op_idx;
+
+    ptr = tcg_const_ptr(&tb->exec_count);
+    count = tcg_temp_new_i64();
+    tcg_gen_ld_i64(count, ptr, 0);
+    tcg_gen_addi_i64(count, count, 1);
+    tcg_gen_st_i64(count, ptr, 0);
+    tcg_temp_free_i64(count);
+    tcg_temp_free_ptr(ptr);
+
+    /* Unlink [first, new_last] from the tail and splice it after OI.  */
+    new_last = s->gen_last_op_idx;
+    next = s->gen_op_buf[oi].next;
+
+    s->gen_op_buf[last].next = -1;
+    s->gen_last_op_idx = last;
+
+    s->gen_op_buf[first].prev = oi;
+    s->gen_op_buf[new_last].next = next;
+    s->gen_op_buf[next].prev = new_last;
+    s->gen_op_buf[oi].next = first;
+}
+
 int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
 {
     int i, oi, oi_next, num_insns;
 
+    if (tb_profile_enabled) {
+        tcg_gen_tb_counter(s, tb);
+    }
+
 #ifdef CONFIG_PROFILER
+    tcg_count_ops_in(s);
     {
         int n;
 
@@ -2386,9 +2647,18 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
 
     s->code_buf = tb->tc_ptr;
     s->code_ptr = tb->tc_ptr;
+    s->code_reloc_tb = tb;
 
     tcg_out_tb_init(s);
 
+    /* Entering from the prologue loads the pinned globals, direct jumps
+       from other TBs of the chain enter after these loads.  */
+    pinned_globals_load(s);
+    tb->tc_chain_offset = tcg_current_code_size(s);
+    /* A chained entry keeps the registers of the previous TB, which may
+       not have been written back to env yet.  */
+    pinned_globals_invalidate(s);
+
     num_insns = -1;
     for (oi = s->gen_first_op_idx; oi >= 0; oi = oi_next) {
         TCGOp * const op = &s->gen_op_buf[oi];
@@ -101,6 +101,18 @@ typedef uint64_t TCGRegSet;
 #define TCG_TARGET_HAS_sub2_i32         1
 #endif
 
+/* Whether the backend reports position dependent code via
+   tcg_out_code_reloc, which is required by the translation cache.  */
+#ifndef TCG_TARGET_HAS_code_relocs
+#define TCG_TARGET_HAS_code_relocs      0
+#endif
+
+/* Number of callee-saved host registers the backend lists in
+   tcg_target_pinned_regs[] for tcg_global_pin_i32/i64.  */
+#ifndef TCG_TARGET_NB_PINNED_REGS
+#define TCG_TARGET_NB_PINNED_REGS       0
+#endif
+
 #ifndef TCG_TARGET_deposit_i32_valid
 #define TCG_TARGET_deposit_i32_valid(ofs, len) 1
 #endif
@@ -469,6 +481,8 @@ typedef struct TCGTemp {
                                   basic blocks. Otherwise, it is not
                                   preserved across basic blocks. */
     unsigned int temp_allocated:1; /* never used for code gen */
+    unsigned int pinned_reg:1; /* global kept in 'reg' for the whole TB
+                                  chain, with fixed_reg also set */
 
     tcg_target_long val;
     struct TCGTemp *mem_base;
@@ -478,6 +492,30 @@ typedef struct TCGTemp {
 
 typedef struct TCGContext TCGContext;
 
+/* A position dependent value in generated host code.  These are only
+   recorded when code_reloc_enabled is set, so that the code of a block
+   can be saved and later copied to a different address.  */
+typedef enum TCGCodeRelocType {
+    TCG_CODE_RELOC_PCREL32, /* 32-bit displacement from the end of the field */
+    TCG_CODE_RELOC_ABS,     /* host pointer sized absolute value */
+} TCGCodeRelocType;
+
+typedef enum TCGCodeRelocBase {
+    TCG_CODE_RELOC_BASE_PROLOGUE, /* relative to code_gen_prologue */
+    TCG_CODE_RELOC_BASE_TB,       /* relative to the TranslationBlock */
+    TCG_CODE_RELOC_BASE_BINARY,   /* QEMU binary, relative to tb_gen_code */
+} TCGCodeRelocBase;
+
+typedef struct TCGCodeReloc {
+    uint32_t offset;    /* of the field from the start of the block code */
+    uint8_t type;       /* TCGCodeRelocType */
+    uint8_t base;       /* TCGCodeRelocBase */
+    uint16_t pad;
+    uint64_t addend;
+} TCGCodeReloc;
+
+#define TCG_MAX_CODE_RELOCS 256
+
 typedef struct TCGTempSet {
     unsigned long l[BITS_TO_LONGS(TCG_MAX_TEMPS)];
 } TCGTempSet;
@@ -531,6 +569,19 @@ struct TCGContext {
 
     GHashTable *helpers;
 
+    /* code relocations, see TCGCodeReloc */
+    bool code_reloc_enabled;
+    bool code_relocatable;
+    int nb_code_relocs;
+    TranslationBlock *code_reloc_tb;
+    uintptr_t code_reloc_binary_start;
+    uintptr_t code_reloc_binary_end;
+    TCGCodeReloc code_relocs[TCG_MAX_CODE_RELOCS];
+
+    /* globals pinned to host registers, see tcg_global_pin_i32 */
+    int nb_pinned_globals;
+    int pinned_globals[TCG_TARGET_NB_PINNED_REGS + 1];
+
 #ifdef CONFIG_PROFILER
     /* profiling info */
     int64_t tb_count1;
@@ -645,6 +696,9 @@ int tcg_global_mem_new_internal(TCGType, TCGv_ptr, intptr_t, const char *);
 TCGv_i32 tcg_global_reg_new_i32(TCGReg reg, const char *name);
 TCGv_i64 tcg_global_reg_new_i64(TCGReg reg, const char *name);
 
+bool tcg_global_pin_i32(TCGv_i32 v);
+bool tcg_global_pin_i64(TCGv_i64 v);
+
 TCGv_i32 tcg_temp_new_internal_i32(int temp_local);
 TCGv_i64 tcg_temp_new_internal_i64(int temp_local);
 
@@ -730,6 +784,9 @@ enum {
     /* Instruction is optional and not implemented by the host, or insn
        is generic and should not be implemened by the host.  */
     TCG_OPF_NOT_PRESENT  = 0x10,
+    /* Instruction is a conditional branch: execution may continue with
+       the next instruction, which has no other predecessor.  */
+    TCG_OPF_COND_BRANCH  = 0x20,
 };
 
 typedef struct TCGOpDef {
@@ -772,7 +829,9 @@ void tcg_add_target_add_op_defs(const TCGTargetOpDef *tdefs);
 #define TCGV_NAT_TO_PTR(n) MAKE_TCGV_PTR(GET_TCGV_I32(n))
 #define TCGV_PTR_TO_NAT(n) MAKE_TCGV_I32(GET_TCGV_PTR(n))
 
-#define tcg_const_ptr(V) TCGV_NAT_TO_PTR(tcg_const_i32((intptr_t)(V)))
+/* Host pointers embedded in the code cannot be relocated.  */
+#define tcg_const_ptr(V) (tcg_ctx.code_relocatable = false, \
+    TCGV_NAT_TO_PTR(tcg_const_i32((intptr_t)(V))))
 #define tcg_global_reg_new_ptr(R, N) \
     TCGV_NAT_TO_PTR(tcg_global_reg_new_i32((R), (N)))
 #define tcg_global_mem_new_ptr(R, O, N) \
@@ -783,7 +842,9 @@ void tcg_add_target_add_op_defs(const TCGTargetOpDef *tdefs);
 #define TCGV_NAT_TO_PTR(n) MAKE_TCGV_PTR(GET_TCGV_I64(n))
 #define TCGV_PTR_TO_NAT(n) MAKE_TCGV_I64(GET_TCGV_PTR(n))
 
-#define tcg_const_ptr(V) TCGV_NAT_TO_PTR(tcg_const_i64((intptr_t)(V)))
+/* Host pointers embedded in the code cannot be relocated.  */
+#define tcg_const_ptr(V) (tcg_ctx.code_relocatable = false, \
+    TCGV_NAT_TO_PTR(tcg_const_i64((intptr_t)(V))))
 #define tcg_global_reg_new_ptr(R, N) \
     TCGV_NAT_TO_PTR(tcg_global_reg_new_i64((R), (N)))
 #define tcg_global_mem_new_ptr(R, O, N) \
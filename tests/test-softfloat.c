@@ -0,0 +1,200 @@
+/*
+ * Test the softfloat host FPU fast paths
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include <glib.h>
+#include "fpu/softfloat.h"
+
+/* The host FPU is only used when the inexact flag is already set, so
+ * running each operation once with float_flag_inexact preset and once
+ * with no flags set compares the fast path against the pure software
+ * implementation.  The results must be identical and so must the flags,
+ * apart from inexact itself.
+ */
+
+#define ITERATIONS 200000
+
+typedef float32 (*Float32BinOp)(float32, float32, float_status *);
+typedef float64 (*Float64BinOp)(float64, float64, float_status *);
+
+static float32 float32_sqrt_op(float32 a, float32 b, float_status *s)
+{
+    return float32_sqrt(a, s);
+}
+
+static float64 float64_sqrt_op(float64 a, float64 b, float_status *s)
+{
+    return float64_sqrt(a, s);
+}
+
+/* Mostly normal numbers with exponents near the middle of the range, but
+ * also values close to overflow and underflow, zeros, denormals,
+ * infinities and NaNs.
+ */
+static float32 random_float32(void)
+{
+    uint32_t sign = g_test_rand_int() & 0x80000000;
+    uint32_t frac = g_test_rand_int() & 0x007fffff;
+    uint32_t exp;
+
+    switch (g_test_rand_int_range(0, 16)) {
+    case 0:
+        exp = g_test_rand_int_range(1, 24);
+        break;
+    case 1:
+        exp = g_test_rand_int_range(0xe8, 0xff);
+        break;
+    case 2:
+        exp = 0;
+        frac = g_test_rand_bit() ? frac : 0;
+        break;
+    case 3:
+        exp = 0xff;
+        frac = g_test_rand_bit() ? frac : 0;
+        break;
+    default:
+        exp = g_test_rand_int_range(0x60, 0xa0);
+        break;
+    }
+    return make_float32(sign | (exp << 23) | frac);
+}
+
+static float64 random_float64(void)
+{
+    uint64_t sign = (uint64_t)g_test_rand_bit() << 63;
+    uint64_t frac = (((uint64_t)g_test_rand_int() << 32) |
+                     g_test_rand_int()) & 0x000fffffffffffffULL;
+    uint64_t exp;
+
+    switch (g_test_rand_int_range(0, 16)) {
+    case 0:
+        exp = g_test_rand_int_range(1, 54);
+        break;
+    case 1:
+        exp = g_test_rand_int_range(0x7c0, 0x7ff);
+        break;
+    case 2:
+        exp = 0;
+        frac = g_test_rand_bit() ? frac : 0;
+        break;
+    case 3:
+        exp = 0x7ff;
+        frac = g_test_rand_bit() ? frac : 0;
+        break;
+    default:
+        exp = g_test_rand_int_range(0x3c0, 0x440);
+        break;
+    }
+    return make_float64(sign | (exp << 52) | frac);
+}
+
+static void check_float32(Float32BinOp op, float32 a, float32 b)
+{
+    float_status fast = { .float_exception_flags = float_flag_inexact };
+    float_status slow = { .float_exception_flags = 0 };
+    float32 r_fast = op(a, b, &fast);
+    float32 r_slow = op(a, b, &slow);
+
+    if (float32_val(r_fast) != float32_val(r_slow) ||
+        fast.float_exception_flags !=
+        (slow.float_exception_flags | float_flag_inexact)) {
+        g_test_message("a=%08x b=%08x: got %08x flags %#x, "
+                       "expected %08x flags %#x",
+                       float32_val(a), float32_val(b),
+                       float32_val(r_fast), fast.float_exception_flags,
+                       float32_val(r_slow),
+                       slow.float_exception_flags | float_flag_inexact);
+        g_assert_not_reached();
+    }
+}
+
+static void check_float64(Float64BinOp op, float64 a, float64 b)
+{
+    float_status fast = { .float_exception_flags = float_flag_inexact };
+    float_status slow = { .float_exception_flags = 0 };
+    float64 r_fast = op(a, b, &fast);
+    float64 r_slow = op(a, b, &slow);
+
+    if (float64_val(r_fast) != float64_val(r_slow) ||
+        fast.float_exception_flags !=
+        (slow.float_exception_flags | float_flag_inexact)) {
+        g_test_message("a=%016" PRIx64 " b=%016" PRIx64 ": "
+                       "got %016" PRIx64 " flags %#x, "
+                       "expected %016" PRIx64 " flags %#x",
+                       float64_val(a), float64_val(b),
+                       float64_val(r_fast), fast.float_exception_flags,
+                       float64_val(r_slow),
+                       slow.float_exception_flags | float_flag_inexact);
+        g_assert_not_reached();
+    }
+}
+
+static void test_float32(gconstpointer opaque)
+{
+    Float32BinOp op = opaque;
+    static const uint32_t special[] = {
+        0x00000000, 0x80000000, 0x00800000, 0x80800000, 0x00800001,
+        0x3f800000, 0xbf800000, 0x7f7fffff, 0xff7fffff, 0x7f000000,
+        0x1f800000, 0x20000000, 0x00400000, 0x7f800000, 0x7fc00000,
+    };
+    int i, j;
+
+    for (i = 0; i < ARRAY_SIZE(special); i++) {
+        for (j = 0; j < ARRAY_SIZE(special); j++) {
+            check_float32(op, make_float32(special[i]),
+                          make_float32(special[j]));
+        }
+    }
+    for (i = 0; i < ITERATIONS; i++) {
+        check_float32(op, random_float32(), random_float32());
+    }
+}
+
+static void test_float64(gconstpointer opaque)
+{
+    Float64BinOp op = opaque;
+    static const uint64_t special[] = {
+        0x0000000000000000ULL, 0x8000000000000000ULL,
+        0x0010000000000000ULL, 0x8010000000000000ULL,
+        0x0010000000000001ULL, 0x3ff0000000000000ULL,
+        0xbff0000000000000ULL, 0x7fefffffffffffffULL,
+        0xffefffffffffffffULL, 0x7fe0000000000000ULL,
+        0x1ff0000000000000ULL, 0x2000000000000000ULL,
+        0x0008000000000000ULL, 0x7ff0000000000000ULL,
+        0x7ff8000000000000ULL,
+    };
+    int i, j;
+
+    for (i = 0; i < ARRAY_SIZE(special); i++) {
+        for (j = 0; j < ARRAY_SIZE(special); j++) {
+            check_float64(op, make_float64(special[i]),
+                          make_float64(special[j]));
+        }
+    }
+    for (i = 0; i < ITERATIONS; i++) {
+        check_float64(op, random_float64(), random_float64());
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_data_func("/softfloat/float32/add", float32_add, test_float32);
+    g_test_add_data_func("/softfloat/float32/sub", float32_sub, test_float32);
+    g_test_add_data_func("/softfloat/float32/mul", float32_mul, test_float32);
+    g_test_add_data_func("/softfloat/float32/div", float32_div, test_float32);
+    g_test_add_data_func("/softfloat/float32/sqrt", float32_sqrt_op,
+                         test_float32);
+    g_test_add_data_func("/softfloat/float64/add", float64_add, test_float64);
+    g_test_add_data_func("/softfloat/float64/sub", float64_sub, test_float64);
+    g_test_add_data_func("/softfloat/float64/mul", float64_mul, test_float64);
+    g_test_add_data_func("/softfloat/float64/div", float64_div, test_float64);
+    g_test_add_data_func("/softfloat/float64/sqrt", float64_sqrt_op,
+                         test_float64);
+    return g_test_run();
+}
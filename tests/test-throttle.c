@@ -571,6 +571,85 @@ static void test_accounting(void)
                                 (64.0 / 13)));
 }
 
+static void test_credit(void)
+{
+    ThrottleCredit credit;
+    ThrottleConfig cfg;
+
+    throttle_init(&ts);
+    throttle_timers_init(&tt, ctx, QEMU_CLOCK_VIRTUAL,
+                         read_timer_cb, write_timer_cb, &ts);
+    throttle_config_init(&cfg);
+    cfg.buckets[THROTTLE_BPS_READ].avg = 1000;
+    throttle_config(&ts, &tt, &cfg);
+
+    /* half of the free space (max = avg / 10) is reserved and accounted */
+    throttle_reserve(&ts, false, 0.5, &credit);
+    g_assert(double_cmp(credit.size, 50));
+    g_assert(isinf(credit.units));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_BPS_READ].level, 50));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_BPS_WRITE].level, 0));
+
+    /* I/O is charged against the credit as long as it is covered */
+    g_assert(throttle_credit_consume(&credit, 30));
+    g_assert(!throttle_credit_consume(&credit, 30));
+    g_assert(double_cmp(credit.size, 20));
+
+    /* the rest is given back */
+    throttle_release(&ts, false, &credit);
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_BPS_READ].level, 30));
+    g_assert(!throttle_credit_consume(&credit, 0));
+
+    throttle_timers_destroy(&tt);
+}
+
+static void test_update_scale(void)
+{
+    ThrottleConfig cfg;
+    int i;
+
+    throttle_init(&ts);
+    throttle_timers_init(&tt, ctx, QEMU_CLOCK_VIRTUAL,
+                         read_timer_cb, write_timer_cb, &ts);
+    throttle_config_init(&cfg);
+    cfg.buckets[THROTTLE_BPS_TOTAL].avg = 1000;
+    throttle_config(&ts, &tt, &cfg);
+
+    /* without a target the rates are never scaled */
+    throttle_update_scale(&ts, 10 * NANOSECONDS_PER_SECOND);
+    g_assert(double_cmp(ts.scale, 1));
+
+    cfg.latency_target = 1000;
+    throttle_config(&ts, &tt, &cfg);
+
+    /* back off by 25% while the target is exceeded... */
+    throttle_update_scale(&ts, 1000 * SCALE_US + 1);
+    g_assert(double_cmp(ts.scale, 0.75));
+    throttle_update_scale(&ts, 1000 * SCALE_US + 1);
+    g_assert(double_cmp(ts.scale, 0.5625));
+
+    /* ...but never below the minimum */
+    for (i = 0; i < 100; i++) {
+        throttle_update_scale(&ts, 1000 * SCALE_US + 1);
+    }
+    g_assert(double_cmp(ts.scale, THROTTLE_SCALE_MIN));
+
+    /* recover by 5% steps when the target is met, up to the full rates */
+    throttle_update_scale(&ts, 1000 * SCALE_US);
+    g_assert(double_cmp(ts.scale, THROTTLE_SCALE_MIN + 0.05));
+    for (i = 0; i < 100; i++) {
+        throttle_update_scale(&ts, 0);
+    }
+    g_assert(double_cmp(ts.scale, 1));
+
+    /* reconfiguring starts again from the full rates */
+    throttle_update_scale(&ts, 1000 * SCALE_US + 1);
+    throttle_config(&ts, &tt, &cfg);
+    g_assert(double_cmp(ts.scale, 1));
+
+    throttle_timers_destroy(&tt);
+}
+
 static void test_groups(void)
 {
     ThrottleConfig cfg1, cfg2;
@@ -649,6 +728,8 @@ int main(int argc, char **argv)
     g_test_add_func("/throttle/config/max",         test_max_is_missing_limit);
     g_test_add_func("/throttle/config_functions",   test_config_functions);
     g_test_add_func("/throttle/accounting",         test_accounting);
+    g_test_add_func("/throttle/credit",             test_credit);
+    g_test_add_func("/throttle/update_scale",       test_update_scale);
     g_test_add_func("/throttle/groups",             test_groups);
     return g_test_run();
 }
@@ -48,6 +48,7 @@
 #endif
 #else
 #include "exec/address-spaces.h"
+#include "qmp-commands.h"
 #endif
 
 #include "exec/cputlb.h"
@@ -767,6 +768,7 @@ static TranslationBlock *tb_alloc(target_ulong pc)
     tb = &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs++];
     tb->pc = pc;
     tb->cflags = 0;
+    tb->exec_count = 0;
     return tb;
 }
 
@@ -1048,6 +1050,15 @@ static void build_page_bitmap(PageDesc *p)
     }
 }
 
+static void tb_gen_time_account(int64_t ns)
+{
+    int64_t us = ns / SCALE_US;
+    int bucket = us ? 64 - clz64(us) : 0;
+
+    bucket = MIN(bucket, TB_GEN_TIME_HIST_SIZE - 1);
+    tcg_ctx.tb_ctx.tb_gen_time_hist[bucket]++;
+}
+
 /* Called with mmap_lock held for user mode emulation.  */
 TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base,
@@ -1059,10 +1070,15 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     target_ulong virt_page2;
     tcg_insn_unit *gen_code_buf;
     int gen_code_size, search_size;
+    int64_t gen_start = 0;
 #ifdef CONFIG_PROFILER
     int64_t ti;
 #endif
 
+    if (tb_profile_enabled) {
+        gen_start = get_clock();
+    }
+
     phys_pc = get_page_addr_code(env, pc);
     if (use_icount && !(cflags & CF_IGNORE_ICOUNT)) {
         cflags |= CF_USE_ICOUNT;
@@ -1086,6 +1102,12 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->flags = flags;
     tb->cflags = cflags;
 
+#ifdef CONFIG_LINUX_USER
+    if (tb_cache_lookup(tb, &gen_code_size, &search_size)) {
+        goto cached;
+    }
+#endif
+
 #ifdef CONFIG_PROFILER
     tcg_ctx.tb_count1++; /* includes aborted translations because of
                        exceptions */
@@ -1147,10 +1169,19 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     }
 #endif
 
+#ifdef CONFIG_LINUX_USER
+    tb_cache_add(tb, gen_code_size, search_size);
+ cached:
+#endif
     tcg_ctx.code_gen_ptr = (void *)
         ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size,
                  CODE_GEN_ALIGN);
 
+    tb->tc_size = gen_code_size;
+    if (tb_profile_enabled) {
+        tb_gen_time_account(get_clock() - gen_start);
+    }
+
     /* check next page if needed */
     virt_page2 = (pc + tb->size - 1) & TARGET_PAGE_MASK;
     phys_page2 = -1;
@@ -1737,6 +1768,73 @@ void dump_opcount_info(FILE *f, fprintf_function cpu_fprintf)
     tcg_dump_op_count(f, cpu_fprintf);
 }
 
+static int tb_exec_count_cmp(const void *a, const void *b)
+{
+    const TranslationBlock *tb1 = *(TranslationBlock * const *)a;
+    const TranslationBlock *tb2 = *(TranslationBlock * const *)b;
+
+    if (tb1->exec_count != tb2->exec_count) {
+        return tb1->exec_count < tb2->exec_count ? 1 : -1;
+    }
+    return 0;
+}
+
+TBProfileInfo *qmp_x_query_tb_profile(bool has_max, int64_t max,
+                                      Error **errp)
+{
+    TBProfileInfo *info;
+    TranslationBlock **sorted;
+    TBProfileEntryList *entry, **plist;
+    TBGenTimeBucketList *bucket, **pbucket;
+    int i, n, nb_tbs;
+
+    if (!tb_profile_enabled) {
+        error_setg(errp, "TB profiling is not enabled, use -tb-profile");
+        return NULL;
+    }
+    if (!has_max) {
+        max = 20;
+    } else if (max < 0) {
+        error_setg(errp, "Parameter 'max' expects a non-negative value");
+        return NULL;
+    }
+
+    info = g_new0(TBProfileInfo, 1);
+
+    nb_tbs = tcg_ctx.tb_ctx.nb_tbs;
+    sorted = g_new(TranslationBlock *, nb_tbs);
+    for (i = 0; i < nb_tbs; i++) {
+        sorted[i] = &tcg_ctx.tb_ctx.tbs[i];
+    }
+    qsort(sorted, nb_tbs, sizeof(*sorted), tb_exec_count_cmp);
+
+    n = MIN(nb_tbs, max);
+    plist = &info->blocks;
+    for (i = 0; i < n && sorted[i]->exec_count; i++) {
+        entry = g_new0(TBProfileEntryList, 1);
+        entry->value = g_new0(TBProfileEntry, 1);
+        entry->value->pc = sorted[i]->pc;
+        entry->value->guest_size = sorted[i]->size;
+        entry->value->host_size = sorted[i]->tc_size;
+        entry->value->count = sorted[i]->exec_count;
+        *plist = entry;
+        plist = &entry->next;
+    }
+
+    pbucket = &info->translation_time;
+    for (i = 0; i < TB_GEN_TIME_HIST_SIZE; i++) {
+        bucket = g_new0(TBGenTimeBucketList, 1);
+        bucket->value = g_new0(TBGenTimeBucket, 1);
+        bucket->value->lower_us = i ? 1ULL << (i - 1) : 0;
+        bucket->value->count = tcg_ctx.tb_ctx.tb_gen_time_hist[i];
+        *pbucket = bucket;
+        pbucket = &bucket->next;
+    }
+
+    g_free(sorted);
+    return info;
+}
+
 #else /* CONFIG_USER_ONLY */
 
 void cpu_interrupt(CPUState *cpu, int mask)
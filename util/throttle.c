@@ -23,11 +23,24 @@
  */
 
 #include "qemu/osdep.h"
+#include <math.h>
 #include "qapi/error.h"
 #include "qemu/throttle.h"
 #include "qemu/timer.h"
 #include "block/aio.h"
 
+/* Buckets charged by each type of operation (read/write), in bytes... */
+static const BucketType bucket_types_size[2][2] = {
+    { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ },
+    { THROTTLE_BPS_TOTAL, THROTTLE_BPS_WRITE }
+};
+
+/* ...and in operations */
+static const BucketType bucket_types_units[2][2] = {
+    { THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
+    { THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE }
+};
+
 /* This function make a bucket leak
  *
  * @bkt:   the bucket to make leak
@@ -68,6 +81,9 @@ static void throttle_do_leak(ThrottleState *ts, int64_t now)
         return;
     }
 
+    /* a scaled down bucket leaks as if less time had passed */
+    delta_ns *= ts->scale;
+
     /* make each bucket leak */
     for (i = 0; i < BUCKETS_COUNT; i++) {
         throttle_leak_bucket(&ts->cfg.buckets[i], delta_ns);
@@ -147,7 +163,7 @@ static int64_t throttle_compute_wait_for(ThrottleState *ts,
         }
     }
 
-    return max_wait;
+    return max_wait / ts->scale;
 }
 
 /* compute the timer for this type of operation
@@ -209,6 +225,7 @@ void throttle_init(ThrottleState *ts)
 {
     memset(ts, 0, sizeof(ThrottleState));
     throttle_config_init(&ts->cfg);
+    ts->scale = 1;
 }
 
 /* To be called first on the ThrottleTimers */
@@ -342,6 +359,17 @@ bool throttle_is_valid(ThrottleConfig *cfg, Error **errp)
         }
     }
 
+    if (cfg->latency_target > THROTTLE_LATENCY_TARGET_MAX) {
+        error_setg(errp, "the latency target must be within [0, %llu]"
+                   " microseconds", THROTTLE_LATENCY_TARGET_MAX);
+        return false;
+    }
+
+    if (cfg->latency_target && !throttle_enabled(cfg)) {
+        error_setg(errp, "a latency target requires bps/iops values");
+        return false;
+    }
+
     return true;
 }
 
@@ -394,6 +422,7 @@ void throttle_config(ThrottleState *ts,
     }
 
     ts->previous_leak = qemu_clock_get_ns(tt->clock_type);
+    ts->scale = 1;
 
     for (i = 0; i < 2; i++) {
         throttle_cancel_timer(tt->timers[i]);
@@ -447,6 +476,22 @@ bool throttle_schedule_timer(ThrottleState *ts,
     return true;
 }
 
+/* compute the number of operations an I/O counts as
+ *
+ * @op_size: cfg.op_size
+ * @size:    the size of the operation
+ * @ret:     the number of operations
+ */
+static double throttle_units(uint64_t op_size, uint64_t size)
+{
+    /* if cfg.op_size is defined and smaller than size we compute unit count */
+    if (op_size && size > op_size) {
+        return (double) size / op_size;
+    }
+
+    return 1.0;
+}
+
 /* do the accounting for this operation
  *
  * @is_write: the type of operation (read/write)
@@ -454,22 +499,9 @@ bool throttle_schedule_timer(ThrottleState *ts,
  */
 void throttle_account(ThrottleState *ts, bool is_write, uint64_t size)
 {
-    const BucketType bucket_types_size[2][2] = {
-        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ },
-        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_WRITE }
-    };
-    const BucketType bucket_types_units[2][2] = {
-        { THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
-        { THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE }
-    };
-    double units = 1.0;
+    double units = throttle_units(ts->cfg.op_size, size);
     unsigned i;
 
-    /* if cfg.op_size is defined and smaller than size we compute unit count */
-    if (ts->cfg.op_size && size > ts->cfg.op_size) {
-        units = (double) size / ts->cfg.op_size;
-    }
-
     for (i = 0; i < 2; i++) {
         LeakyBucket *bkt;
 
@@ -487,3 +519,138 @@ void throttle_account(ThrottleState *ts, bool is_write, uint64_t size)
     }
 }
 
+
+/* compute how much can still be accounted in a bucket before I/O has
+ * to wait
+ *
+ * @bkt: the leaky bucket we operate on
+ * @ret: the free space, or INFINITY if the bucket has no limit
+ */
+static double throttle_bucket_headroom(LeakyBucket *bkt)
+{
+    double room;
+
+    if (!bkt->avg) {
+        return INFINITY;
+    }
+
+    room = bkt->max * bkt->burst_length - bkt->level;
+    if (bkt->burst_length > 1) {
+        room = MIN(room, bkt->max / 10 - bkt->burst_level);
+    }
+
+    return MAX(room, 0);
+}
+
+/* add an amount, which may be negative, to the limited buckets of a type
+ *
+ * @types:  the two buckets to charge
+ * @amount: the number of units
+ */
+static void throttle_charge(ThrottleState *ts, const BucketType types[2],
+                            double amount)
+{
+    unsigned i;
+
+    for (i = 0; i < 2; i++) {
+        LeakyBucket *bkt = &ts->cfg.buckets[types[i]];
+
+        if (!bkt->avg) {
+            continue;
+        }
+        bkt->level = MAX(bkt->level + amount, 0);
+        if (bkt->burst_length > 1) {
+            bkt->burst_level = MAX(bkt->burst_level + amount, 0);
+        }
+    }
+}
+
+/* account part of the free bucket space in advance and store it in a
+ * credit, which must be empty
+ *
+ * @is_write: the type of operation (read/write)
+ * @fraction: the part of the free space to reserve, between 0 and 1
+ * @credit:   the credit to fill
+ */
+void throttle_reserve(ThrottleState *ts, bool is_write, double fraction,
+                      ThrottleCredit *credit)
+{
+    double size = INFINITY;
+    double units = INFINITY;
+    unsigned i;
+
+    for (i = 0; i < 2; i++) {
+        LeakyBucket *bkt;
+
+        bkt = &ts->cfg.buckets[bucket_types_size[is_write][i]];
+        size = MIN(size, throttle_bucket_headroom(bkt));
+
+        bkt = &ts->cfg.buckets[bucket_types_units[is_write][i]];
+        units = MIN(units, throttle_bucket_headroom(bkt));
+    }
+
+    credit->size = size * fraction;
+    credit->units = units * fraction;
+    credit->op_size = ts->cfg.op_size;
+
+    throttle_charge(ts, bucket_types_size[is_write], credit->size);
+    throttle_charge(ts, bucket_types_units[is_write], credit->units);
+}
+
+/* give back what is left of a credit and empty it
+ *
+ * The ThrottleState must not have been reconfigured since the credit was
+ * reserved; a credit that predates throttle_config() is simply dropped.
+ *
+ * @is_write: the type of operation the credit was reserved for
+ * @credit:   the credit to empty
+ */
+void throttle_release(ThrottleState *ts, bool is_write,
+                      ThrottleCredit *credit)
+{
+    throttle_charge(ts, bucket_types_size[is_write], -credit->size);
+    throttle_charge(ts, bucket_types_units[is_write], -credit->units);
+
+    credit->size = 0;
+    credit->units = 0;
+}
+
+/* do the accounting for this operation using a credit
+ *
+ * @credit: the credit reserved with throttle_reserve()
+ * @size:   the size of the operation
+ * @ret:    true if the credit covered the operation, false if it was
+ *          left untouched
+ */
+bool throttle_credit_consume(ThrottleCredit *credit, uint64_t size)
+{
+    double units = throttle_units(credit->op_size, size);
+
+    if (size > credit->size || units > credit->units) {
+        return false;
+    }
+
+    credit->size -= size;
+    credit->units -= units;
+    return true;
+}
+
+/* adjust the scale of the rates to the latency target: back off quickly
+ * while the average latency is above the target and recover slowly
+ * otherwise
+ *
+ * @latency_ns: the average latency of the requests since the last call,
+ *              not including the time spent waiting to be let through
+ */
+void throttle_update_scale(ThrottleState *ts, uint64_t latency_ns)
+{
+    if (!ts->cfg.latency_target) {
+        return;
+    }
+
+    if (latency_ns > ts->cfg.latency_target * SCALE_US) {
+        ts->scale = MAX(ts->scale * 0.75, THROTTLE_SCALE_MIN);
+    } else {
+        ts->scale = MIN(ts->scale + 0.05, 1);
+    }
+}
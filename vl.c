@@ -156,6 +156,8 @@ CharDriverState *virtcon_hds[MAX_VIRTIO_CONSOLES];
 CharDriverState *sclp_hds[MAX_SCLP_CONSOLES];
 int win2k_install_hack = 0;
 int singlestep = 0;
+bool tb_profile_enabled;
+int tcg_pinned_regs;
 int smp_cpus = 1;
 int max_cpus = 0;
 int smp_cores = 1;
@@ -3387,6 +3389,22 @@ int main(int argc, char **argv, char **envp)
             case QEMU_OPTION_singlestep:
                 singlestep = 1;
                 break;
+            case QEMU_OPTION_tb_profile:
+                tb_profile_enabled = true;
+                break;
+            case QEMU_OPTION_tcg_pin_regs:
+                {
+                    long n;
+
+                    if (qemu_strtol(optarg, NULL, 0, &n) < 0 ||
+                        n < 0 || n > INT_MAX) {
+                        error_report("invalid -tcg-pin-regs value: %s",
+                                     optarg);
+                        exit(1);
+                    }
+                    tcg_pinned_regs = n;
+                }
+                break;
             case QEMU_OPTION_S:
                 autostart = 0;
                 break;